@@ -0,0 +1,710 @@
+/*
+	zdray-bench: times each stage of ZDRay on a generated map.
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+// The map goes through the same steps as in zdray, but each one is timed on
+// its own, and the collision mesh is also timed against a fixed set of random
+// rays. Everything runs on the CPU. The results are written as JSON.
+
+// HEADER FILES ------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <cmath>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <string>
+#include <vector>
+
+#include "framework/zdray.h"
+#include "wad/wad.h"
+#include "level/level.h"
+#include "blockmapbuilder/blockmapbuilder.h"
+#include "lightmap/levelmesh.h"
+#include "lightmap/collision.h"
+#include "lightmap/cpuraytracer.h"
+#include "library/libzdray.h"
+#include "commandline/getopt.h"
+#include "bench/mapgen.h"
+
+// TYPES -------------------------------------------------------------------
+
+struct FBenchRay
+{
+	vec3 Start, End;
+};
+
+// Collects the results in the order they are added, to be written as JSON.
+class FBenchResults
+{
+public:
+	void BeginObject(const char *name)
+	{
+		Separate();
+		Text += Indent() + "\"" + name + "\": {\n";
+		Depth++;
+		First = true;
+	}
+
+	void EndObject()
+	{
+		Depth--;
+		Text += "\n" + Indent() + "}";
+		First = false;
+	}
+
+	void Add(const char *name, double value)
+	{
+		char buffer[64];
+		snprintf(buffer, sizeof(buffer), "%.6g", value);
+		AddRaw(name, buffer);
+	}
+
+	void Add(const char *name, int64_t value)
+	{
+		AddRaw(name, std::to_string(value));
+	}
+
+	void Add(const char *name, int value) { Add(name, (int64_t)value); }
+
+	void Add(const char *name, const std::vector<int> &values)
+	{
+		std::string list = "[";
+		for (size_t i = 0; i < values.size(); i++)
+		{
+			list += (i > 0 ? ", " : "") + std::to_string(values[i]);
+		}
+		AddRaw(name, list + "]");
+	}
+	void Add(const char *name, const char *value) { AddRaw(name, std::string("\"") + value + "\""); }
+
+	std::string Finish() const
+	{
+		return "{\n" + Text + "\n}\n";
+	}
+
+private:
+	std::string Text;
+	int Depth = 1;
+	bool First = true;
+
+	std::string Indent() const { return std::string(Depth, '\t'); }
+
+	void Separate()
+	{
+		if (!First)
+		{
+			Text += ",\n";
+		}
+		First = false;
+	}
+
+	void AddRaw(const char *name, const std::string &value)
+	{
+		Separate();
+		Text += Indent() + "\"" + name + "\": " + value;
+	}
+};
+
+// PRIVATE FUNCTION PROTOTYPES ---------------------------------------------
+
+static void ParseArgs(int argc, char **argv);
+static void ShowUsage();
+static void RunBenchmark(FBenchResults &results);
+static std::vector<FBenchRay> CreateRays(const FMapGenInfo &info, int count);
+template<typename Spread> static int64_t ForEachCoverageSpread(LevelMesh &mesh, const CPUSceneLighting &lighting, Spread spread);
+
+// EXTERNAL DATA DECLARATIONS ----------------------------------------------
+
+extern "C" int optind;
+extern "C" char *optarg;
+
+// PRIVATE DATA DEFINITIONS ------------------------------------------------
+
+static FMapGenSettings MapSettings;
+static int RayCount = 1000000;
+static bool FullSamples = false;
+static bool KeepFiles = false;
+static const char *WadName = "zdray-bench.wad";
+static const char *OutWadName = "zdray-bench-out.wad";
+static const char *JsonName = nullptr;
+
+static option long_opts[] =
+{
+	{"help",			no_argument,		0,	1000},
+	{"rooms",			required_argument,	0,	'r'},
+	{"room-size",		required_argument,	0,	1001},
+	{"lights",			required_argument,	0,	'l'},
+	{"stairs",			required_argument,	0,	1002},
+	{"slopes",			required_argument,	0,	1003},
+	{"sky",				required_argument,	0,	1004},
+	{"3d-floors",		required_argument,	0,	1005},
+	{"sample-distance",	required_argument,	0,	1006},
+	{"seed",			required_argument,	0,	1007},
+	{"rays",			required_argument,	0,	'n'},
+	{"threads",			required_argument,	0,	'j'},
+	{"size",			required_argument,	0,	'S'},
+	{"full-samples",	no_argument,		0,	1008},
+	{"keep",			no_argument,		0,	'k'},
+	{"output",			required_argument,	0,	'o'},
+	{0,0,0,0}
+};
+
+static const char short_opts[] = "r:l:n:j:S:ko:";
+
+// CODE --------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+	// Start from the defaults of zdray, SSE included
+	ZDRayOptions().Apply();
+
+	// Same as zdray --preview, so that a run takes seconds rather than minutes
+	coverageSampleCount = 4;
+	bounceSampleCount = 16;
+	ambientSampleCount = 16;
+
+	ParseArgs(argc, argv);
+
+	if (optind < argc)
+	{
+		ShowUsage();
+		return 0;
+	}
+
+	if (FullSamples)
+	{
+		coverageSampleCount = 256;
+		bounceSampleCount = 2048;
+		ambientSampleCount = 2048;
+	}
+
+	try
+	{
+		FBenchResults results;
+		RunBenchmark(results);
+
+		std::string json = results.Finish();
+		if (JsonName)
+		{
+			FILE *file = fopen(JsonName, "wb");
+			if (!file || fwrite(json.data(), json.size(), 1, file) != 1)
+			{
+				if (file) fclose(file);
+				throw std::runtime_error(std::string("Could not write ") + JsonName);
+			}
+			fclose(file);
+		}
+		else
+		{
+			printf("\n%s", json.c_str());
+		}
+	}
+	catch (std::runtime_error msg)
+	{
+		printf("%s\n", msg.what());
+		return 20;
+	}
+	catch (std::bad_alloc)
+	{
+		printf("Out of memory\n");
+		return 20;
+	}
+	catch (std::exception msg)
+	{
+		printf("%s\n", msg.what());
+		return 20;
+	}
+
+	return 0;
+}
+
+//==========================================================================
+//
+// RunBenchmark
+//
+//==========================================================================
+
+static double SecondsSince(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void RunBenchmark(FBenchResults &results)
+{
+	auto start = std::chrono::steady_clock::now();
+	FMapGenInfo info = GenerateMap(MapSettings, WadName);
+	double generateTime = SecondsSince(start);
+
+	results.Add("version", ZDRAY_VERSION);
+	results.BeginObject("settings");
+	results.Add("rooms_x", MapSettings.RoomsX);
+	results.Add("rooms_y", MapSettings.RoomsY);
+	results.Add("room_size", MapSettings.RoomSize);
+	results.Add("lights", MapSettings.Lights);
+	results.Add("sample_distance", MapSettings.SampleDistance);
+	results.Add("seed", (int64_t)MapSettings.Seed);
+	results.Add("texture_size", LMDims);
+	results.Add("threads", NumThreads > 0 ? NumThreads : (int)std::thread::hardware_concurrency());
+	results.Add("coverage_samples", coverageSampleCount);
+	results.Add("bounce_samples", bounceSampleCount);
+	results.Add("ambient_samples", ambientSampleCount);
+	results.EndObject();
+
+	results.BeginObject("map");
+	results.Add("vertices", info.NumVertices);
+	results.Add("lines", info.NumLines);
+	results.Add("sides", info.NumSides);
+	results.Add("sectors", info.NumSectors);
+	results.Add("things", info.NumThings);
+	results.Add("stairs", info.NumStairs);
+	results.Add("slopes", info.NumSlopes);
+	results.Add("sky", info.NumSky);
+	results.Add("3d_floors", info.Num3DFloors);
+	results.EndObject();
+
+	std::vector<std::pair<const char *, double>> stages;
+	stages.push_back({ "generate", generateTime });
+
+	{
+		FWadReader inwad(WadName);
+		FWadWriter outwad(OutWadName, false);
+
+		start = std::chrono::steady_clock::now();
+		FProcessor processor(inwad, 0);
+		stages.push_back({ "load", SecondsSince(start) });
+
+		start = std::chrono::steady_clock::now();
+		processor.BuildNodes();
+		stages.push_back({ "nodes", SecondsSince(start) });
+
+		// UDMF maps do not get a blockmap written out, but it is built
+		// for the binary formats in the same way.
+		start = std::chrono::steady_clock::now();
+		{
+			int size;
+			FBlockmapBuilder blockmap(processor.GetLevel());
+			blockmap.GetBlockmap(size);
+		}
+		stages.push_back({ "blockmap", SecondsSince(start) });
+
+		start = std::chrono::steady_clock::now();
+		processor.PrepareLightmaps();
+		stages.push_back({ "prepare_lightmaps", SecondsSince(start) });
+
+		FLevel &level = processor.GetLevel();
+		start = std::chrono::steady_clock::now();
+		LevelMesh mesh(level, level.DefaultSamples, LMDims);
+		stages.push_back({ "level_mesh", SecondsSince(start) });
+
+		start = std::chrono::steady_clock::now();
+		TriangleMeshShape shape(mesh.MeshVertices.Data(), mesh.MeshVertices.Size(), mesh.MeshElements.Data(), mesh.MeshElements.Size(), WatertightTrace);
+		stages.push_back({ "collision_mesh", SecondsSince(start) });
+
+		// The same rays go through both tests, one thread at a time, so
+		// the rates do not depend on the number of cores.
+		std::vector<FBenchRay> rays = CreateRays(info, RayCount);
+		int64_t firstHits = 0, anyHits = 0;
+
+		TriangleMeshShape::take_trace_stats();
+		start = std::chrono::steady_clock::now();
+		for (const FBenchRay &ray : rays)
+		{
+			TraceHit hit = TriangleMeshShape::find_first_hit(&shape, ray.Start, ray.End);
+			firstHits += hit.fraction < 1.0f;
+		}
+		double firstHitTime = SecondsSince(start);
+		TraceStats firstHitStats = TriangleMeshShape::take_trace_stats();
+
+		start = std::chrono::steady_clock::now();
+		for (const FBenchRay &ray : rays)
+		{
+			anyHits += TriangleMeshShape::find_any_hit(&shape, ray.Start, ray.End);
+		}
+		double anyHitTime = SecondsSince(start);
+		TraceStats anyHitStats = TriangleMeshShape::take_trace_stats();
+
+		stages.push_back({ "find_first_hit", firstHitTime });
+		stages.push_back({ "find_any_hit", anyHitTime });
+
+		CPUTraceStats traceStats;
+		start = std::chrono::steady_clock::now();
+		{
+			CPURaytracer raytracer;
+			raytracer.Raytrace(&mesh);
+			traceStats = raytracer.GetStats();
+		}
+		stages.push_back({ "raytrace", SecondsSince(start) });
+
+		// The coverage sample origins of the direct light pass, made the way
+		// the tracer did before it kept the tangent frames and the Hammersley
+		// offsets in tables, and from the tables. Nothing is traced.
+		CPUSceneLighting lighting;
+		lighting.Gather(&mesh);
+		const int coverageCount = coverageSampleCount;
+		double uncachedSum = 0.0, cachedSum = 0.0;
+
+		start = std::chrono::steady_clock::now();
+		int64_t coverageSpreads = ForEachCoverageSpread(mesh, lighting, [&](int, const vec3 &origin, const vec3 &normal, float distance)
+		{
+			CPUTangentFrame frame = CPUTangentFrame::FromNormal(normal);
+			for (int i = 0; i < coverageCount; i++)
+			{
+				vec2 offset = (CPURaytracer::Hammersley(i, coverageCount) - 0.5f) * distance;
+				vec3 sample = origin + frame.E0 * offset.x + frame.E1 * offset.y;
+				uncachedSum += sample.x + sample.y + sample.z;
+			}
+		});
+		double uncachedTime = SecondsSince(start);
+
+		start = std::chrono::steady_clock::now();
+		std::vector<CPUTangentFrame> frames(mesh.surfaces.size());
+		for (size_t i = 0; i < mesh.surfaces.size(); i++)
+		{
+			frames[i] = CPUTangentFrame::FromNormal(mesh.surfaces[i].plane.Normal());
+		}
+		std::vector<vec2> offsets(coverageCount);
+		for (int i = 0; i < coverageCount; i++)
+		{
+			offsets[i] = CPURaytracer::Hammersley(i, coverageCount) - 0.5f;
+		}
+		ForEachCoverageSpread(mesh, lighting, [&](int surface, const vec3 &origin, const vec3 &, float distance)
+		{
+			const CPUTangentFrame &frame = frames[surface];
+			for (int i = 0; i < coverageCount; i++)
+			{
+				vec2 offset = offsets[i] * distance;
+				vec3 sample = origin + frame.E0 * offset.x + frame.E1 * offset.y;
+				cachedSum += sample.x + sample.y + sample.z;
+			}
+		});
+		double cachedTime = SecondsSince(start);
+
+		// The sums also keep the compiler from dropping the loops
+		if (std::abs(uncachedSum - cachedSum) > 1e-6 * std::abs(uncachedSum))
+		{
+			throw std::runtime_error("The coverage sample origins from the tables differ");
+		}
+		stages.push_back({ "coverage_uncached", uncachedTime });
+		stages.push_back({ "coverage_cached", cachedTime });
+
+		start = std::chrono::steady_clock::now();
+		mesh.CreateTextures();
+		stages.push_back({ "create_textures", SecondsSince(start) });
+
+		// The processor has no lightmap of its own here, so the lump is
+		// compressed separately and ends up after the map.
+		start = std::chrono::steady_clock::now();
+		processor.Write(outwad);
+		stages.push_back({ "write_map", SecondsSince(start) });
+
+		start = std::chrono::steady_clock::now();
+		mesh.AddLightmapLump(outwad);
+		outwad.Close();
+		stages.push_back({ "lightmap_lump", SecondsSince(start) });
+
+		results.BeginObject("mesh");
+		results.Add("surfaces", (int64_t)mesh.surfaces.size());
+		results.Add("vertices", (int64_t)mesh.MeshVertices.Size());
+		results.Add("triangles", (int64_t)mesh.MeshElements.Size() / 3);
+		results.Add("textures", (int64_t)mesh.textures.size());
+		results.Add("bvh_min_depth", shape.get_min_depth());
+		results.Add("bvh_max_depth", shape.get_max_depth());
+		results.EndObject();
+
+		results.BeginObject("rays");
+		results.Add("count", (int64_t)rays.size());
+		results.Add("first_hit_per_second", firstHitTime > 0 ? rays.size() / firstHitTime : 0.0);
+		results.Add("first_hit_fraction", rays.empty() ? 0.0 : double(firstHits) / rays.size());
+		results.Add("first_hit_triangles_per_ray", rays.empty() ? 0.0 : double(firstHitStats.triangles) / rays.size());
+		results.Add("any_hit_per_second", anyHitTime > 0 ? rays.size() / anyHitTime : 0.0);
+		results.Add("any_hit_fraction", rays.empty() ? 0.0 : double(anyHits) / rays.size());
+		results.Add("any_hit_triangles_per_ray", rays.empty() ? 0.0 : double(anyHitStats.triangles) / rays.size());
+		results.EndObject();
+
+		results.BeginObject("coverage");
+		results.Add("spreads", coverageSpreads);
+		results.Add("uncached_per_second", uncachedTime > 0 ? coverageSpreads / uncachedTime : 0.0);
+		results.Add("cached_per_second", cachedTime > 0 ? coverageSpreads / cachedTime : 0.0);
+		results.EndObject();
+
+		// What the ray tracer did. Without the counters only the shape of
+		// the BVH is known.
+		results.BeginObject("raytrace");
+#ifndef NO_TRACE_COUNTERS
+		const CPUTraceCounters &counters = traceStats.Counters;
+		double tracedRays = (double)std::max(counters.Rays, (int64_t)1);
+		results.Add("texels", counters.Texels);
+		results.Add("probes", counters.Probes);
+		results.Add("rays", counters.Rays);
+		results.Add("sun_rays", counters.SunRays);
+		results.Add("light_rays", counters.LightRays);
+		results.Add("bounce_rays", counters.BounceRays);
+		results.Add("bounce_misses", counters.BounceMisses);
+		results.Add("probe_rays", counters.ProbeRays);
+		results.Add("bvh_nodes_per_ray", counters.BVHNodes / tracedRays);
+		results.Add("triangles_per_ray", counters.Triangles / tracedRays);
+		results.Add("lights_per_texel", counters.Texels > 0 ? double(counters.LightsInRange) / counters.Texels : 0.0);
+#endif
+		results.Add("bvh_min_depth", traceStats.BVHMinDepth);
+		results.Add("bvh_max_depth", traceStats.BVHMaxDepth);
+		results.Add("bvh_depth_histogram", traceStats.BVHDepthHistogram);
+		results.EndObject();
+	}
+
+	FILE *file = fopen(OutWadName, "rb");
+	if (file)
+	{
+		fseek(file, 0, SEEK_END);
+		results.Add("output_bytes", (int64_t)ftell(file));
+		fclose(file);
+	}
+
+	if (!KeepFiles)
+	{
+		remove(WadName);
+		remove(OutWadName);
+	}
+
+	double total = 0;
+	results.BeginObject("seconds");
+	for (const auto &stage : stages)
+	{
+		results.Add(stage.first, stage.second);
+		total += stage.second;
+	}
+	results.Add("total", total);
+	results.EndObject();
+}
+
+//==========================================================================
+//
+// CreateRays
+//
+// Rays start at random points inside the rooms and go 2048 units in a
+// random direction. std::mt19937 gives the same numbers everywhere, unlike
+// the standard distributions, so the rays are turned into floats here.
+//
+//==========================================================================
+
+static std::vector<FBenchRay> CreateRays(const FMapGenInfo &info, int count)
+{
+	std::mt19937 random(MapSettings.Seed);
+	auto frand = [&]() { return float(random() >> 8) * (1.0f / 16777216.0f); };
+
+	std::vector<FBenchRay> rays(count);
+	for (FBenchRay &ray : rays)
+	{
+		const FMapGenRoom &room = info.Rooms[random() % info.Rooms.size()];
+
+		// Stay above the highest step and below the lowest ceiling
+		ray.Start.x = room.X1 + 16 + frand() * (room.X2 - room.X1 - 32);
+		ray.Start.y = room.Y1 + 16 + frand() * (room.Y2 - room.Y1 - 32);
+		ray.Start.z = room.Floor + 72 + frand() * (room.Ceiling - room.Floor - 88);
+
+		float z = frand() * 2.0f - 1.0f;
+		float angle = frand() * 6.28318530718f;
+		float r = std::sqrt(std::max(1.0f - z * z, 0.0f));
+		ray.End = ray.Start + vec3(r * std::cos(angle), r * std::sin(angle), z) * 2048.0f;
+	}
+	return rays;
+}
+
+//==========================================================================
+//
+// ForEachCoverageSpread
+//
+// Calls spread(surface, origin, normal, sampleDistance) every time the direct
+// light pass spreads its coverage samples over a texel: for the sun and for
+// every point or spot light in range that the texel faces. Returns the number
+// of calls.
+//
+//==========================================================================
+
+template<typename Spread>
+static int64_t ForEachCoverageSpread(LevelMesh &mesh, const CPUSceneLighting &lighting, Spread spread)
+{
+	int64_t count = 0;
+	for (size_t s = 0; s < mesh.surfaces.size(); s++)
+	{
+		const Surface &surface = mesh.surfaces[s];
+		vec3 normal = surface.plane.Normal();
+		float distance = float(surface.sampleDimension);
+		bool sun = dot(normal, lighting.SunDir) > 0.0f;
+
+		for (int y = 0; y < surface.lightmapDims[1]; y++)
+		{
+			for (int x = 0; x < surface.lightmapDims[0]; x++)
+			{
+				vec3 origin = surface.lightmapOrigin + surface.lightmapSteps[0] * (x + 0.5f) + surface.lightmapSteps[1] * (y + 0.5f) + normal * 0.1f;
+
+				if (sun)
+				{
+					spread((int)s, origin, normal, distance);
+					count++;
+				}
+
+				for (const CPULightInfo &light : lighting.Lights)
+				{
+					float dist = length(light.Origin - origin);
+					if (dist > 0.01f && dist < light.Radius && dot(normal, light.Origin - origin) > 0.0f)
+					{
+						spread((int)s, origin, normal, distance);
+						count++;
+					}
+				}
+			}
+		}
+	}
+	return count;
+}
+
+//==========================================================================
+//
+// ParseArgs
+//
+//==========================================================================
+
+static float ParseFraction(const char *arg)
+{
+	float value = (float)atof(arg);
+	return value < 0 ? 0 : value > 1 ? 1 : value;
+}
+
+static void ParseArgs(int argc, char **argv)
+{
+	int ch;
+
+	while ((ch = getopt_long(argc, argv, short_opts, long_opts, NULL)) != EOF)
+	{
+		switch (ch)
+		{
+		case 0:
+			break;
+
+		case 'r':
+			if (sscanf(optarg, "%dx%d", &MapSettings.RoomsX, &MapSettings.RoomsY) != 2)
+			{
+				MapSettings.RoomsX = MapSettings.RoomsY = atoi(optarg);
+			}
+			if (MapSettings.RoomsX < 1) MapSettings.RoomsX = 1;
+			if (MapSettings.RoomsY < 1) MapSettings.RoomsY = 1;
+			break;
+		case 1001:
+			MapSettings.RoomSize = atoi(optarg);
+			if (MapSettings.RoomSize < 128) MapSettings.RoomSize = 128;
+			break;
+		case 'l':
+			MapSettings.Lights = atoi(optarg);
+			if (MapSettings.Lights < 0) MapSettings.Lights = 0;
+			break;
+		case 1002:
+			MapSettings.Stairs = ParseFraction(optarg);
+			break;
+		case 1003:
+			MapSettings.Slopes = ParseFraction(optarg);
+			break;
+		case 1004:
+			MapSettings.Sky = ParseFraction(optarg);
+			break;
+		case 1005:
+			MapSettings.Floors3D = ParseFraction(optarg);
+			break;
+		case 1006:
+			MapSettings.SampleDistance = atoi(optarg);
+			break;
+		case 1007:
+			MapSettings.Seed = (uint32_t)strtoul(optarg, nullptr, 0);
+			break;
+		case 'n':
+			RayCount = atoi(optarg);
+			if (RayCount < 0) RayCount = 0;
+			break;
+		case 'j':
+			NumThreads = atoi(optarg);
+			break;
+		case 'S':
+			LMDims = atoi(optarg);
+			if (LMDims <= 0) LMDims = 1;
+			if (LMDims > 1024) LMDims = 1024;
+			LMDims = Math::RoundPowerOfTwo(LMDims);
+			break;
+		case 1008:
+			FullSamples = true;
+			break;
+		case 'k':
+			KeepFiles = true;
+			break;
+		case 'o':
+			JsonName = optarg;
+			break;
+		case 1000:
+			ShowUsage();
+			exit(0);
+		default:
+			printf("Try `zdray-bench --help' for more information.\n");
+			exit(0);
+		}
+	}
+}
+
+//==========================================================================
+//
+// ShowUsage
+//
+//==========================================================================
+
+static void ShowUsage()
+{
+	printf(
+		"Usage: zdray-bench [options]\n"
+		"Options:\n"
+		"  -r, --rooms=WxH          Size of the grid of rooms (default %dx%d)\n"
+		"      --room-size=NNN      Width of a room in map units (default %d)\n"
+		"  -l, --lights=NNN         Number of static point lights (default %d)\n"
+		"      --stairs=F           Share of rooms with a staircase (default %g)\n"
+		"      --slopes=F           Share of rooms with a sloped floor (default %g)\n"
+		"      --sky=F              Share of rooms open to the sky (default %g)\n"
+		"      --3d-floors=F        Share of rooms with a 3D floor platform (default %g)\n"
+		"      --sample-distance=N  Lightmap sample distance (default %d)\n"
+		"      --seed=NNN           Seed for the map and the rays (default %u)\n"
+		"  -n, --rays=NNN           Number of rays for the collision mesh tests (default %d)\n"
+		"  -j, --threads=NNN        Number of threads used for raytracing (default %d)\n"
+		"  -S, --size=NNN           Lightmap texture dimensions (default %d)\n"
+		"      --full-samples       Use zdray's sample counts instead of --preview's\n"
+		"  -k, --keep               Keep %s and %s\n"
+		"  -o, --output=FILE        Write the results to FILE instead of the console\n"
+		"      --help               Display this usage information\n"
+		, MapSettings.RoomsX, MapSettings.RoomsY
+		, MapSettings.RoomSize
+		, MapSettings.Lights
+		, MapSettings.Stairs
+		, MapSettings.Slopes
+		, MapSettings.Sky
+		, MapSettings.Floors3D
+		, MapSettings.SampleDistance
+		, MapSettings.Seed
+		, RayCount
+		, (int)std::thread::hardware_concurrency()
+		, LMDims
+		, WadName, OutWadName
+	);
+}
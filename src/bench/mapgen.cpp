@@ -0,0 +1,516 @@
+/*
+	Procedural maps for zdray-bench.
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <map>
+#include <algorithm>
+
+#include "framework/zdray.h"
+#include "wad/wad.h"
+#include "bench/mapgen.h"
+
+// The map is a grid of square rooms. Neighbouring rooms are joined by a
+// door sector that crosses the wall between them. Every sector is given as
+// one or more closed loops of points, clockwise around its inside, so that
+// the sector is on the right of each edge. A loop around a hole in a sector
+// (a staircase or a platform) goes the other way. An edge that two loops
+// share becomes a two-sided line, with the sector that added it first in
+// front.
+
+static const int THING_PLAYER1 = 1;
+static const int THING_POINTLIGHT_STATIC = 9876;
+static const int THING_ZDRAYINFO = 9890;
+static const int SECTOR_SET_3DFLOOR = 160;
+
+static const int STAIR_STEPS = 4;
+static const int STAIR_STEP_HEIGHT = 16;
+static const int SLOPE_RISE = 48;
+
+namespace
+{
+	// A small generator of its own, so that the map does not depend on how
+	// the standard library implements its distributions.
+	class FMapGenRandom
+	{
+	public:
+		FMapGenRandom(uint32_t seed) : State(seed * 2654435761u + 1) { }
+
+		uint32_t Next()
+		{
+			State ^= State << 13;
+			State ^= State >> 17;
+			State ^= State << 5;
+			return State;
+		}
+
+		// Returns a number in [lo, hi].
+		int Range(int lo, int hi)
+		{
+			return lo + int(Next() % uint32_t(hi - lo + 1));
+		}
+
+		bool Chance(float fraction)
+		{
+			return (Next() >> 8) < uint32_t(fraction * float(1 << 24));
+		}
+
+	private:
+		uint32_t State;
+	};
+
+	struct FGenSector
+	{
+		int Floor = 0;
+		int Ceiling = 0;
+		const char *FloorPic = "FLOOR0_1";
+		const char *CeilingPic = "CEIL1_1";
+		int Tag = 0;
+		bool Sloped = false;
+		float PlaneA = 0, PlaneB = 0, PlaneC = 1, PlaneD = 0;
+	};
+
+	struct FGenLine
+	{
+		int V1, V2;
+		int Front, Back;
+		int Special = 0;
+		int Args[4] = { 0, 0, 0, 0 };
+	};
+
+	struct FGenThing
+	{
+		int X, Y, Height;
+		int Type;
+		int Angle = 0;
+		int Pitch = 0;
+		int Args[4] = { 0, 0, 0, 0 };
+		int SampleDistance = 0;
+	};
+
+	struct FGenPoint
+	{
+		int X, Y;
+	};
+
+	class FMapBuilder
+	{
+	public:
+		std::vector<FGenPoint> Vertices;
+		std::vector<FGenLine> Lines;
+		std::vector<FGenSector> Sectors;
+		std::vector<FGenThing> Things;
+
+		int AddSector(const FGenSector &sector)
+		{
+			Sectors.push_back(sector);
+			return int(Sectors.size()) - 1;
+		}
+
+		// Adds the edges of a closed loop with sector on their right.
+		// Returns the index of the first line the loop created, or -1.
+		int AddLoop(int sector, const std::vector<FGenPoint> &points)
+		{
+			int first = -1;
+			for (size_t i = 0; i < points.size(); i++)
+			{
+				int line = AddEdge(sector, points[i], points[(i + 1) % points.size()]);
+				if (first < 0)
+				{
+					first = line;
+				}
+			}
+			return first;
+		}
+
+		// Adds a rectangle, as the outside of sector or, if hole is set,
+		// as a hole in it.
+		int AddRect(int sector, int x1, int y1, int x2, int y2, bool hole = false)
+		{
+			std::vector<FGenPoint> points = { { x1, y1 }, { x1, y2 }, { x2, y2 }, { x2, y1 } };
+			if (hole)
+			{
+				std::reverse(points.begin(), points.end());
+			}
+			return AddLoop(sector, points);
+		}
+
+	private:
+		std::map<std::pair<int, int>, int> VertexMap;
+		std::map<std::pair<int, int>, int> EdgeMap;
+
+		int AddVertex(const FGenPoint &p)
+		{
+			auto it = VertexMap.find({ p.X, p.Y });
+			if (it != VertexMap.end())
+			{
+				return it->second;
+			}
+			Vertices.push_back(p);
+			VertexMap[{ p.X, p.Y }] = int(Vertices.size()) - 1;
+			return int(Vertices.size()) - 1;
+		}
+
+		int AddEdge(int sector, const FGenPoint &p1, const FGenPoint &p2)
+		{
+			int v1 = AddVertex(p1);
+			int v2 = AddVertex(p2);
+			auto it = EdgeMap.find({ std::min(v1, v2), std::max(v1, v2) });
+			if (it == EdgeMap.end())
+			{
+				FGenLine line;
+				line.V1 = v1;
+				line.V2 = v2;
+				line.Front = sector;
+				line.Back = -1;
+				Lines.push_back(line);
+				EdgeMap[{ std::min(v1, v2), std::max(v1, v2) }] = int(Lines.size()) - 1;
+				return int(Lines.size()) - 1;
+			}
+
+			FGenLine &line = Lines[it->second];
+			if (line.Back >= 0 || line.V1 != v2)
+			{
+				throw std::runtime_error("Map generator produced overlapping sectors");
+			}
+			line.Back = sector;
+			return it->second;
+		}
+	};
+
+	class FTextWriter
+	{
+	public:
+		std::string Text;
+
+		void Add(const char *format, ...)
+		{
+			char buffer[256];
+			va_list args;
+			va_start(args, format);
+			vsnprintf(buffer, sizeof(buffer), format, args);
+			va_end(args);
+			Text += buffer;
+		}
+	};
+}
+
+static std::string WriteTextMap(const FMapBuilder &map)
+{
+	FTextWriter out;
+	out.Add("namespace = \"zdoom\";\n");
+
+	for (size_t i = 0; i < map.Things.size(); i++)
+	{
+		const FGenThing &thing = map.Things[i];
+		out.Add("\nthing // %d\n{\nx = %d.000;\ny = %d.000;\nheight = %d.000;\ntype = %d;\n", (int)i, thing.X, thing.Y, thing.Height, thing.Type);
+		if (thing.Angle != 0) out.Add("angle = %d;\n", thing.Angle);
+		if (thing.Pitch != 0) out.Add("pitch = %d;\n", thing.Pitch);
+		for (int a = 0; a < 4; a++)
+		{
+			if (thing.Args[a] != 0) out.Add("arg%d = %d;\n", a, thing.Args[a]);
+		}
+		if (thing.SampleDistance != 0) out.Add("lm_sampledistance = %d;\n", thing.SampleDistance);
+		out.Add("skill1 = true;\nskill2 = true;\nskill3 = true;\nskill4 = true;\nskill5 = true;\nsingle = true;\n}\n");
+	}
+
+	for (size_t i = 0; i < map.Vertices.size(); i++)
+	{
+		out.Add("\nvertex // %d\n{\nx = %d.000;\ny = %d.000;\n}\n", (int)i, map.Vertices[i].X, map.Vertices[i].Y);
+	}
+
+	int side = 0;
+	for (size_t i = 0; i < map.Lines.size(); i++)
+	{
+		const FGenLine &line = map.Lines[i];
+		out.Add("\nlinedef // %d\n{\nv1 = %d;\nv2 = %d;\nsidefront = %d;\n", (int)i, line.V1, line.V2, side++);
+		if (line.Back >= 0)
+		{
+			out.Add("sideback = %d;\ntwosided = true;\n", side++);
+		}
+		else
+		{
+			out.Add("blocking = true;\n");
+		}
+		if (line.Special != 0)
+		{
+			out.Add("special = %d;\n", line.Special);
+			for (int a = 0; a < 4; a++)
+			{
+				if (line.Args[a] != 0) out.Add("arg%d = %d;\n", a, line.Args[a]);
+			}
+		}
+		out.Add("}\n");
+	}
+
+	for (size_t i = 0, s = 0; i < map.Lines.size(); i++)
+	{
+		const FGenLine &line = map.Lines[i];
+		if (line.Back >= 0)
+		{
+			out.Add("\nsidedef // %d\n{\nsector = %d;\ntexturetop = \"STARTAN2\";\ntexturebottom = \"STARTAN2\";\n}\n", (int)s++, line.Front);
+			out.Add("\nsidedef // %d\n{\nsector = %d;\ntexturetop = \"STARTAN2\";\ntexturebottom = \"STARTAN2\";\n}\n", (int)s++, line.Back);
+		}
+		else
+		{
+			out.Add("\nsidedef // %d\n{\nsector = %d;\ntexturemiddle = \"STARTAN2\";\n}\n", (int)s++, line.Front);
+		}
+	}
+
+	for (size_t i = 0; i < map.Sectors.size(); i++)
+	{
+		const FGenSector &sector = map.Sectors[i];
+		out.Add("\nsector // %d\n{\nheightfloor = %d;\nheightceiling = %d;\ntexturefloor = \"%s\";\ntextureceiling = \"%s\";\nlightlevel = 160;\n",
+			(int)i, sector.Floor, sector.Ceiling, sector.FloorPic, sector.CeilingPic);
+		if (sector.Tag != 0)
+		{
+			out.Add("id = %d;\n", sector.Tag);
+		}
+		if (sector.Sloped)
+		{
+			out.Add("floorplane_a = %.6f;\nfloorplane_b = %.6f;\nfloorplane_c = %.6f;\nfloorplane_d = %.6f;\n",
+				sector.PlaneA, sector.PlaneB, sector.PlaneC, sector.PlaneD);
+		}
+		out.Add("}\n");
+	}
+
+	return out.Text;
+}
+
+FMapGenInfo GenerateMap(const FMapGenSettings &settings, const char *filename)
+{
+	const int size = settings.RoomSize;
+	const int pitch = settings.RoomSize + settings.WallThickness;
+	const int door = std::min(settings.DoorWidth, size / 2);
+	const int doorstart = (size - door) / 2;
+
+	if (settings.RoomsX < 1 || settings.RoomsY < 1 || size < 128 || settings.WallThickness < 8)
+	{
+		throw std::runtime_error("Map generator settings are out of range");
+	}
+
+	FMapGenRandom random(settings.Seed);
+	FMapBuilder map;
+	FMapGenInfo info;
+
+	// Rooms first, so that a room is in front of the lines it shares with
+	// its doors, steps and platforms.
+	std::vector<int> roomsectors;
+	for (int j = 0; j < settings.RoomsY; j++)
+	{
+		for (int i = 0; i < settings.RoomsX; i++)
+		{
+			FMapGenRoom room;
+			room.X1 = i * pitch;
+			room.Y1 = j * pitch;
+			room.X2 = room.X1 + size;
+			room.Y2 = room.Y1 + size;
+			room.Floor = 8 * random.Range(0, 4);
+			room.Ceiling = room.Floor + 256 + 16 * random.Range(0, 4);
+
+			FGenSector sector;
+			sector.Floor = room.Floor;
+			sector.Ceiling = room.Ceiling;
+			if (random.Chance(settings.Sky))
+			{
+				sector.CeilingPic = "F_SKY1";
+				info.NumSky++;
+			}
+
+			int x1 = room.X1, y1 = room.Y1, x2 = room.X2, y2 = room.Y2;
+			int dx1 = x1 + doorstart, dx2 = dx1 + door;
+			int dy1 = y1 + doorstart, dy2 = dy1 + door;
+
+			std::vector<FGenPoint> outline;
+			outline.push_back({ x1, y1 });
+			if (i > 0) { outline.push_back({ x1, dy1 }); outline.push_back({ x1, dy2 }); }
+			outline.push_back({ x1, y2 });
+			if (j < settings.RoomsY - 1) { outline.push_back({ dx1, y2 }); outline.push_back({ dx2, y2 }); }
+			outline.push_back({ x2, y2 });
+			if (i < settings.RoomsX - 1) { outline.push_back({ x2, dy2 }); outline.push_back({ x2, dy1 }); }
+			outline.push_back({ x2, y1 });
+			if (j > 0) { outline.push_back({ dx2, y1 }); outline.push_back({ dx1, y1 }); }
+
+			bool stairs = random.Chance(settings.Stairs);
+			bool floor3d = !stairs && random.Chance(settings.Floors3D);
+			if (!stairs && !floor3d && random.Chance(settings.Slopes))
+			{
+				// The floor rises by SLOPE_RISE units across the room, along x
+				// or y. A plane is ax + by + cz + d = 0.
+				float rise = float(SLOPE_RISE) / float(size);
+				bool alongx = random.Range(0, 1) == 0;
+				sector.Sloped = true;
+				sector.PlaneA = alongx ? -rise : 0.0f;
+				sector.PlaneB = alongx ? 0.0f : -rise;
+				sector.PlaneC = 1.0f;
+				sector.PlaneD = rise * float(alongx ? x1 : y1) - float(room.Floor);
+				info.NumSlopes++;
+			}
+
+			int roomsector = map.AddSector(sector);
+			roomsectors.push_back(roomsector);
+			map.AddLoop(roomsector, outline);
+
+			if (stairs)
+			{
+				// Concentric steps going up towards the middle of the room
+				int inset = size / 8, stepwidth = size / 16;
+				int parent = roomsector;
+				for (int k = 1; k <= STAIR_STEPS; k++)
+				{
+					int d = inset + (k - 1) * stepwidth;
+					FGenSector step = sector;
+					step.Floor = room.Floor + k * STAIR_STEP_HEIGHT;
+					int stepsector = map.AddSector(step);
+					map.AddRect(parent, x1 + d, y1 + d, x2 - d, y2 - d, true);
+					map.AddRect(stepsector, x1 + d, y1 + d, x2 - d, y2 - d);
+					parent = stepsector;
+				}
+				info.NumStairs++;
+			}
+			else if (floor3d)
+			{
+				// A platform floating over the middle of the room. The sector
+				// under it is tagged, and a control sector outside the grid
+				// gives the platform's bottom and top.
+				int tag = int(info.Num3DFloors) + 1;
+				int d = size / 4;
+				FGenSector platform = sector;
+				platform.Tag = tag;
+				int platformsector = map.AddSector(platform);
+				map.AddRect(roomsector, x1 + d, y1 + d, x2 - d, y2 - d, true);
+				map.AddRect(platformsector, x1 + d, y1 + d, x2 - d, y2 - d);
+
+				FGenSector control;
+				control.Floor = room.Floor + 96;
+				control.Ceiling = room.Floor + 112;
+				control.FloorPic = "FLAT1";
+				control.CeilingPic = "FLAT1";
+				int controlsector = map.AddSector(control);
+				int cx = info.Num3DFloors * 192, cy = -pitch - 128;
+				int line = map.AddRect(controlsector, cx, cy, cx + 128, cy + 128);
+				map.Lines[line].Special = SECTOR_SET_3DFLOOR;
+				map.Lines[line].Args[0] = tag;
+				map.Lines[line].Args[1] = 1;		// solid
+				map.Lines[line].Args[3] = 255;		// opaque
+				info.Num3DFloors++;
+			}
+
+			info.Rooms.push_back(room);
+		}
+	}
+
+	// Doors to the right of and above each room
+	for (int j = 0; j < settings.RoomsY; j++)
+	{
+		for (int i = 0; i < settings.RoomsX; i++)
+		{
+			int index = j * settings.RoomsX + i;
+			const FMapGenRoom &room = info.Rooms[index];
+
+			for (int dir = 0; dir < 2; dir++)
+			{
+				int ni = i + (dir == 0), nj = j + (dir == 1);
+				if (ni >= settings.RoomsX || nj >= settings.RoomsY)
+				{
+					continue;
+				}
+				const FMapGenRoom &next = info.Rooms[nj * settings.RoomsX + ni];
+
+				FGenSector sector;
+				sector.Floor = std::max(room.Floor, next.Floor);
+				sector.Ceiling = std::min(room.Ceiling, next.Ceiling) - 32;
+				int doorsector = map.AddSector(sector);
+
+				if (dir == 0)
+				{
+					int y1 = room.Y1 + doorstart;
+					map.AddRect(doorsector, room.X2, y1, next.X1, y1 + door);
+				}
+				else
+				{
+					int x1 = room.X1 + doorstart;
+					map.AddRect(doorsector, x1, room.Y2, x1 + door, next.Y1);
+				}
+			}
+		}
+	}
+
+	// Things: the player, the sun and the lights
+	{
+		const FMapGenRoom &start = info.Rooms[0];
+
+		FGenThing player;
+		player.X = start.X1 + size / 2;
+		player.Y = start.Y1 + size / 2;
+		player.Height = 0;
+		player.Type = THING_PLAYER1;
+		player.Angle = 90;
+		map.Things.push_back(player);
+
+		FGenThing sun = player;
+		sun.X += 32;
+		sun.Type = THING_ZDRAYINFO;
+		sun.Angle = 45;
+		sun.Pitch = 60;
+		sun.SampleDistance = settings.SampleDistance;
+		map.Things.push_back(sun);
+	}
+
+	static const int colors[][3] =
+	{
+		{ 255, 255, 255 }, { 255, 200, 128 }, { 128, 160, 255 },
+		{ 255, 96, 64 }, { 96, 255, 128 }, { 255, 240, 160 }
+	};
+
+	for (int k = 0; k < settings.Lights; k++)
+	{
+		const FMapGenRoom &room = info.Rooms[random.Range(0, int(info.Rooms.size()) - 1)];
+		const int *color = colors[random.Range(0, 5)];
+
+		FGenThing light;
+		light.X = random.Range(room.X1 + 64, room.X2 - 64);
+		light.Y = random.Range(room.Y1 + 64, room.Y2 - 64);
+		light.Height = random.Range(64, 160);
+		light.Type = THING_POINTLIGHT_STATIC;
+		light.Args[0] = color[0];
+		light.Args[1] = color[1];
+		light.Args[2] = color[2];
+		light.Args[3] = random.Range(256, 640);
+		map.Things.push_back(light);
+	}
+
+	std::string textmap = WriteTextMap(map);
+
+	FWadWriter wad(filename, false);
+	wad.CreateLabel("MAP01");
+	wad.WriteLump("TEXTMAP", textmap.data(), int(textmap.size()));
+	wad.CreateLabel("ENDMAP");
+	wad.Close();
+
+	info.NumVertices = int(map.Vertices.size());
+	info.NumLines = int(map.Lines.size());
+	info.NumSectors = int(map.Sectors.size());
+	info.NumThings = int(map.Things.size());
+	for (const FGenLine &line : map.Lines)
+	{
+		info.NumSides += line.Back >= 0 ? 2 : 1;
+	}
+	return info;
+}
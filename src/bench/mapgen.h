@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Settings for a generated benchmark map. Every room is a square of
+// RoomSize map units, with WallThickness units and a door between it and
+// each of its neighbours. The fractions are the share of rooms that get a
+// staircase, a sloped floor, a sky ceiling or a 3D floor.
+struct FMapGenSettings
+{
+	int RoomsX = 8;
+	int RoomsY = 8;
+	int RoomSize = 512;
+	int WallThickness = 64;
+	int DoorWidth = 128;
+	int Lights = 16;
+	int SampleDistance = 16;
+	float Stairs = 0.25f;
+	float Slopes = 0.25f;
+	float Sky = 0.25f;
+	float Floors3D = 0.125f;
+	uint32_t Seed = 1;
+};
+
+// A room of the generated map, for placing test rays inside it.
+struct FMapGenRoom
+{
+	int X1, Y1, X2, Y2;
+	int Floor, Ceiling;
+};
+
+struct FMapGenInfo
+{
+	std::vector<FMapGenRoom> Rooms;
+	int NumVertices = 0;
+	int NumLines = 0;
+	int NumSides = 0;
+	int NumSectors = 0;
+	int NumThings = 0;
+	int NumStairs = 0;
+	int NumSlopes = 0;
+	int NumSky = 0;
+	int Num3DFloors = 0;
+};
+
+// Writes a UDMF map called MAP01 to the wad filename. The same settings
+// always give the same map.
+FMapGenInfo GenerateMap(const FMapGenSettings &settings, const char *filename);
@@ -23,10 +23,19 @@
 #include "framework/zdray.h"
 #include "framework/templates.h"
 #include "framework/tarray.h"
+#include "framework/parallel.h"
 #include "blockmapbuilder/blockmapbuilder.h"
 
 #undef BLOCK_TEST
 
+// Lines are rasterized in up to BLOCK_CHUNKS chunks of at least
+// BLOCK_CHUNK_LINES lines each.
+static const int BLOCK_CHUNKS = 16;
+static const int BLOCK_CHUNK_LINES = 1024;
+
+// Number of blocks hashed by one job.
+static const int BLOCK_HASH_BATCH = 4096;
+
 FBlockmapBuilder::FBlockmapBuilder (FLevel &level)
 	: Level (level)
 {
@@ -170,13 +179,140 @@ notest:
 	return &BlockMap[0];
 }
 
+// Scale() goes through doubles on most targets, which -ffast-math is free to
+// reassociate. Both rasterization passes have to agree on every block, so
+// this uses exact integer math instead.
+
+static inline int BlockScale (int a, int b, int c)
+{
+	return int((int64_t)a * b / c);
+}
+
+// Calls visit(block) for every block the line passes through.
+
+template<class Visit>
+static void RasterizeLine (FLevel &Level, int line, int minx, int miny, int bmapwidth, Visit visit)
+{
+	int x1 = Level.Vertices[Level.Lines[line].v1].x >> FRACBITS;
+	int y1 = Level.Vertices[Level.Lines[line].v1].y >> FRACBITS;
+	int x2 = Level.Vertices[Level.Lines[line].v2].x >> FRACBITS;
+	int y2 = Level.Vertices[Level.Lines[line].v2].y >> FRACBITS;
+	int dx = x2 - x1;
+	int dy = y2 - y1;
+	int bx = (x1 - minx) >> BLOCKBITS;
+	int by = (y1 - miny) >> BLOCKBITS;
+	int bx2 = (x2 - minx) >> BLOCKBITS;
+	int by2 = (y2 - miny) >> BLOCKBITS;
+
+	int block = bx + by * bmapwidth;
+	int endblock = bx2 + by2 * bmapwidth;
+
+	if (block == endblock)	// Single block
+	{
+		visit (block);
+	}
+	else if (by == by2)		// Horizontal line
+	{
+		if (bx > bx2)
+		{
+			std::swap (block, endblock);
+		}
+		do
+		{
+			visit (block);
+			block += 1;
+		} while (block <= endblock);
+	}
+	else if (bx == bx2)	// Vertical line
+	{
+		if (by > by2)
+		{
+			std::swap (block, endblock);
+		}
+		do
+		{
+			visit (block);
+			block += bmapwidth;
+		} while (block <= endblock);
+	}
+	else				// Diagonal line
+	{
+		int xchange = (dx < 0) ? -1 : 1;
+		int ychange = (dy < 0) ? -1 : 1;
+		int ymove = ychange * bmapwidth;
+		int adx = abs (dx);
+		int ady = abs (dy);
+
+		if (adx == ady)		// 45 degrees
+		{
+			int xb = (x1 - minx) & (BLOCKSIZE-1);
+			int yb = (y1 - miny) & (BLOCKSIZE-1);
+			if (dx < 0)
+			{
+				xb = BLOCKSIZE-xb;
+			}
+			if (dy < 0)
+			{
+				yb = BLOCKSIZE-yb;
+			}
+			if (xb < yb)
+				adx--;
+		}
+		if (adx >= ady)		// X-major
+		{
+			int yadd = dy < 0 ? -1 : BLOCKSIZE;
+			do
+			{
+				int stop = (BlockScale ((by << BLOCKBITS) + yadd - (y1 - miny), dx, dy) + (x1 - minx)) >> BLOCKBITS;
+				while (bx != stop)
+				{
+					visit (block);
+					block += xchange;
+					bx += xchange;
+				}
+				visit (block);
+				block += ymove;
+				by += ychange;
+			} while (by != by2);
+			while (block != endblock)
+			{
+				visit (block);
+				block += xchange;
+			}
+			visit (block);
+		}
+		else					// Y-major
+		{
+			int xadd = dx < 0 ? -1 : BLOCKSIZE;
+			do
+			{
+				int stop = (BlockScale ((bx << BLOCKBITS) + xadd - (x1 - minx), dy, dx) + (y1 - miny)) >> BLOCKBITS;
+				while (by != stop)
+				{
+					visit (block);
+					block += ymove;
+					by += ychange;
+				}
+				visit (block);
+				block += xchange;
+				bx += xchange;
+			} while (bx != bx2);
+			while (block != endblock)
+			{
+				visit (block);
+				block += ymove;
+			}
+			visit (block);
+		}
+	}
+}
+
 void FBlockmapBuilder::BuildBlockmap ()
 {
-	TArray<uint16_t> *BlockLists, *block, *endblock;
 	uint16_t adder;
-	int bmapwidth, bmapheight;
+	int bmapwidth, bmapheight, numblocks;
 	int minx, maxx, miny, maxy;
-	uint16_t line;
+	int numlines, chunklines, numchunks, i;
 
 	if (Level.NumVertices <= 0)
 		return;
@@ -202,138 +338,70 @@ void FBlockmapBuilder::BuildBlockmap ()
 */
 	bmapwidth =	 ((maxx - minx) >> BLOCKBITS) + 1;
 	bmapheight = ((maxy - miny) >> BLOCKBITS) + 1;
+	numblocks = bmapwidth * bmapheight;
 
 	adder = uint16_t(minx);			BlockMap.Push (adder);
 	adder = uint16_t(miny);			BlockMap.Push (adder);
 	adder = uint16_t(bmapwidth);	BlockMap.Push (adder);
 	adder = uint16_t(bmapheight);	BlockMap.Push (adder);
 
-	BlockLists = new TArray<uint16_t>[bmapwidth * bmapheight];
+	// The lines are split into chunks that are rasterized in parallel twice:
+	// once to count the lines in each block, and once more to store them.
+	// Every chunk gets its own range inside each block, so the lines in a
+	// block stay in ascending order.
+	numlines = Level.NumLines();
+	chunklines = MAX (BLOCK_CHUNK_LINES, ChunkCount (numlines, BLOCK_CHUNKS));
+	numchunks = ChunkCount (numlines, chunklines);
+
+	TArray<int> chunkpos;
+	chunkpos.Resize (numchunks * numblocks);
+	if (chunkpos.Size() > 0)
+	{
+		memset (&chunkpos[0], 0, chunkpos.Size() * sizeof(int));
+	}
 
-	for (line = 0; line < Level.NumLines(); ++line)
+	ParallelForChunks (numlines, chunklines, [&](int chunk, int start, int end)
 	{
-		int x1 = Level.Vertices[Level.Lines[line].v1].x >> FRACBITS;
-		int y1 = Level.Vertices[Level.Lines[line].v1].y >> FRACBITS;
-		int x2 = Level.Vertices[Level.Lines[line].v2].x >> FRACBITS;
-		int y2 = Level.Vertices[Level.Lines[line].v2].y >> FRACBITS;
-		int dx = x2 - x1;
-		int dy = y2 - y1;
-		int bx = (x1 - minx) >> BLOCKBITS;
-		int by = (y1 - miny) >> BLOCKBITS;
-		int bx2 = (x2 - minx) >> BLOCKBITS;
-		int by2 = (y2 - miny) >> BLOCKBITS;
-
-		block = &BlockLists[bx + by * bmapwidth];
-		endblock = &BlockLists[bx2 + by2 * bmapwidth];
-
-		if (block == endblock)	// Single block
-		{
-			block->Push (line);
-		}
-		else if (by == by2)		// Horizontal line
+		int *counts = &chunkpos[chunk * numblocks];
+		for (int line = start; line < end; ++line)
 		{
-			if (bx > bx2)
-			{
-				std::swap (block, endblock);
-			}
-			do
-			{
-				block->Push (line);
-				block += 1;
-			} while (block <= endblock);
+			RasterizeLine (Level, line, minx, miny, bmapwidth, [counts](int block) { counts[block]++; });
 		}
-		else if (bx == bx2)	// Vertical line
+	});
+
+	BlockStart.Resize (numblocks + 1);
+	int pos = 0;
+	for (i = 0; i < numblocks; ++i)
+	{
+		BlockStart[i] = pos;
+		for (int chunk = 0; chunk < numchunks; ++chunk)
 		{
-			if (by > by2)
-			{
-				std::swap (block, endblock);
-			}
-			do
-			{
-				block->Push (line);
-				block += bmapwidth;
-			} while (block <= endblock);
+			int count = chunkpos[chunk * numblocks + i];
+			chunkpos[chunk * numblocks + i] = pos;
+			pos += count;
 		}
-		else				// Diagonal line
-		{
-			int xchange = (dx < 0) ? -1 : 1;
-			int ychange = (dy < 0) ? -1 : 1;
-			int ymove = ychange * bmapwidth;
-			int adx = abs (dx);
-			int ady = abs (dy);
+	}
+	BlockStart[numblocks] = pos;
+	BlockLines.Resize (pos);
 
-			if (adx == ady)		// 45 degrees
-			{
-				int xb = (x1 - minx) & (BLOCKSIZE-1);
-				int yb = (y1 - miny) & (BLOCKSIZE-1);
-				if (dx < 0)
-				{
-					xb = BLOCKSIZE-xb;
-				}
-				if (dy < 0)
-				{
-					yb = BLOCKSIZE-yb;
-				}
-				if (xb < yb)
-					adx--;
-			}
-			if (adx >= ady)		// X-major
-			{
-				int yadd = dy < 0 ? -1 : BLOCKSIZE;
-				do
-				{
-					int stop = (Scale ((by << BLOCKBITS) + yadd - (y1 - miny), dx, dy) + (x1 - minx)) >> BLOCKBITS;
-					while (bx != stop)
-					{
-						block->Push (line);
-						block += xchange;
-						bx += xchange;
-					}
-					block->Push (line);
-					block += ymove;
-					by += ychange;
-				} while (by != by2);
-				while (block != endblock)
-				{
-					block->Push (line);
-					block += xchange;
-				}
-				block->Push (line);
-			}
-			else					// Y-major
-			{
-				int xadd = dx < 0 ? -1 : BLOCKSIZE;
-				do
-				{
-					int stop = (Scale ((bx << BLOCKBITS) + xadd - (x1 - minx), dy, dx) + (y1 - miny)) >> BLOCKBITS;
-					while (by != stop)
-					{
-						block->Push (line);
-						block += ymove;
-						by += ychange;
-					}
-					block->Push (line);
-					block += xchange;
-					bx += xchange;
-				} while (bx != bx2);
-				while (block != endblock)
-				{
-					block->Push (line);
-					block += ymove;
-				}
-				block->Push (line);
-			}
+	ParallelForChunks (numlines, chunklines, [&](int chunk, int start, int end)
+	{
+		int *next = &chunkpos[chunk * numblocks];
+		uint16_t *lines = BlockLines.Data();
+		for (int line = start; line < end; ++line)
+		{
+			RasterizeLine (Level, line, minx, miny, bmapwidth, [next, lines, line](int block) { lines[next[block]++] = uint16_t(line); });
 		}
-	}
+	});
 
-	BlockMap.Reserve (bmapwidth * bmapheight);
-	CreatePackedBlockmap (BlockLists, bmapwidth, bmapheight);
-	delete[] BlockLists;
+	BlockMap.Reserve (numblocks);
+	CreatePackedBlockmap (bmapwidth, bmapheight);
+	BlockStart.Clear ();
+	BlockLines.Clear ();
 }
 
-void FBlockmapBuilder::CreateUnpackedBlockmap (TArray<uint16_t> *blocks, int bmapwidth, int bmapheight)
+void FBlockmapBuilder::CreateUnpackedBlockmap (int bmapwidth, int bmapheight)
 {
-	TArray<uint16_t> *block;
 	uint16_t zero = 0;
 	uint16_t terminator = 0xffff;
 
@@ -341,102 +409,95 @@ void FBlockmapBuilder::CreateUnpackedBlockmap (TArray<uint16_t> *blocks, int bma
 	{
 		BlockMap[4+i] = uint16_t(BlockMap.Size());
 		BlockMap.Push (zero);
-		block = &blocks[i];
-		for (unsigned int j = 0; j < block->Size(); ++j)
+		for (int j = BlockStart[i]; j < BlockStart[i+1]; ++j)
 		{
-			BlockMap.Push ((*block)[j]);
+			BlockMap.Push (BlockLines[j]);
 		}
 		BlockMap.Push (terminator);
 	}
 }
 
-static unsigned int BlockHash (TArray<uint16_t> *block)
+uint64_t FBlockmapBuilder::BlockHash (int block) const
 {
-	int hash = 0;
-	uint16_t *ar = &(*block)[0];
-	for (size_t i = 0; i < block->Size(); ++i)
+	// 64-bit FNV-1a
+	uint64_t hash = 14695981039346656037ull;
+	for (int i = BlockStart[block]; i < BlockStart[block+1]; ++i)
 	{
-		hash = hash * 12235 + ar[i];
+		hash = (hash ^ BlockLines[i]) * 1099511628211ull;
 	}
-	return hash & 0x7fffffff;
+	return hash;
 }
 
-static bool BlockCompare (TArray<uint16_t> *block1, TArray<uint16_t> *block2)
+bool FBlockmapBuilder::BlockCompare (int block1, int block2) const
 {
-	size_t size = block1->Size();
+	int size = BlockStart[block1+1] - BlockStart[block1];
 
-	if (size != block2->Size())
+	if (size != BlockStart[block2+1] - BlockStart[block2])
 	{
 		return false;
 	}
-	if (size == 0)
-	{
-		return true;
-	}
-	uint16_t *ar1 = &(*block1)[0];
-	uint16_t *ar2 = &(*block2)[0];
-	for (size_t i = 0; i < size; ++i)
-	{
-		if (ar1[i] != ar2[i])
-		{
-			return false;
-		}
-	}
-	return true;
+	return size == 0 || memcmp (&BlockLines[BlockStart[block1]], &BlockLines[BlockStart[block2]], size * sizeof(uint16_t)) == 0;
 }
 
-void FBlockmapBuilder::CreatePackedBlockmap (TArray<uint16_t> *blocks, int bmapwidth, int bmapheight)
+void FBlockmapBuilder::CreatePackedBlockmap (int bmapwidth, int bmapheight)
 {
-	uint16_t buckets[4096];
-	uint16_t *hashes, hashblock;
-	TArray<uint16_t> *block;
 	uint16_t zero = 0;
 	uint16_t terminator = 0xffff;
-	uint16_t *array;
-	int i, hash;
+	int numblocks = bmapwidth * bmapheight;
+	int i;
 	int hashed = 0, nothashed = 0;
 
-	hashes = new uint16_t[bmapwidth * bmapheight];
+	TArray<uint64_t> hashes;
+	hashes.Resize (numblocks);
+	ParallelForChunks (numblocks, BLOCK_HASH_BATCH, [&](int, int start, int end)
+	{
+		for (int j = start; j < end; ++j)
+		{
+			hashes[j] = BlockHash (j);
+		}
+	});
 
-	memset (hashes, 0xff, sizeof(uint16_t)*bmapwidth*bmapheight);
-	memset (buckets, 0xff, sizeof(buckets));
+	// Open-addressed table of the first block seen with each content.
+	unsigned int tablesize = 16;
+	while (tablesize < (unsigned int)numblocks * 2)
+	{
+		tablesize <<= 1;
+	}
+	TArray<int> table;
+	table.Resize (tablesize);
+	memset (&table[0], 0xff, tablesize * sizeof(int));
 
-	for (i = 0; i < bmapwidth * bmapheight; ++i)
+	for (i = 0; i < numblocks; ++i)
 	{
-		block = &blocks[i];
-		hash = BlockHash (block) % 4096;
-		hashblock = buckets[hash];
-		while (hashblock != 0xffff)
+		unsigned int slot = (unsigned int)(hashes[i] ^ (hashes[i] >> 32)) & (tablesize - 1);
+		int match;
+
+		while ((match = table[slot]) != -1)
 		{
-			if (BlockCompare (block, &blocks[hashblock]))
+			if (hashes[match] == hashes[i] && BlockCompare (i, match))
 			{
 				break;
 			}
-			hashblock = hashes[hashblock];
+			slot = (slot + 1) & (tablesize - 1);
 		}
-		if (hashblock != 0xffff)
+		if (match != -1)
 		{
-			BlockMap[4+i] = BlockMap[4+hashblock];
+			BlockMap[4+i] = BlockMap[4+match];
 			hashed++;
 		}
 		else
 		{
-			hashes[i] = buckets[hash];
-			buckets[hash] = uint16_t(i);
+			table[slot] = i;
 			BlockMap[4+i] = uint16_t(BlockMap.Size());
 			BlockMap.Push (zero);
-			array = &(*block)[0];
-			for (size_t j = 0; j < block->Size(); ++j)
+			for (int j = BlockStart[i]; j < BlockStart[i+1]; ++j)
 			{
-				BlockMap.Push (array[j]);
+				BlockMap.Push (BlockLines[j]);
 			}
 			BlockMap.Push (terminator);
 			nothashed++;
 		}
 	}
 
-	delete[] hashes;
-
 //	printf ("%d blocks written, %d blocks saved\n", nothashed, hashed);
 }
-
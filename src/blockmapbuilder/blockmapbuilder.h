@@ -15,7 +15,14 @@ private:
 	FLevel &Level;
 	TArray<uint16_t> BlockMap;
 
+	// The lines in block i are BlockLines[BlockStart[i]] up to
+	// BlockLines[BlockStart[i+1]].
+	TArray<int> BlockStart;
+	TArray<uint16_t> BlockLines;
+
 	void BuildBlockmap ();
-	void CreateUnpackedBlockmap (TArray<uint16_t> *blocks, int bmapwidth, int bmapheight);
-	void CreatePackedBlockmap (TArray<uint16_t> *blocks, int bmapwidth, int bmapheight);
+	void CreateUnpackedBlockmap (int bmapwidth, int bmapheight);
+	void CreatePackedBlockmap (int bmapwidth, int bmapheight);
+	uint64_t BlockHash (int block) const;
+	bool BlockCompare (int block1, int block2) const;
 };
@@ -0,0 +1,263 @@
+#include "framework/bakecache.h"
+#include <algorithm>
+#include <stdexcept>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <direct.h>
+#include <process.h>
+#include <sys/utime.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <utime.h>
+#endif
+
+//==========================================================================
+//
+// FMappedFile
+//
+//==========================================================================
+
+#ifdef _WIN32
+
+std::unique_ptr<FMappedFile> FMappedFile::Open(const std::string &filename)
+{
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return nullptr;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+	{
+		CloseHandle(file);
+		return nullptr;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	const void *memory = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+	if (!memory)
+	{
+		if (mapping)
+			CloseHandle(mapping);
+		CloseHandle(file);
+		return nullptr;
+	}
+
+	std::unique_ptr<FMappedFile> mapped(new FMappedFile());
+	mapped->File = file;
+	mapped->Mapping = mapping;
+	mapped->Memory = (const uint8_t *)memory;
+	mapped->Length = (size_t)size.QuadPart;
+	return mapped;
+}
+
+FMappedFile::~FMappedFile()
+{
+	UnmapViewOfFile(Memory);
+	CloseHandle(Mapping);
+	CloseHandle(File);
+}
+
+#else
+
+std::unique_ptr<FMappedFile> FMappedFile::Open(const std::string &filename)
+{
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+		return nullptr;
+
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size == 0)
+	{
+		close(fd);
+		return nullptr;
+	}
+
+	// The mapping stays valid after the descriptor is closed
+	void *memory = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (memory == MAP_FAILED)
+		return nullptr;
+
+	std::unique_ptr<FMappedFile> mapped(new FMappedFile());
+	mapped->Memory = (const uint8_t *)memory;
+	mapped->Length = (size_t)info.st_size;
+	return mapped;
+}
+
+FMappedFile::~FMappedFile()
+{
+	munmap((void *)Memory, Length);
+}
+
+#endif
+
+//==========================================================================
+//
+// FBakeCache
+//
+//==========================================================================
+
+FBakeCache::FBakeCache(const char *directory, uint64_t maxSize) : Directory(directory), MaxSize(maxSize)
+{
+	while (Directory.size() > 1 && (Directory.back() == '/' || Directory.back() == '\\'))
+		Directory.pop_back();
+
+	struct stat info;
+	if (stat(Directory.c_str(), &info) != 0)
+	{
+#ifdef _WIN32
+		_mkdir(Directory.c_str());
+#else
+		mkdir(Directory.c_str(), 0777);
+#endif
+		if (stat(Directory.c_str(), &info) != 0)
+		{
+			printf("Could not create the cache directory %s\n", Directory.c_str());
+			throw std::runtime_error("Could not create cache directory");
+		}
+	}
+}
+
+std::string FBakeCache::GetPath(const FHash128 &key, const char *kind) const
+{
+	return Directory + "/" + key.ToString() + "." + kind;
+}
+
+std::unique_ptr<FMappedFile> FBakeCache::Find(const FHash128 &key, const char *kind)
+{
+	std::string path = GetPath(key, kind);
+	auto file = FMappedFile::Open(path);
+	if (file)
+		utime(path.c_str(), nullptr);
+	return file;
+}
+
+std::vector<std::unique_ptr<FMappedFile>> FBakeCache::FindRecent(const char *kind, int maxEntries)
+{
+	std::vector<Entry> entries = ListEntries(kind);
+	std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) { return a.LastUsed > b.LastUsed; });
+
+	std::vector<std::unique_ptr<FMappedFile>> files;
+	for (const Entry &entry : entries)
+	{
+		if ((int)files.size() == maxEntries)
+			break;
+		auto file = FMappedFile::Open(entry.Filename);
+		if (file)
+			files.push_back(std::move(file));
+	}
+	return files;
+}
+
+void FBakeCache::Store(const FHash128 &key, const char *kind, const void *data, size_t size)
+{
+	std::string path = GetPath(key, kind);
+
+	struct stat info;
+	if (stat(path.c_str(), &info) == 0)
+	{
+		utime(path.c_str(), nullptr);
+		return;
+	}
+
+	// Other runs may be reading the directory, so the entry only appears
+	// under its real name once it is complete.
+#ifdef _WIN32
+	std::string temp = path + ".tmp" + std::to_string(_getpid());
+#else
+	std::string temp = path + ".tmp" + std::to_string(getpid());
+#endif
+
+	FILE *file = fopen(temp.c_str(), "wb");
+	bool ok = file != nullptr;
+	if (ok)
+	{
+		ok = size == 0 || fwrite(data, size, 1, file) == 1;
+		ok = fclose(file) == 0 && ok;
+	}
+	if (ok)
+	{
+		ok = rename(temp.c_str(), path.c_str()) == 0;
+	}
+	if (!ok)
+	{
+		// The cache only saves time, so a failed write is not an error
+		remove(temp.c_str());
+		printf("   Could not write %s to the cache\n", path.c_str());
+	}
+}
+
+void FBakeCache::Trim()
+{
+	std::vector<Entry> entries = ListEntries(nullptr);
+	std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) { return a.LastUsed < b.LastUsed; });
+
+	uint64_t total = 0;
+	for (const Entry &entry : entries)
+		total += entry.Size;
+
+	for (const Entry &entry : entries)
+	{
+		if (total <= MaxSize)
+			break;
+		if (remove(entry.Filename.c_str()) == 0)
+			total -= entry.Size;
+	}
+}
+
+// Returns the entries of one kind, or of every kind if kind is null. Other
+// files in the directory are left alone.
+std::vector<FBakeCache::Entry> FBakeCache::ListEntries(const char *kind) const
+{
+	std::vector<std::string> names;
+#ifdef _WIN32
+	WIN32_FIND_DATAA data;
+	HANDLE find = FindFirstFileA((Directory + "/*").c_str(), &data);
+	if (find != INVALID_HANDLE_VALUE)
+	{
+		do
+		{
+			names.push_back(data.cFileName);
+		} while (FindNextFileA(find, &data));
+		FindClose(find);
+	}
+#else
+	DIR *dir = opendir(Directory.c_str());
+	if (dir)
+	{
+		while (struct dirent *ent = readdir(dir))
+			names.push_back(ent->d_name);
+		closedir(dir);
+	}
+#endif
+
+	std::vector<Entry> entries;
+	for (const std::string &name : names)
+	{
+		if (name.size() < 34 || name[32] != '.' || strspn(name.c_str(), "0123456789abcdef") != 32)
+			continue;
+		if (name.find(".tmp") != std::string::npos)
+			continue;
+		if (kind && name.compare(33, std::string::npos, kind) != 0)
+			continue;
+
+		Entry entry;
+		entry.Filename = Directory + "/" + name;
+		struct stat info;
+		if (stat(entry.Filename.c_str(), &info) != 0)
+			continue;
+		entry.Size = (uint64_t)info.st_size;
+		entry.LastUsed = (int64_t)info.st_mtime;
+		entries.push_back(entry);
+	}
+	return entries;
+}
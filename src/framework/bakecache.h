@@ -0,0 +1,69 @@
+#pragma once
+
+#include "framework/hash.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+// A read-only view of a whole file, mapped into memory.
+class FMappedFile
+{
+public:
+	~FMappedFile();
+
+	// Returns null if the file cannot be opened or is empty
+	static std::unique_ptr<FMappedFile> Open(const std::string &filename);
+
+	const uint8_t *Data() const { return Memory; }
+	size_t Size() const { return Length; }
+
+private:
+	FMappedFile() = default;
+	FMappedFile(const FMappedFile &) = delete;
+	FMappedFile &operator=(const FMappedFile &) = delete;
+
+	const uint8_t *Memory = nullptr;
+	size_t Length = 0;
+#ifdef _WIN32
+	void *File = nullptr;
+	void *Mapping = nullptr;
+#endif
+};
+
+// A directory of files shared by every run that is given the same --cache.
+// Each entry is named after the hash of everything it was made from, plus
+// a kind that says what it holds ("1f0e...c3.nodes"). Entries are never
+// changed once written, so runs can share the directory. Using an entry
+// updates its modification time, and when the directory grows past its
+// size limit the entries that were used longest ago are removed.
+class FBakeCache
+{
+public:
+	FBakeCache(const char *directory, uint64_t maxSize);
+
+	// Returns null if there is no such entry
+	std::unique_ptr<FMappedFile> Find(const FHash128 &key, const char *kind);
+
+	// Entries of one kind, the most recently used first
+	std::vector<std::unique_ptr<FMappedFile>> FindRecent(const char *kind, int maxEntries);
+
+	// Writes the entry unless it already exists
+	void Store(const FHash128 &key, const char *kind, const void *data, size_t size);
+
+	// Removes the least recently used entries until the directory fits the size limit
+	void Trim();
+
+private:
+	struct Entry
+	{
+		std::string Filename;
+		uint64_t Size;
+		int64_t LastUsed;
+	};
+
+	std::string GetPath(const FHash128 &key, const char *kind) const;
+	std::vector<Entry> ListEntries(const char *kind) const;
+
+	std::string Directory;
+	uint64_t MaxSize;
+};
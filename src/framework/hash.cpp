@@ -0,0 +1,105 @@
+#include "framework/hash.h"
+
+static inline uint64_t RotateLeft(uint64_t x, int bits)
+{
+	return (x << bits) | (x >> (64 - bits));
+}
+
+// The finalizer of MurmurHash3
+static inline uint64_t Mix(uint64_t x)
+{
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+	return x;
+}
+
+std::string FHash128::ToString() const
+{
+	static const char digits[] = "0123456789abcdef";
+	std::string text(32, '0');
+	for (int i = 0; i < 16; i++)
+	{
+		text[15 - i] = digits[(Hi >> (i * 4)) & 15];
+		text[31 - i] = digits[(Lo >> (i * 4)) & 15];
+	}
+	return text;
+}
+
+void FHasher::AddWord(uint64_t word)
+{
+	uint64_t k1 = word * 0x87c37b91114253d5ULL;
+	k1 = RotateLeft(k1, 31) * 0x4cf5ad432745937fULL;
+	H1 ^= k1;
+	H1 = RotateLeft(H1, 27) + H2;
+	H1 = H1 * 5 + 0x52dce729;
+
+	uint64_t k2 = word * 0x4cf5ad432745937fULL;
+	k2 = RotateLeft(k2, 33) * 0x87c37b91114253d5ULL;
+	H2 ^= k2;
+	H2 = RotateLeft(H2, 31) + H1;
+	H2 = H2 * 5 + 0x38495ab5;
+}
+
+void FHasher::Add(const void *data, size_t size)
+{
+	const uint8_t *bytes = (const uint8_t *)data;
+	Length += size;
+
+	// Finish the word started by the last call
+	while (TailSize > 0 && TailSize < 8 && size > 0)
+	{
+		Tail |= uint64_t(*bytes++) << (TailSize * 8);
+		TailSize++;
+		size--;
+	}
+	if (TailSize == 8)
+	{
+		AddWord(Tail);
+		Tail = 0;
+		TailSize = 0;
+	}
+
+	while (size >= 8)
+	{
+		uint64_t word = 0;
+		for (int i = 0; i < 8; i++)
+			word |= uint64_t(bytes[i]) << (i * 8);
+		AddWord(word);
+		bytes += 8;
+		size -= 8;
+	}
+
+	while (size > 0)
+	{
+		Tail |= uint64_t(*bytes++) << (TailSize * 8);
+		TailSize++;
+		size--;
+	}
+}
+
+FHash128 FHasher::Finish() const
+{
+	uint64_t h1 = H1, h2 = H2;
+	if (TailSize > 0)
+	{
+		h1 ^= RotateLeft(Tail * 0x87c37b91114253d5ULL, 31) * 0x4cf5ad432745937fULL;
+		h2 ^= RotateLeft(Tail * 0x4cf5ad432745937fULL, 33) * 0x87c37b91114253d5ULL;
+	}
+
+	h1 ^= Length;
+	h2 ^= Length;
+	h1 += h2;
+	h2 += h1;
+	h1 = Mix(h1);
+	h2 = Mix(h2);
+	h1 += h2;
+	h2 += h1;
+
+	FHash128 hash;
+	hash.Lo = h1;
+	hash.Hi = h2;
+	return hash;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+// A 128 bit hash, used to name the entries of the bake cache by what went
+// into them. It is quick and spreads its input well, but it is not a
+// cryptographic hash.
+struct FHash128
+{
+	uint64_t Lo = 0;
+	uint64_t Hi = 0;
+
+	bool operator==(const FHash128 &other) const { return Lo == other.Lo && Hi == other.Hi; }
+	bool operator!=(const FHash128 &other) const { return !(*this == other); }
+	bool operator<(const FHash128 &other) const { return Hi != other.Hi ? Hi < other.Hi : Lo < other.Lo; }
+
+	// 32 hex digits
+	std::string ToString() const;
+};
+
+class FHasher
+{
+public:
+	void Add(const void *data, size_t size);
+	void Add(const FHash128 &hash) { AddValue(hash.Lo); AddValue(hash.Hi); }
+
+	// Only for types without padding, since the padding bytes are hashed too
+	template<typename T>
+	void AddValue(const T &value) { Add(&value, sizeof(T)); }
+
+	template<typename T>
+	void AddArray(const T *values, size_t count)
+	{
+		AddValue((uint64_t)count);
+		Add(values, count * sizeof(T));
+	}
+
+	FHash128 Finish() const;
+
+private:
+	void AddWord(uint64_t word);
+
+	uint64_t H1 = 0x243f6a8885a308d3ULL;
+	uint64_t H2 = 0x13198a2e03707344ULL;
+	uint64_t Length = 0;
+	uint64_t Tail = 0;	// Bytes that do not make a whole word yet
+	int TailSize = 0;
+};
@@ -0,0 +1,379 @@
+#include "framework/json.h"
+#include <cmath>
+#include <stdexcept>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace
+{
+	class JsonParser
+	{
+	public:
+		JsonParser(const std::string &text) : Text(text.c_str()), Pos(text.c_str()) { }
+
+		FJsonValue ParseDocument()
+		{
+			FJsonValue value = ParseValue(0);
+			SkipSpace();
+			if (*Pos != 0)
+				Fail("unexpected text after the value");
+			return value;
+		}
+
+	private:
+		// Deeper nesting than any request needs is refused, so that bad input
+		// cannot run the stack out
+		enum { MaxDepth = 64 };
+
+		[[noreturn]] void Fail(const char *message)
+		{
+			throw std::runtime_error("JSON error at offset " + std::to_string(Pos - Text) + ": " + message);
+		}
+
+		void SkipSpace()
+		{
+			while (*Pos == ' ' || *Pos == '\t' || *Pos == '\r' || *Pos == '\n')
+				Pos++;
+		}
+
+		bool Match(const char *word)
+		{
+			size_t len = strlen(word);
+			if (strncmp(Pos, word, len) != 0)
+				return false;
+			Pos += len;
+			return true;
+		}
+
+		FJsonValue ParseValue(int depth)
+		{
+			if (depth > MaxDepth)
+				Fail("nested too deeply");
+
+			SkipSpace();
+			if (*Pos == '{')
+			{
+				Pos++;
+				FJsonValue object = FJsonValue::MakeObject();
+				SkipSpace();
+				if (*Pos == '}')
+				{
+					Pos++;
+					return object;
+				}
+				while (true)
+				{
+					SkipSpace();
+					if (*Pos != '"')
+						Fail("expected a member name");
+					std::string key = ParseString();
+					SkipSpace();
+					if (*Pos != ':')
+						Fail("expected ':'");
+					Pos++;
+					object.Set(key.c_str(), ParseValue(depth + 1));
+					SkipSpace();
+					if (*Pos == ',')
+					{
+						Pos++;
+					}
+					else if (*Pos == '}')
+					{
+						Pos++;
+						return object;
+					}
+					else
+					{
+						Fail("expected ',' or '}'");
+					}
+				}
+			}
+			else if (*Pos == '[')
+			{
+				Pos++;
+				FJsonValue array = FJsonValue::MakeArray();
+				SkipSpace();
+				if (*Pos == ']')
+				{
+					Pos++;
+					return array;
+				}
+				while (true)
+				{
+					array.Add(ParseValue(depth + 1));
+					SkipSpace();
+					if (*Pos == ',')
+					{
+						Pos++;
+					}
+					else if (*Pos == ']')
+					{
+						Pos++;
+						return array;
+					}
+					else
+					{
+						Fail("expected ',' or ']'");
+					}
+				}
+			}
+			else if (*Pos == '"')
+			{
+				return FJsonValue(ParseString());
+			}
+			else if (Match("true"))
+			{
+				return FJsonValue(true);
+			}
+			else if (Match("false"))
+			{
+				return FJsonValue(false);
+			}
+			else if (Match("null"))
+			{
+				return FJsonValue();
+			}
+			else if (*Pos == '-' || (*Pos >= '0' && *Pos <= '9'))
+			{
+				char *end;
+				double value = strtod(Pos, &end);
+				if (end == Pos)
+					Fail("bad number");
+				Pos = end;
+				return FJsonValue(value);
+			}
+			Fail("expected a value");
+		}
+
+		std::string ParseString()
+		{
+			std::string result;
+			Pos++;
+			while (*Pos != '"')
+			{
+				if (*Pos == 0)
+					Fail("unterminated string");
+
+				if (*Pos != '\\')
+				{
+					result += *Pos++;
+					continue;
+				}
+
+				Pos++;
+				switch (*Pos++)
+				{
+				case '"': result += '"'; break;
+				case '\\': result += '\\'; break;
+				case '/': result += '/'; break;
+				case 'b': result += '\b'; break;
+				case 'f': result += '\f'; break;
+				case 'n': result += '\n'; break;
+				case 'r': result += '\r'; break;
+				case 't': result += '\t'; break;
+				case 'u':
+				{
+					unsigned int c = ParseHex4();
+					if (c >= 0xd800 && c < 0xdc00 && Pos[0] == '\\' && Pos[1] == 'u')
+					{
+						Pos += 2;
+						unsigned int low = ParseHex4();
+						if (low < 0xdc00 || low >= 0xe000)
+							Fail("bad surrogate pair");
+						c = 0x10000 + ((c - 0xd800) << 10) + (low - 0xdc00);
+					}
+					AppendUTF8(result, c);
+					break;
+				}
+				default:
+					Pos--;
+					Fail("bad escape");
+				}
+			}
+			Pos++;
+			return result;
+		}
+
+		unsigned int ParseHex4()
+		{
+			unsigned int c = 0;
+			for (int i = 0; i < 4; i++)
+			{
+				char ch = *Pos;
+				if (ch >= '0' && ch <= '9') c = c * 16 + (ch - '0');
+				else if (ch >= 'a' && ch <= 'f') c = c * 16 + (ch - 'a' + 10);
+				else if (ch >= 'A' && ch <= 'F') c = c * 16 + (ch - 'A' + 10);
+				else Fail("bad \\u escape");
+				Pos++;
+			}
+			return c;
+		}
+
+		static void AppendUTF8(std::string &out, unsigned int c)
+		{
+			if (c < 0x80)
+			{
+				out += (char)c;
+			}
+			else if (c < 0x800)
+			{
+				out += (char)(0xc0 | (c >> 6));
+				out += (char)(0x80 | (c & 0x3f));
+			}
+			else if (c < 0x10000)
+			{
+				out += (char)(0xe0 | (c >> 12));
+				out += (char)(0x80 | ((c >> 6) & 0x3f));
+				out += (char)(0x80 | (c & 0x3f));
+			}
+			else
+			{
+				out += (char)(0xf0 | (c >> 18));
+				out += (char)(0x80 | ((c >> 12) & 0x3f));
+				out += (char)(0x80 | ((c >> 6) & 0x3f));
+				out += (char)(0x80 | (c & 0x3f));
+			}
+		}
+
+		const char *Text;
+		const char *Pos;
+	};
+
+	void WriteString(std::string &out, const std::string &str)
+	{
+		out += '"';
+		for (char ch : str)
+		{
+			switch (ch)
+			{
+			case '"': out += "\\\""; break;
+			case '\\': out += "\\\\"; break;
+			case '\n': out += "\\n"; break;
+			case '\r': out += "\\r"; break;
+			case '\t': out += "\\t"; break;
+			default:
+				if ((unsigned char)ch < 0x20)
+				{
+					char buffer[8];
+					snprintf(buffer, sizeof(buffer), "\\u%04x", (unsigned char)ch);
+					out += buffer;
+				}
+				else
+				{
+					out += ch;
+				}
+				break;
+			}
+		}
+		out += '"';
+	}
+}
+
+FJsonValue FJsonValue::Parse(const std::string &text)
+{
+	return JsonParser(text).ParseDocument();
+}
+
+std::string FJsonValue::ToString() const
+{
+	std::string out;
+	Write(out);
+	return out;
+}
+
+void FJsonValue::Write(std::string &out) const
+{
+	switch (Type)
+	{
+	case Null:
+		out += "null";
+		break;
+
+	case Bool:
+		out += BoolValue ? "true" : "false";
+		break;
+
+	case Number:
+	{
+		// JSON has no infinities or NaNs
+		char buffer[32];
+		if (!std::isfinite(NumberValue))
+			snprintf(buffer, sizeof(buffer), "null");
+		else if (NumberValue == std::floor(NumberValue) && std::fabs(NumberValue) < 1e15)
+			snprintf(buffer, sizeof(buffer), "%.0f", NumberValue);
+		else
+			snprintf(buffer, sizeof(buffer), "%.9g", NumberValue);
+		out += buffer;
+		break;
+	}
+
+	case String:
+		WriteString(out, StringValue);
+		break;
+
+	case Array:
+		out += '[';
+		for (size_t i = 0; i < Elements.size(); i++)
+		{
+			if (i > 0)
+				out += ',';
+			Elements[i].Write(out);
+		}
+		out += ']';
+		break;
+
+	case Object:
+		out += '{';
+		for (size_t i = 0; i < Members.size(); i++)
+		{
+			if (i > 0)
+				out += ',';
+			WriteString(out, Members[i].first);
+			out += ':';
+			Members[i].second.Write(out);
+		}
+		out += '}';
+		break;
+	}
+}
+
+bool FJsonValue::GetBool() const
+{
+	if (Type != Bool)
+		throw std::runtime_error("JSON value is not true or false");
+	return BoolValue;
+}
+
+double FJsonValue::GetNumber() const
+{
+	if (Type != Number)
+		throw std::runtime_error("JSON value is not a number");
+	return NumberValue;
+}
+
+const std::string &FJsonValue::GetString() const
+{
+	if (Type != String)
+		throw std::runtime_error("JSON value is not a string");
+	return StringValue;
+}
+
+const std::vector<FJsonValue> &FJsonValue::GetArray() const
+{
+	if (Type != Array)
+		throw std::runtime_error("JSON value is not an array");
+	return Elements;
+}
+
+const FJsonValue *FJsonValue::Find(const char *key) const
+{
+	if (Type != Object)
+		return nullptr;
+	for (const auto &member : Members)
+	{
+		if (member.first == key)
+			return &member.second;
+	}
+	return nullptr;
+}
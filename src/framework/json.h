@@ -0,0 +1,54 @@
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+// A JSON value, for the requests and replies of --serve. Objects keep their
+// members in the order they were added, so replies come out as written.
+class FJsonValue
+{
+public:
+	enum EType { Null, Bool, Number, String, Array, Object };
+
+	FJsonValue() = default;
+	FJsonValue(bool value) : Type(Bool), BoolValue(value) { }
+	FJsonValue(int value) : Type(Number), NumberValue(value) { }
+	FJsonValue(double value) : Type(Number), NumberValue(value) { }
+	FJsonValue(const char *value) : Type(String), StringValue(value) { }
+	FJsonValue(const std::string &value) : Type(String), StringValue(value) { }
+
+	static FJsonValue MakeArray() { FJsonValue v; v.Type = Array; return v; }
+	static FJsonValue MakeObject() { FJsonValue v; v.Type = Object; return v; }
+
+	// Throws std::runtime_error if the text is not a single JSON value
+	static FJsonValue Parse(const std::string &text);
+
+	// The value on one line
+	std::string ToString() const;
+
+	EType GetType() const { return Type; }
+	bool IsNull() const { return Type == Null; }
+
+	// These throw std::runtime_error if the value has another type
+	bool GetBool() const;
+	double GetNumber() const;
+	const std::string &GetString() const;
+	const std::vector<FJsonValue> &GetArray() const;
+
+	// Returns null if this is not an object or has no such member
+	const FJsonValue *Find(const char *key) const;
+
+	FJsonValue &Add(const FJsonValue &value) { Elements.push_back(value); return *this; }
+	FJsonValue &Set(const char *key, const FJsonValue &value) { Members.push_back({ key, value }); return *this; }
+
+private:
+	void Write(std::string &out) const;
+
+	EType Type = Null;
+	bool BoolValue = false;
+	double NumberValue = 0.0;
+	std::string StringValue;
+	std::vector<FJsonValue> Elements;
+	std::vector<std::pair<std::string, FJsonValue>> Members;
+};
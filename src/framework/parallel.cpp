@@ -0,0 +1,71 @@
+#include "framework/parallel.h"
+#include "framework/timeline.h"
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+extern int NumThreads;
+
+void ParallelFor(int count, const std::function<void(int)> &callback)
+{
+	if (count <= 0)
+		return;
+
+	int numThreads = NumThreads;
+	if (numThreads <= 0)
+		numThreads = std::thread::hardware_concurrency();
+	if (numThreads <= 0)
+		numThreads = 4;
+
+	numThreads = std::min(numThreads, count);
+
+	if (numThreads == 1)
+	{
+		for (int i = 0; i < count; i++)
+			callback(i);
+		return;
+	}
+
+	std::atomic<int> next(0);
+	std::mutex errorMutex;
+	std::exception_ptr error;
+	auto worker = [&]() {
+		TIMELINE_SCOPE("ParallelFor worker");
+		try
+		{
+			for (int i = next++; i < count; i = next++)
+				callback(i);
+		}
+		catch (...)
+		{
+			std::unique_lock<std::mutex> lock(errorMutex);
+			if (!error)
+				error = std::current_exception();
+			next = count;
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (int threadIndex = 1; threadIndex < numThreads; threadIndex++)
+		threads.push_back(std::thread(worker));
+
+	worker();
+
+	for (std::thread &thread : threads)
+		thread.join();
+
+	if (error)
+		std::rethrow_exception(error);
+}
+
+void ParallelForChunks(int count, int chunkSize, const std::function<void(int chunk, int start, int end)> &callback)
+{
+	ParallelFor(ChunkCount(count, chunkSize), [&](int chunk)
+	{
+		int start = chunk * chunkSize;
+		callback(chunk, start, std::min(start + chunkSize, count));
+	});
+}
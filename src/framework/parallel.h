@@ -0,0 +1,18 @@
+#pragma once
+
+#include <functional>
+
+// Calls callback(i) for every i in [0, count) on NumThreads worker threads.
+// Indices are handed out one at a time, so uneven work items balance out.
+// Returns when every call has finished. If a call throws, no further indices
+// are handed out and the first exception is rethrown on the calling thread.
+void ParallelFor(int count, const std::function<void(int)> &callback);
+
+// Number of chunks of chunkSize items it takes to hold count items.
+inline int ChunkCount(int count, int chunkSize) { return (count + chunkSize - 1) / chunkSize; }
+
+// Splits [0, count) into chunks of chunkSize indices and calls
+// callback(chunk, start, end) for each of them through ParallelFor, with
+// [start, end) being the indices of the chunk. For work items too small to be
+// handed out one at a time, or that need state of their own for each chunk.
+void ParallelForChunks(int count, int chunkSize, const std::function<void(int chunk, int start, int end)> &callback);
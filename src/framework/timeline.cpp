@@ -0,0 +1,154 @@
+#include "framework/timeline.h"
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <stdio.h>
+#include <vector>
+
+bool TimelineEnabled = false;
+
+namespace
+{
+	const size_t TimelineBufferSize = 16384;	// Events kept per thread
+
+	struct FTimelineEvent
+	{
+		const char *Name;
+		const char *ArgName;
+		int64_t Arg;
+		int64_t Start;
+		int64_t Duration;
+	};
+
+	struct FTimelineBuffer
+	{
+		int Lane;
+		uint64_t Count = 0;
+		std::unique_ptr<FTimelineEvent[]> Events;
+	};
+
+	std::chrono::steady_clock::time_point StartTime;
+
+	// Buffers outlive their threads. When a thread exits its buffer is handed
+	// to the next new thread, so short-lived workers share a few lanes
+	// instead of each getting one of its own.
+	std::mutex BufferMutex;
+	std::vector<std::unique_ptr<FTimelineBuffer>> Buffers;
+	std::vector<FTimelineBuffer *> FreeBuffers;
+
+	struct FThreadBuffer
+	{
+		FTimelineBuffer *Buffer = nullptr;
+
+		~FThreadBuffer()
+		{
+			if (Buffer)
+			{
+				std::unique_lock<std::mutex> lock(BufferMutex);
+				FreeBuffers.push_back(Buffer);
+			}
+		}
+	};
+
+	thread_local FThreadBuffer ThreadBuffer;
+
+	FTimelineBuffer *GetThreadBuffer()
+	{
+		if (!ThreadBuffer.Buffer)
+		{
+			std::unique_lock<std::mutex> lock(BufferMutex);
+			if (!FreeBuffers.empty())
+			{
+				ThreadBuffer.Buffer = FreeBuffers.back();
+				FreeBuffers.pop_back();
+			}
+			else
+			{
+				auto buffer = std::make_unique<FTimelineBuffer>();
+				buffer->Lane = (int)Buffers.size();
+				buffer->Events.reset(new FTimelineEvent[TimelineBufferSize]);
+				ThreadBuffer.Buffer = buffer.get();
+				Buffers.push_back(std::move(buffer));
+			}
+		}
+		return ThreadBuffer.Buffer;
+	}
+}
+
+void TimelineStart()
+{
+	StartTime = std::chrono::steady_clock::now();
+	TimelineEnabled = true;
+
+	// The thread that starts the timeline gets the first lane
+	GetThreadBuffer();
+}
+
+int64_t TimelineNow()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - StartTime).count();
+}
+
+void TimelineRecord(const char *name, int64_t start, const char *argName, int64_t arg)
+{
+	int64_t end = TimelineNow();
+	FTimelineBuffer *buffer = GetThreadBuffer();
+	FTimelineEvent &event = buffer->Events[buffer->Count % TimelineBufferSize];
+	event.Name = name;
+	event.ArgName = argName;
+	event.Arg = arg;
+	event.Start = start;
+	event.Duration = end - start;
+	buffer->Count++;
+}
+
+void TimelineWrite(const char *filename)
+{
+	// Call this when no other thread is recording
+	FILE *file = fopen(filename, "w");
+	if (!file)
+	{
+		printf("Could not open %s for writing\n", filename);
+		throw std::runtime_error("Could not write timeline");
+	}
+
+	uint64_t numEvents = 0, numDropped = 0;
+
+	fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"zdray\"}}");
+
+	std::unique_lock<std::mutex> lock(BufferMutex);
+	for (const auto &buffer : Buffers)
+	{
+		fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s %d\"}}",
+			buffer->Lane, buffer->Lane == 0 ? "Main" : "Worker", buffer->Lane);
+
+		uint64_t first = buffer->Count > TimelineBufferSize ? buffer->Count - TimelineBufferSize : 0;
+		for (uint64_t i = first; i < buffer->Count; i++)
+		{
+			const FTimelineEvent &event = buffer->Events[i % TimelineBufferSize];
+			fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+				event.Name, buffer->Lane, event.Start / 1000.0, event.Duration / 1000.0);
+			if (event.ArgName)
+				fprintf(file, ",\"args\":{\"%s\":%lld}", event.ArgName, (long long)event.Arg);
+			fprintf(file, "}");
+		}
+
+		numEvents += buffer->Count - first;
+		numDropped += first;
+	}
+
+	fprintf(file, "\n]}\n");
+
+	if (fclose(file) != 0)
+	{
+		printf("Could not write %s\n", filename);
+		throw std::runtime_error("Could not write timeline");
+	}
+
+	printf("Timeline with %llu events written to %s", (unsigned long long)numEvents, filename);
+	if (numDropped > 0)
+		printf(" (%llu older events dropped)", (unsigned long long)numDropped);
+	printf("\n");
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdint.h>
+
+// A timeline of what every thread was doing, written as Chrome trace-event
+// JSON that chrome://tracing and Perfetto can open. Code marks a region with
+// TIMELINE_SCOPE("Name") and the region is recorded when the scope ends.
+// TIMELINE_SCOPE_ARG adds a number to the event and TIMELINE_SCOPE_IF only
+// records it when a condition holds.
+//
+// Each thread records into its own ring buffer, so recording takes no locks.
+// When a buffer is full the oldest events are overwritten. Until
+// TimelineStart() is called a scope costs one test of a global flag, and
+// building with NO_TIMELINE removes the scopes altogether.
+//
+// Names and argument names must be string literals (or otherwise live until
+// the timeline is written), since only the pointers are kept.
+
+extern bool TimelineEnabled;
+
+void TimelineStart();
+void TimelineWrite(const char *filename);
+
+int64_t TimelineNow();
+void TimelineRecord(const char *name, int64_t start, const char *argName, int64_t arg);
+
+class FTimelineScope
+{
+public:
+	FTimelineScope(const char *name, const char *argName = nullptr, int64_t arg = 0) : Name(name), ArgName(argName), Arg(arg)
+	{
+		if (TimelineEnabled && name)
+			Start = TimelineNow();
+	}
+
+	~FTimelineScope()
+	{
+		if (Start >= 0)
+			TimelineRecord(Name, Start, ArgName, Arg);
+	}
+
+private:
+	FTimelineScope(const FTimelineScope &) = delete;
+	FTimelineScope &operator=(const FTimelineScope &) = delete;
+
+	const char *Name;
+	const char *ArgName;
+	int64_t Arg;
+	int64_t Start = -1;
+};
+
+#define TIMELINE_CONCAT2(a, b) a##b
+#define TIMELINE_CONCAT(a, b) TIMELINE_CONCAT2(a, b)
+
+#ifdef NO_TIMELINE
+#define TIMELINE_SCOPE(name)
+#define TIMELINE_SCOPE_ARG(name, argName, arg)
+#define TIMELINE_SCOPE_IF(cond, name, argName, arg)
+#else
+#define TIMELINE_SCOPE(name) FTimelineScope TIMELINE_CONCAT(timelineScope, __LINE__)(name)
+#define TIMELINE_SCOPE_ARG(name, argName, arg) FTimelineScope TIMELINE_CONCAT(timelineScope, __LINE__)(name, argName, (int64_t)(arg))
+#define TIMELINE_SCOPE_IF(cond, name, argName, arg) FTimelineScope TIMELINE_CONCAT(timelineScope, __LINE__)((cond) ? (name) : nullptr, argName, (int64_t)(arg))
+#endif
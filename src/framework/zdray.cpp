@@ -0,0 +1,90 @@
+/*
+	Global settings shared by every part of ZDRay.
+	Copyright (C) 2002-2006 Randy Heit
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+// These live outside main.cpp so that zdray-bench can link the same code
+// with its own main().
+
+// HEADER FILES ------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdarg.h>
+
+#include "framework/zdray.h"
+
+// PUBLIC DATA DEFINITIONS -------------------------------------------------
+
+const char		*Map = nullptr;
+const char		*InName;
+const char		*OutName = "tmp.wad";
+bool			 BuildNodes = true;
+bool			 BuildGLNodes = true;// false;
+bool			 ConformNodes = false;
+bool			 NoPrune = false;
+EBlockmapMode	 BlockmapMode = EBM_Rebuild;
+ERejectMode		 RejectMode = ERM_DontTouch;
+int				 RejectTimeLimit = 60;
+float			 WeldDistance = 0;
+bool			 WatertightTrace = false;
+bool			 WriteComments = false;
+int				 MaxSegs = 64;
+bool			 FastNodes = false;
+int				 SplitCost = 8;
+int				 AAPreference = 16;
+bool			 CheckPolyobjs = true;
+bool			 ShowWarnings = false;
+bool			 NoTiming = false;
+bool			 CompressNodes = true;// false;
+bool			 CompressGLNodes = true;// false;
+bool			 ForceCompression = true;// false;
+bool			 GLOnly = true;// false;
+bool			 V5GLNodes = false;
+bool			 HaveSSE1, HaveSSE2;
+int				 SSELevel;
+int				 NumThreads = 0;
+int				 LMDims = 1024;
+bool			 CPURaytrace = false;
+bool			 VKDebug = false;
+bool			 DumpMesh = false;
+const char		*DumpSceneName = nullptr;
+const char		*ReplaySceneName = nullptr;
+const char		*TimelineName = nullptr;
+bool			 ServeMode = false;
+
+int coverageSampleCount = 256;
+int bounceSampleCount = 2048;
+int ambientSampleCount = 2048;
+
+// CODE --------------------------------------------------------------------
+
+//==========================================================================
+
+void Warn(const char *format, ...)
+{
+	va_list marker;
+
+	if (!ShowWarnings)
+	{
+		return;
+	}
+
+	va_start(marker, format);
+	vprintf(format, marker);
+	va_end(marker);
+}
@@ -29,13 +29,29 @@ extern bool				 BuildNodes, BuildGLNodes, ConformNodes, GLOnly, WriteComments;
 extern bool				 NoPrune;
 extern EBlockmapMode	 BlockmapMode;
 extern ERejectMode		 RejectMode;
+extern int				 RejectTimeLimit;
+extern float			 WeldDistance;
+extern bool				 WatertightTrace;
 extern int				 MaxSegs;
+extern bool				 FastNodes;
 extern int				 SplitCost;
 extern int				 AAPreference;
 extern bool				 CheckPolyobjs;
 extern bool				 CompressNodes, CompressGLNodes, ForceCompression, V5GLNodes;
 extern bool				 HaveSSE1, HaveSSE2;
 extern int				 SSELevel;
+extern bool				 NoTiming;
+extern bool				 ShowWarnings;
+extern int				 NumThreads;
+extern int				 LMDims;
+extern bool				 CPURaytrace;
+extern bool				 VKDebug;
+extern bool				 DumpMesh;
+extern const char		*DumpSceneName;
+extern const char		*ReplaySceneName;
+extern const char		*TimelineName;
+extern bool				 ServeMode;
+extern int				 coverageSampleCount, bounceSampleCount, ambientSampleCount;
 
 
 #define FIXED_MAX		INT_MAX
@@ -17,10 +17,35 @@ enum
 	BOXTOP, BOXBOTTOM, BOXLEFT, BOXRIGHT
 };
 
+#define DEFINE_UDMF_KEY(name, key) name,
+
+enum EUDMFKey
+{
+	UDMF_Unknown,
+#include "udmfkeys.h"
+};
+#undef DEFINE_UDMF_KEY
+
+// A UDMF property. key and value are written back unchanged, keyId is for
+// looking it up without comparing the strings.
 struct UDMFKey
 {
 	const char *key;
 	const char *value;
+	EUDMFKey keyId;
+
+	// The value read like atoi() and atof() do, clamped to [min, max]. A NaN
+	// becomes min.
+	int GetInt(int min, int max) const;
+	double GetFloat(double min, double max) const;
+};
+
+// The properties of one map element: FLevel::UDMFProps[first] to
+// FLevel::UDMFProps[first + count - 1].
+struct UDMFKeyRange
+{
+	unsigned int first = 0;
+	unsigned int count = 0;
 };
 
 struct MapVertex
@@ -69,7 +94,7 @@ struct IntSideDef
 	inline int GetSampleDistanceMiddle() const { return sampleDistanceMiddle ? sampleDistanceMiddle : sampleDistance; }
 	inline int GetSampleDistanceBottom() const { return sampleDistanceBottom ? sampleDistanceBottom : sampleDistance; }
 
-	TArray<UDMFKey> props;
+	UDMFKeyRange props;
 };
 
 struct MapLineDef
@@ -103,7 +128,7 @@ struct IntLineDef
 	int args[5];
 	uint32_t sidenum[2];
 
-	TArray<UDMFKey> props;
+	UDMFKeyRange props;
 	TArray<int> ids;
 
 	IntSector *frontsector, *backsector;
@@ -155,7 +180,7 @@ struct IntSector
 
 	inline const char* GetTextureName(int plane) const { return plane != PLANE_FLOOR ? data.ceilingpic : data.floorpic; }
 
-	TArray<UDMFKey> props;
+	UDMFKeyRange props;
 
 	TArray<IntLineDef*> lines;
 };
@@ -275,12 +300,12 @@ struct IntThing
 	float height; // UDMF
 	float alpha;
 
-	TArray<UDMFKey> props;
+	UDMFKeyRange props;
 };
 
 struct IntVertex
 {
-	TArray<UDMFKey> props;
+	UDMFKeyRange props;
 	double zfloor = 100000, zceiling = 100000;
 
 	inline bool HasZFloor() const { return zfloor != 100000; }
@@ -422,7 +447,8 @@ struct FLevel
 
 	fixed_t MinX, MinY, MaxX, MaxY;
 
-	TArray<UDMFKey> props;
+	TArray<UDMFKey> props;		// of the map itself
+	TArray<UDMFKey> UDMFProps;	// of all map elements, see UDMFKeyRange
 
 	TArray<ThingLight> ThingLights;
 	TArray<SurfaceLightDef> SurfaceLights;
@@ -460,6 +486,21 @@ struct FLevel
 
 	int FindFirstSectorFromTag(int tag);
 
+	// Returns the last property with the key, like the parser, which lets a
+	// later one override an earlier one. An element has only a handful of
+	// properties, so this is a short scan of its own range.
+	const UDMFKey *FindProp(const UDMFKeyRange &props, EUDMFKey key) const
+	{
+		for (unsigned int i = props.count; i-- > 0; )
+		{
+			if (UDMFProps[props.first + i].keyId == key)
+			{
+				return &UDMFProps[props.first + i];
+			}
+		}
+		return nullptr;
+	}
+
 	inline IntSector* PointInSector(const dvec2& pos) { return GetSectorFromSubSector(PointInSubSector(int(pos.x), int(pos.y))); }
 private:
 	void CheckSkySectors();
@@ -21,8 +21,13 @@
 #include "level/level.h"
 #include "lightmap/cpuraytracer.h"
 #include "lightmap/gpuraytracer.h"
+#include "lightmap/bakescene.h"
+#include "lightmap/lightmapcache.h"
+#include "lightmap/bakeshard.h"
+#include "lightmap/bakecheckpoint.h"
+#include "framework/timeline.h"
 #include "math/vec.h"
-//#include "rejectbuilder.h"
+#include "rejectbuilder/rejectbuilder.h"
 #include <memory>
 
 #ifdef _MSC_VER
@@ -73,6 +78,8 @@ FProcessor::FProcessor (FWadReader &inwad, int lump)
 :
   Wad (inwad), Lump (lump)
 {
+	TIMELINE_SCOPE("Load map");
+
 	printf ("----%s----\n", Wad.LumpName (Lump));
 
 	isUDMF = Wad.isUDMF(lump);
@@ -537,6 +544,18 @@ void FLevel::RemoveExtraSectors ()
 	delete[] remap;
 }
 
+int UDMFKey::GetInt(int min, int max) const
+{
+	long long val = strtoll(value, nullptr, 10);
+	return val < min ? min : val > max ? max : (int)val;
+}
+
+double UDMFKey::GetFloat(double min, double max) const
+{
+	double val = atof(value);
+	return val >= min ? (val <= max ? val : max) : min;
+}
+
 int FLevel::FindFirstSectorFromTag(int tag)
 {
 	for (unsigned i = 0; i < Sectors.Size(); ++i)
@@ -667,6 +686,8 @@ void FLevel::PostLoadInitialization()
 
 void FProcessor::BuildNodes()
 {
+	TIMELINE_SCOPE("Build nodes");
+
 	NodesBuilt = true;
 
 	FNodeBuilder *builder = nullptr;
@@ -695,6 +716,13 @@ void FProcessor::BuildNodes()
 		{
 			SSELevel = 0;
 		}
+
+		if (Cache && LoadCachedNodes())
+		{
+			printf("   Nodes taken from the cache\n");
+			return;
+		}
+
 		builder = new FNodeBuilder(Level, PolyStarts, PolyAnchors, Wad.LumpName(Lump), BuildGLNodes);
 		if (builder == nullptr)
 		{
@@ -741,6 +769,11 @@ void FProcessor::BuildNodes()
 		}
 		delete builder;
 		builder = nullptr;
+
+		if (Cache)
+		{
+			StoreCachedNodes();
+		}
 	}
 	catch (...)
 	{
@@ -754,8 +787,10 @@ void FProcessor::BuildNodes()
 
 //#define USE_GPU_RAYTRACER
 
-void FProcessor::BuildLightmaps()
+void FProcessor::PrepareLightmaps()
 {
+	TIMELINE_SCOPE("Prepare lightmaps");
+
 	Level.PostLoadInitialization();
 
 	SpawnSlopeMakers(&Level.Things[0], &Level.Things[Level.Things.Size()], nullptr);
@@ -764,11 +799,30 @@ void FProcessor::BuildLightmaps()
 	SetSlopes();
 
 	Level.SetupLights();
+}
+
+void FProcessor::BuildLightmaps()
+{
+	TIMELINE_SCOPE("Build lightmaps");
+
+	PrepareLightmaps();
 
-	LightmapMesh = std::make_unique<LevelMesh>(Level, Level.DefaultSamples, LMDims);
+	{
+		TIMELINE_SCOPE("Level mesh");
+		LightmapMesh = std::make_unique<LevelMesh>(Level, Level.DefaultSamples, LMDims);
+	}
+
+	CPUSceneLighting lighting;
+	lighting.Gather(LightmapMesh.get());
+
+	if (DumpSceneName)
+	{
+		SaveBakeScene(DumpSceneName, LightmapMesh.get(), lighting);
+		printf("Bake scene written to %s\n", DumpSceneName);
+	}
 
 	std::unique_ptr<GPURaytracer> gpuraytracer;
-	if (!CPURaytrace)
+	if (!CPURaytrace && !Checkpoint && !ShardWriter && !ShardMerger)
 	{
 		try
 		{
@@ -781,17 +835,68 @@ void FProcessor::BuildLightmaps()
 		}
 	}
 
-	if (gpuraytracer)
+	// Surfaces and probes found in the cache are not traced again. The GPU
+	// ray tracer can only trace everything, so it is skipped only when
+	// everything was found.
+	std::unique_ptr<LightmapCache> lightmapCache;
+	CPUTraceSelection selection;
+	int untraced = 1;
+	if (Cache)
+	{
+		TIMELINE_SCOPE("Lightmap cache");
+		lightmapCache = std::make_unique<LightmapCache>(Cache, LightmapMesh.get(), lighting, gpuraytracer != nullptr);
+		if (!ShardMerger)
+			untraced = lightmapCache->Load(selection);
+	}
+
+	if (ShardWriter)
+	{
+		if (!lightmapCache)
+			selection.Init(LightmapMesh.get(), true);
+		untraced = ShardWriter->Select(selection);
+	}
+
+	if (ShardMerger)
+	{
+		TIMELINE_SCOPE("Merge shards");
+		ShardMerger->Load(Wad.LumpName(Lump), LightmapMesh.get(), lighting);
+	}
+	else if (untraced == 0)
+	{
+		printf("Nothing to ray trace\n");
+	}
+	else if (gpuraytracer)
 	{
 		gpuraytracer->Raytrace(LightmapMesh.get());
 	}
 	else
 	{
-		CPURaytracer raytracer;
-		raytracer.Raytrace(LightmapMesh.get());
+		CPURaytracer localRaytracer;
+		CPURaytracer *raytracer = Raytracer ? Raytracer : &localRaytracer;
+		if (Checkpoint)
+			Checkpoint->SetMap(Wad.LumpName(Lump));
+		raytracer->SetCheckpoint(Checkpoint);
+		raytracer->Raytrace(LightmapMesh.get(), lighting, (lightmapCache || ShardWriter) ? &selection : nullptr);
+	}
+
+	// The samples of the other shards are missing, so a shard neither adds
+	// to the cache nor makes textures
+	if (ShardWriter)
+	{
+		ShardWriter->Add(Wad.LumpName(Lump), LightmapMesh.get(), lighting);
+		return;
+	}
+
+	if (lightmapCache)
+	{
+		TIMELINE_SCOPE("Lightmap cache");
+		lightmapCache->Store();
 	}
 
-	LightmapMesh->CreateTextures();
+	{
+		TIMELINE_SCOPE("Create textures");
+		LightmapMesh->CreateTextures();
+	}
 }
 
 void FProcessor::DumpMesh()
@@ -808,6 +913,8 @@ void FProcessor::DumpMesh()
 
 void FProcessor::Write (FWadWriter &out)
 {
+	TIMELINE_SCOPE("Write map");
+
 	if (Level.NumLines() == 0 || Level.NumSides() == 0 || Level.NumSectors() == 0 || Level.NumVertices == 0)
 	{
 		if (!isUDMF)
@@ -861,10 +968,20 @@ void FProcessor::Write (FWadWriter &out)
 
 	if (!isUDMF)
 	{
-		FBlockmapBuilder bbuilder (Level);
-		uint16_t *blocks = bbuilder.GetBlockmap (Level.BlockmapSize);
-		Level.Blockmap = new uint16_t[Level.BlockmapSize];
-		memcpy (Level.Blockmap, blocks, Level.BlockmapSize*sizeof(uint16_t));
+		TIMELINE_SCOPE("Blockmap and reject");
+
+		if (!Cache || !LoadCachedBlockmap ())
+		{
+			FBlockmapBuilder bbuilder (Level);
+			uint16_t *blocks = bbuilder.GetBlockmap (Level.BlockmapSize);
+			Level.Blockmap = new uint16_t[Level.BlockmapSize];
+			memcpy (Level.Blockmap, blocks, Level.BlockmapSize*sizeof(uint16_t));
+
+			if (Cache)
+			{
+				StoreCachedBlockmap ();
+			}
+		}
 
 		Level.RejectSize = (Level.NumSectors()*Level.NumSectors() + 7) / 8;
 		Level.Reject = nullptr;
@@ -872,10 +989,11 @@ void FProcessor::Write (FWadWriter &out)
 		switch (RejectMode)
 		{
 		case ERM_Rebuild:
-			//FRejectBuilder reject (Level);
-			//Level.Reject = reject.GetReject ();
-			printf ("   Rebuilding the reject is unsupported.\n");
-			// Intentional fall-through
+			{
+				FRejectBuilder reject (Level);
+				Level.Reject = reject.GetReject ();
+			}
+			break;
 
 		case ERM_DontTouch:
 			{
@@ -1041,7 +1159,7 @@ uint8_t *FProcessor::FixReject (const uint8_t *oldreject)
 		{
 			ox = Level.OrgSectorMap[x];
 			pnum = y*Level.NumSectors() + x;
-			opnum = oy*Level.NumSectors() + ox;
+			opnum = oy*Level.NumOrgSectors + ox;
 
 			if (oldreject[opnum >> 3] & (1 << (opnum & 7)))
 			{
@@ -1560,6 +1678,7 @@ void FProcessor::WriteGLNodes (FWadWriter &out, bool v5)
 
 void FProcessor::WriteBSPZ (FWadWriter &out, const char *label)
 {
+	TIMELINE_SCOPE("Compress nodes");
 	ZLibOut zout (out);
 
 	if (!CompressNodes)
@@ -1577,6 +1696,7 @@ void FProcessor::WriteBSPZ (FWadWriter &out, const char *label)
 
 void FProcessor::WriteGLBSPZ (FWadWriter &out, const char *label)
 {
+	TIMELINE_SCOPE("Compress GL nodes");
 	ZLibOut zout (out);
 	bool fracsplitters = CheckForFracSplitters(Level.GLNodes, Level.NumGLNodes);
 	int nodever;
@@ -8,6 +8,8 @@
 #include "nodebuilder/nodebuild.h"
 #include "blockmapbuilder/blockmapbuilder.h"
 #include "lightmap/levelmesh.h"
+#include "parse/udmfscanner.h"
+#include "framework/hash.h"
 #include <miniz/miniz.h>
 
 #define DEFINE_SPECIAL(name, num, min, max, map) name = num,
@@ -17,6 +19,17 @@ typedef enum {
 } linespecial_t;
 #undef DEFINE_SPECIAL
 
+// A 'key = value;' pair from a TEXTMAP. Key and Value point into the lump
+// and are null-terminated.
+struct FUDMFKeyValue
+{
+	const char *Key;
+	const char *Value;
+	EUDMFKey KeyId;
+	double Number;	// Value converted like strtod() does
+	bool IsNumber;	// The whole value was a number
+};
+
 typedef enum {
 	Init_Gravity = 0,
 	Init_Color = 1,
@@ -50,6 +63,27 @@ private:
 	FWadWriter &Out;
 };
 
+// Collects a TEXTMAP in memory, so that it can be written in one piece.
+class FUDMFWriter
+{
+public:
+	void Add(const char *str, int len);
+	void Add(const char *str) { Add(str, (int)strlen(str)); }
+	void AddInt(int value);
+
+	const char *Data() const { return Buffer.Size() > 0 ? &Buffer[0] : ""; }
+	int Size() const { return (int)Buffer.Size(); }
+
+private:
+	TArray<char> Buffer;
+};
+
+class FBakeCache;
+class CPURaytracer;
+class BakeCheckpoint;
+class BakeShardWriter;
+class BakeShardMerger;
+
 class FProcessor
 {
 public:
@@ -61,6 +95,33 @@ public:
 
 	void DumpMesh();
 
+	// Everything BuildLightmaps() does before it creates the level mesh:
+	// slopes, lights and the other data the mesh is built from. zdray-bench
+	// uses this to time the lightmap stages one at a time.
+	void PrepareLightmaps();
+	FLevel &GetLevel() { return Level; }
+
+	// Reuse nodes, blockmaps and lightmaps from the cache, and add new ones
+	void SetCache(FBakeCache *cache) { Cache = cache; }
+
+	// Trace on the CPU with this ray tracer, which keeps the BVH of the mesh
+	// after BuildLightmaps() returns. Null makes a new one for each bake.
+	void SetRaytracer(CPURaytracer *raytracer) { Raytracer = raytracer; }
+
+	// Save the progress of the ray tracing so it can be resumed. This always
+	// traces on the CPU.
+	void SetCheckpoint(BakeCheckpoint *checkpoint) { Checkpoint = checkpoint; }
+
+	// Trace only one shard of the lightmaps and add its samples to the
+	// writer instead of making textures (see lightmap/bakeshard.h)
+	void SetShardWriter(BakeShardWriter *writer) { ShardWriter = writer; }
+
+	// Take the samples from the shards instead of tracing
+	void SetShardMerger(BakeShardMerger *merger) { ShardMerger = merger; }
+
+	// The mesh made by BuildLightmaps(), or null
+	LevelMesh *GetLightmapMesh() { return LightmapMesh.get(); }
+
 private:
 	void LoadUDMF();
 	void LoadThings();
@@ -126,23 +187,33 @@ private:
 	void WriteNodes5(FWadWriter &out, const char *name, const MapNodeEx *zaNodes, int count) const;
 	void WriteSSectors5(FWadWriter &out, const char *name, const MapSubsectorEx *zaSubs, int count) const;
 
-	const char *ParseKey(const char *&value);
-	bool CheckKey(const char *&key, const char *&value);
-	void ParseThing(IntThing *th);
-	void ParseLinedef(IntLineDef *ld);
-	void ParseSidedef(IntSideDef *sd);
-	void ParseSector(IntSector *sec);
-	void ParseVertex(WideVertex *vt, IntVertex *vtp);
-	void ParseMapProperties();
+	FHash128 GetNodesKey() const;
+	bool LoadCachedNodes();
+	void StoreCachedNodes();
+	FHash128 GetBlockmapKey() const;
+	bool LoadCachedBlockmap();
+	void StoreCachedBlockmap();
+
+	void ParseKey(FUDMFScanner &sc, FUDMFKeyValue &kv);
+	bool CheckKey(FUDMFScanner &sc, FUDMFKeyValue &kv);
+	void ParseThing(FUDMFScanner &sc, IntThing *th, TArray<UDMFKey> &props);
+	void ParseLinedef(FUDMFScanner &sc, IntLineDef *ld, TArray<UDMFKey> &props);
+	void ParseSidedef(FUDMFScanner &sc, IntSideDef *sd, TArray<UDMFKey> &props);
+	void ParseSector(FUDMFScanner &sc, IntSector *sec, TArray<UDMFKey> &props);
+	void ParseVertex(FUDMFScanner &sc, WideVertex *vt, IntVertex *vtp, TArray<UDMFKey> &props);
+	void ParseMapProperties(FUDMFScanner &sc);
 	void ParseTextMap(int lump);
 
-	void WriteProps(FWadWriter &out, TArray<UDMFKey> &props);
-	void WriteIntProp(FWadWriter &out, const char *key, int value);
-	void WriteThingUDMF(FWadWriter &out, IntThing *th, int num);
-	void WriteLinedefUDMF(FWadWriter &out, IntLineDef *ld, int num);
-	void WriteSidedefUDMF(FWadWriter &out, IntSideDef *sd, int num);
-	void WriteSectorUDMF(FWadWriter &out, IntSector *sec, int num);
-	void WriteVertexUDMF(FWadWriter &out, IntVertex *vt, int num);
+	void WriteProps(FUDMFWriter &out, TArray<UDMFKey> &props);
+	void WriteProps(FUDMFWriter &out, const UDMFKeyRange &props);
+	void WriteIntProp(FUDMFWriter &out, const char *key, int value);
+	void WriteBlockStart(FUDMFWriter &out, const char *type, int num);
+	void WriteThingUDMF(FUDMFWriter &out, IntThing *th, int num);
+	void WriteLinedefUDMF(FUDMFWriter &out, IntLineDef *ld, int num);
+	void WriteSidedefUDMF(FUDMFWriter &out, IntSideDef *sd, int num);
+	void WriteSectorUDMF(FUDMFWriter &out, IntSector *sec, int num);
+	void WriteVertexUDMF(FUDMFWriter &out, IntVertex *vt, int num);
+	bool TextMapUnchanged();
 	void WriteTextMap(FWadWriter &out);
 	void WriteUDMF(FWadWriter &out);
 
@@ -158,5 +229,15 @@ private:
 	int Lump;
 
 	bool NodesBuilt = false;
+	FBakeCache *Cache = nullptr;
+	CPURaytracer *Raytracer = nullptr;
+	BakeCheckpoint *Checkpoint = nullptr;
+	BakeShardWriter *ShardWriter = nullptr;
+	BakeShardMerger *ShardMerger = nullptr;
+	FHash128 NodesKey;
 	std::unique_ptr<LevelMesh> LightmapMesh;
+
+	// The UDMF properties point into this.
+	std::unique_ptr<char[]> TextMap;
+	int TextMapLines = 0, TextMapSides = 0, TextMapSectors = 0;
 };
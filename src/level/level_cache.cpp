@@ -0,0 +1,271 @@
+// Reusing nodes and blockmaps from the bake cache (see framework/bakecache.h).
+// The nodes depend only on the map geometry and the node builder options, so
+// an entry is keyed by a hash of exactly those. Things, textures and lights
+// can change without building the nodes again.
+
+#include "math/mathlib.h"
+#include "level/level.h"
+#include "framework/bakecache.h"
+#include <stdexcept>
+
+namespace
+{
+	const uint32_t NodeCacheVersion = 1;
+	const uint32_t BlockmapCacheVersion = 1;
+
+	enum ENodeCacheArray
+	{
+		NCA_LineVertices,
+		NCA_Vertices,
+		NCA_GLVertices,
+		NCA_Nodes,
+		NCA_Segs,
+		NCA_Subsectors,
+		NCA_GLNodes,
+		NCA_GLSegs,
+		NCA_GLSubsectors,
+
+		NUM_NODECACHE_ARRAYS
+	};
+
+	// A nodes entry is this header followed by the arrays in the order above,
+	// each holding Counts[i] elements exactly as they are laid out in memory.
+	// Arrays that were never allocated have a count of -1.
+	struct NodeCacheHeader
+	{
+		char Magic[4];	// "ZBCN"
+		uint32_t Version;
+		int32_t NumOrgVerts;
+		int32_t Counts[NUM_NODECACHE_ARRAYS];
+	};
+
+	template<typename T>
+	void AppendArray(std::vector<uint8_t> &data, int32_t &count, const T *values, int numValues)
+	{
+		count = values ? numValues : -1;
+		if (values && numValues > 0)
+		{
+			const uint8_t *bytes = reinterpret_cast<const uint8_t *>(values);
+			data.insert(data.end(), bytes, bytes + size_t(numValues) * sizeof(T));
+		}
+	}
+
+	// Copies the arrays out of a mapped entry, refusing one that is too short
+	class NodeCacheReader
+	{
+	public:
+		NodeCacheReader(const uint8_t *data, size_t size) : Pos(data), End(data + size) { }
+
+		template<typename T>
+		bool Read(int32_t count, T *&values, int &numValues)
+		{
+			values = nullptr;
+			numValues = 0;
+			if (count < 0)
+				return true;
+			if (size_t(count) > size_t(End - Pos) / sizeof(T))
+				return false;
+			values = new T[count];
+			memcpy(values, Pos, size_t(count) * sizeof(T));
+			numValues = count;
+			Pos += size_t(count) * sizeof(T);
+			return true;
+		}
+
+	private:
+		const uint8_t *Pos;
+		const uint8_t *End;
+	};
+}
+
+// Hashes everything FNodeBuilder reads. This has to be done before the nodes
+// are built, since the builder renumbers the vertices of the lines.
+FHash128 FProcessor::GetNodesKey() const
+{
+	FHasher hasher;
+	hasher.AddValue(NodeCacheVersion);
+	hasher.AddValue(BuildGLNodes);
+	hasher.AddValue(ConformNodes);
+	hasher.AddValue(GLOnly);
+	hasher.AddValue(MaxSegs);
+	hasher.AddValue(SplitCost);
+	hasher.AddValue(AAPreference);
+	hasher.AddValue(FastNodes);
+	hasher.AddValue(CheckPolyobjs);
+	hasher.AddValue(SSELevel);
+
+	hasher.AddValue(Level.NumVertices);
+	hasher.AddValue(Level.NumOrgVerts);
+	for (int i = 0; i < Level.NumVertices; i++)
+	{
+		hasher.AddValue(Level.Vertices[i].x);
+		hasher.AddValue(Level.Vertices[i].y);
+		hasher.AddValue(Level.Vertices[i].index);
+	}
+
+	hasher.AddValue(Level.NumLines());
+	for (const IntLineDef &line : Level.Lines)
+	{
+		hasher.AddValue(line.v1);
+		hasher.AddValue(line.v2);
+		hasher.AddValue(line.flags);
+		hasher.AddValue(line.special);
+		hasher.AddValue(line.args);
+		hasher.AddValue(line.sidenum);
+	}
+
+	hasher.AddValue(Level.NumSides());
+	for (const IntSideDef &side : Level.Sides)
+	{
+		hasher.AddValue(side.sector);
+	}
+	hasher.AddValue(Level.NumSectors());
+
+	for (const TArray<FNodeBuilder::FPolyStart> *spots : { &PolyStarts, &PolyAnchors })
+	{
+		hasher.AddValue(spots->Size());
+		for (const FNodeBuilder::FPolyStart &spot : *spots)
+		{
+			hasher.AddValue(spot.polynum);
+			hasher.AddValue(spot.x);
+			hasher.AddValue(spot.y);
+		}
+	}
+	return hasher.Finish();
+}
+
+bool FProcessor::LoadCachedNodes()
+{
+	NodesKey = GetNodesKey();
+
+	auto file = Cache->Find(NodesKey, "nodes");
+	if (!file || file->Size() < sizeof(NodeCacheHeader))
+		return false;
+
+	NodeCacheHeader header;
+	memcpy(&header, file->Data(), sizeof(NodeCacheHeader));
+	if (memcmp(header.Magic, "ZBCN", 4) != 0 || header.Version != NodeCacheVersion || header.Counts[NCA_LineVertices] != Level.NumLines() * 2)
+		return false;
+
+	FLevel nodes;
+	uint32_t *lineVertices = nullptr;
+	int numLineVertices = 0;
+	NodeCacheReader reader(file->Data() + sizeof(NodeCacheHeader), file->Size() - sizeof(NodeCacheHeader));
+	bool ok =
+		reader.Read(header.Counts[NCA_LineVertices], lineVertices, numLineVertices) &&
+		reader.Read(header.Counts[NCA_Vertices], nodes.Vertices, nodes.NumVertices) &&
+		reader.Read(header.Counts[NCA_GLVertices], nodes.GLVertices, nodes.NumGLVertices) &&
+		reader.Read(header.Counts[NCA_Nodes], nodes.Nodes, nodes.NumNodes) &&
+		reader.Read(header.Counts[NCA_Segs], nodes.Segs, nodes.NumSegs) &&
+		reader.Read(header.Counts[NCA_Subsectors], nodes.Subsectors, nodes.NumSubsectors) &&
+		reader.Read(header.Counts[NCA_GLNodes], nodes.GLNodes, nodes.NumGLNodes) &&
+		reader.Read(header.Counts[NCA_GLSegs], nodes.GLSegs, nodes.NumGLSegs) &&
+		reader.Read(header.Counts[NCA_GLSubsectors], nodes.GLSubsectors, nodes.NumGLSubsectors);
+
+	if (ok)
+	{
+		for (int i = 0; i < Level.NumLines(); i++)
+		{
+			Level.Lines[i].v1 = lineVertices[i * 2];
+			Level.Lines[i].v2 = lineVertices[i * 2 + 1];
+		}
+		Level.NumOrgVerts = header.NumOrgVerts;
+
+		// Hand the arrays over to the level. The ones being replaced go to the
+		// temporary level, which frees them.
+		std::swap(Level.Vertices, nodes.Vertices);
+		std::swap(Level.NumVertices, nodes.NumVertices);
+		std::swap(Level.Nodes, nodes.Nodes);
+		std::swap(Level.NumNodes, nodes.NumNodes);
+		std::swap(Level.Segs, nodes.Segs);
+		std::swap(Level.NumSegs, nodes.NumSegs);
+		std::swap(Level.Subsectors, nodes.Subsectors);
+		std::swap(Level.NumSubsectors, nodes.NumSubsectors);
+		std::swap(Level.GLNodes, nodes.GLNodes);
+		std::swap(Level.NumGLNodes, nodes.NumGLNodes);
+		std::swap(Level.GLSegs, nodes.GLSegs);
+		std::swap(Level.NumGLSegs, nodes.NumGLSegs);
+		std::swap(Level.GLSubsectors, nodes.GLSubsectors);
+		std::swap(Level.NumGLSubsectors, nodes.NumGLSubsectors);
+		Level.GLVertices = nodes.GLVertices;
+		Level.NumGLVertices = nodes.NumGLVertices;
+	}
+	else
+	{
+		delete[] nodes.GLVertices;
+	}
+	delete[] lineVertices;
+	return ok;
+}
+
+void FProcessor::StoreCachedNodes()
+{
+	std::vector<uint32_t> lineVertices(Level.NumLines() * 2);
+	for (int i = 0; i < Level.NumLines(); i++)
+	{
+		lineVertices[i * 2] = Level.Lines[i].v1;
+		lineVertices[i * 2 + 1] = Level.Lines[i].v2;
+	}
+
+	NodeCacheHeader header = {};
+	memcpy(header.Magic, "ZBCN", 4);
+	header.Version = NodeCacheVersion;
+	header.NumOrgVerts = Level.NumOrgVerts;
+
+	std::vector<uint8_t> data(sizeof(NodeCacheHeader));
+	AppendArray(data, header.Counts[NCA_LineVertices], lineVertices.data(), (int)lineVertices.size());
+	AppendArray(data, header.Counts[NCA_Vertices], Level.Vertices, Level.NumVertices);
+	AppendArray(data, header.Counts[NCA_GLVertices], Level.GLVertices, Level.NumGLVertices);
+	AppendArray(data, header.Counts[NCA_Nodes], Level.Nodes, Level.NumNodes);
+	AppendArray(data, header.Counts[NCA_Segs], Level.Segs, Level.NumSegs);
+	AppendArray(data, header.Counts[NCA_Subsectors], Level.Subsectors, Level.NumSubsectors);
+	AppendArray(data, header.Counts[NCA_GLNodes], Level.GLNodes, Level.NumGLNodes);
+	AppendArray(data, header.Counts[NCA_GLSegs], Level.GLSegs, Level.NumGLSegs);
+	AppendArray(data, header.Counts[NCA_GLSubsectors], Level.GLSubsectors, Level.NumGLSubsectors);
+	memcpy(data.data(), &header, sizeof(NodeCacheHeader));
+
+	Cache->Store(NodesKey, "nodes", data.data(), data.size());
+}
+
+// Hashes everything FBlockmapBuilder reads
+FHash128 FProcessor::GetBlockmapKey() const
+{
+	FHasher hasher;
+	hasher.AddValue(BlockmapCacheVersion);
+	hasher.AddValue(Level.MinX);
+	hasher.AddValue(Level.MinY);
+	hasher.AddValue(Level.MaxX);
+	hasher.AddValue(Level.MaxY);
+
+	hasher.AddValue(Level.NumVertices);
+	for (int i = 0; i < Level.NumVertices; i++)
+	{
+		hasher.AddValue(Level.Vertices[i].x);
+		hasher.AddValue(Level.Vertices[i].y);
+	}
+
+	hasher.AddValue(Level.NumLines());
+	for (const IntLineDef &line : Level.Lines)
+	{
+		hasher.AddValue(line.v1);
+		hasher.AddValue(line.v2);
+	}
+	return hasher.Finish();
+}
+
+bool FProcessor::LoadCachedBlockmap()
+{
+	auto file = Cache->Find(GetBlockmapKey(), "blockmap");
+	if (!file || file->Size() % sizeof(uint16_t) != 0)
+		return false;
+
+	Level.BlockmapSize = int(file->Size() / sizeof(uint16_t));
+	Level.Blockmap = new uint16_t[Level.BlockmapSize];
+	memcpy(Level.Blockmap, file->Data(), file->Size());
+	return true;
+}
+
+void FProcessor::StoreCachedBlockmap()
+{
+	Cache->Store(GetBlockmapKey(), "blockmap", Level.Blockmap, Level.BlockmapSize * sizeof(uint16_t));
+}
@@ -70,37 +70,30 @@ void FLevel::SetupLights()
 
 			printf("Sun vector: %f, %f, %f\n", sundir.x, sundir.y, sundir.z);
 
-			for (unsigned int propIndex = 0; propIndex < thing->props.Size(); propIndex++)
-			{
-				const UDMFKey &key = thing->props[propIndex];
+			const UDMFKey *prop;
 
-				if (!stricmp(key.key, "lm_suncolor"))
-				{
-					lightcolor = atoi(key.value);
-					printf("Sun color: %d (%X)\n", lightcolor, lightcolor);
-				}
-				else if (!stricmp(key.key, "lm_sampledistance"))
-				{
-					DefaultSamples = atoi(key.value);
-					if (DefaultSamples < 8) DefaultSamples = 8;
-					if (DefaultSamples > 128) DefaultSamples = 128;
-					DefaultSamples = Math::RoundPowerOfTwo(DefaultSamples);
-				}
-				/*
-				// light bounces temporarily disabled
-				else if (!stricmp(key.key, "lm_bounces"))
-				{
-					LightBounce = atoi(key.value);
-					if (LightBounce < 0) LightBounce = 0;
-					if (LightBounce > 8) LightBounce = 8;
-				}
-				*/
-				else if (!stricmp(key.key, "lm_gridsize"))
-				{
-					GridSize = atof(key.value) ? atof(key.value) : 64.f;
-					if (GridSize < 1.f) GridSize = 1.f;
-					if (GridSize > 1024.f) GridSize = 1024.f;
-				}
+			if ((prop = FindProp(thing->props, UDMF_LM_SunColor)))
+			{
+				lightcolor = prop->GetInt(INT_MIN, INT_MAX);
+				printf("Sun color: %d (%X)\n", lightcolor, lightcolor);
+			}
+			if ((prop = FindProp(thing->props, UDMF_LM_SampleDistance)))
+			{
+				DefaultSamples = prop->GetInt(8, 128);
+				DefaultSamples = Math::RoundPowerOfTwo(DefaultSamples);
+			}
+			/*
+			// light bounces temporarily disabled
+			if ((prop = FindProp(thing->props, UDMF_LM_Bounces)))
+			{
+				LightBounce = prop->GetInt(0, 8);
+			}
+			*/
+			if ((prop = FindProp(thing->props, UDMF_LM_GridSize)))
+			{
+				GridSize = (float)prop->GetFloat(-1.0, 1024.0);
+				if (GridSize == 0.f) GridSize = 64.f;
+				if (GridSize < 1.f) GridSize = 1.f;
 			}
 
 			if (dot(sundir, sundir) > 0.01f)
@@ -334,9 +327,9 @@ void FLevel::CreateLights()
 			float lightdistance = 0.0f;
 
 			/*
-			for (unsigned int propIndex = 0; propIndex < line->props.Size(); propIndex++)
+			for (unsigned int propIndex = 0; propIndex < line->props.count; propIndex++)
 			{
-				const UDMFKey &key = line->props[propIndex];
+				const UDMFKey &key = UDMFProps[line->props.first + propIndex];
 				if (!stricmp(key.key, "lightcolorline"))
 				{
 					lightcolor = atoi(key.value);
@@ -377,9 +370,9 @@ void FLevel::CreateLights()
 		float lightdistance = 0.0f;
 
 		/*
-		for (unsigned int propIndex = 0; propIndex < sector->props.Size(); propIndex++)
+		for (unsigned int propIndex = 0; propIndex < sector->props.count; propIndex++)
 		{
-			const UDMFKey &key = sector->props[propIndex];
+			const UDMFKey &key = UDMFProps[sector->props.first + propIndex];
 			if (!stricmp(key.key, "lm_lightcolorfloor"))
 			{
 				lightcolor = atoi(key.value);
@@ -409,9 +402,9 @@ void FLevel::CreateLights()
 		lightintensity = 1.0f;
 		lightdistance = 0.0f;
 
-		for (unsigned int propIndex = 0; propIndex < sector->props.Size(); propIndex++)
+		for (unsigned int propIndex = 0; propIndex < sector->props.count; propIndex++)
 		{
-			const UDMFKey &key = sector->props[propIndex];
+			const UDMFKey &key = UDMFProps[sector->props.first + propIndex];
 			if (!stricmp(key.key, "lm_lightcolorceiling"))
 			{
 				lightcolor = atoi(key.value);
@@ -19,9 +19,8 @@
 */
 
 
-#include <float.h>
 #include "level/level.h"
-#include "parse/sc_man.h"
+#include "framework/parallel.h"
 
 typedef double real64;
 typedef unsigned int uint32;
@@ -52,43 +51,24 @@ static void CopyUDMFString(char *dest, int destlen, const char *udmfvalue)
 	*dest = 0;
 }
 
-class StringBuffer
-{
-	const static size_t BLOCK_SIZE = 100000;
-	const static size_t BLOCK_ALIGN = sizeof(size_t);
-
-	TDeletingArray<char *> blocks;
-	size_t currentindex;
-
-	char *Alloc(size_t size)
-	{
-		if (currentindex + size >= BLOCK_SIZE)
-		{
-			// Block is full - get a new one!
-			char *newblock = new char[BLOCK_SIZE];
-			blocks.Push(newblock);
-			currentindex = 0;
-		}
-		size = (size + BLOCK_ALIGN-1) &~ (BLOCK_ALIGN-1);
-		char *p = blocks[blocks.Size()-1] + currentindex;
-		currentindex += size;
-		return p;
-	}
-public:
-
-	StringBuffer()
-	{
-		currentindex = BLOCK_SIZE;
-	}
+//===========================================================================
+//
+// Looks up the id of a key. The case labels are hashes computed at compile
+// time, so two keys with the same hash are caught by the compiler.
+//
+//===========================================================================
 
-	char * Copy(const char * p)
+static EUDMFKey GetUDMFKey(const FUDMFToken &key)
+{
+	switch (UDMFKeyHash(key.Str, key.Len))
 	{
-		return p != nullptr? strcpy(Alloc(strlen(p)+1) , p) : nullptr;
+#define DEFINE_UDMF_KEY(name, str) case UDMFKeyHash(str): return key.Is(str) ? name : UDMF_Unknown;
+#include "level/udmfkeys.h"
+#undef DEFINE_UDMF_KEY
+	default:
+		return UDMF_Unknown;
 	}
-};
-
-StringBuffer stbuf;
-
+}
 
 //===========================================================================
 //
@@ -96,144 +76,158 @@ StringBuffer stbuf;
 //
 //===========================================================================
 
-const char *FProcessor::ParseKey(const char *&value)
+void FProcessor::ParseKey(FUDMFScanner &sc, FUDMFKeyValue &kv)
 {
-	SC_MustGetString();
-	const char *key = stbuf.Copy(sc_String);
-	SC_MustGetStringName("=");
-
-	sc_Number = INT_MIN;
-	sc_Float = DBL_MIN;
-	if (!SC_CheckFloat())
-	{
-		SC_MustGetString();
-	}
-	value = stbuf.Copy(sc_String);
-	SC_MustGetStringName(";");
-	return key;
+	FUDMFToken key, value;
+
+	sc.MustGetToken(key);
+	sc.MustGetTokenName("=");
+	sc.MustGetToken(value);
+	sc.MustGetTokenName(";");
+
+	// The character after each token has been read already, so both can be
+	// terminated in place.
+	key.Str[key.Len] = 0;
+	value.Str[value.Len] = 0;
+
+	kv.Key = key.Str;
+	kv.Value = value.Str;
+	kv.KeyId = GetUDMFKey(key);
+	kv.IsNumber = UDMFStrToD(value.Str, value.Len, kv.Number);
 }
 
-bool FProcessor::CheckKey(const char *&key, const char *&value)
+bool FProcessor::CheckKey(FUDMFScanner &sc, FUDMFKeyValue &kv)
 {
-	SC_SavePos();
-	SC_MustGetString();
-	if (SC_CheckString("="))
+	FUDMFScanner::FPos pos = sc.SavePos();
+	FUDMFToken key;
+	if (sc.GetToken(key) && sc.CheckTokenName("="))
 	{
-		SC_RestorePos();
-		key = ParseKey(value);
+		sc.RestorePos(pos);
+		ParseKey(sc, kv);
 		return true;
 	}
-	SC_RestorePos();
+	sc.RestorePos(pos);
 	return false;
 }
 
-int CheckInt(const char *key)
+static int CheckInt(FUDMFScanner &sc, const FUDMFKeyValue &kv)
 {
-	if (sc_Number == INT_MIN)
+	if (!kv.IsNumber)
+	{
+		sc.ScriptError("Integer value expected for key '%s'", kv.Key);
+	}
+	if (!(kv.Number > INT_MIN - 1.0 && kv.Number < INT_MAX + 1.0))
 	{
-		SC_ScriptError("Integer value expected for key '%s'", key);
+		sc.ScriptError("Integer value is out of range for key '%s'", kv.Key);
 	}
-	return sc_Number;
+	return (int)kv.Number;
 }
 
-double CheckFloat(const char *key)
+static double CheckFloat(FUDMFScanner &sc, const FUDMFKeyValue &kv)
 {
-	if (sc_Float == DBL_MIN)
+	if (!kv.IsNumber)
 	{
-		SC_ScriptError("Floating point value expected for key '%s'", key);
+		sc.ScriptError("Floating point value expected for key '%s'", kv.Key);
 	}
-	return sc_Float;
+	return kv.Number;
 }
 
-fixed_t CheckFixed(const char *key)
+// Stores the key in its unprocessed form
+static void AddProp(TArray<UDMFKey> &props, const FUDMFKeyValue &kv)
 {
-	double val = CheckFloat(key);
+	UDMFKey k = { kv.Key, kv.Value, kv.KeyId };
+	props.Push(k);
+}
+
+static fixed_t CheckFixed(FUDMFScanner &sc, const FUDMFKeyValue &kv)
+{
+	double val = CheckFloat(sc, kv);
 	if (val < -32768 || val > 32767)
 	{
-		SC_ScriptError("Fixed point value is out of range for key '%s'\n\t%.2f should be within [-32768,32767]", key, val / 65536);
+		sc.ScriptError("Fixed point value is out of range for key '%s'\n\t%.2f should be within [-32768,32767]", kv.Key, val / 65536);
 	}
 	return xs_Fix<16>::ToFix(val);
 }
 
-//===========================================================================
-//
-// Parse a thing block
-//
-//===========================================================================
+// strtok() is not used here, because blocks are parsed on several threads.
 
-void FProcessor::ParseThing(IntThing *th)
+static void ParseMoreIds(const char *tagstring, int ignore, std::vector<int> &moreids)
 {
-	th->pitch = 0;
-
-	SC_MustGetStringName("{");
-	while (!SC_CheckString("}"))
+	if (*tagstring != '"')
 	{
-		const char *value;
-		const char *key = ParseKey(value);
+		return;
+	}
 
-		if (!stricmp(key, "x"))
-		{
-			th->x = CheckFixed(key);
-		}
-		else if (!stricmp(key, "y"))
-		{
-			th->y = CheckFixed(key);
-		}
-		if (!stricmp(key, "angle"))
-		{
-			th->angle = (short)CheckInt(key);
-		}
-		if (!stricmp(key, "pitch"))
-		{
-			th->pitch = (short)CheckInt(key);
-		}
-		if (!stricmp(key, "type"))
-		{
-			th->type = (short)CheckInt(key);
-		}
-		if (!stricmp(key, "height"))
-		{
-			th->height = CheckInt(key);
-		}
-		if (!stricmp(key, "special"))
-		{
-			th->special = CheckInt(key);
-		}
-		if (!stricmp(key, "arg0"))
-		{
-			th->args[0] = CheckInt(key);
-		}
-		if (!stricmp(key, "arg1"))
+	// skip the quotation mark
+	const char *p = tagstring + 1;
+	for (;;)
+	{
+		while (*p == ' ' || *p == '"')
 		{
-			th->args[1] = CheckInt(key);
+			p++;
 		}
-		if (!stricmp(key, "arg2"))
+		if (*p == 0)
 		{
-			th->args[2] = CheckInt(key);
+			break;
 		}
-		if (!stricmp(key, "arg3"))
+		auto tag = strtoll(p, nullptr, 0);
+		if (tag != ignore && (int)tag == tag)
 		{
-			th->args[3] = CheckInt(key);
+			moreids.push_back(tag);
 		}
-		if (!stricmp(key, "arg4"))
+		while (*p != 0 && *p != ' ' && *p != '"')
 		{
-			th->args[4] = CheckInt(key);
+			p++;
 		}
+	}
+}
+
+//===========================================================================
+//
+// Parse a thing block
+//
+//===========================================================================
+
+void FProcessor::ParseThing(FUDMFScanner &sc, IntThing *th, TArray<UDMFKey> &props)
+{
+	th->pitch = 0;
+
+	sc.MustGetTokenName("{");
+	th->props.first = props.Size();
+	while (!sc.CheckTokenName("}"))
+	{
+		FUDMFKeyValue kv;
+		ParseKey(sc, kv);
+
 		th->alpha = 1.0f;
-		if (!stricmp(key, "alpha"))
-		{
-			th->alpha = CheckFloat(key);
-		}
-		if (!stricmp(key, "arg0str"))
-		{
-			th->arg0str = value;
+		switch (kv.KeyId)
+		{
+		case UDMF_X:		th->x = CheckFixed(sc, kv); break;
+		case UDMF_Y:		th->y = CheckFixed(sc, kv); break;
+		case UDMF_Angle:	th->angle = (short)CheckInt(sc, kv); break;
+		case UDMF_Pitch:	th->pitch = (short)CheckInt(sc, kv); break;
+		case UDMF_Type:		th->type = (short)CheckInt(sc, kv); break;
+		case UDMF_Height:	th->height = CheckInt(sc, kv); break;
+		case UDMF_Special:	th->special = CheckInt(sc, kv); break;
+		case UDMF_Arg0:		th->args[0] = CheckInt(sc, kv); break;
+		case UDMF_Arg1:		th->args[1] = CheckInt(sc, kv); break;
+		case UDMF_Arg2:		th->args[2] = CheckInt(sc, kv); break;
+		case UDMF_Arg3:		th->args[3] = CheckInt(sc, kv); break;
+		case UDMF_Arg4:		th->args[4] = CheckInt(sc, kv); break;
+		case UDMF_Alpha:	th->alpha = CheckFloat(sc, kv); break;
+
+		case UDMF_Arg0Str:
+			th->arg0str = kv.Value;
 			th->arg0str.StripChars("\"");
+			break;
+
+		default:
+			break;
 		}
 
-		// now store the key in its unprocessed form
-		UDMFKey k = {key, value};
-		th->props.Push(k);
+		AddProp(props, kv);
 	}
+	th->props.count = props.Size() - th->props.first;
 }
 
 //===========================================================================
@@ -242,106 +236,60 @@ void FProcessor::ParseThing(IntThing *th)
 //
 //===========================================================================
 
-void FProcessor::ParseLinedef(IntLineDef *ld)
+void FProcessor::ParseLinedef(FUDMFScanner &sc, IntLineDef *ld, TArray<UDMFKey> &props)
 {
 	std::vector<int> moreids;
-	SC_MustGetStringName("{");
+	sc.MustGetTokenName("{");
 	ld->v1 = ld->v2 = ld->sidenum[0] = ld->sidenum[1] = NO_INDEX;
 	ld->flags = 0;
 	ld->special = 0;
-	while (!SC_CheckString("}"))
+	ld->props.first = props.Size();
+	while (!sc.CheckTokenName("}"))
 	{
-		const char *value;
-		const char *key = ParseKey(value);
+		FUDMFKeyValue kv;
+		ParseKey(sc, kv);
 
-		if (!stricmp(key, "v1"))
-		{
-			ld->v1 = CheckInt(key);
-			continue;	// do not store in props
-		}
-		else if (!stricmp(key, "v2"))
-		{
-			ld->v2 = CheckInt(key);
-			continue;	// do not store in props
-		}
-		else if (Extended && !stricmp(key, "special"))
+		switch (kv.KeyId)
 		{
-			ld->special = CheckInt(key);
-		}
-		else if (Extended && !stricmp(key, "arg0"))
-		{
-			ld->args[0] = CheckInt(key);
-		}
-		else if (Extended && !stricmp(key, "arg1"))
-		{
-			ld->args[1] = CheckInt(key);
-		}
-		else if (Extended && !stricmp(key, "arg2"))
-		{
-			ld->args[2] = CheckInt(key);
-		}
-		else if (Extended && !stricmp(key, "arg3"))
-		{
-			ld->args[3] = CheckInt(key);
-		}
-		else if (Extended && !stricmp(key, "arg4"))
-		{
-			ld->args[4] = CheckInt(key);
-		}
-		else if (stricmp(key, "moreids") == 0)
-		{
-			// delay parsing of the tag string until parsing of the sector is complete
+		// These are not stored in props
+		case UDMF_V1:		ld->v1 = CheckInt(sc, kv); continue;
+		case UDMF_V2:		ld->v2 = CheckInt(sc, kv); continue;
+		case UDMF_SideFront:	ld->sidenum[0] = CheckInt(sc, kv); continue;
+		case UDMF_SideBack:	ld->sidenum[1] = CheckInt(sc, kv); continue;
+
+		case UDMF_Special:	if (Extended) ld->special = CheckInt(sc, kv); break;
+		case UDMF_Arg0:		if (Extended) ld->args[0] = CheckInt(sc, kv); break;
+		case UDMF_Arg1:		if (Extended) ld->args[1] = CheckInt(sc, kv); break;
+		case UDMF_Arg2:		if (Extended) ld->args[2] = CheckInt(sc, kv); break;
+		case UDMF_Arg3:		if (Extended) ld->args[3] = CheckInt(sc, kv); break;
+		case UDMF_Arg4:		if (Extended) ld->args[4] = CheckInt(sc, kv); break;
+
+		case UDMF_MoreIds:
+			// delay parsing of the tag string until parsing of the linedef is complete
 			// This ensures that the ID is always the first tag in the list.
-			auto tagstring = value;
-			if (tagstring != nullptr && *tagstring == '"')
+			ParseMoreIds(kv.Value, -1, moreids);
+			break;
+
+		case UDMF_Blocking:	if (!stricmp(kv.Value, "true")) ld->flags |= ML_BLOCKING; break;
+		case UDMF_BlockMonsters:	if (!stricmp(kv.Value, "true")) ld->flags |= ML_BLOCKMONSTERS; break;
+		case UDMF_TwoSided:	if (!stricmp(kv.Value, "true")) ld->flags |= ML_TWOSIDED; break;
+
+		case UDMF_Id:
+			if (Extended)
 			{
-				// skip the quotation mark
-				auto workstring = strdup(tagstring + 1);
-				for (char* token = strtok(workstring, " \""); token; token = strtok(nullptr, " \""))
-				{
-					auto tag = strtoll(token, nullptr, 0);
-					if (tag != -1 && (int)tag == tag)
-					{
-						moreids.push_back(tag);
-					}
-				}
-				free(workstring);
+				int id = CheckInt(sc, kv);
+				ld->ids.Clear();
+				if (id != -1) ld->ids.Push(id);
 			}
-		}
-		else if (!stricmp(key, "blocking") && !stricmp(value, "true"))
-		{
-			ld->flags |= ML_BLOCKING;
-		}
-		else if (!stricmp(key, "blockmonsters") && !stricmp(value, "true"))
-		{
-			ld->flags |= ML_BLOCKMONSTERS;
-		}
-		else if (!stricmp(key, "twosided") && !stricmp(value, "true"))
-		{
-			ld->flags |= ML_TWOSIDED;
-		}
-		else if (Extended && !stricmp(key, "id"))
-		{
-			int id = CheckInt(key);
-			ld->ids.Clear();
-			if (id != -1) ld->ids.Push(id);
-		}
+			break;
 
-		if (!stricmp(key, "sidefront"))
-		{
-			ld->sidenum[0] = CheckInt(key);
-			continue;	// do not store in props
-		}
-		else if (!stricmp(key, "sideback"))
-		{
-			ld->sidenum[1] = CheckInt(key);
-			continue;	// do not store in props
+		default:
+			break;
 		}
 
-		// now store the key in its unprocessed form
-		UDMFKey k = {key, value};
-		ld->props.Push(k);
+		AddProp(props, kv);
 	}
+	ld->props.count = props.Size() - ld->props.first;
 
 	for (int tag : moreids)
 		ld->ids.Push(tag);	// don't bother with duplicates, they don't pose a problem.
@@ -353,9 +301,9 @@ void FProcessor::ParseLinedef(IntLineDef *ld)
 //
 //===========================================================================
 
-void FProcessor::ParseSidedef(IntSideDef *sd)
+void FProcessor::ParseSidedef(FUDMFScanner &sc, IntSideDef *sd, TArray<UDMFKey> &props)
 {
-	SC_MustGetStringName("{");
+	sc.MustGetTokenName("{");
 	sd->sector = NO_INDEX;
 	sd->textureoffset = 0;
 	sd->rowoffset = 0;
@@ -369,58 +317,35 @@ void FProcessor::ParseSidedef(IntSideDef *sd)
 	sd->sampleDistanceTop = 0;
 	sd->sampleDistanceMiddle = 0;
 	sd->sampleDistanceBottom = 0;
-	while (!SC_CheckString("}"))
+	sd->props.first = props.Size();
+	while (!sc.CheckTokenName("}"))
 	{
-		const char *value;
-		const char *key = ParseKey(value);
+		FUDMFKeyValue kv;
+		ParseKey(sc, kv);
 
-		if (!stricmp(key, "sector"))
+		switch (kv.KeyId)
 		{
-			sd->sector = CheckInt(key);
+		case UDMF_Sector:
+			sd->sector = CheckInt(sc, kv);
 			continue;	// do not store in props
-		}
 
-		if (stricmp(key, "texturetop") == 0)
-		{
-			CopyUDMFString(sd->toptexture, 64, value);
-		}
-		else if (stricmp(key, "texturemiddle") == 0)
-		{
-			CopyUDMFString(sd->midtexture, 64, value);
-		}
-		else if (stricmp(key, "texturebottom") == 0)
-		{
-			CopyUDMFString(sd->bottomtexture, 64, value);
-		}
-		else if (stricmp(key, "offsetx_mid") == 0)
-		{
-			sd->textureoffset = CheckInt(key);
-		}
-		else if (stricmp(key, "offsety_mid") == 0)
-		{
-			sd->rowoffset = CheckInt(key);
-		}
-		else if (stricmp(key, "lm_sampledist_line") == 0)
-		{
-			sd->sampleDistance = CheckInt(key);
-		}
-		else if (stricmp(key, "lm_sampledist_top") == 0)
-		{
-			sd->sampleDistanceTop = CheckInt(key);
-		}
-		else if (stricmp(key, "lm_sampledist_mid") == 0)
-		{
-			sd->sampleDistanceMiddle = CheckInt(key);
-		}
-		else if (stricmp(key, "lm_sampledist_bot") == 0)
-		{
-			sd->sampleDistanceBottom = CheckInt(key);
+		case UDMF_TextureTop:		CopyUDMFString(sd->toptexture, 64, kv.Value); break;
+		case UDMF_TextureMiddle:	CopyUDMFString(sd->midtexture, 64, kv.Value); break;
+		case UDMF_TextureBottom:	CopyUDMFString(sd->bottomtexture, 64, kv.Value); break;
+		case UDMF_OffsetX_Mid:		sd->textureoffset = CheckInt(sc, kv); break;
+		case UDMF_OffsetY_Mid:		sd->rowoffset = CheckInt(sc, kv); break;
+		case UDMF_LM_SampleDist_Line:	sd->sampleDistance = CheckInt(sc, kv); break;
+		case UDMF_LM_SampleDist_Top:	sd->sampleDistanceTop = CheckInt(sc, kv); break;
+		case UDMF_LM_SampleDist_Mid:	sd->sampleDistanceMiddle = CheckInt(sc, kv); break;
+		case UDMF_LM_SampleDist_Bot:	sd->sampleDistanceBottom = CheckInt(sc, kv); break;
+
+		default:
+			break;
 		}
 
-		// now store the key in its unprocessed form
-		UDMFKey k = {key, value};
-		sd->props.Push(k);
+		AddProp(props, kv);
 	}
+	sd->props.count = props.Size() - sd->props.first;
 }
 
 //===========================================================================
@@ -429,7 +354,7 @@ void FProcessor::ParseSidedef(IntSideDef *sd)
 //
 //===========================================================================
 
-void FProcessor::ParseSector(IntSector *sec)
+void FProcessor::ParseSector(FUDMFScanner &sc, IntSector *sec, TArray<UDMFKey> &props)
 {
 	std::vector<int> moreids;
 	memset(&sec->data, 0, sizeof(sec->data));
@@ -439,116 +364,56 @@ void FProcessor::ParseSector(IntSector *sec)
 
 	int ceilingplane = 0, floorplane = 0;
 
-	SC_MustGetStringName("{");
-	while (!SC_CheckString("}"))
+	sc.MustGetTokenName("{");
+	sec->props.first = props.Size();
+	while (!sc.CheckTokenName("}"))
 	{
-		const char *value;
-		const char *key = ParseKey(value);
+		FUDMFKeyValue kv;
+		ParseKey(sc, kv);
 
-		if (stricmp(key, "textureceiling") == 0)
-		{
-			CopyUDMFString(sec->data.ceilingpic, 64, value);
-		}
-		else if (stricmp(key, "texturefloor") == 0)
-		{
-			CopyUDMFString(sec->data.floorpic, 64, value);
-		}
-		else if (stricmp(key, "heightceiling") == 0)
-		{
-			sec->data.ceilingheight = CheckFloat(key);
-		}
-		else if (stricmp(key, "heightfloor") == 0)
-		{
-			sec->data.floorheight = CheckFloat(key);
-		}
-		else if (stricmp(key, "lightlevel") == 0)
-		{
-			sec->data.lightlevel = CheckInt(key);
-		}
-		else if (stricmp(key, "special") == 0)
+		switch (kv.KeyId)
 		{
-			sec->data.special = CheckInt(key);
-		}
-		else if (stricmp(key, "id") == 0)
+		case UDMF_TextureCeiling:	CopyUDMFString(sec->data.ceilingpic, 64, kv.Value); break;
+		case UDMF_TextureFloor:		CopyUDMFString(sec->data.floorpic, 64, kv.Value); break;
+		case UDMF_HeightCeiling:	sec->data.ceilingheight = CheckFloat(sc, kv); break;
+		case UDMF_HeightFloor:		sec->data.floorheight = CheckFloat(sc, kv); break;
+		case UDMF_LightLevel:		sec->data.lightlevel = CheckInt(sc, kv); break;
+		case UDMF_Special:			sec->data.special = CheckInt(sc, kv); break;
+
+		case UDMF_Id:
 		{
-			int id = CheckInt(key);
+			int id = CheckInt(sc, kv);
 			sec->data.tag = (short)id;
 			sec->tags.Clear();
 			if (id != 0) sec->tags.Push(id);
+			break;
 		}
-		else if (stricmp(key, "ceilingplane_a") == 0)
-		{
-			ceilingplane|=1;
-			sec->ceilingplane.a = CheckFloat(key);
-		}
-		else if (stricmp(key, "ceilingplane_b") == 0)
-		{
-			ceilingplane|=2;
-			sec->ceilingplane.b = CheckFloat(key);
-		}
-		else if (stricmp(key, "ceilingplane_c") == 0)
-		{
-			ceilingplane|=4;
-			sec->ceilingplane.c = CheckFloat(key);
-		}
-		else if (stricmp(key, "ceilingplane_d") == 0)
-		{
-			ceilingplane|=8;
-			sec->ceilingplane.d = CheckFloat(key);
-		}
-		else if (stricmp(key, "floorplane_a") == 0)
-		{
-			floorplane|=1;
-			sec->floorplane.a = CheckFloat(key);
-		}
-		else if (stricmp(key, "floorplane_b") == 0)
-		{
-			floorplane|=2;
-			sec->floorplane.b = CheckFloat(key);
-		}
-		else if (stricmp(key, "floorplane_c") == 0)
-		{
-			floorplane|=4;
-			sec->floorplane.c = CheckFloat(key);
-		}
-		else if (stricmp(key, "floorplane_d") == 0)
-		{
-			floorplane|=8;
-			sec->floorplane.d = CheckFloat(key);
-		}
-		else if (stricmp(key, "moreids") == 0)
-		{
+
+		case UDMF_CeilingPlane_A:	ceilingplane |= 1; sec->ceilingplane.a = CheckFloat(sc, kv); break;
+		case UDMF_CeilingPlane_B:	ceilingplane |= 2; sec->ceilingplane.b = CheckFloat(sc, kv); break;
+		case UDMF_CeilingPlane_C:	ceilingplane |= 4; sec->ceilingplane.c = CheckFloat(sc, kv); break;
+		case UDMF_CeilingPlane_D:	ceilingplane |= 8; sec->ceilingplane.d = CheckFloat(sc, kv); break;
+		case UDMF_FloorPlane_A:		floorplane |= 1; sec->floorplane.a = CheckFloat(sc, kv); break;
+		case UDMF_FloorPlane_B:		floorplane |= 2; sec->floorplane.b = CheckFloat(sc, kv); break;
+		case UDMF_FloorPlane_C:		floorplane |= 4; sec->floorplane.c = CheckFloat(sc, kv); break;
+		case UDMF_FloorPlane_D:		floorplane |= 8; sec->floorplane.d = CheckFloat(sc, kv); break;
+
+		case UDMF_MoreIds:
 			// delay parsing of the tag string until parsing of the sector is complete
 			// This ensures that the ID is always the first tag in the list.
-			auto tagstring = value;
-			if (tagstring != nullptr && *tagstring == '"')
-			{
-				// skip the quotation mark
-				auto workstring = strdup(tagstring + 1);
-				for (char* token = strtok(workstring, " \""); token; token = strtok(nullptr, " \""))
-				{
-					auto tag = strtoll(token, nullptr, 0);
-					if (tag != 0 && (int)tag == tag)
-					{
-						moreids.push_back(tag);
-					}
-				}
-				free(workstring);
-			}
-		}
-		else if (stricmp(key, "lm_sampledist_floor") == 0)
-		{
-			sec->sampleDistanceFloor = CheckInt(key);
-		}
-		else if (stricmp(key, "lm_sampledist_ceiling") == 0)
-		{
-			sec->sampleDistanceCeiling = CheckInt(key);
+			ParseMoreIds(kv.Value, 0, moreids);
+			break;
+
+		case UDMF_LM_SampleDist_Floor:		sec->sampleDistanceFloor = CheckInt(sc, kv); break;
+		case UDMF_LM_SampleDist_Ceiling:	sec->sampleDistanceCeiling = CheckInt(sc, kv); break;
+
+		default:
+			break;
 		}
 
-		// now store the key in its unprocessed form
-		UDMFKey k = {key, value};
-		sec->props.Push(k);
+		AddProp(props, kv);
 	}
+	sec->props.count = props.Size() - sec->props.first;
 
 	if (ceilingplane != 15)
 	{
@@ -594,36 +459,30 @@ void FProcessor::ParseSector(IntSector *sec)
 //
 //===========================================================================
 
-void FProcessor::ParseVertex(WideVertex *vt, IntVertex *vtp)
+void FProcessor::ParseVertex(FUDMFScanner &sc, WideVertex *vt, IntVertex *vtp, TArray<UDMFKey> &props)
 {
 	vt->x = vt->y = 0;
-	SC_MustGetStringName("{");
-	while (!SC_CheckString("}"))
+	sc.MustGetTokenName("{");
+	vtp->props.first = props.Size();
+	while (!sc.CheckTokenName("}"))
 	{
-		const char *value;
-		const char *key = ParseKey(value);
+		FUDMFKeyValue kv;
+		ParseKey(sc, kv);
 
-		if (!stricmp(key, "x"))
-		{
-			vt->x = CheckFixed(key);
-		}
-		else if (!stricmp(key, "y"))
-		{
-			vt->y = CheckFixed(key);
-		}
-		if (!stricmp(key, "zfloor"))
-		{
-			vtp->zfloor = CheckFloat(key);
-		}
-		else if (!stricmp(key, "zceiling"))
+		switch (kv.KeyId)
 		{
-			vtp->zceiling = CheckFloat(key);
+		case UDMF_X:		vt->x = CheckFixed(sc, kv); break;
+		case UDMF_Y:		vt->y = CheckFixed(sc, kv); break;
+		case UDMF_ZFloor:	vtp->zfloor = CheckFloat(sc, kv); break;
+		case UDMF_ZCeiling:	vtp->zceiling = CheckFloat(sc, kv); break;
+
+		default:
+			break;
 		}
 
-		// now store the key in its unprocessed form
-		UDMFKey k = {key, value};
-		vtp->props.Push(k);
+		AddProp(props, kv);
 	}
+	vtp->props.count = props.Size() - vtp->props.first;
 }
 
 
@@ -633,23 +492,21 @@ void FProcessor::ParseVertex(WideVertex *vt, IntVertex *vtp)
 //
 //===========================================================================
 
-void FProcessor::ParseMapProperties()
+void FProcessor::ParseMapProperties(FUDMFScanner &sc)
 {
-	const char *key, *value;
+	FUDMFKeyValue kv;
 
 	// all global keys must come before the first map element.
 
-	while (CheckKey(key, value))
+	while (CheckKey(sc, kv))
 	{
-		if (!stricmp(key, "namespace"))
+		if (kv.KeyId == UDMF_Namespace)
 		{
 			// all unknown namespaces are assumed to be standard.
-			Extended = !stricmp(value, "\"ZDoom\"") || !stricmp(value, "\"Hexen\"") || !stricmp(value, "\"Vavoom\"");
+			Extended = !stricmp(kv.Value, "\"ZDoom\"") || !stricmp(kv.Value, "\"Hexen\"") || !stricmp(kv.Value, "\"Vavoom\"");
 		}
 
-		// now store the key in its unprocessed form
-		UDMFKey k = {key, value};
-		Level.props.Push(k);
+		AddProp(Level.props, kv);
 	}
 }
 
@@ -658,55 +515,218 @@ void FProcessor::ParseMapProperties()
 //
 // Main parsing function
 //
+// The map is read in two passes: the first one only finds the blocks and
+// counts them, the second one parses them on all threads, each straight
+// into its place in the level.
+//
 //===========================================================================
 
+enum
+{
+	TEXTMAP_Thing,
+	TEXTMAP_Linedef,
+	TEXTMAP_Sidedef,
+	TEXTMAP_Sector,
+	TEXTMAP_Vertex,
+	NUM_TEXTMAP_BLOCKS
+};
+
+// Blocks other than things are handed to the threads in runs of this many.
+static const int TEXTMAP_CHUNK = 512;
+
+struct FTextMapBlock
+{
+	FUDMFScanner::FPos Start;	// just past the block's name
+	char *End;					// just past its closing brace
+	int Type;
+	int Index;					// among the blocks of the same type
+};
+
 void FProcessor::ParseTextMap(int lump)
 {
 	char *buffer;
 	int buffersize;
 	TArray<WideVertex> Vertices;
+	TArray<FTextMapBlock> blocks, things;
+	int counts[NUM_TEXTMAP_BLOCKS] = { 0 };
 
+	// The lump is tokenized in place and the properties keep pointing into
+	// it, so it has to live as long as the level.
 	ReadLump<char> (Wad, lump, buffer, buffersize);
-	SC_OpenMem("TEXTMAP", buffer, buffersize);
+	TextMap.reset(buffer);
+
+	FUDMFScanner sc(buffer, buffersize);
+	FUDMFToken token;
+
+	ParseMapProperties(sc);
+
+	while (sc.GetToken(token))
+	{
+		FTextMapBlock block;
+
+		if (token.Is("thing"))
+		{
+			block.Type = TEXTMAP_Thing;
+		}
+		else if (token.Is("linedef"))
+		{
+			block.Type = TEXTMAP_Linedef;
+		}
+		else if (token.Is("sidedef"))
+		{
+			block.Type = TEXTMAP_Sidedef;
+		}
+		else if (token.Is("sector"))
+		{
+			block.Type = TEXTMAP_Sector;
+		}
+		else if (token.Is("vertex"))
+		{
+			block.Type = TEXTMAP_Vertex;
+		}
+		else
+		{
+			continue;
+		}
+
+		block.Start = sc.SavePos();
+		sc.SkipBlock();
+		block.End = sc.SavePos().Ptr;
+		block.Index = counts[block.Type]++;
+
+		if (block.Type == TEXTMAP_Thing)
+		{
+			things.Push(block);
+		}
+		else
+		{
+			blocks.Push(block);
+		}
+	}
+
+	int base[NUM_TEXTMAP_BLOCKS];
+	base[TEXTMAP_Thing] = Level.Things.Reserve(counts[TEXTMAP_Thing]);
+	base[TEXTMAP_Linedef] = Level.Lines.Reserve(counts[TEXTMAP_Linedef]);
+	base[TEXTMAP_Sidedef] = Level.Sides.Reserve(counts[TEXTMAP_Sidedef]);
+	base[TEXTMAP_Sector] = Level.Sectors.Reserve(counts[TEXTMAP_Sector]);
+	base[TEXTMAP_Vertex] = Level.VertexProps.Reserve(counts[TEXTMAP_Vertex]);
+	Vertices.Resize(counts[TEXTMAP_Vertex]);
+
+	auto parseblock = [&](const FTextMapBlock &block, TArray<UDMFKey> &props)
+	{
+		FUDMFScanner blocksc(block.Start, block.End);
+		int index = base[block.Type] + block.Index;
+
+		switch (block.Type)
+		{
+		case TEXTMAP_Thing:
+			ParseThing(blocksc, &Level.Things[index], props);
+			break;
 
-	SC_SetCMode(true);
-	ParseMapProperties();
+		case TEXTMAP_Linedef:
+			ParseLinedef(blocksc, &Level.Lines[index], props);
+			break;
 
-	while (SC_GetString())
+		case TEXTMAP_Sidedef:
+			ParseSidedef(blocksc, &Level.Sides[index], props);
+			break;
+
+		case TEXTMAP_Sector:
+			ParseSector(blocksc, &Level.Sectors[index], props);
+			break;
+
+		case TEXTMAP_Vertex:
+		{
+			WideVertex *vt = &Vertices[block.Index];
+			vt->index = block.Index + 1;
+			ParseVertex(blocksc, vt, &Level.VertexProps[index], props);
+			break;
+		}
+		}
+	};
+
+	auto blockprops = [&](const FTextMapBlock &block) -> UDMFKeyRange &
 	{
-		if (SC_Compare("thing"))
+		int index = base[block.Type] + block.Index;
+
+		switch (block.Type)
 		{
-			IntThing *th = &Level.Things[Level.Things.Reserve(1)];
-			ParseThing(th);
+		case TEXTMAP_Thing:		return Level.Things[index].props;
+		case TEXTMAP_Linedef:	return Level.Lines[index].props;
+		case TEXTMAP_Sidedef:	return Level.Sides[index].props;
+		case TEXTMAP_Sector:	return Level.Sectors[index].props;
+		default:				return Level.VertexProps[index].props;
 		}
-		else if (SC_Compare("linedef"))
+	};
+
+	// Reference counting in FString is not thread safe, so all the things
+	// are parsed by the first chunk, before its blocks.
+	std::vector<TArray<UDMFKey>> chunkprops(MAX(ChunkCount((int)blocks.Size(), TEXTMAP_CHUNK), 1));
+
+	auto parsechunk = [&](int chunk, int start, int end)
+	{
+		if (chunk == 0)
 		{
-			IntLineDef *ld = &Level.Lines[Level.Lines.Reserve(1)];
-			ParseLinedef(ld);
+			for (const FTextMapBlock &thing : things)
+			{
+				parseblock(thing, chunkprops[0]);
+			}
 		}
-		else if (SC_Compare("sidedef"))
+		for (int i = start; i < end; i++)
+		{
+			parseblock(blocks[i], chunkprops[chunk]);
+		}
+	};
+
+	if (blocks.Size() > 0)
+	{
+		ParallelForChunks((int)blocks.Size(), TEXTMAP_CHUNK, parsechunk);
+	}
+	else
+	{
+		parsechunk(0, 0, 0);
+	}
+
+	// Put all the properties into one array. The ranges were relative to
+	// their chunk's array.
+	unsigned int numprops = 0;
+	for (const TArray<UDMFKey> &props : chunkprops)
+	{
+		numprops += props.Size();
+	}
+	numprops = Level.UDMFProps.Reserve(numprops);
+
+	for (int chunk = 0; chunk < (int)chunkprops.size(); chunk++)
+	{
+		const TArray<UDMFKey> &props = chunkprops[chunk];
+
+		if (props.Size() > 0)
 		{
-			IntSideDef *sd = &Level.Sides[Level.Sides.Reserve(1)];
-			ParseSidedef(sd);
+			memcpy(&Level.UDMFProps[numprops], &props[0], props.Size() * sizeof(UDMFKey));
 		}
-		else if (SC_Compare("sector"))
+
+		if (chunk == 0)
 		{
-			IntSector *sec = &Level.Sectors[Level.Sectors.Reserve(1)];
-			ParseSector(sec);
+			for (const FTextMapBlock &thing : things)
+			{
+				blockprops(thing).first += numprops;
+			}
 		}
-		else if (SC_Compare("vertex"))
+		int end = MIN((chunk + 1) * TEXTMAP_CHUNK, (int)blocks.Size());
+		for (int i = chunk * TEXTMAP_CHUNK; i < end; i++)
 		{
-			WideVertex *vt = &Vertices[Vertices.Reserve(1)];
-			IntVertex *vtp = &Level.VertexProps[Level.VertexProps.Reserve(1)];
-			vt->index = Vertices.Size();
-			ParseVertex(vt, vtp);
+			blockprops(blocks[i]).first += numprops;
 		}
+		numprops += props.Size();
 	}
+
 	Level.Vertices = new WideVertex[Vertices.Size()];
 	Level.NumVertices = Vertices.Size();
 	memcpy(Level.Vertices, &Vertices[0], Vertices.Size() * sizeof(WideVertex));
-	SC_Close();
-	delete[] buffer;
+
+	TextMapLines = Level.NumLines();
+	TextMapSides = Level.NumSides();
+	TextMapSectors = Level.NumSectors();
 }
 
 
@@ -721,20 +741,65 @@ void FProcessor::LoadUDMF()
 	ParseTextMap(Lump+1);
 }
 
+//===========================================================================
+//
+// FUDMFWriter
+//
+//===========================================================================
+
+void FUDMFWriter::Add(const char *str, int len)
+{
+	if (len > 0)
+	{
+		memcpy(&Buffer[Buffer.Reserve(len)], str, len);
+	}
+}
+
+void FUDMFWriter::AddInt(int value)
+{
+	char buffer[12];
+	char *p = buffer + sizeof(buffer);
+	unsigned int v = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+
+	do
+	{
+		*--p = '0' + v % 10;
+		v /= 10;
+	} while (v != 0);
+
+	if (value < 0)
+	{
+		*--p = '-';
+	}
+	Add(p, int(buffer + sizeof(buffer) - p));
+}
+
 //===========================================================================
 //
 // writes a property list
 //
 //===========================================================================
 
-void FProcessor::WriteProps(FWadWriter &out, TArray<UDMFKey> &props)
+void FProcessor::WriteProps(FUDMFWriter &out, TArray<UDMFKey> &props)
 {
 	for(unsigned i=0; i< props.Size(); i++)
 	{
-		out.AddToLump(props[i].key, (int)strlen(props[i].key));
-		out.AddToLump(" = ", 3);
-		out.AddToLump(props[i].value, (int)strlen(props[i].value));
-		out.AddToLump(";\n", 2);
+		out.Add(props[i].key);
+		out.Add(" = ", 3);
+		out.Add(props[i].value);
+		out.Add(";\n", 2);
+	}
+}
+
+void FProcessor::WriteProps(FUDMFWriter &out, const UDMFKeyRange &props)
+{
+	for(unsigned i=0; i< props.count; i++)
+	{
+		const UDMFKey &prop = Level.UDMFProps[props.first + i];
+		out.Add(prop.key);
+		out.Add(" = ", 3);
+		out.Add(prop.value);
+		out.Add(";\n", 2);
 	}
 }
 
@@ -744,34 +809,42 @@ void FProcessor::WriteProps(FWadWriter &out, TArray<UDMFKey> &props)
 //
 //===========================================================================
 
-void FProcessor::WriteIntProp(FWadWriter &out, const char *key, int value)
+void FProcessor::WriteIntProp(FUDMFWriter &out, const char *key, int value)
 {
-	char buffer[20];
-
-	out.AddToLump(key, (int)strlen(key));
-	out.AddToLump(" = ", 3);
-	sprintf(buffer, "%d;\n", value);
-	out.AddToLump(buffer, (int)strlen(buffer));
+	out.Add(key);
+	out.Add(" = ", 3);
+	out.AddInt(value);
+	out.Add(";\n", 2);
 }
 
 //===========================================================================
 //
-// writes a UDMF thing
+// writes the header of a block
 //
 //===========================================================================
 
-void FProcessor::WriteThingUDMF(FWadWriter &out, IntThing *th, int num)
+void FProcessor::WriteBlockStart(FUDMFWriter &out, const char *type, int num)
 {
-	out.AddToLump("thing", 5);
+	out.Add(type);
 	if (WriteComments)
 	{
-		char buffer[32];
-		int len = sprintf(buffer, " // %d", num);
-		out.AddToLump(buffer, len);
+		out.Add(" // ", 4);
+		out.AddInt(num);
 	}
-	out.AddToLump("\n{\n", 3);
+	out.Add("\n{\n", 3);
+}
+
+//===========================================================================
+//
+// writes a UDMF thing
+//
+//===========================================================================
+
+void FProcessor::WriteThingUDMF(FUDMFWriter &out, IntThing *th, int num)
+{
+	WriteBlockStart(out, "thing", num);
 	WriteProps(out, th->props);
-	out.AddToLump("}\n\n", 3);
+	out.Add("}\n\n", 3);
 }
 
 //===========================================================================
@@ -780,22 +853,15 @@ void FProcessor::WriteThingUDMF(FWadWriter &out, IntThing *th, int num)
 //
 //===========================================================================
 
-void FProcessor::WriteLinedefUDMF(FWadWriter &out, IntLineDef *ld, int num)
+void FProcessor::WriteLinedefUDMF(FUDMFWriter &out, IntLineDef *ld, int num)
 {
-	out.AddToLump("linedef", 7);
-	if (WriteComments)
-	{
-		char buffer[32];
-		int len = sprintf(buffer, " // %d", num);
-		out.AddToLump(buffer, len);
-	}
-	out.AddToLump("\n{\n", 3);
+	WriteBlockStart(out, "linedef", num);
 	WriteIntProp(out, "v1", ld->v1);
 	WriteIntProp(out, "v2", ld->v2);
 	if (ld->sidenum[0] != NO_INDEX) WriteIntProp(out, "sidefront", ld->sidenum[0]);
 	if (ld->sidenum[1] != NO_INDEX) WriteIntProp(out, "sideback", ld->sidenum[1]);
 	WriteProps(out, ld->props);
-	out.AddToLump("}\n\n", 3);
+	out.Add("}\n\n", 3);
 }
 
 //===========================================================================
@@ -804,19 +870,12 @@ void FProcessor::WriteLinedefUDMF(FWadWriter &out, IntLineDef *ld, int num)
 //
 //===========================================================================
 
-void FProcessor::WriteSidedefUDMF(FWadWriter &out, IntSideDef *sd, int num)
+void FProcessor::WriteSidedefUDMF(FUDMFWriter &out, IntSideDef *sd, int num)
 {
-	out.AddToLump("sidedef", 7);
-	if (WriteComments)
-	{
-		char buffer[32];
-		int len = sprintf(buffer, " // %d", num);
-		out.AddToLump(buffer, len);
-	}
-	out.AddToLump("\n{\n", 3);
+	WriteBlockStart(out, "sidedef", num);
 	WriteIntProp(out, "sector", sd->sector);
 	WriteProps(out, sd->props);
-	out.AddToLump("}\n\n", 3);
+	out.Add("}\n\n", 3);
 }
 
 //===========================================================================
@@ -825,18 +884,11 @@ void FProcessor::WriteSidedefUDMF(FWadWriter &out, IntSideDef *sd, int num)
 //
 //===========================================================================
 
-void FProcessor::WriteSectorUDMF(FWadWriter &out, IntSector *sec, int num)
+void FProcessor::WriteSectorUDMF(FUDMFWriter &out, IntSector *sec, int num)
 {
-	out.AddToLump("sector", 6);
-	if (WriteComments)
-	{
-		char buffer[32];
-		int len = sprintf(buffer, " // %d", num);
-		out.AddToLump(buffer, len);
-	}
-	out.AddToLump("\n{\n", 3);
+	WriteBlockStart(out, "sector", num);
 	WriteProps(out, sec->props);
-	out.AddToLump("}\n\n", 3);
+	out.Add("}\n\n", 3);
 }
 
 //===========================================================================
@@ -845,18 +897,41 @@ void FProcessor::WriteSectorUDMF(FWadWriter &out, IntSector *sec, int num)
 //
 //===========================================================================
 
-void FProcessor::WriteVertexUDMF(FWadWriter &out, IntVertex *vt, int num)
+void FProcessor::WriteVertexUDMF(FUDMFWriter &out, IntVertex *vt, int num)
 {
-	out.AddToLump("vertex", 6);
-	if (WriteComments)
+	WriteBlockStart(out, "vertex", num);
+	WriteProps(out, vt->props);
+	out.Add("}\n\n", 3);
+}
+
+//===========================================================================
+//
+// Checks if every vertex, line, side and sector still has the index it had
+// in the TEXTMAP. Only those references are written from the level, all
+// other properties are copied from the map as they are, so in that case the
+// lump can be copied too.
+//
+//===========================================================================
+
+bool FProcessor::TextMapUnchanged()
+{
+	if (WriteComments ||
+		Level.NumLines() != TextMapLines ||
+		Level.NumSides() != TextMapSides ||
+		Level.NumSectors() != TextMapSectors ||
+		Level.NumOrgVerts != (int)Level.VertexProps.Size())
 	{
-		char buffer[32];
-		int len = sprintf(buffer, " // %d", num);
-		out.AddToLump(buffer, len);
+		return false;
 	}
-	out.AddToLump("\n{\n", 3);
-	WriteProps(out, vt->props);
-	out.AddToLump("}\n\n", 3);
+
+	for (int i = 0; i < Level.NumOrgVerts; i++)
+	{
+		if (Level.Vertices[i].index != i + 1)
+		{
+			return false;
+		}
+	}
+	return true;
 }
 
 //===========================================================================
@@ -867,11 +942,18 @@ void FProcessor::WriteVertexUDMF(FWadWriter &out, IntVertex *vt, int num)
 
 void FProcessor::WriteTextMap(FWadWriter &out)
 {
-	out.StartWritingLump("TEXTMAP");
-	WriteProps(out, Level.props);
+	if (TextMapUnchanged())
+	{
+		out.CopyLump(Wad, Lump+1);
+		return;
+	}
+
+	FUDMFWriter text;
+
+	WriteProps(text, Level.props);
 	for(int i = 0; i < Level.NumThings(); i++)
 	{
-		WriteThingUDMF(out, &Level.Things[i], i);
+		WriteThingUDMF(text, &Level.Things[i], i);
 	}
 
 	for(int i = 0; i < Level.NumOrgVerts; i++)
@@ -882,23 +964,25 @@ void FProcessor::WriteTextMap(FWadWriter &out)
 			// not valid!
 			throw std::runtime_error("Invalid vertex data.");
 		}
-		WriteVertexUDMF(out, &Level.VertexProps[vt->index-1], i);
+		WriteVertexUDMF(text, &Level.VertexProps[vt->index-1], i);
 	}
 
 	for(int i = 0; i < Level.NumLines(); i++)
 	{
-		WriteLinedefUDMF(out, &Level.Lines[i], i);
+		WriteLinedefUDMF(text, &Level.Lines[i], i);
 	}
 
 	for(int i = 0; i < Level.NumSides(); i++)
 	{
-		WriteSidedefUDMF(out, &Level.Sides[i], i);
+		WriteSidedefUDMF(text, &Level.Sides[i], i);
 	}
 
 	for(int i = 0; i < Level.NumSectors(); i++)
 	{
-		WriteSectorUDMF(out, &Level.Sectors[i], i);
+		WriteSectorUDMF(text, &Level.Sectors[i], i);
 	}
+
+	out.WriteLump("TEXTMAP", text.Data(), text.Size());
 }
 
 //===========================================================================
@@ -0,0 +1,62 @@
+// enum name, key name (UDMF keys are not case sensitive)
+DEFINE_UDMF_KEY(UDMF_Namespace, "namespace")
+
+DEFINE_UDMF_KEY(UDMF_X, "x")
+DEFINE_UDMF_KEY(UDMF_Y, "y")
+DEFINE_UDMF_KEY(UDMF_Angle, "angle")
+DEFINE_UDMF_KEY(UDMF_Pitch, "pitch")
+DEFINE_UDMF_KEY(UDMF_Type, "type")
+DEFINE_UDMF_KEY(UDMF_Height, "height")
+DEFINE_UDMF_KEY(UDMF_Special, "special")
+DEFINE_UDMF_KEY(UDMF_Arg0, "arg0")
+DEFINE_UDMF_KEY(UDMF_Arg1, "arg1")
+DEFINE_UDMF_KEY(UDMF_Arg2, "arg2")
+DEFINE_UDMF_KEY(UDMF_Arg3, "arg3")
+DEFINE_UDMF_KEY(UDMF_Arg4, "arg4")
+DEFINE_UDMF_KEY(UDMF_Alpha, "alpha")
+DEFINE_UDMF_KEY(UDMF_Arg0Str, "arg0str")
+DEFINE_UDMF_KEY(UDMF_Id, "id")
+DEFINE_UDMF_KEY(UDMF_MoreIds, "moreids")
+
+DEFINE_UDMF_KEY(UDMF_V1, "v1")
+DEFINE_UDMF_KEY(UDMF_V2, "v2")
+DEFINE_UDMF_KEY(UDMF_SideFront, "sidefront")
+DEFINE_UDMF_KEY(UDMF_SideBack, "sideback")
+DEFINE_UDMF_KEY(UDMF_Blocking, "blocking")
+DEFINE_UDMF_KEY(UDMF_BlockMonsters, "blockmonsters")
+DEFINE_UDMF_KEY(UDMF_TwoSided, "twosided")
+
+DEFINE_UDMF_KEY(UDMF_Sector, "sector")
+DEFINE_UDMF_KEY(UDMF_TextureTop, "texturetop")
+DEFINE_UDMF_KEY(UDMF_TextureMiddle, "texturemiddle")
+DEFINE_UDMF_KEY(UDMF_TextureBottom, "texturebottom")
+DEFINE_UDMF_KEY(UDMF_OffsetX_Mid, "offsetx_mid")
+DEFINE_UDMF_KEY(UDMF_OffsetY_Mid, "offsety_mid")
+DEFINE_UDMF_KEY(UDMF_LM_SampleDist_Line, "lm_sampledist_line")
+DEFINE_UDMF_KEY(UDMF_LM_SampleDist_Top, "lm_sampledist_top")
+DEFINE_UDMF_KEY(UDMF_LM_SampleDist_Mid, "lm_sampledist_mid")
+DEFINE_UDMF_KEY(UDMF_LM_SampleDist_Bot, "lm_sampledist_bot")
+
+DEFINE_UDMF_KEY(UDMF_TextureFloor, "texturefloor")
+DEFINE_UDMF_KEY(UDMF_TextureCeiling, "textureceiling")
+DEFINE_UDMF_KEY(UDMF_HeightFloor, "heightfloor")
+DEFINE_UDMF_KEY(UDMF_HeightCeiling, "heightceiling")
+DEFINE_UDMF_KEY(UDMF_LightLevel, "lightlevel")
+DEFINE_UDMF_KEY(UDMF_CeilingPlane_A, "ceilingplane_a")
+DEFINE_UDMF_KEY(UDMF_CeilingPlane_B, "ceilingplane_b")
+DEFINE_UDMF_KEY(UDMF_CeilingPlane_C, "ceilingplane_c")
+DEFINE_UDMF_KEY(UDMF_CeilingPlane_D, "ceilingplane_d")
+DEFINE_UDMF_KEY(UDMF_FloorPlane_A, "floorplane_a")
+DEFINE_UDMF_KEY(UDMF_FloorPlane_B, "floorplane_b")
+DEFINE_UDMF_KEY(UDMF_FloorPlane_C, "floorplane_c")
+DEFINE_UDMF_KEY(UDMF_FloorPlane_D, "floorplane_d")
+DEFINE_UDMF_KEY(UDMF_LM_SampleDist_Floor, "lm_sampledist_floor")
+DEFINE_UDMF_KEY(UDMF_LM_SampleDist_Ceiling, "lm_sampledist_ceiling")
+
+DEFINE_UDMF_KEY(UDMF_ZFloor, "zfloor")
+DEFINE_UDMF_KEY(UDMF_ZCeiling, "zceiling")
+
+DEFINE_UDMF_KEY(UDMF_LM_SunColor, "lm_suncolor")
+DEFINE_UDMF_KEY(UDMF_LM_SampleDistance, "lm_sampledistance")
+DEFINE_UDMF_KEY(UDMF_LM_Bounces, "lm_bounces")
+DEFINE_UDMF_KEY(UDMF_LM_GridSize, "lm_gridsize")
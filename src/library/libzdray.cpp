@@ -0,0 +1,243 @@
+#include "library/libzdray.h"
+#include "framework/bakecache.h"
+#include "level/level.h"
+#include "lightmap/bakecheckpoint.h"
+#include "lightmap/bakeshard.h"
+#include "wad/wad.h"
+#include <chrono>
+#include <memory>
+#include <mutex>
+
+namespace
+{
+	std::mutex SettingsMutex;
+
+	std::unique_ptr<BakeCheckpoint> CreateCheckpoint(const ZDRayOptions &options)
+	{
+		if (options.CheckpointFile.empty())
+			return nullptr;
+
+		BakeCheckpoint::Clock::time_point deadline = BakeCheckpoint::Clock::time_point::max();
+		if (options.TimeBudget > 0.0)
+		{
+			deadline = BakeCheckpoint::Clock::now() + std::chrono::duration_cast<BakeCheckpoint::Clock::duration>(std::chrono::duration<double>(options.TimeBudget));
+		}
+		return std::make_unique<BakeCheckpoint>(options.CheckpointFile, options.CheckpointInterval, options.Resume, deadline);
+	}
+
+	// What every map of a call is built with
+	struct BuildSetup
+	{
+		std::unique_ptr<FBakeCache> Cache;
+		std::unique_ptr<BakeCheckpoint> Checkpoint;
+		std::unique_ptr<BakeShardWriter> ShardWriter;
+		std::unique_ptr<BakeShardMerger> ShardMerger;
+
+		BuildSetup(const ZDRayOptions &options, const char *shardFile)
+		{
+			if (!options.CacheDir.empty())
+				Cache = std::make_unique<FBakeCache>(options.CacheDir.c_str(), uint64_t(options.CacheSize) << 20);
+			Checkpoint = CreateCheckpoint(options);
+			if (options.ShardCount > 0)
+				ShardWriter = std::make_unique<BakeShardWriter>(shardFile, options.Shard, options.ShardCount);
+			if (!options.MergeShards.empty())
+				ShardMerger = std::make_unique<BakeShardMerger>(options.MergeShards);
+		}
+
+		void Apply(FProcessor &builder)
+		{
+			builder.SetCache(Cache.get());
+			builder.SetCheckpoint(Checkpoint.get());
+			builder.SetShardWriter(ShardWriter.get());
+			builder.SetShardMerger(ShardMerger.get());
+		}
+
+		void Finish()
+		{
+			if (ShardWriter)
+				ShardWriter->Close();
+			if (Cache)
+				Cache->Trim();
+		}
+	};
+
+	// Builds the maps of the wad and copies everything else. A shard has no
+	// output wad, only its shard file.
+	void ProcessLumps(FWadReader &inwad, FWadWriter *outwad, const char *map, BuildSetup &setup)
+	{
+		int lump = 0;
+		int max = inwad.NumLumps();
+
+		while (lump < max)
+		{
+			if (inwad.IsMap(lump) && (!map || stricmp(inwad.LumpName(lump), map) == 0))
+			{
+				auto start = std::chrono::steady_clock::now();
+
+				FProcessor builder(inwad, lump);
+				setup.Apply(builder);
+				builder.BuildNodes();
+				builder.BuildLightmaps();
+				if (outwad)
+					builder.Write(*outwad);
+
+				if (!NoTiming)
+				{
+					printf("   %.3f seconds.\n", std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+				}
+
+				if (DumpMesh)
+				{
+					printf("\n");
+					builder.DumpMesh();
+				}
+
+				lump = inwad.LumpAfterMap(lump);
+			}
+			else if (inwad.IsGLNodes(lump))
+			{
+				// Ignore GL nodes from the input for any maps we process.
+				if (BuildNodes && (map == nullptr || stricmp(inwad.LumpName(lump) + 3, map) == 0))
+				{
+					lump = inwad.SkipGLNodes(lump);
+				}
+				else
+				{
+					if (outwad)
+						outwad->CopyLump(inwad, lump);
+					++lump;
+				}
+			}
+			else
+			{
+				if (outwad)
+					outwad->CopyLump(inwad, lump);
+				++lump;
+			}
+		}
+	}
+}
+
+void ZDRayOptions::Apply() const
+{
+	::BuildNodes = BuildNodes;
+	::BuildGLNodes = BuildGLNodes;
+	::ConformNodes = ConformNodes;
+	::GLOnly = GLOnly;
+	::V5GLNodes = V5GLNodes;
+	::CompressNodes = CompressNodes;
+	::CompressGLNodes = CompressGLNodes;
+	::ForceCompression = ForceCompression;
+	::MaxSegs = MaxSegs;
+	::FastNodes = FastNodes;
+	::SplitCost = SplitCost;
+	::AAPreference = AAPreference;
+	::CheckPolyobjs = CheckPolyobjs;
+#ifdef DISABLE_SSE
+	::HaveSSE1 = false;
+	::HaveSSE2 = false;
+#else
+	::HaveSSE1 = SSE1;
+	::HaveSSE2 = SSE2;
+#endif
+
+	::NoPrune = NoPrune;
+	::WriteComments = WriteComments;
+	::BlockmapMode = BlockmapMode;
+	::RejectMode = RejectMode;
+	::RejectTimeLimit = RejectTimeLimit;
+
+	::NumThreads = Threads;
+	::LMDims = LightmapSize;
+	::CPURaytrace = CPURaytrace;
+	::VKDebug = VKDebug;
+	::WeldDistance = WeldDistance;
+	::WatertightTrace = WatertightTrace;
+	::coverageSampleCount = CoverageSamples;
+	::bounceSampleCount = BounceSamples;
+	::ambientSampleCount = AmbientSamples;
+
+	::ShowWarnings = ShowWarnings;
+	::NoTiming = NoTiming;
+}
+
+std::vector<ZDRayLump> ZDRayContext::ProcessMap(const std::vector<ZDRayLump> &lumps)
+{
+	if (lumps.empty())
+		throw std::runtime_error("No map lumps given");
+
+	// The lumps go through the same wad reader and writer as files do, with
+	// the wads kept in memory
+	FWadWriter inwad(false);
+	for (const ZDRayLump &lump : lumps)
+	{
+		inwad.WriteLump(lump.Name.c_str(), lump.Data.data(), (int)lump.Data.size());
+	}
+	inwad.Close();
+
+	FWadReader outwad(ProcessWad(inwad.GetImage(), nullptr));
+
+	std::vector<ZDRayLump> result(outwad.NumLumps());
+	for (int i = 0; i < outwad.NumLumps(); i++)
+	{
+		uint8_t *data;
+		int size;
+		ReadLump<uint8_t>(outwad, i, data, size);
+		result[i].Name = outwad.LumpName(i);
+		result[i].Data.assign(data, data + size);
+		delete[] data;
+	}
+	return result;
+}
+
+std::vector<uint8_t> ZDRayContext::ProcessWad(const std::vector<uint8_t> &wad, const char *map)
+{
+	if (Options.ShardCount > 0)
+		throw std::runtime_error("A shard writes a shard file and has to be given file names");
+
+	std::lock_guard<std::mutex> lock(SettingsMutex);
+	Options.Apply();
+
+	BuildSetup setup(Options, nullptr);
+
+	FWadReader inwad(wad);
+	FWadWriter outwad(inwad.IsIWAD());
+	ProcessLumps(inwad, &outwad, map, setup);
+	outwad.Close();
+
+	setup.Finish();
+	return outwad.GetImage();
+}
+
+void ZDRayContext::ProcessWad(const char *inName, const char *outName, const char *map)
+{
+	std::lock_guard<std::mutex> lock(SettingsMutex);
+	Options.Apply();
+
+	BuildSetup setup(Options, outName);
+
+	if (setup.ShardWriter)
+	{
+		FWadReader inwad(inName);
+		ProcessLumps(inwad, nullptr, map, setup);
+	}
+	else
+	{
+		FWadReader inwad(inName);
+		FWadWriter outwad(outName, inwad.IsIWAD());
+		ProcessLumps(inwad, &outwad, map, setup);
+		outwad.Close();
+	}
+
+	setup.Finish();
+}
+
+const ZDRayLump *ZDRayFindLump(const std::vector<ZDRayLump> &lumps, const char *name)
+{
+	for (const ZDRayLump &lump : lumps)
+	{
+		if (stricmp(lump.Name.c_str(), name) == 0)
+			return &lump;
+	}
+	return nullptr;
+}
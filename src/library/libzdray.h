@@ -0,0 +1,116 @@
+#pragma once
+
+#include "framework/zdray.h"
+#include <string>
+#include <vector>
+
+// libzdray: ZDRay for programs that want to build maps in their own process,
+// such as level editors and asset pipelines. Wads and lumps are passed in
+// and out in memory, so no temporary files are needed. The zdray command
+// line tool is a thin wrapper around ZDRayContext::ProcessWad.
+//
+//	ZDRayContext context;
+//	context.Options.CPURaytrace = true;
+//	std::vector<ZDRayLump> map = context.ProcessMap(lumps);	// "MAP01", "TEXTMAP", ..., "ENDMAP"
+//	const ZDRayLump *lightmap = ZDRayFindLump(map, "LIGHTMAP");
+//
+// Errors are thrown as std::runtime_error. Progress is printed to stdout.
+// The settings are shared by the whole process, so calls made by several
+// threads or contexts at once run one after the other.
+
+// Everything a build can be told, with the defaults of the command line
+struct ZDRayOptions
+{
+	// Nodes
+	bool BuildNodes = true;
+	bool BuildGLNodes = true;
+	bool ConformNodes = false;	// Make the GL nodes match the normal ones
+	bool GLOnly = true;
+	bool V5GLNodes = false;
+	bool CompressNodes = true;
+	bool CompressGLNodes = true;
+	bool ForceCompression = true;
+	int MaxSegs = 64;
+	bool FastNodes = false;
+	int SplitCost = 8;
+	int AAPreference = 16;
+	bool CheckPolyobjs = true;
+	bool SSE1 = true;	// Use the SSE point-on-side routines, unless libzdray was built with DISABLE_SSE
+	bool SSE2 = true;
+
+	// Other map data
+	bool NoPrune = false;
+	bool WriteComments = false;
+	EBlockmapMode BlockmapMode = EBM_Rebuild;
+	ERejectMode RejectMode = ERM_DontTouch;
+	int RejectTimeLimit = 60;	// Seconds, 0 for no limit
+
+	// Lightmaps
+	int Threads = 0;	// 0 for one per hardware thread
+	int LightmapSize = 1024;
+	bool CPURaytrace = false;
+	bool VKDebug = false;
+	float WeldDistance = 0.0f;
+	bool WatertightTrace = false;
+	int CoverageSamples = 256;
+	int BounceSamples = 2048;
+	int AmbientSamples = 2048;
+
+	// Bake cache (see framework/bakecache.h). Not used if CacheDir is empty.
+	std::string CacheDir;
+	int CacheSize = 2048;	// Megabytes
+
+	// Checkpoints of the CPU ray tracing (see lightmap/bakecheckpoint.h). Not
+	// written if CheckpointFile is empty. When the time budget runs out, the
+	// call throws BakeTimeBudgetExceeded.
+	std::string CheckpointFile;
+	int CheckpointInterval = 300;	// Seconds
+	bool Resume = false;
+	double TimeBudget = 0.0;	// Seconds from the start of the call, 0 for no limit
+
+	// Sharded bakes (see lightmap/bakeshard.h). With a ShardCount, only shard
+	// Shard (1 to ShardCount) is traced and the output file is the shard file
+	// instead of a wad. With MergeShards, the samples come from the shard
+	// files of all shards instead of being traced.
+	int Shard = 0;
+	int ShardCount = 0;
+	std::vector<std::string> MergeShards;
+
+	bool ShowWarnings = false;
+	bool NoTiming = false;
+
+	// ZDRay keeps its settings in globals (see framework/zdray.h). This sets
+	// them. Contexts do it themselves at the start of every call.
+	void Apply() const;
+};
+
+// A lump of a wad
+struct ZDRayLump
+{
+	std::string Name;
+	std::vector<uint8_t> Data;
+};
+
+class ZDRayContext
+{
+public:
+	ZDRayContext() = default;
+	explicit ZDRayContext(const ZDRayOptions &options) : Options(options) { }
+
+	ZDRayOptions Options;
+
+	// Builds one map, given as its lumps from the map marker to the last one
+	// (ENDMAP for UDMF maps), and returns the lumps of the built map in the
+	// same form.
+	std::vector<ZDRayLump> ProcessMap(const std::vector<ZDRayLump> &lumps);
+
+	// Builds every map of a wad, or only the one named, and returns the new
+	// wad. Lumps that are not part of a map are copied.
+	std::vector<uint8_t> ProcessWad(const std::vector<uint8_t> &wad, const char *map = nullptr);
+
+	// The same with files
+	void ProcessWad(const char *inName, const char *outName, const char *map = nullptr);
+};
+
+// Returns null if there is no lump of that name
+const ZDRayLump *ZDRayFindLump(const std::vector<ZDRayLump> &lumps, const char *name);
@@ -0,0 +1,282 @@
+#include "math/mathlib.h"
+#include "levelmesh.h"
+#include "cpuraytracer.h"
+#include "bakecheckpoint.h"
+#include "bakescene.h"
+#include "framework/bakecache.h"
+#include <cstring>
+#include <cstdio>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+// A checkpoint file is this header, then for each map a BakeCheckpointMap
+// and the samples of its first DoneTasks tasks, three floats each.
+struct BakeCheckpointHeader
+{
+	char Magic[4];	// "ZBCK"
+	uint32_t Version;
+	uint64_t NumMaps;
+};
+
+struct BakeCheckpointMap
+{
+	char Name[16];
+	FHash128 Key;
+	uint64_t NumTasks;
+	uint64_t DoneTasks;
+};
+
+namespace
+{
+	const uint32_t BakeCheckpointVersion = 2;
+
+	static_assert(sizeof(vec3) == 3 * sizeof(float), "samples are stored as three floats");
+
+	struct SavedMap
+	{
+		BakeCheckpointMap Map;
+		const uint8_t *Samples;
+	};
+
+	vec3 &TaskSample(LevelMesh *mesh, const CPUTraceTask &task)
+	{
+		if (task.id >= 0)
+		{
+			Surface *surface = &mesh->surfaces[task.id];
+			return mesh->GetSamples(surface)[task.x + task.y * surface->lightmapDims[0]];
+		}
+		else
+		{
+			return mesh->lightProbes[(size_t)(-task.id) - 2].Color;
+		}
+	}
+
+	// Returns false if the file is not a checkpoint of this version
+	bool ReadMaps(const FMappedFile &file, std::vector<SavedMap> &maps)
+	{
+		BakeCheckpointHeader header;
+		if (file.Size() < sizeof(header))
+			return false;
+		memcpy(&header, file.Data(), sizeof(header));
+		if (memcmp(header.Magic, "ZBCK", 4) != 0 || header.Version != BakeCheckpointVersion)
+			return false;
+
+		size_t pos = sizeof(header);
+		for (uint64_t i = 0; i < header.NumMaps; i++)
+		{
+			SavedMap saved;
+			if (file.Size() - pos < sizeof(saved.Map))
+				return false;
+			memcpy(&saved.Map, file.Data() + pos, sizeof(saved.Map));
+			pos += sizeof(saved.Map);
+			if (saved.Map.DoneTasks > saved.Map.NumTasks || (file.Size() - pos) / sizeof(vec3) < saved.Map.DoneTasks)
+				return false;
+			saved.Samples = file.Data() + pos;
+			pos += saved.Map.DoneTasks * sizeof(vec3);
+			maps.push_back(saved);
+		}
+		return pos == file.Size();
+	}
+}
+
+BakeCheckpoint::BakeCheckpoint(const std::string &filename, int interval, bool resume, Clock::time_point deadline)
+	: Filename(filename), Interval(interval), Resume(resume), Deadline(deadline)
+{
+}
+
+void BakeCheckpoint::SetMap(const char *name)
+{
+	memset(MapName, 0, sizeof(MapName));
+	strncpy(MapName, name, sizeof(MapName) - 1);
+}
+
+FHash128 BakeCheckpoint::CreateKey(const CPUSceneLighting &lighting) const
+{
+	FHasher hasher;
+	hasher.AddValue(BakeCheckpointVersion);
+	hasher.Add(HashBakeScene(Mesh, lighting));
+	hasher.AddArray(Tasks->data(), Tasks->size());
+	return hasher.Finish();
+}
+
+size_t BakeCheckpoint::Begin(LevelMesh *mesh, const CPUSceneLighting &lighting, const std::vector<CPUTraceTask> &tasks)
+{
+	Mesh = mesh;
+	Tasks = &tasks;
+	Key = CreateKey(lighting);
+	LastSave = Clock::now();
+	Saved = 0;
+
+	if (!Resume)
+		return 0;
+
+	std::unique_ptr<FMappedFile> file = FMappedFile::Open(Filename);
+	if (!file)
+	{
+		printf("No checkpoint in %s, tracing from the start\n", Filename.c_str());
+		return 0;
+	}
+
+	std::vector<SavedMap> maps;
+	if (!ReadMaps(*file, maps))
+	{
+		printf("%s is not a checkpoint of this version, tracing from the start\n", Filename.c_str());
+		return 0;
+	}
+
+	const SavedMap *saved = nullptr;
+	for (const SavedMap &map : maps)
+	{
+		if (memcmp(map.Map.Name, MapName, sizeof(MapName)) == 0)
+			saved = &map;
+	}
+	if (!saved)
+	{
+		printf("No checkpoint of %s in %s, tracing from the start\n", MapName, Filename.c_str());
+		return 0;
+	}
+
+	if (saved->Map.Key != Key || saved->Map.NumTasks != tasks.size())
+	{
+		printf("Checkpoint of %s in %s is of another bake, tracing from the start\n", MapName, Filename.c_str());
+		return 0;
+	}
+
+	for (size_t i = 0; i < saved->Map.DoneTasks; i++)
+	{
+		memcpy(&TaskSample(mesh, tasks[i]), saved->Samples + i * sizeof(vec3), sizeof(vec3));
+	}
+
+	Saved = (size_t)saved->Map.DoneTasks;
+	printf("Resuming %s from %s: %llu of %llu tasks already traced\n", MapName, Filename.c_str(), (unsigned long long)saved->Map.DoneTasks, (unsigned long long)saved->Map.NumTasks);
+	return Saved;
+}
+
+void BakeCheckpoint::Update(size_t done)
+{
+	Clock::time_point now = Clock::now();
+	if (now >= Deadline && done < Tasks->size())
+	{
+		Save(done);
+		throw BakeTimeBudgetExceeded("The time budget ran out. Checkpoint written to " + Filename + ", run again with --resume to continue.");
+	}
+
+	if (now - LastSave >= Interval && done > Saved)
+	{
+		Save(done);
+	}
+}
+
+void BakeCheckpoint::Finish()
+{
+	WriteFile(nullptr, nullptr);
+}
+
+void BakeCheckpoint::Save(size_t done)
+{
+	BakeCheckpointMap map;
+	memcpy(map.Name, MapName, sizeof(map.Name));
+	map.Key = Key;
+	map.NumTasks = Tasks->size();
+	map.DoneTasks = done;
+
+	std::vector<vec3> samples(done);
+	for (size_t i = 0; i < done; i++)
+	{
+		samples[i] = TaskSample(Mesh, (*Tasks)[i]);
+	}
+
+	WriteFile(&map, samples.data());
+
+	Saved = done;
+	LastSave = Clock::now();
+	printf("\rCheckpoint: %llu of %llu tasks saved\n", (unsigned long long)done, (unsigned long long)Tasks->size());
+}
+
+void BakeCheckpoint::WriteFile(const BakeCheckpointMap *map, const vec3 *samples)
+{
+	// Written under another name first, so that a kill while writing leaves
+	// the previous checkpoint
+#ifdef _WIN32
+	std::string temp = Filename + ".tmp" + std::to_string(_getpid());
+#else
+	std::string temp = Filename + ".tmp" + std::to_string(getpid());
+#endif
+
+	BakeCheckpointHeader header;
+	memcpy(header.Magic, "ZBCK", 4);
+	header.Version = BakeCheckpointVersion;
+	header.NumMaps = 0;
+
+	bool ok;
+	{
+		// The other maps are copied from the current file. It must be closed
+		// again before it can be replaced on Windows.
+		std::unique_ptr<FMappedFile> file = FMappedFile::Open(Filename);
+		std::vector<SavedMap> maps;
+		if (file && !ReadMaps(*file, maps))
+			maps.clear();
+
+		bool found = false;
+		for (size_t i = 0; i < maps.size(); )
+		{
+			if (memcmp(maps[i].Map.Name, MapName, sizeof(MapName)) == 0)
+			{
+				maps.erase(maps.begin() + i);
+				found = true;
+			}
+			else
+			{
+				i++;
+			}
+		}
+
+		header.NumMaps = maps.size() + (map ? 1 : 0);
+		if (header.NumMaps == 0)
+		{
+			file.reset();
+			remove(Filename.c_str());
+			return;
+		}
+		if (!map && !found)
+			return;	// Nothing of this map to remove
+
+		FILE *out = fopen(temp.c_str(), "wb");
+		ok = out != nullptr;
+		if (ok)
+		{
+			ok = fwrite(&header, sizeof(header), 1, out) == 1;
+			if (map)
+			{
+				ok = ok && fwrite(map, sizeof(*map), 1, out) == 1;
+				ok = ok && (map->DoneTasks == 0 || fwrite(samples, sizeof(vec3), map->DoneTasks, out) == map->DoneTasks);
+			}
+			for (const SavedMap &saved : maps)
+			{
+				ok = ok && fwrite(&saved.Map, sizeof(saved.Map), 1, out) == 1;
+				ok = ok && (saved.Map.DoneTasks == 0 || fwrite(saved.Samples, sizeof(vec3), saved.Map.DoneTasks, out) == saved.Map.DoneTasks);
+			}
+			ok = fclose(out) == 0 && ok;
+		}
+	}
+#ifdef _WIN32
+	if (ok)
+	{
+		remove(Filename.c_str());
+	}
+#endif
+	if (ok)
+	{
+		ok = rename(temp.c_str(), Filename.c_str()) == 0;
+	}
+	if (!ok)
+	{
+		remove(temp.c_str());
+		printf("Could not write checkpoint %s\n", Filename.c_str());
+		throw std::runtime_error("Could not write checkpoint");
+	}
+}
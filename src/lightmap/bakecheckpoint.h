@@ -0,0 +1,81 @@
+#pragma once
+
+#include "framework/hash.h"
+#include "math/vec.h"
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+class LevelMesh;
+struct CPUSceneLighting;
+struct CPUTraceTask;
+struct BakeCheckpointMap;
+
+// Thrown by the CPU ray tracer when the time budget of a bake has run out.
+// The checkpoint has been written by then, so the bake can be resumed.
+class BakeTimeBudgetExceeded : public std::runtime_error
+{
+public:
+	using std::runtime_error::runtime_error;
+};
+
+// Saves the progress of a CPU bake to a file, so that a bake that is killed
+// or runs out of time can go on where it stopped.
+//
+// The ray tracer works through its task list in batches. After a batch, when
+// the interval has passed, the samples of every task finished so far are
+// written to the file, which is replaced as a whole so a kill while writing
+// leaves the previous checkpoint. A checkpoint holds a key made of the mesh,
+// the lighting, the trace settings and the task list. A resumed bake only
+// uses it if the key is the same, copies its samples back and traces the
+// remaining tasks. Tasks do not depend on each other, so the result is the
+// same as a bake that was never stopped.
+//
+// The file keeps one checkpoint for each map by name, and saving one map
+// leaves the others as they are. A map's checkpoint is removed when its bake
+// finishes, and the file when no map is left in it. The maps of a wad that
+// were finished are traced again on a resume, unless --cache keeps them.
+class BakeCheckpoint
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	// A deadline of Clock::time_point::max() means no time budget
+	BakeCheckpoint(const std::string &filename, int interval, bool resume, Clock::time_point deadline);
+
+	// The map that the next bake is of
+	void SetMap(const char *name);
+
+	// Restores the samples of a saved bake if it is the same as this one.
+	// Returns the number of tasks, from the start of the list, that are done.
+	size_t Begin(LevelMesh *mesh, const CPUSceneLighting &lighting, const std::vector<CPUTraceTask> &tasks);
+
+	// Called after each batch with the number of tasks finished. Saves the
+	// samples when the interval has passed, and saves them and throws
+	// BakeTimeBudgetExceeded when the deadline has.
+	void Update(size_t done);
+
+	// The bake is complete and the checkpoint of its map no longer needed
+	void Finish();
+
+private:
+	FHash128 CreateKey(const CPUSceneLighting &lighting) const;
+	void Save(size_t done);
+
+	// Replaces the checkpoint of this map in the file with map, or removes
+	// it if map is null
+	void WriteFile(const BakeCheckpointMap *map, const vec3 *samples);
+
+	std::string Filename;
+	std::chrono::seconds Interval;
+	bool Resume;
+	Clock::time_point Deadline;
+	Clock::time_point LastSave;
+	char MapName[16] = {};
+
+	LevelMesh *Mesh = nullptr;
+	const std::vector<CPUTraceTask> *Tasks = nullptr;
+	FHash128 Key;
+	size_t Saved = 0;
+};
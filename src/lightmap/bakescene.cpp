@@ -0,0 +1,381 @@
+#include "math/mathlib.h"
+#include "levelmesh.h"
+#include "cpuraytracer.h"
+#include "bakescene.h"
+#include "framework/zdray.h"
+#include <stdexcept>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+
+namespace
+{
+	const uint32_t BakeSceneByteOrder = 0x01020304;
+	const size_t BakeSceneAlignment = 16;
+
+	size_t AlignSection(size_t offset)
+	{
+		return (offset + BakeSceneAlignment - 1) & ~(BakeSceneAlignment - 1);
+	}
+
+	void ToFloats(float *dest, const vec3 &v)
+	{
+		dest[0] = v.x;
+		dest[1] = v.y;
+		dest[2] = v.z;
+	}
+
+	vec3 FromFloats(const float *src)
+	{
+		return vec3(src[0], src[1], src[2]);
+	}
+
+	// Collects the sections of a file being written, in the order they appear.
+	class BakeSceneWriter
+	{
+	public:
+		template<typename T>
+		void Add(EBakeSceneSection section, const T *data, size_t count)
+		{
+			Data[section] = data;
+			Header.Sections[section].Count = count;
+			Header.Sections[section].ElementSize = sizeof(T);
+		}
+
+		void Write(const char *filename)
+		{
+			size_t offset = AlignSection(sizeof(BakeSceneHeader));
+			for (int i = 0; i < NUM_BAKESCENE_SECTIONS; i++)
+			{
+				BakeSceneSection &section = Header.Sections[i];
+				section.Offset = offset;
+				offset = AlignSection(offset + size_t(section.Count) * section.ElementSize);
+			}
+
+			FILE *file = fopen(filename, "wb");
+			if (!file)
+			{
+				printf("Could not open %s for writing\n", filename);
+				throw std::runtime_error("Could not write bake scene");
+			}
+
+			static const char padding[BakeSceneAlignment] = { 0 };
+
+			bool ok = fwrite(&Header, sizeof(BakeSceneHeader), 1, file) == 1;
+			size_t pos = sizeof(BakeSceneHeader);
+			for (int i = 0; i < NUM_BAKESCENE_SECTIONS && ok; i++)
+			{
+				const BakeSceneSection &section = Header.Sections[i];
+				ok = fwrite(padding, 1, size_t(section.Offset) - pos, file) == size_t(section.Offset) - pos;
+				size_t size = size_t(section.Count) * section.ElementSize;
+				if (ok && size > 0)
+					ok = fwrite(Data[i], 1, size, file) == size;
+				pos = size_t(section.Offset) + size;
+			}
+
+			if (fclose(file) != 0)
+				ok = false;
+
+			if (!ok)
+			{
+				printf("Could not write %s\n", filename);
+				throw std::runtime_error("Could not write bake scene");
+			}
+		}
+
+		BakeSceneHeader Header = {};
+
+	private:
+		const void *Data[NUM_BAKESCENE_SECTIONS] = {};
+	};
+
+	// Gives the sections of a file that has been read into memory.
+	class BakeSceneReader
+	{
+	public:
+		BakeSceneReader(const char *filename, std::vector<uint8_t> &buffer) : Filename(filename), Buffer(buffer)
+		{
+		}
+
+		template<typename T>
+		size_t Count(EBakeSceneSection section)
+		{
+			const BakeSceneSection &s = Header().Sections[section];
+			if (s.ElementSize != sizeof(T))
+				Fail("was written by a build with a different layout");
+			if (s.Offset % BakeSceneAlignment != 0 || s.Offset > Buffer.size() || s.Count > (Buffer.size() - s.Offset) / sizeof(T))
+				Fail("is truncated");
+			return size_t(s.Count);
+		}
+
+		template<typename T>
+		void Copy(EBakeSceneSection section, T *dest, size_t count)
+		{
+			if (count > 0)
+				memcpy(dest, Buffer.data() + Header().Sections[section].Offset, count * sizeof(T));
+		}
+
+		template<typename T>
+		const T *Get(EBakeSceneSection section)
+		{
+			return reinterpret_cast<const T *>(Buffer.data() + Header().Sections[section].Offset);
+		}
+
+		const BakeSceneHeader &Header() const { return *reinterpret_cast<const BakeSceneHeader *>(Buffer.data()); }
+
+		[[noreturn]] void Fail(const char *reason)
+		{
+			printf("Bake scene %s %s\n", Filename, reason);
+			throw std::runtime_error("Invalid bake scene");
+		}
+
+	private:
+		const char *Filename;
+		std::vector<uint8_t> &Buffer;
+	};
+}
+
+void SaveBakeScene(const char *filename, LevelMesh *mesh, const CPUSceneLighting &lighting)
+{
+	std::vector<BakeSceneSurface> surfaces(mesh->surfaces.size());
+	for (size_t i = 0; i < surfaces.size(); i++)
+	{
+		const Surface &surface = mesh->surfaces[i];
+		BakeSceneSurface &record = surfaces[i];
+		record.Plane[0] = surface.plane.a;
+		record.Plane[1] = surface.plane.b;
+		record.Plane[2] = surface.plane.c;
+		record.Plane[3] = surface.plane.d;
+		record.LightmapDims[0] = surface.lightmapDims[0];
+		record.LightmapDims[1] = surface.lightmapDims[1];
+		ToFloats(record.LightmapOrigin, surface.lightmapOrigin);
+		ToFloats(record.LightmapSteps[0], surface.lightmapSteps[0]);
+		ToFloats(record.LightmapSteps[1], surface.lightmapSteps[1]);
+		ToFloats(record.TextureCoords[0], surface.textureCoords[0]);
+		ToFloats(record.TextureCoords[1], surface.textureCoords[1]);
+		ToFloats(record.Bounds[0], surface.bounds.min);
+		ToFloats(record.Bounds[1], surface.bounds.max);
+		record.NumVerts = surface.numVerts;
+		record.FirstVert = surface.firstVert;
+		record.FirstSample = surface.firstSample;
+		record.Type = surface.type;
+		record.TypeIndex = surface.typeIndex;
+		record.ControlSector = surface.controlSector;
+		record.Sky = surface.bSky ? 1 : 0;
+		record.SampleDimension = surface.sampleDimension;
+	}
+
+	std::vector<vec3> probes(mesh->lightProbes.size());
+	for (size_t i = 0; i < probes.size(); i++)
+		probes[i] = mesh->lightProbes[i].Position;
+
+	BakeSceneWriter writer;
+	BakeSceneHeader &header = writer.Header;
+	memcpy(header.Magic, "ZBSC", 4);
+	header.Version = BAKESCENE_VERSION;
+	header.ByteOrder = BakeSceneByteOrder;
+	header.TextureWidth = mesh->textureWidth;
+	header.TextureHeight = mesh->textureHeight;
+	header.DefaultSamples = mesh->defaultSamples;
+	header.NumGLSubsectors = mesh->numGLSubsectors;
+	header.LightBounce = lighting.LightBounce;
+	ToFloats(header.SunDir, lighting.SunDir);
+	ToFloats(header.SunColor, lighting.SunColor);
+
+	writer.Add(BSS_Surfaces, surfaces.data(), surfaces.size());
+	writer.Add(BSS_SurfaceVerts, mesh->surfaceVerts.data(), mesh->surfaceVerts.size());
+	writer.Add(BSS_LightmapCoords, mesh->lightmapCoords.data(), mesh->lightmapCoords.size());
+	writer.Add(BSS_LightProbes, probes.data(), probes.size());
+	writer.Add(BSS_MeshVertices, mesh->MeshVertices.Data(), mesh->MeshVertices.Size());
+	writer.Add(BSS_MeshElements, mesh->MeshElements.Data(), mesh->MeshElements.Size());
+	writer.Add(BSS_MeshSurfaces, mesh->MeshSurfaces.Data(), mesh->MeshSurfaces.Size());
+	writer.Add(BSS_Lights, lighting.Lights.data(), lighting.Lights.size());
+	writer.Add(BSS_Emissives, lighting.Emissives.data(), lighting.Emissives.size());
+	writer.Add(BSS_SurfaceEmissives, lighting.SurfaceEmissives.data(), lighting.SurfaceEmissives.size());
+	writer.Write(filename);
+}
+
+std::unique_ptr<LevelMesh> LoadBakeScene(const char *filename, CPUSceneLighting &lighting)
+{
+	std::vector<uint8_t> buffer;
+
+	FILE *file = fopen(filename, "rb");
+	if (!file)
+	{
+		printf("Could not open %s\n", filename);
+		throw std::runtime_error("Could not read bake scene");
+	}
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	bool ok = size >= 0;
+	if (ok)
+	{
+		buffer.resize(size_t(size));
+		ok = fread(buffer.data(), 1, buffer.size(), file) == buffer.size();
+	}
+	fclose(file);
+	if (!ok)
+	{
+		printf("Could not read %s\n", filename);
+		throw std::runtime_error("Could not read bake scene");
+	}
+
+	BakeSceneReader reader(filename, buffer);
+	if (buffer.size() < sizeof(BakeSceneHeader) || memcmp(reader.Header().Magic, "ZBSC", 4) != 0)
+		reader.Fail("is not a bake scene");
+	if (reader.Header().Version != BAKESCENE_VERSION)
+		reader.Fail("has an unsupported version");
+	if (reader.Header().ByteOrder != BakeSceneByteOrder)
+		reader.Fail("was written on a machine with a different byte order");
+
+	const BakeSceneHeader &header = reader.Header();
+
+	auto mesh = std::make_unique<LevelMesh>();
+	mesh->textureWidth = header.TextureWidth;
+	mesh->textureHeight = header.TextureHeight;
+	mesh->defaultSamples = header.DefaultSamples;
+	mesh->numGLSubsectors = header.NumGLSubsectors;
+
+	size_t numVerts = reader.Count<vec3>(BSS_SurfaceVerts);
+	mesh->surfaceVerts.resize(numVerts);
+	reader.Copy(BSS_SurfaceVerts, mesh->surfaceVerts.data(), numVerts);
+
+	if (reader.Count<vec2>(BSS_LightmapCoords) != numVerts)
+		reader.Fail("has the wrong number of lightmap coordinates");
+	mesh->lightmapCoords.resize(numVerts);
+	reader.Copy(BSS_LightmapCoords, mesh->lightmapCoords.data(), numVerts);
+
+	size_t numSurfaces = reader.Count<BakeSceneSurface>(BSS_Surfaces);
+	const BakeSceneSurface *records = reader.Get<BakeSceneSurface>(BSS_Surfaces);
+	mesh->surfaces.resize(numSurfaces);
+	size_t numSamples = 0;
+	for (size_t i = 0; i < numSurfaces; i++)
+	{
+		const BakeSceneSurface &record = records[i];
+		Surface &surface = mesh->surfaces[i];
+		surface.plane.a = record.Plane[0];
+		surface.plane.b = record.Plane[1];
+		surface.plane.c = record.Plane[2];
+		surface.plane.d = record.Plane[3];
+		surface.lightmapNum = -1;
+		surface.lightmapOffs[0] = 0;
+		surface.lightmapOffs[1] = 0;
+		surface.lightmapDims[0] = record.LightmapDims[0];
+		surface.lightmapDims[1] = record.LightmapDims[1];
+		surface.lightmapOrigin = FromFloats(record.LightmapOrigin);
+		surface.lightmapSteps[0] = FromFloats(record.LightmapSteps[0]);
+		surface.lightmapSteps[1] = FromFloats(record.LightmapSteps[1]);
+		surface.textureCoords[0] = FromFloats(record.TextureCoords[0]);
+		surface.textureCoords[1] = FromFloats(record.TextureCoords[1]);
+		surface.bounds.min = FromFloats(record.Bounds[0]);
+		surface.bounds.max = FromFloats(record.Bounds[1]);
+		surface.numVerts = record.NumVerts;
+		surface.firstVert = record.FirstVert;
+		surface.firstSample = record.FirstSample;
+		surface.type = (SurfaceType)record.Type;
+		surface.typeIndex = record.TypeIndex;
+		surface.controlSector = record.ControlSector;
+		surface.bSky = record.Sky != 0;
+		surface.material = -1;
+		surface.sampleDimension = record.SampleDimension;
+
+		if (surface.numVerts < 0 || surface.firstVert < 0 || size_t(surface.firstVert) + surface.numVerts > numVerts)
+			reader.Fail("has a surface with vertices out of range");
+		if (surface.lightmapDims[0] < 0 || surface.lightmapDims[1] < 0 || surface.firstSample < 0)
+			reader.Fail("has a surface with an invalid lightmap size");
+
+		numSamples = std::max(numSamples, size_t(surface.firstSample) + size_t(surface.lightmapDims[0]) * surface.lightmapDims[1]);
+	}
+	mesh->samples.resize(numSamples);
+
+	size_t numProbes = reader.Count<vec3>(BSS_LightProbes);
+	const vec3 *probes = reader.Get<vec3>(BSS_LightProbes);
+	mesh->lightProbes.resize(numProbes);
+	for (size_t i = 0; i < numProbes; i++)
+		mesh->lightProbes[i].Position = probes[i];
+
+	size_t numMeshVerts = reader.Count<vec3>(BSS_MeshVertices);
+	mesh->MeshVertices.Resize((unsigned int)numMeshVerts);
+	reader.Copy(BSS_MeshVertices, mesh->MeshVertices.Data(), numMeshVerts);
+
+	size_t numElements = reader.Count<unsigned int>(BSS_MeshElements);
+	mesh->MeshElements.Resize((unsigned int)numElements);
+	reader.Copy(BSS_MeshElements, mesh->MeshElements.Data(), numElements);
+	for (size_t i = 0; i < numElements; i++)
+	{
+		if (mesh->MeshElements[i] >= numMeshVerts)
+			reader.Fail("has a triangle with vertices out of range");
+	}
+
+	size_t numTriangles = reader.Count<int>(BSS_MeshSurfaces);
+	if (numElements != numTriangles * 3)
+		reader.Fail("has the wrong number of triangle surfaces");
+	mesh->MeshSurfaces.Resize((unsigned int)numTriangles);
+	reader.Copy(BSS_MeshSurfaces, mesh->MeshSurfaces.Data(), numTriangles);
+	for (size_t i = 0; i < numTriangles; i++)
+	{
+		if (mesh->MeshSurfaces[i] < 0 || size_t(mesh->MeshSurfaces[i]) >= numSurfaces)
+			reader.Fail("has a triangle with a surface out of range");
+	}
+
+	size_t numLights = reader.Count<CPULightInfo>(BSS_Lights);
+	lighting.Lights.resize(numLights);
+	reader.Copy(BSS_Lights, lighting.Lights.data(), numLights);
+
+	size_t numEmissives = reader.Count<CPUEmissiveSurface>(BSS_Emissives);
+	if (numEmissives == 0)
+		reader.Fail("has no emissive entries");
+	lighting.Emissives.resize(numEmissives);
+	reader.Copy(BSS_Emissives, lighting.Emissives.data(), numEmissives);
+
+	if (reader.Count<int>(BSS_SurfaceEmissives) != numSurfaces)
+		reader.Fail("has the wrong number of surface emissives");
+	lighting.SurfaceEmissives.resize(numSurfaces);
+	reader.Copy(BSS_SurfaceEmissives, lighting.SurfaceEmissives.data(), numSurfaces);
+	for (int emissive : lighting.SurfaceEmissives)
+	{
+		if (emissive < 0 || size_t(emissive) >= numEmissives)
+			reader.Fail("has a surface emissive out of range");
+	}
+
+	lighting.SunDir = FromFloats(header.SunDir);
+	lighting.SunColor = FromFloats(header.SunColor);
+	lighting.LightBounce = header.LightBounce;
+
+	return mesh;
+}
+
+FHash128 HashBakeScene(const LevelMesh *mesh, const CPUSceneLighting &lighting)
+{
+	FHasher hasher;
+	hasher.AddValue(BAKESCENE_VERSION);
+	hasher.AddValue(coverageSampleCount);
+	hasher.AddValue(bounceSampleCount);
+	hasher.AddValue(WatertightTrace);
+	hasher.AddArray(mesh->MeshVertices.Data(), mesh->MeshVertices.Size());
+	hasher.AddArray(mesh->MeshElements.Data(), mesh->MeshElements.Size());
+	hasher.AddArray(mesh->MeshSurfaces.Data(), mesh->MeshSurfaces.Size());
+	hasher.AddValue((uint64_t)mesh->surfaces.size());
+	for (const Surface &surface : mesh->surfaces)
+	{
+		hasher.AddValue(surface.plane.Normal());
+		hasher.AddValue(surface.lightmapDims);
+		hasher.AddValue(surface.lightmapOrigin);
+		hasher.AddValue(surface.lightmapSteps);
+		hasher.AddValue(surface.sampleDimension);
+		hasher.AddValue(surface.bSky);
+	}
+	hasher.AddValue((uint64_t)mesh->lightProbes.size());
+	for (const LightProbeSample &probe : mesh->lightProbes)
+	{
+		hasher.AddValue(probe.Position);
+	}
+	hasher.AddArray(lighting.Lights.data(), lighting.Lights.size());
+	hasher.AddArray(lighting.Emissives.data(), lighting.Emissives.size());
+	hasher.AddArray(lighting.SurfaceEmissives.data(), lighting.SurfaceEmissives.size());
+	hasher.AddValue(lighting.SunDir);
+	hasher.AddValue(lighting.SunColor);
+	hasher.AddValue(lighting.LightBounce);
+	return hasher.Finish();
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "framework/hash.h"
+#include <memory>
+#include <stdint.h>
+
+class LevelMesh;
+struct CPUSceneLighting;
+
+// A bake scene is everything the CPU ray tracer and CreateTextures() read,
+// taken once the level mesh is built: the surfaces, the collision mesh, the
+// light probes and the lighting. Tracing it again gives the same lightmap as
+// the full run, without loading the map, building nodes or creating the mesh.
+//
+// The file is a header followed by one array per section. Each section starts
+// on a 16 byte boundary and holds its elements exactly as they are laid out in
+// memory, so loading it is a single read and a copy per section. The header
+// records the size of each element, and a file written by a build with
+// different structures is refused.
+
+static const uint32_t BAKESCENE_VERSION = 1;
+
+enum EBakeSceneSection
+{
+	BSS_Surfaces,
+	BSS_SurfaceVerts,
+	BSS_LightmapCoords,
+	BSS_LightProbes,
+	BSS_MeshVertices,
+	BSS_MeshElements,
+	BSS_MeshSurfaces,
+	BSS_Lights,
+	BSS_Emissives,
+	BSS_SurfaceEmissives,
+
+	NUM_BAKESCENE_SECTIONS
+};
+
+struct BakeSceneSection
+{
+	uint64_t Offset;
+	uint64_t Count;
+	uint32_t ElementSize;
+	uint32_t Reserved;
+};
+
+struct BakeSceneHeader
+{
+	char Magic[4];			// "ZBSC"
+	uint32_t Version;
+	uint32_t ByteOrder;		// 0x01020304 as written by the machine that made the file
+	int32_t TextureWidth;
+	int32_t TextureHeight;
+	int32_t DefaultSamples;
+	int32_t NumGLSubsectors;
+	int32_t LightBounce;
+	float SunDir[3];
+	float SunColor[3];
+	BakeSceneSection Sections[NUM_BAKESCENE_SECTIONS];
+};
+
+// The parts of a Surface that are kept. The rest is set by CreateTextures().
+struct BakeSceneSurface
+{
+	float Plane[4];
+	int32_t LightmapDims[2];
+	float LightmapOrigin[3];
+	float LightmapSteps[2][3];
+	float TextureCoords[2][3];
+	float Bounds[2][3];
+	int32_t NumVerts;
+	int32_t FirstVert;
+	int32_t FirstSample;
+	int32_t Type;
+	int32_t TypeIndex;
+	int32_t ControlSector;
+	int32_t Sky;
+	int32_t SampleDimension;
+};
+
+void SaveBakeScene(const char *filename, LevelMesh *mesh, const CPUSceneLighting &lighting);
+
+// The mesh that comes back has no level, and its surfaces have no texture
+// coordinates or materials. It can be traced, turned into textures and
+// written as a LIGHTMAP lump.
+std::unique_ptr<LevelMesh> LoadBakeScene(const char *filename, CPUSceneLighting &lighting);
+
+// A hash of everything in the scene that the ray tracer reads and of the
+// trace settings. Scenes with the same hash give the same sample for each
+// texel and probe, so samples can be moved between runs that agree on it.
+FHash128 HashBakeScene(const LevelMesh *mesh, const CPUSceneLighting &lighting);
@@ -0,0 +1,264 @@
+#include "math/mathlib.h"
+#include "levelmesh.h"
+#include "cpuraytracer.h"
+#include "bakeshard.h"
+#include "bakescene.h"
+#include "framework/bakecache.h"
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <stdexcept>
+
+struct BakeShardHeader
+{
+	char Magic[4];	// "ZBSH"
+	uint32_t Version;
+	uint32_t Shard;
+	uint32_t Count;
+	uint64_t NumMaps;
+};
+
+struct BakeShardMap
+{
+	char Name[16];
+	FHash128 SceneKey;
+	uint64_t NumSamples;
+};
+
+namespace
+{
+	const uint32_t BakeShardVersion = 1;
+
+	static_assert(sizeof(vec3) == 3 * sizeof(float), "samples are stored as three floats");
+
+	// Calls back with every sample of the shard, in the order they are stored
+	template<typename Callback>
+	void ForEachShardSample(LevelMesh *mesh, int shard, int count, Callback callback)
+	{
+		size_t tile = 0;
+		for (Surface &surface : mesh->surfaces)
+		{
+			int width = surface.lightmapDims[0];
+			int height = surface.lightmapDims[1];
+			int tilesX = CPUTraceSelection::TileCount(width);
+			int tilesY = CPUTraceSelection::TileCount(height);
+			vec3 *samples = mesh->GetSamples(&surface);
+
+			for (int ty = 0; ty < tilesY; ty++)
+			{
+				for (int tx = 0; tx < tilesX; tx++, tile++)
+				{
+					if (tile % count != size_t(shard - 1))
+						continue;
+
+					int x0 = tx * CPUTraceSelection::TileSize;
+					int y0 = ty * CPUTraceSelection::TileSize;
+					int x1 = std::min(x0 + (int)CPUTraceSelection::TileSize, width);
+					int y1 = std::min(y0 + (int)CPUTraceSelection::TileSize, height);
+					for (int y = y0; y < y1; y++)
+					{
+						for (int x = x0; x < x1; x++)
+						{
+							callback(samples[x + y * width]);
+						}
+					}
+				}
+			}
+		}
+
+		for (size_t i = shard - 1; i < mesh->lightProbes.size(); i += count)
+		{
+			callback(mesh->lightProbes[i].Color);
+		}
+	}
+
+	void SetMapName(BakeShardMap &map, const char *name)
+	{
+		memset(map.Name, 0, sizeof(map.Name));
+		strncpy(map.Name, name, sizeof(map.Name) - 1);
+	}
+}
+
+//==========================================================================
+//
+// BakeShardWriter
+//
+//==========================================================================
+
+BakeShardWriter::BakeShardWriter(const std::string &filename, int shard, int count) : Filename(filename), Shard(shard), Count(count)
+{
+	Data.resize(sizeof(BakeShardHeader));
+}
+
+int BakeShardWriter::Select(CPUTraceSelection &selection) const
+{
+	int selected = 0;
+	for (size_t i = 0; i < selection.Tiles.size(); i++)
+	{
+		bool inShard = i % Count == size_t(Shard - 1);
+		selection.Tiles[i] = selection.Tiles[i] && inShard;
+		selected += selection.Tiles[i] ? 1 : 0;
+	}
+	for (size_t i = 0; i < selection.Probes.size(); i++)
+	{
+		bool inShard = i % Count == size_t(Shard - 1);
+		selection.Probes[i] = selection.Probes[i] && inShard;
+		selected += selection.Probes[i] ? 1 : 0;
+	}
+	return selected;
+}
+
+void BakeShardWriter::Add(const char *mapName, LevelMesh *mesh, const CPUSceneLighting &lighting)
+{
+	std::vector<vec3> samples;
+	ForEachShardSample(mesh, Shard, Count, [&](const vec3 &sample) { samples.push_back(sample); });
+
+	BakeShardMap map;
+	SetMapName(map, mapName);
+	map.SceneKey = HashBakeScene(mesh, lighting);
+	map.NumSamples = samples.size();
+
+	size_t pos = Data.size();
+	Data.resize(pos + sizeof(map) + samples.size() * sizeof(vec3));
+	memcpy(Data.data() + pos, &map, sizeof(map));
+	if (!samples.empty())
+		memcpy(Data.data() + pos + sizeof(map), samples.data(), samples.size() * sizeof(vec3));
+	NumMaps++;
+
+	printf("   Shard %d of %d: %llu samples\n", Shard, Count, (unsigned long long)samples.size());
+}
+
+void BakeShardWriter::Close()
+{
+	BakeShardHeader header;
+	memcpy(header.Magic, "ZBSH", 4);
+	header.Version = BakeShardVersion;
+	header.Shard = Shard;
+	header.Count = Count;
+	header.NumMaps = NumMaps;
+	memcpy(Data.data(), &header, sizeof(header));
+
+	FILE *file = fopen(Filename.c_str(), "wb");
+	if (!file)
+	{
+		printf("Could not open %s for writing\n", Filename.c_str());
+		throw std::runtime_error("Could not write shard file");
+	}
+	bool ok = fwrite(Data.data(), Data.size(), 1, file) == 1;
+	if (fclose(file) != 0)
+		ok = false;
+	if (!ok)
+	{
+		printf("Could not write %s\n", Filename.c_str());
+		throw std::runtime_error("Could not write shard file");
+	}
+}
+
+//==========================================================================
+//
+// BakeShardMerger
+//
+//==========================================================================
+
+BakeShardMerger::BakeShardMerger(const std::vector<std::string> &filenames)
+{
+	Files.resize(filenames.size());
+	Filenames.resize(filenames.size());
+
+	for (const std::string &filename : filenames)
+	{
+		std::unique_ptr<FMappedFile> file = FMappedFile::Open(filename);
+		if (!file)
+		{
+			printf("Could not open %s\n", filename.c_str());
+			throw std::runtime_error("Could not read shard file");
+		}
+
+		BakeShardHeader header;
+		bool valid = file->Size() >= sizeof(header);
+		if (valid)
+		{
+			memcpy(&header, file->Data(), sizeof(header));
+			valid = memcmp(header.Magic, "ZBSH", 4) == 0 && header.Version == BakeShardVersion;
+		}
+		if (!valid)
+		{
+			printf("%s is not a shard file of this version\n", filename.c_str());
+			throw std::runtime_error("Could not read shard file");
+		}
+
+		if (header.Count != filenames.size() || header.Shard < 1 || header.Shard > header.Count)
+		{
+			printf("%s is shard %u of %u, but %d shard files were given\n", filename.c_str(), header.Shard, header.Count, (int)filenames.size());
+			throw std::runtime_error("Shard files do not match");
+		}
+
+		if (Files[header.Shard - 1])
+		{
+			printf("%s and %s are both shard %u\n", Filenames[header.Shard - 1].c_str(), filename.c_str(), header.Shard);
+			throw std::runtime_error("Shard files do not match");
+		}
+
+		Files[header.Shard - 1] = std::move(file);
+		Filenames[header.Shard - 1] = filename;
+	}
+}
+
+BakeShardMerger::~BakeShardMerger()
+{
+}
+
+void BakeShardMerger::Load(const char *mapName, LevelMesh *mesh, const CPUSceneLighting &lighting)
+{
+	FHash128 sceneKey = HashBakeScene(mesh, lighting);
+	int count = (int)Files.size();
+
+	for (int shard = 1; shard <= count; shard++)
+	{
+		const FMappedFile *file = Files[shard - 1].get();
+		BakeShardHeader header;
+		memcpy(&header, file->Data(), sizeof(header));
+
+		// Find the map among the maps of the file
+		const uint8_t *samples = nullptr;
+		size_t numSamples = 0;
+		size_t pos = sizeof(header);
+		for (uint64_t i = 0; i < header.NumMaps; i++)
+		{
+			BakeShardMap map;
+			if (file->Size() - pos < sizeof(map))
+				break;
+			memcpy(&map, file->Data() + pos, sizeof(map));
+			pos += sizeof(map);
+			if (map.NumSamples > (file->Size() - pos) / sizeof(vec3))
+				break;
+
+			if (map.SceneKey == sceneKey)
+			{
+				samples = file->Data() + pos;
+				numSamples = (size_t)map.NumSamples;
+				break;
+			}
+			pos += (size_t)map.NumSamples * sizeof(vec3);
+		}
+
+		if (!samples)
+		{
+			printf("%s has no samples of %s as it is now. Every shard must be traced with the same map and options.\n", Filenames[shard - 1].c_str(), mapName);
+			throw std::runtime_error("Shard files do not match");
+		}
+
+		size_t expected = 0;
+		ForEachShardSample(mesh, shard, count, [&](vec3 &) { expected++; });
+		if (expected != numSamples)
+		{
+			printf("%s has %llu samples of %s, but the map needs %llu\n", Filenames[shard - 1].c_str(), (unsigned long long)numSamples, mapName, (unsigned long long)expected);
+			throw std::runtime_error("Shard files do not match");
+		}
+
+		size_t index = 0;
+		ForEachShardSample(mesh, shard, count, [&](vec3 &sample) { memcpy(&sample, samples + (index++) * sizeof(vec3), sizeof(vec3)); });
+	}
+
+	printf("Samples of %s merged from %d shards\n", mapName, count);
+}
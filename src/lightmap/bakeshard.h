@@ -0,0 +1,73 @@
+#pragma once
+
+#include "framework/hash.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+class LevelMesh;
+class FMappedFile;
+struct CPUSceneLighting;
+struct CPUTraceSelection;
+
+// A sharded bake splits the CPU ray tracing of a wad between processes that
+// each trace one shard, for example one per NUMA node. Shard K of N traces
+// the tiles of CPUTraceSelection whose index modulo N is K - 1, and the light
+// probes the same way, which spreads the expensive parts of the map evenly.
+// Every shard builds the nodes and the level mesh itself, so the processes
+// share nothing but the input wad.
+//
+// A shard writes the samples of its tiles and probes for each map to a shard
+// file instead of a wad. The merge run builds the maps again, fills in the
+// samples from the files of all shards and writes the wad. Samples are only
+// taken from a shard traced with the same mesh, lighting and trace settings
+// (see HashBakeScene), and since every texel is traced the same way in any
+// process, the lightmaps are the same as those of a single run.
+//
+// A shard file is a BakeShardHeader, then for each map a BakeShardMap and
+// its samples, three floats each, in the order of the tiles and probes of
+// the shard. The texels of a tile are stored row by row.
+
+// Traces one shard and writes its samples
+class BakeShardWriter
+{
+public:
+	// shard is 1 to count
+	BakeShardWriter(const std::string &filename, int shard, int count);
+
+	// Leaves only the tiles and probes of this shard selected. Returns the
+	// number still selected.
+	int Select(CPUTraceSelection &selection) const;
+
+	// Adds the samples of this shard of a map that has been traced
+	void Add(const char *mapName, LevelMesh *mesh, const CPUSceneLighting &lighting);
+
+	// Writes the file
+	void Close();
+
+private:
+	std::string Filename;
+	int Shard;
+	int Count;
+	int NumMaps = 0;
+	std::vector<uint8_t> Data;
+};
+
+// Puts the samples of every shard of a bake together
+class BakeShardMerger
+{
+public:
+	// The files written by every shard of a bake, in any order
+	BakeShardMerger(const std::vector<std::string> &filenames);
+	~BakeShardMerger();
+
+	// Fills in the samples of a map from the shard files. Throws if a shard
+	// has no samples of it for this scene.
+	void Load(const char *mapName, LevelMesh *mesh, const CPUSceneLighting &lighting);
+
+	int GetCount() const { return (int)Files.size(); }
+
+private:
+	std::vector<std::unique_ptr<FMappedFile>> Files;	// Shard 1 first
+	std::vector<std::string> Filenames;
+};
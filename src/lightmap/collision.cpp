@@ -28,8 +28,10 @@
 #include <immintrin.h>
 #endif
 
-TriangleMeshShape::TriangleMeshShape(const vec3 *vertices, int num_vertices, const unsigned int *elements, int num_elements)
-	: vertices(vertices), num_vertices(num_vertices), elements(elements), num_elements(num_elements)
+static thread_local TraceStats trace_stats;
+
+TriangleMeshShape::TriangleMeshShape(const vec3 *vertices, int num_vertices, const unsigned int *elements, int num_elements, bool watertight)
+	: vertices(vertices), num_vertices(num_vertices), elements(elements), num_elements(num_elements), watertight(watertight)
 {
 	int num_triangles = num_elements / 3;
 	if (num_triangles <= 0)
@@ -50,7 +52,11 @@ TriangleMeshShape::TriangleMeshShape(const vec3 *vertices, int num_vertices, con
 
 	std::vector<int> work_buffer(num_triangles * 2);
 
+	leaves.reserve(num_triangles);
 	root = subdivide(&triangles[0], (int)triangles.size(), &centroids[0], &work_buffer[0]);
+
+	if (watertight)
+		create_packets();
 }
 
 float TriangleMeshShape::sweep(TriangleMeshShape *shape1, SphereShape *shape2, const vec3 &target)
@@ -70,12 +76,19 @@ bool TriangleMeshShape::find_any_hit(TriangleMeshShape *shape1, SphereShape *sha
 
 bool TriangleMeshShape::find_any_hit(TriangleMeshShape *shape, const vec3 &ray_start, const vec3 &ray_end)
 {
-	return find_any_hit(shape, RayBBox(ray_start, ray_end), shape->root);
+	TRACE_COUNTER_ADD(trace_stats.rays, 1);
+
+	RayBBox ray(ray_start, ray_end);
+	ShearedRay sheared;
+	if (shape->watertight)
+		sheared = ShearedRay(ray);
+	return find_any_hit(shape, ray, sheared, shape->root);
 }
 
 TraceHit TriangleMeshShape::find_first_hit(TriangleMeshShape *shape, const vec3 &ray_start, const vec3 &ray_end)
 {
 	TraceHit hit;
+	TRACE_COUNTER_ADD(trace_stats.rays, 1);
 
 	// Perform segmented tracing to keep the ray AABB box smaller
 
@@ -87,7 +100,12 @@ TraceHit TriangleMeshShape::find_first_hit(TriangleMeshShape *shape, const vec3
 		float segstart = t / tracedist;
 		float segend = std::min(t + segmentlen, tracedist) / tracedist;
 
-		find_first_hit(shape, RayBBox(ray_start + ray_dir * segstart, ray_start + ray_dir * segend), shape->root, &hit);
+		RayBBox ray(ray_start + ray_dir * segstart, ray_start + ray_dir * segend);
+		ShearedRay sheared;
+		if (shape->watertight)
+			sheared = ShearedRay(ray);
+
+		find_first_hit(shape, ray, sheared, shape->root, &hit);
 		if (hit.fraction < 1.0f)
 		{
 			hit.fraction = segstart * (1.0f - hit.fraction) + segend * hit.fraction;
@@ -98,6 +116,13 @@ TraceHit TriangleMeshShape::find_first_hit(TriangleMeshShape *shape, const vec3
 	return hit;
 }
 
+TraceStats TriangleMeshShape::take_trace_stats()
+{
+	TraceStats stats = trace_stats;
+	trace_stats = TraceStats();
+	return stats;
+}
+
 float TriangleMeshShape::sweep(TriangleMeshShape *shape1, SphereShape *shape2, int a, const vec3 &target)
 {
 	if (sweep_overlap_bv_sphere(shape1, shape2, a, target))
@@ -186,73 +211,89 @@ bool TriangleMeshShape::find_any_hit(TriangleMeshShape *shape1, TriangleMeshShap
 	}
 }
 
-bool TriangleMeshShape::find_any_hit(TriangleMeshShape *shape, const RayBBox &ray, int a)
+bool TriangleMeshShape::find_any_hit(TriangleMeshShape *shape, const RayBBox &ray, const ShearedRay &sheared, int a)
 {
 	if (overlap_bv_ray(shape, ray, a))
 	{
-		if (shape->is_leaf(a))
+		const Node &node = shape->nodes[a];
+		if (node.leaf_index != -1 || node.packet_index != -1)
 		{
+			int leaf_index;
 			float baryB, baryC;
-			return intersect_triangle_ray(shape, ray, a, baryB, baryC) < 1.0f;
+			return intersect_leaf_ray(shape, ray, sheared, a, leaf_index, baryB, baryC) < 1.0f;
 		}
 		else
 		{
-			if (find_any_hit(shape, ray, shape->nodes[a].left))
+			if (find_any_hit(shape, ray, sheared, node.left))
 				return true;
 			else
-				return find_any_hit(shape, ray, shape->nodes[a].right);
+				return find_any_hit(shape, ray, sheared, node.right);
 		}
 	}
 	return false;
 }
 
-void TriangleMeshShape::find_first_hit(TriangleMeshShape *shape, const RayBBox &ray, int a, TraceHit *hit)
+void TriangleMeshShape::find_first_hit(TriangleMeshShape *shape, const RayBBox &ray, const ShearedRay &sheared, int a, TraceHit *hit)
 {
 	if (overlap_bv_ray(shape, ray, a))
 	{
-		if (shape->is_leaf(a))
+		const Node &node = shape->nodes[a];
+		if (node.leaf_index != -1 || node.packet_index != -1)
 		{
+			int leaf_index;
 			float baryB, baryC;
-			float t = intersect_triangle_ray(shape, ray, a, baryB, baryC);
+			float t = intersect_leaf_ray(shape, ray, sheared, a, leaf_index, baryB, baryC);
 			if (t < hit->fraction)
 			{
 				hit->fraction = t;
-				hit->triangle = shape->nodes[a].element_index / 3;
+				hit->triangle = shape->leaves[leaf_index].triangle;
 				hit->b = baryB;
 				hit->c = baryC;
 			}
 		}
 		else
 		{
-			find_first_hit(shape, ray, shape->nodes[a].left, hit);
-			find_first_hit(shape, ray, shape->nodes[a].right, hit);
+			find_first_hit(shape, ray, sheared, node.left, hit);
+			find_first_hit(shape, ray, sheared, node.right, hit);
 		}
 	}
 }
 
 bool TriangleMeshShape::overlap_bv_ray(TriangleMeshShape *shape, const RayBBox &ray, int a)
 {
+	TRACE_COUNTER_ADD(trace_stats.nodes, 1);
 	return IntersectionTest::ray_aabb(ray, shape->nodes[a].aabb) == IntersectionTest::overlap;
 }
 
-float TriangleMeshShape::intersect_triangle_ray(TriangleMeshShape *shape, const RayBBox &ray, int a, float &barycentricB, float &barycentricC)
+float TriangleMeshShape::intersect_leaf_ray(TriangleMeshShape *shape, const RayBBox &ray, const ShearedRay &sheared, int a, int &leaf_index, float &barycentricB, float &barycentricC)
 {
-	const int start_element = shape->nodes[a].element_index;
-
-	vec3 p[3] =
+	const Node &node = shape->nodes[a];
+	if (node.packet_index != -1)
 	{
-		shape->vertices[shape->elements[start_element]],
-		shape->vertices[shape->elements[start_element + 1]],
-		shape->vertices[shape->elements[start_element + 2]]
-	};
+		TRACE_COUNTER_ADD(trace_stats.triangles, shape->packets[node.packet_index].count);
+		return intersect_packet_ray(shape, ray, sheared, node.packet_index, leaf_index, barycentricB, barycentricC);
+	}
+
+	TRACE_COUNTER_ADD(trace_stats.triangles, 1);
+	leaf_index = node.leaf_index;
+	if (shape->watertight)
+		return intersect_triangle_ray_watertight(shape, ray, sheared, leaf_index, barycentricB, barycentricC);
+	else
+		return intersect_triangle_ray(shape, ray, leaf_index, barycentricB, barycentricC);
+}
+
+float TriangleMeshShape::intersect_triangle_ray(TriangleMeshShape *shape, const RayBBox &ray, int leaf_index, float &barycentricB, float &barycentricC)
+{
+	const Leaf &leaf = shape->leaves[leaf_index];
+	const vec3 *p = leaf.p;
 
 	// MoellerTrumbore ray-triangle intersection algorithm:
 
-	vec3 D = ray.end - ray.start;
+	const vec3 &D = ray.dir;
 
-	// Find vectors for two edges sharing p[0]
-	vec3 e1 = p[1] - p[0];
-	vec3 e2 = p[2] - p[0];
+	// Vectors for the two edges sharing p[0]
+	const vec3 &e1 = leaf.e1;
+	const vec3 &e2 = leaf.e2;
 
 	// Begin calculating determinant - also used to calculate u parameter
 	vec3 P = cross(D, e2);
@@ -299,6 +340,156 @@ float TriangleMeshShape::intersect_triangle_ray(TriangleMeshShape *shape, const
 	return t;
 }
 
+TriangleMeshShape::ShearedRay::ShearedRay(const RayBBox &ray)
+{
+	float dx = std::abs(ray.dir.x);
+	float dy = std::abs(ray.dir.y);
+	float dz = std::abs(ray.dir.z);
+	kz = dx > dy ? (dx > dz ? 0 : 2) : (dy > dz ? 1 : 2);
+	kx = kz == 2 ? 0 : kz + 1;
+	ky = kx == 2 ? 0 : kx + 1;
+
+	// Keep the winding of the triangles as seen along the ray
+	if (ray.dir[kz] < 0.0f)
+		std::swap(kx, ky);
+
+	sx = ray.dir[kx] / ray.dir[kz];
+	sy = ray.dir[ky] / ray.dir[kz];
+	sz = 1.0f / ray.dir[kz];
+}
+
+float TriangleMeshShape::intersect_triangle_ray_watertight(TriangleMeshShape *shape, const RayBBox &ray, const ShearedRay &sheared, int leaf_index, float &barycentricB, float &barycentricC)
+{
+	// Watertight ray-triangle intersection (Woop, Benthin, Wald 2013):
+	//
+	// The vertices are moved into a space where the ray starts at the origin
+	// and goes along z. The signs of the 2D edge functions then decide if the
+	// ray is inside, and as neighbouring triangles compute the same values for
+	// a shared edge, a ray can not pass between them.
+
+	const Leaf &leaf = shape->leaves[leaf_index];
+	int kx = sheared.kx, ky = sheared.ky, kz = sheared.kz;
+
+	vec3 A = leaf.p[0] - ray.start;
+	vec3 B = leaf.p[1] - ray.start;
+	vec3 C = leaf.p[2] - ray.start;
+
+	float ax = A[kx] - sheared.sx * A[kz];
+	float ay = A[ky] - sheared.sy * A[kz];
+	float bx = B[kx] - sheared.sx * B[kz];
+	float by = B[ky] - sheared.sy * B[kz];
+	float cx = C[kx] - sheared.sx * C[kz];
+	float cy = C[ky] - sheared.sy * C[kz];
+
+	float U = cx * by - cy * bx;
+	float V = ax * cy - ay * cx;
+	float W = bx * ay - by * ax;
+
+	// The ray goes through an edge or a vertex. The products are exact in
+	// double precision, so the signs are right there.
+	if (U == 0.0f || V == 0.0f || W == 0.0f)
+	{
+		U = (float)((double)cx * (double)by - (double)cy * (double)bx);
+		V = (float)((double)ax * (double)cy - (double)ay * (double)cx);
+		W = (float)((double)bx * (double)ay - (double)by * (double)ax);
+	}
+
+	if ((U < 0.0f || V < 0.0f || W < 0.0f) && (U > 0.0f || V > 0.0f || W > 0.0f))
+		return 1.0f;
+
+	float det = U + V + W;
+	if (det == 0.0f)
+		return 1.0f;
+
+	float az = sheared.sz * A[kz];
+	float bz = sheared.sz * B[kz];
+	float cz = sheared.sz * C[kz];
+	float T = U * az + V * bz + W * cz;
+
+	float inv_det = 1.0f / det;
+	float t = T * inv_det;
+	if (!(t > FLT_EPSILON && t < 1.0f))
+		return 1.0f;
+
+	barycentricB = V * inv_det;
+	barycentricC = W * inv_det;
+	return t;
+}
+
+float TriangleMeshShape::intersect_packet_ray(TriangleMeshShape *shape, const RayBBox &ray, const ShearedRay &sheared, int packet_index, int &leaf_index, float &barycentricB, float &barycentricC)
+{
+	const LeafPacket &packet = shape->packets[packet_index];
+
+	float lane_t[4], lane_b[4], lane_c[4];
+	int hit_mask = 0;
+	int edge_mask = (1 << packet.count) - 1;
+
+#ifndef NO_SSE
+	// Same steps as intersect_triangle_ray_watertight, for four triangles at once.
+	// Lanes where the ray goes through an edge are done again one at a time.
+
+	int kx = sheared.kx, ky = sheared.ky, kz = sheared.kz;
+	__m128 sx = _mm_set1_ps(sheared.sx);
+	__m128 sy = _mm_set1_ps(sheared.sy);
+	__m128 sz = _mm_set1_ps(sheared.sz);
+	__m128 ox = _mm_set1_ps(ray.start[kx]);
+	__m128 oy = _mm_set1_ps(ray.start[ky]);
+	__m128 oz = _mm_set1_ps(ray.start[kz]);
+
+	__m128 x[3], y[3], z[3];
+	for (int i = 0; i < 3; i++)
+	{
+		__m128 pz = _mm_sub_ps(_mm_loadu_ps(packet.p[i][kz]), oz);
+		x[i] = _mm_sub_ps(_mm_sub_ps(_mm_loadu_ps(packet.p[i][kx]), ox), _mm_mul_ps(sx, pz));
+		y[i] = _mm_sub_ps(_mm_sub_ps(_mm_loadu_ps(packet.p[i][ky]), oy), _mm_mul_ps(sy, pz));
+		z[i] = _mm_mul_ps(sz, pz);
+	}
+
+	__m128 U = _mm_sub_ps(_mm_mul_ps(x[2], y[1]), _mm_mul_ps(y[2], x[1]));
+	__m128 V = _mm_sub_ps(_mm_mul_ps(x[0], y[2]), _mm_mul_ps(y[0], x[2]));
+	__m128 W = _mm_sub_ps(_mm_mul_ps(x[1], y[0]), _mm_mul_ps(y[1], x[0]));
+
+	__m128 zero = _mm_setzero_ps();
+	__m128 negative = _mm_or_ps(_mm_or_ps(_mm_cmplt_ps(U, zero), _mm_cmplt_ps(V, zero)), _mm_cmplt_ps(W, zero));
+	__m128 positive = _mm_or_ps(_mm_or_ps(_mm_cmpgt_ps(U, zero), _mm_cmpgt_ps(V, zero)), _mm_cmpgt_ps(W, zero));
+	__m128 edge = _mm_or_ps(_mm_or_ps(_mm_cmpeq_ps(U, zero), _mm_cmpeq_ps(V, zero)), _mm_cmpeq_ps(W, zero));
+
+	__m128 det = _mm_add_ps(_mm_add_ps(U, V), W);
+	__m128 T = _mm_add_ps(_mm_add_ps(_mm_mul_ps(U, z[0]), _mm_mul_ps(V, z[1])), _mm_mul_ps(W, z[2]));
+	__m128 inv_det = _mm_div_ps(_mm_set1_ps(1.0f), det);
+	__m128 t = _mm_mul_ps(T, inv_det);
+
+	__m128 hit = _mm_andnot_ps(_mm_and_ps(negative, positive), _mm_cmpneq_ps(det, zero));
+	hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpgt_ps(t, _mm_set1_ps(FLT_EPSILON)), _mm_cmplt_ps(t, _mm_set1_ps(1.0f))));
+
+	_mm_storeu_ps(lane_t, t);
+	_mm_storeu_ps(lane_b, _mm_mul_ps(V, inv_det));
+	_mm_storeu_ps(lane_c, _mm_mul_ps(W, inv_det));
+	edge_mask &= _mm_movemask_ps(edge);
+	hit_mask = _mm_movemask_ps(hit) & ~edge_mask;
+#endif
+
+	// Pick the nearest hit. Ties go to the first leaf, like they do when the
+	// leaves are visited one by one.
+	float fraction = 1.0f;
+	for (int i = 0; i < packet.count; i++)
+	{
+		if (edge_mask & (1 << i))
+			lane_t[i] = intersect_triangle_ray_watertight(shape, ray, sheared, packet.first_leaf + i, lane_b[i], lane_c[i]);
+		else if (!(hit_mask & (1 << i)))
+			continue;
+
+		if (lane_t[i] < fraction)
+		{
+			fraction = lane_t[i];
+			leaf_index = packet.first_leaf + i;
+			barycentricB = lane_b[i];
+			barycentricC = lane_c[i];
+		}
+	}
+	return fraction;
+}
+
 bool TriangleMeshShape::sweep_overlap_bv_sphere(TriangleMeshShape *shape1, SphereShape *shape2, int a, const vec3 &target)
 {
 	// Convert to ray test by expanding the AABB:
@@ -311,14 +502,7 @@ bool TriangleMeshShape::sweep_overlap_bv_sphere(TriangleMeshShape *shape1, Spher
 
 float TriangleMeshShape::sweep_intersect_triangle_sphere(TriangleMeshShape *shape1, SphereShape *shape2, int a, const vec3 &target)
 {
-	const int start_element = shape1->nodes[a].element_index;
-
-	vec3 p[3] =
-	{
-		shape1->vertices[shape1->elements[start_element]],
-		shape1->vertices[shape1->elements[start_element + 1]],
-		shape1->vertices[shape1->elements[start_element + 2]]
-	};
+	const vec3 *p = shape1->leaves[shape1->nodes[a].leaf_index].p;
 
 	vec3 c = shape2->center;
 	vec3 e = target;
@@ -484,12 +668,12 @@ bool TriangleMeshShape::overlap_triangle_sphere(TriangleMeshShape *shape1, Spher
 {
 	// http://realtimecollisiondetection.net/blog/?p=103
 
-	int element_index = shape1->nodes[shape1_node_index].element_index;
+	const vec3 *p = shape1->leaves[shape1->nodes[shape1_node_index].leaf_index].p;
 
 	vec3 P = shape2->center;
-	vec3 A = shape1->vertices[shape1->elements[element_index]] - P;
-	vec3 B = shape1->vertices[shape1->elements[element_index + 1]] - P;
-	vec3 C = shape1->vertices[shape1->elements[element_index + 2]] - P;
+	vec3 A = p[0] - P;
+	vec3 B = p[1] - P;
+	vec3 C = p[2] - P;
 	float r = shape2->radius;
 	float rr = r * r;
 
@@ -536,7 +720,7 @@ bool TriangleMeshShape::overlap_triangle_sphere(TriangleMeshShape *shape1, Spher
 
 bool TriangleMeshShape::is_leaf(int node_index)
 {
-	return nodes[node_index].element_index != -1;
+	return nodes[node_index].leaf_index != -1;
 }
 
 float TriangleMeshShape::volume(int node_index)
@@ -550,7 +734,7 @@ int TriangleMeshShape::get_min_depth() const
 	std::function<int(int, int)> visit;
 	visit = [&](int level, int node_index) -> int {
 		const Node &node = nodes[node_index];
-		if (node.element_index == -1)
+		if (node.leaf_index == -1)
 			return std::min(visit(level + 1, node.left), visit(level + 1, node.right));
 		else
 			return level;
@@ -563,7 +747,7 @@ int TriangleMeshShape::get_max_depth() const
 	std::function<int(int, int)> visit;
 	visit = [&](int level, int node_index) -> int {
 		const Node &node = nodes[node_index];
-		if (node.element_index == -1)
+		if (node.leaf_index == -1)
 			return std::max(visit(level + 1, node.left), visit(level + 1, node.right));
 		else
 			return level;
@@ -571,12 +755,37 @@ int TriangleMeshShape::get_max_depth() const
 	return visit(1, root);
 }
 
+std::vector<int> TriangleMeshShape::get_depth_histogram() const
+{
+	std::vector<int> histogram;
+	if (nodes.empty())
+		return histogram;
+
+	std::function<void(int, int)> visit;
+	visit = [&](int level, int node_index) {
+		const Node &node = nodes[node_index];
+		if (node.leaf_index == -1)
+		{
+			visit(level + 1, node.left);
+			visit(level + 1, node.right);
+		}
+		else
+		{
+			if ((int)histogram.size() <= level)
+				histogram.resize(level + 1);
+			histogram[level]++;
+		}
+	};
+	visit(1, root);
+	return histogram;
+}
+
 float TriangleMeshShape::get_average_depth() const
 {
 	std::function<float(int, int)> visit;
 	visit = [&](int level, int node_index) -> float {
 		const Node &node = nodes[node_index];
-		if (node.element_index == -1)
+		if (node.leaf_index == -1)
 			return visit(level + 1, node.left) + visit(level + 1, node.right);
 		else
 			return (float)level;
@@ -623,7 +832,17 @@ int TriangleMeshShape::subdivide(int *triangles, int num_triangles, const vec3 *
 
 	if (num_triangles == 1) // Leaf node
 	{
-		nodes.push_back(Node(min, max, triangles[0] * 3));
+		int element_index = triangles[0] * 3;
+		Leaf leaf;
+		leaf.p[0] = vertices[elements[element_index]];
+		leaf.p[1] = vertices[elements[element_index + 1]];
+		leaf.p[2] = vertices[elements[element_index + 2]];
+		leaf.e1 = leaf.p[1] - leaf.p[0];
+		leaf.e2 = leaf.p[2] - leaf.p[0];
+		leaf.triangle = triangles[0];
+		leaves.push_back(leaf);
+
+		nodes.push_back(Node(min, max, (int)leaves.size() - 1));
 		return (int)nodes.size() - 1;
 	}
 
@@ -705,6 +924,64 @@ int TriangleMeshShape::subdivide(int *triangles, int num_triangles, const vec3 *
 	return (int)nodes.size() - 1;
 }
 
+void TriangleMeshShape::create_packets()
+{
+	// Children are created before their parent, so the leaf range of every
+	// node can be found in a single pass
+	std::vector<int> first_leaf(nodes.size());
+	std::vector<int> leaf_count(nodes.size());
+	for (size_t i = 0; i < nodes.size(); i++)
+	{
+		const Node &node = nodes[i];
+		if (node.leaf_index != -1)
+		{
+			first_leaf[i] = node.leaf_index;
+			leaf_count[i] = 1;
+		}
+		else
+		{
+			first_leaf[i] = first_leaf[node.left];
+			leaf_count[i] = leaf_count[node.left] + leaf_count[node.right];
+		}
+	}
+
+	// Give the largest subtrees with no more than four leaves a packet each
+	std::vector<int> stack;
+	stack.push_back(root);
+	while (!stack.empty())
+	{
+		int a = stack.back();
+		stack.pop_back();
+
+		Node &node = nodes[a];
+		if (node.leaf_index != -1)
+			continue;
+
+		if (leaf_count[a] > 4)
+		{
+			stack.push_back(node.right);
+			stack.push_back(node.left);
+			continue;
+		}
+
+		LeafPacket packet;
+		packet.first_leaf = first_leaf[a];
+		packet.count = leaf_count[a];
+		for (int lane = 0; lane < 4; lane++)
+		{
+			// Unused lanes repeat the last triangle
+			const Leaf &leaf = leaves[packet.first_leaf + std::min(lane, packet.count - 1)];
+			for (int i = 0; i < 3; i++)
+			{
+				for (int axis = 0; axis < 3; axis++)
+					packet.p[i][axis][lane] = leaf.p[i][axis];
+			}
+		}
+		node.packet_index = (int)packets.size();
+		packets.push_back(packet);
+	}
+}
+
 /////////////////////////////////////////////////////////////////////////////
 
 IntersectionTest::Result IntersectionTest::plane_aabb(const vec4 &plane, const BBox &aabb)
@@ -25,6 +25,7 @@
 #include "math/mathlib.h"
 #include <vector>
 #include <cmath>
+#include <cstdint>
 
 class SphereShape
 {
@@ -67,6 +68,7 @@ class RayBBox
 public:
 	RayBBox(const vec3 &ray_start, const vec3 &ray_end) : start(ray_start), end(ray_end)
 	{
+		dir = ray_end - ray_start;
 		c = (ray_start + ray_end) * 0.5f;
 		w = ray_end - c;
 		v.x = std::abs(w.x);
@@ -75,18 +77,39 @@ public:
 	}
 
 	vec3 start, end;
+	vec3 dir;
 	vec3 c, w, v;
 	float ssePadding = 0.0f; // Needed to safely load v directly into a sse register
 };
 
+// Building with NO_TRACE_COUNTERS leaves out the ray tracing counters, here
+// and in the CPU ray tracer, so they cost nothing.
+#ifdef NO_TRACE_COUNTERS
+#define TRACE_COUNTER_ADD(counter, value) ((void)0)
+#else
+#define TRACE_COUNTER_ADD(counter, value) ((counter) += (value))
+#endif
+
+// Ray queries made, BVH nodes visited and ray/triangle tests done by one thread
+struct TraceStats
+{
+	int64_t rays = 0;
+	int64_t nodes = 0;
+	int64_t triangles = 0;
+};
+
 class TriangleMeshShape
 {
 public:
-	TriangleMeshShape(const vec3 *vertices, int num_vertices, const unsigned int *elements, int num_elements);
+	// With watertight set, rays are tested with the watertight algorithm of
+	// Woop, Benthin and Wald instead of Moeller-Trumbore, and subtrees with
+	// up to four triangles are tested together.
+	TriangleMeshShape(const vec3 *vertices, int num_vertices, const unsigned int *elements, int num_elements, bool watertight = false);
 
 	int get_min_depth() const;
 	int get_max_depth() const;
 	float get_average_depth() const;
+	std::vector<int> get_depth_histogram() const;	// Number of leaves at each depth, the root being at depth 1
 	float get_balanced_depth() const;
 
 	const CollisionBBox &get_bbox() const { return nodes[root].aabb; }
@@ -99,17 +122,51 @@ public:
 
 	static TraceHit find_first_hit(TriangleMeshShape *shape, const vec3 &ray_start, const vec3 &ray_end);
 
+	// Returns the counts of the calling thread and resets them
+	static TraceStats take_trace_stats();
+
 private:
 	struct Node
 	{
 		Node() = default;
-		Node(const vec3 &aabb_min, const vec3 &aabb_max, int element_index) : aabb(aabb_min, aabb_max), element_index(element_index) { }
+		Node(const vec3 &aabb_min, const vec3 &aabb_max, int leaf_index) : aabb(aabb_min, aabb_max), leaf_index(leaf_index) { }
 		Node(const vec3 &aabb_min, const vec3 &aabb_max, int left, int right) : aabb(aabb_min, aabb_max), left(left), right(right) { }
 
 		CollisionBBox aabb;
 		int left = -1;
 		int right = -1;
-		int element_index = -1;
+		int leaf_index = -1;	// Index into leaves, -1 if the node is not a leaf
+		int packet_index = -1;	// Index into packets if the whole subtree is tested at once
+	};
+
+	// The triangle of a leaf node. They are copied out of the vertex and
+	// element arrays in the order the leaves are created, so neighbouring
+	// leaves of the tree are next to each other in memory too, and the
+	// leaves of any subtree are a single range.
+	struct Leaf
+	{
+		vec3 p[3];
+		vec3 e1, e2;	// p[1] - p[0] and p[2] - p[0]
+		int triangle;	// Triangle number in elements
+	};
+
+	// Up to four consecutive leaves with the coordinates stored per lane
+	struct alignas(16) LeafPacket
+	{
+		float p[3][3][4];	// Vertex, axis, lane
+		int first_leaf;
+		int count;
+	};
+
+	// The ray transformed for the watertight test. The axis where the
+	// direction is largest becomes z, and the shear maps the direction onto it.
+	struct ShearedRay
+	{
+		ShearedRay() = default;
+		ShearedRay(const RayBBox &ray);
+
+		int kx = 0, ky = 1, kz = 2;
+		float sx = 0.0f, sy = 0.0f, sz = 0.0f;
 	};
 
 	const vec3 *vertices = nullptr;
@@ -118,18 +175,24 @@ private:
 	int num_elements = 0;
 
 	std::vector<Node> nodes;
+	std::vector<Leaf> leaves;
+	std::vector<LeafPacket> packets;
+	bool watertight = false;
 	int root = -1;
 
 	static float sweep(TriangleMeshShape *shape1, SphereShape *shape2, int a, const vec3 &target);
 
 	static bool find_any_hit(TriangleMeshShape *shape1, TriangleMeshShape *shape2, int a, int b);
 	static bool find_any_hit(TriangleMeshShape *shape1, SphereShape *shape2, int a);
-	static bool find_any_hit(TriangleMeshShape *shape1, const RayBBox &ray, int a);
+	static bool find_any_hit(TriangleMeshShape *shape1, const RayBBox &ray, const ShearedRay &sheared, int a);
 
-	static void find_first_hit(TriangleMeshShape *shape1, const RayBBox &ray, int a, TraceHit *hit);
+	static void find_first_hit(TriangleMeshShape *shape1, const RayBBox &ray, const ShearedRay &sheared, int a, TraceHit *hit);
 
 	inline static bool overlap_bv_ray(TriangleMeshShape *shape, const RayBBox &ray, int a);
-	inline static float intersect_triangle_ray(TriangleMeshShape *shape, const RayBBox &ray, int a, float &barycentricB, float &barycentricC);
+	inline static float intersect_triangle_ray(TriangleMeshShape *shape, const RayBBox &ray, int leaf_index, float &barycentricB, float &barycentricC);
+	static float intersect_triangle_ray_watertight(TriangleMeshShape *shape, const RayBBox &ray, const ShearedRay &sheared, int leaf_index, float &barycentricB, float &barycentricC);
+	static float intersect_packet_ray(TriangleMeshShape *shape, const RayBBox &ray, const ShearedRay &sheared, int packet_index, int &leaf_index, float &barycentricB, float &barycentricC);
+	inline static float intersect_leaf_ray(TriangleMeshShape *shape, const RayBBox &ray, const ShearedRay &sheared, int a, int &leaf_index, float &barycentricB, float &barycentricC);
 
 	inline static bool sweep_overlap_bv_sphere(TriangleMeshShape *shape1, SphereShape *shape2, int a, const vec3 &target);
 	inline static float sweep_intersect_triangle_sphere(TriangleMeshShape *shape1, SphereShape *shape2, int a, const vec3 &target);
@@ -144,6 +207,7 @@ private:
 	inline float volume(int node_index);
 
 	int subdivide(int *triangles, int num_triangles, const vec3 *centroids, int *work_buffer);
+	void create_packets();
 };
 
 class OrientedBBox
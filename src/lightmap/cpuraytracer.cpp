@@ -3,16 +3,17 @@
 #include "levelmesh.h"
 #include "level/level.h"
 #include "cpuraytracer.h"
+#include "bakecheckpoint.h"
 #include "framework/binfile.h"
 #include "framework/templates.h"
 #include "framework/halffloat.h"
+#include "framework/timeline.h"
 #include "surfaceclip.h"
 #include <map>
 #include <vector>
 #include <algorithm>
 #include <thread>
 #include <condition_variable>
-#include <atomic>
 
 extern bool VKDebug;
 extern int NumThreads;
@@ -20,6 +21,12 @@ extern int NumThreads;
 extern int coverageSampleCount;
 extern int bounceSampleCount;
 
+// Tasks traced between two chances to write a checkpoint
+static const int CheckpointBatchSize = 65536;
+
+// Counts of the calling thread, added to CPURaytracer::Stats when it finishes
+static thread_local CPUTraceCounters ThreadCounters;
+
 CPURaytracer::CPURaytracer()
 {
 }
@@ -30,22 +37,81 @@ CPURaytracer::~CPURaytracer()
 
 void CPURaytracer::Raytrace(LevelMesh* level)
 {
-	mesh = level;
+	CPUSceneLighting lighting;
+	lighting.Gather(level);
+	Raytrace(level, lighting);
+}
+
+void CPURaytracer::Raytrace(LevelMesh* level, const CPUSceneLighting& lighting, const CPUTraceSelection* selection)
+{
+	TIMELINE_SCOPE("Ray trace");
+
+	if (level != mesh || !CollisionMesh)
+	{
+		TIMELINE_SCOPE("Build BVH");
+		mesh = level;
+		CollisionMesh = std::make_unique<TriangleMeshShape>(mesh->MeshVertices.Data(), mesh->MeshVertices.Size(), mesh->MeshElements.Data(), mesh->MeshElements.Size(), WatertightTrace);
+	}
 
 	std::vector<CPUTraceTask> tasks;
 
-	CreateTasks(tasks);
+	{
+		TIMELINE_SCOPE("Gather trace tasks");
+		CreateTasks(tasks, selection);
+	}
+
+	Stats = CPUTraceStats();
+	if (mesh->MeshElements.Size() > 0)
+	{
+		Stats.BVHMinDepth = CollisionMesh->get_min_depth();
+		Stats.BVHMaxDepth = CollisionMesh->get_max_depth();
+		Stats.BVHDepthHistogram = CollisionMesh->get_depth_histogram();
+	}
 
-	CollisionMesh = std::make_unique<TriangleMeshShape>(mesh->MeshVertices.Data(), mesh->MeshVertices.Size(), mesh->MeshElements.Data(), mesh->MeshElements.Size());
 	CreateHemisphereVectors();
-	CreateLights();
+	CreateSampleOffsets();
+	{
+		TIMELINE_SCOPE("Surface info");
+		CreateSurfaceInfo(lighting);
+	}
+
+	Lights = lighting.Lights;
+	SunDir = lighting.SunDir;
+	SunColor = lighting.SunColor;
+	LightBounce = lighting.LightBounce;
 
 	//printf("Ray tracing with %d bounce(s)\n", mesh->map->LightBounce);
 	printf("Ray tracing in progress...\n");
 
-	RunJob((int)tasks.size(), [=](int id) { RaytraceTask(tasks[id]); });
+	int count = (int)tasks.size();
+	if (!Checkpoint)
+	{
+		RunJob(0, count, count, [&](int id) { RaytraceTask(tasks[id]); });
+	}
+	else
+	{
+		int done = (int)Checkpoint->Begin(mesh, lighting, tasks);
+		if (done == count)
+			printf("\r%.1f%%\t%d/%d\n", 100.0, count, count);
+		while (done < count)
+		{
+			int batch = std::min(CheckpointBatchSize, count - done);
+			RunJob(done, batch, count, [&](int id) { RaytraceTask(tasks[id]); });
+			done += batch;
+			Checkpoint->Update(done);
+		}
+		Checkpoint->Finish();
+	}
 
 	printf("\nRay tracing complete\n");
+#ifndef NO_TRACE_COUNTERS
+	const CPUTraceCounters& counters = Stats.Counters;
+	double rays = (double)std::max(counters.Rays, (int64_t)1);
+	printf("   %lld rays, %.1f BVH nodes and %.1f triangles tested per ray\n", (long long)counters.Rays, counters.BVHNodes / rays, counters.Triangles / rays);
+	printf("   %lld sun, %lld light and %lld bounce rays (%lld bounces missed), %lld rays for probes\n",
+		(long long)counters.SunRays, (long long)counters.LightRays, (long long)counters.BounceRays, (long long)counters.BounceMisses, (long long)counters.ProbeRays);
+	printf("   %.2f lights in range per texel\n", counters.Texels > 0 ? (double)counters.LightsInRange / counters.Texels : 0.0);
+#endif
 }
 
 void CPURaytracer::RaytraceTask(const CPUTraceTask& task)
@@ -55,10 +121,10 @@ void CPURaytracer::RaytraceTask(const CPUTraceTask& task)
 
 	if (task.id >= 0)
 	{
-		Surface* surface = mesh->surfaces[task.id].get();
+		Surface* surface = &mesh->surfaces[task.id];
 		vec3 pos = surface->lightmapOrigin + surface->lightmapSteps[0] * ((float)task.x + 0.5f) + surface->lightmapSteps[1] * ((float)task.y + 0.5f);
 		state.StartPosition = pos;
-		state.StartSurface = surface;
+		state.StartSurface = &SurfaceInfos[task.id];
 	}
 	else
 	{
@@ -67,9 +133,9 @@ void CPURaytracer::RaytraceTask(const CPUTraceTask& task)
 		state.StartSurface = nullptr;
 	}
 
-	state.LightCount = mesh->map->ThingLights.Size();
-	state.SunDir = mesh->map->GetSunDirection();
-	state.SunColor = mesh->map->GetSunColor();
+	state.LightCount = (uint32_t)Lights.size();
+	state.SunDir = SunDir;
+	state.SunColor = SunColor;
 	state.SunIntensity = 1.0f;
 
 	state.PassType = 0;
@@ -88,7 +154,7 @@ void CPURaytracer::RaytraceTask(const CPUTraceTask& task)
 		state.HemisphereVec = HemisphereVectors[state.SampleIndex];
 		RunBounceTrace(state);
 
-		for (int bounce = 0; bounce < mesh->map->LightBounce && !state.EndTrace; bounce++)
+		for (int bounce = 0; bounce < LightBounce && !state.EndTrace; bounce++)
 		{
 			state.SampleCount = coverageSampleCount;
 			RunLightTrace(state);
@@ -103,21 +169,37 @@ void CPURaytracer::RaytraceTask(const CPUTraceTask& task)
 
 	if (task.id >= 0)
 	{
-		Surface* surface = mesh->surfaces[task.id].get();
+		Surface* surface = &mesh->surfaces[task.id];
 		size_t sampleWidth = surface->lightmapDims[0];
-		surface->samples[task.x + task.y * sampleWidth] = state.Output;
+		mesh->GetSamples(surface)[task.x + task.y * sampleWidth] = state.Output;
 	}
 	else
 	{
 		LightProbeSample& probe = mesh->lightProbes[(size_t)(-task.id) - 2];
 		probe.Color = state.Output;
 	}
+
+#ifndef NO_TRACE_COUNTERS
+	TraceStats stats = TriangleMeshShape::take_trace_stats();
+	ThreadCounters.Rays += stats.rays;
+	ThreadCounters.BVHNodes += stats.nodes;
+	ThreadCounters.Triangles += stats.triangles;
+	if (task.id >= 0)
+	{
+		ThreadCounters.Texels++;
+	}
+	else
+	{
+		ThreadCounters.Probes++;
+		ThreadCounters.ProbeRays += stats.rays;
+	}
+#endif
 }
 
 void CPURaytracer::RunBounceTrace(CPUTraceState& state)
 {
 	vec3 origin;
-	Surface* surface;
+	const CPUSurfaceInfo* surface;
 	if (state.PassType == 2)
 	{
 		origin = state.Position;
@@ -136,7 +218,7 @@ void CPURaytracer::RunBounceTrace(CPUTraceState& state)
 	{
 		if (surface)
 		{
-			CPUEmissiveSurface emissive = GetEmissive(surface);
+			const CPUEmissiveSurface& emissive = GetEmissive(surface);
 			incoming = emissive.Color * emissive.Intensity;
 		}
 	}
@@ -151,7 +233,7 @@ void CPURaytracer::RunBounceTrace(CPUTraceState& state)
 		vec3 normal;
 		if (surface)
 		{
-			normal = surface->plane.Normal();
+			normal = surface->Normal;
 		}
 		else
 		{
@@ -180,13 +262,15 @@ void CPURaytracer::RunBounceTrace(CPUTraceState& state)
 			vec3 start = origin + normal * 0.1f;
 			vec3 end = start + L * 32768.0f;
 			LevelTraceHit hit = Trace(start, end);
+			TRACE_COUNTER_ADD(ThreadCounters.BounceRays, 1);
+			TRACE_COUNTER_ADD(ThreadCounters.BounceMisses, hit.fraction < 1.0f ? 0 : 1);
 			if (hit.fraction < 1.0f)
 			{
 				state.EndTrace = false;
 				surface = hit.hitSurface;
 				vec3 hitPosition = start * (1.0f - hit.fraction) + end * hit.fraction;
 
-				CPUEmissiveSurface emissive = GetEmissive(surface);
+				const CPUEmissiveSurface& emissive = GetEmissive(surface);
 				if (emissive.Distance > 0.0f)
 				{
 					float hitDistance = length(hitPosition - origin);
@@ -214,13 +298,17 @@ void CPURaytracer::RunLightTrace(CPUTraceState& state)
 	if (incomingAttenuation <= 0.0f)
 		return;
 
-	Surface* surface = state.Surf;
+	const CPUSurfaceInfo* surface = state.Surf;
+
+	// Only the direct light at the start of the trace takes several samples
+	// spread over the surface. Everything else traces one ray per light.
+	const bool coverage = state.PassType == 0 && surface;
 
 	vec3 origin = state.Position;
 	vec3 normal;
 	if (surface)
 	{
-		normal = surface->plane.Normal();
+		normal = surface->Normal;
 		origin += normal * 0.1f;
 	}
 
@@ -231,25 +319,23 @@ void CPURaytracer::RunLightTrace(CPUTraceState& state)
 		const float dist = 32768.0f;
 
 		float attenuation = 0.0f;
-		if (state.PassType == 0 && surface)
+		if (coverage)
 		{
 			if (dot(normal, state.SunDir) > 0.0f)
 			{
-				vec3 e0 = normalize(cross(normal, std::abs(normal.x) < std::abs(normal.y) ? vec3(1.0f, 0.0f, 0.0f) : vec3(0.0f, 1.0f, 0.0f)));
-				vec3 e1 = cross(normal, e0);
-				e0 = cross(normal, e1);
-
+				const CPUTangentFrame& frame = GetTangentFrame(surface);
 				for (uint32_t i = 0; i < state.SampleCount; i++)
 				{
-					vec2 offset = (Hammersley(i, state.SampleCount) - 0.5f) * float(surface->sampleDimension);
-					vec3 origin2 = origin + e0 * offset.x + e1 * offset.y;
+					vec2 offset = SampleOffsets[i] * surface->SamplingDistance;
+					vec3 origin2 = origin + frame.E0 * offset.x + frame.E1 * offset.y;
 
 					vec3 start = origin2;
 					vec3 end = start + state.SunDir * dist;
 					LevelTraceHit hit = Trace(start, end);
-					if (hit.fraction < 1.0f && hit.hitSurface->bSky)
+					if (hit.fraction < 1.0f && hit.hitSurface->Sky)
 						attenuation += 1.0f;
 				}
+				TRACE_COUNTER_ADD(ThreadCounters.SunRays, state.SampleCount);
 				attenuation *= 1.0f / float(state.SampleCount);
 				incoming += state.SunColor * (attenuation * state.SunIntensity * incomingAttenuation);
 			}
@@ -259,7 +345,8 @@ void CPURaytracer::RunLightTrace(CPUTraceState& state)
 			vec3 start = origin;
 			vec3 end = start + state.SunDir * dist;
 			LevelTraceHit hit = Trace(start, end);
-			attenuation = (hit.fraction < 1.0f && hit.hitSurface->bSky) ? 1.0f : 0.0f;
+			TRACE_COUNTER_ADD(ThreadCounters.SunRays, 1);
+			attenuation = (hit.fraction < 1.0f && hit.hitSurface->Sky) ? 1.0f : 0.0f;
 			incoming += state.SunColor * (attenuation * state.SunIntensity * incomingAttenuation);
 		}
 	}
@@ -271,6 +358,9 @@ void CPURaytracer::RunLightTrace(CPUTraceState& state)
 		float dist = length(light.Origin - origin);
 		if (dist > minDistance && dist < light.Radius)
 		{
+			if (coverage)
+				TRACE_COUNTER_ADD(ThreadCounters.LightsInRange, 1);
+
 			vec3 dir = normalize(light.Origin - origin);
 
 			if (!surface || dot(normal, dir) > 0.0)
@@ -294,25 +384,25 @@ void CPURaytracer::RunLightTrace(CPUTraceState& state)
 				{
 					float shadowAttenuation = 0.0f;
 
-					if (state.PassType == 0 && surface)
+					if (coverage)
 					{
-						vec3 e0 = normalize(cross(normal, std::abs(normal.x) < std::abs(normal.y) ? vec3(1.0f, 0.0f, 0.0f) : vec3(0.0f, 1.0f, 0.0f)));
-						vec3 e1 = cross(normal, e0);
-						e0 = cross(normal, e1);
+						const CPUTangentFrame& frame = GetTangentFrame(surface);
 						for (uint32_t i = 0; i < state.SampleCount; i++)
 						{
-							vec2 offset = (Hammersley(i, state.SampleCount) - 0.5f) * float(surface->sampleDimension);
-							vec3 origin2 = origin + e0 * offset.x + e1 * offset.y;
+							vec2 offset = SampleOffsets[i] * surface->SamplingDistance;
+							vec3 origin2 = origin + frame.E0 * offset.x + frame.E1 * offset.y;
 
 							LevelTraceHit hit = Trace(origin2, light.Origin);
 							if (hit.fraction == 1.0f)
 								shadowAttenuation += 1.0f;
 						}
+						TRACE_COUNTER_ADD(ThreadCounters.LightRays, state.SampleCount);
 						shadowAttenuation *= 1.0f / float(state.SampleCount);
 					}
 					else
 					{
 						LevelTraceHit hit = Trace(origin, light.Origin);
+						TRACE_COUNTER_ADD(ThreadCounters.LightRays, 1);
 						shadowAttenuation = (hit.fraction == 1.0f) ? 1.0f : 0.0f;
 					}
 
@@ -353,12 +443,15 @@ float CPURaytracer::RadicalInverse_VdC(uint32_t bits)
 	return float(bits) * 2.3283064365386963e-10f; // / 0x100000000
 }
 
-void CPURaytracer::CreateTasks(std::vector<CPUTraceTask>& tasks)
+void CPURaytracer::CreateTasks(std::vector<CPUTraceTask>& tasks, const CPUTraceSelection* selection)
 {
 	tasks.reserve(mesh->lightProbes.size());
 
 	for (size_t i = 0; i < mesh->lightProbes.size(); i++)
 	{
+		if (selection && !selection->Probes[i])
+			continue;
+
 		CPUTraceTask task;
 		task.id = -(int)(i + 2);
 		task.x = 0;
@@ -373,22 +466,26 @@ void CPURaytracer::CreateTasks(std::vector<CPUTraceTask>& tasks)
 		if (i % 4096 == 0)
 			printf("\rGathering surface trace tasks: %llu / %llu", i, mesh->surfaces.size());
 
-		Surface* surface = mesh->surfaces[i].get();
+		Surface* surface = &mesh->surfaces[i];
 
 		if (!surface->bSky)
 		{
 			int sampleWidth = surface->lightmapDims[0];
 			int sampleHeight = surface->lightmapDims[1];
+			int tilesX = CPUTraceSelection::TileCount(sampleWidth);
 
 			fullTaskCount += size_t(sampleHeight) * size_t(sampleWidth);
 
-			SurfaceClip surfaceClip(surface);
+			if (selection && !selection->IsAnySelected((int)i, tilesX * CPUTraceSelection::TileCount(sampleHeight)))
+				continue;
+
+			SurfaceClip surfaceClip(mesh, surface);
 
 			for (int y = 0; y < sampleHeight; y++)
 			{
 				for (int x = 0; x < sampleWidth; x++)
 				{
-					if (surfaceClip.SampleIsInBounds(float(x), float(y)))
+					if ((!selection || selection->IsSelected((int)i, tilesX, x, y)) && surfaceClip.SampleIsInBounds(float(x), float(y)))
 					{
 						CPUTraceTask task;
 						task.id = (int)i;
@@ -404,6 +501,20 @@ void CPURaytracer::CreateTasks(std::vector<CPUTraceTask>& tasks)
 	printf("\tDiscarded %.3f%% of all tasks\n", (1.0 - double(tasks.size()) / fullTaskCount) * 100.0);
 }
 
+void CPUTraceSelection::Init(const LevelMesh* mesh, bool selected)
+{
+	FirstTile.resize(mesh->surfaces.size());
+	int numTiles = 0;
+	for (size_t i = 0; i < mesh->surfaces.size(); i++)
+	{
+		const Surface* surface = &mesh->surfaces[i];
+		FirstTile[i] = numTiles;
+		numTiles += TileCount(surface->lightmapDims[0]) * TileCount(surface->lightmapDims[1]);
+	}
+	Tiles.assign(numTiles, selected);
+	Probes.assign(mesh->lightProbes.size(), selected);
+}
+
 void CPURaytracer::CreateHemisphereVectors()
 {
 	if (HemisphereVectors.empty())
@@ -422,10 +533,21 @@ void CPURaytracer::CreateHemisphereVectors()
 	}
 }
 
-void CPURaytracer::CreateLights()
+void CPURaytracer::CreateSampleOffsets()
 {
+	SampleOffsets.resize(coverageSampleCount);
+	for (int i = 0; i < coverageSampleCount; i++)
+	{
+		SampleOffsets[i] = Hammersley(i, coverageSampleCount) - 0.5f;
+	}
+}
+
+void CPUSceneLighting::Gather(LevelMesh* mesh)
+{
+	FLevel* map = mesh->map;
+
 	Lights.clear();
-	for (ThingLight& light : mesh->map->ThingLights)
+	for (ThingLight& light : map->ThingLights)
 	{
 		CPULightInfo info;
 		info.Origin = light.LightOrigin();
@@ -437,53 +559,73 @@ void CPURaytracer::CreateLights()
 		info.Color = light.rgb;
 		Lights.push_back(info);
 	}
-}
-
-CPUEmissiveSurface CPURaytracer::GetEmissive(Surface* surface)
-{
-	CPUEmissiveSurface info;
 
-	SurfaceLightDef* def = nullptr;
-	if (surface->type >= ST_MIDDLESIDE && surface->type <= ST_LOWERSIDE)
+	// Entry 0 is for everything that does not glow, then one for each light definition.
+	Emissives.resize(map->SurfaceLights.Size() + 1);
+	Emissives[0].Distance = 0.0f;
+	Emissives[0].Intensity = 0.0f;
+	Emissives[0].Color = vec3(0.0f, 0.0f, 0.0f);
+	for (unsigned int i = 0; i < map->SurfaceLights.Size(); i++)
 	{
-		int lightdefidx = mesh->map->Sides[surface->typeIndex].lightdef;
-		if (lightdefidx != -1)
-		{
-			def = &mesh->map->SurfaceLights[lightdefidx];
-		}
+		const SurfaceLightDef& def = map->SurfaceLights[i];
+		Emissives[i + 1].Distance = def.distance + def.distance;
+		Emissives[i + 1].Intensity = def.intensity;
+		Emissives[i + 1].Color = def.rgb;
 	}
-	else if (surface->type == ST_FLOOR || surface->type == ST_CEILING)
+
+	SurfaceEmissives.resize(mesh->surfaces.size());
+	for (size_t i = 0; i < mesh->surfaces.size(); i++)
 	{
-		MapSubsectorEx* sub = &mesh->map->GLSubsectors[surface->typeIndex];
-		IntSector* sector = mesh->map->GetSectorFromSubSector(sub);
+		const Surface* surface = &mesh->surfaces[i];
 
-		if (sector && surface->numVerts > 0)
+		int lightdefidx = -1;
+		if (surface->type >= ST_MIDDLESIDE && surface->type <= ST_LOWERSIDE)
 		{
-			if (sector->floorlightdef != -1 && surface->type == ST_FLOOR)
-			{
-				def = &mesh->map->SurfaceLights[sector->floorlightdef];
-			}
-			else if (sector->ceilinglightdef != -1 && surface->type == ST_CEILING)
+			lightdefidx = map->Sides[surface->typeIndex].lightdef;
+		}
+		else if (surface->type == ST_FLOOR || surface->type == ST_CEILING)
+		{
+			MapSubsectorEx* sub = &map->GLSubsectors[surface->typeIndex];
+			IntSector* sector = map->GetSectorFromSubSector(sub);
+
+			if (sector && surface->numVerts > 0)
 			{
-				def = &mesh->map->SurfaceLights[sector->ceilinglightdef];
+				if (sector->floorlightdef != -1 && surface->type == ST_FLOOR)
+				{
+					lightdefidx = sector->floorlightdef;
+				}
+				else if (sector->ceilinglightdef != -1 && surface->type == ST_CEILING)
+				{
+					lightdefidx = sector->ceilinglightdef;
+				}
 			}
 		}
+		SurfaceEmissives[i] = lightdefidx + 1;
 	}
 
-	if (def)
-	{
-		info.Distance = def->distance + def->distance;
-		info.Intensity = def->intensity;
-		info.Color = def->rgb;
-	}
-	else
+	SunDir = map->GetSunDirection();
+	SunColor = map->GetSunColor();
+	LightBounce = map->LightBounce;
+}
+
+void CPURaytracer::CreateSurfaceInfo(const CPUSceneLighting& lighting)
+{
+	Emissives = lighting.Emissives;
+
+	SurfaceInfos.resize(mesh->surfaces.size());
+	TangentFrames.resize(mesh->surfaces.size());
+	for (size_t i = 0; i < mesh->surfaces.size(); i++)
 	{
-		info.Distance = 0.0f;
-		info.Intensity = 0.0f;
-		info.Color = vec3(0.0f, 0.0f, 0.0f);
-	}
+		const Surface* surface = &mesh->surfaces[i];
 
-	return info;
+		CPUSurfaceInfo& info = SurfaceInfos[i];
+		info.Normal = surface->plane.Normal();
+		info.SamplingDistance = float(surface->sampleDimension);
+		info.Emissive = lighting.SurfaceEmissives[i];
+		info.Sky = surface->bSky;
+
+		TangentFrames[i] = CPUTangentFrame::FromNormal(info.Normal);
+	}
 }
 
 LevelTraceHit CPURaytracer::Trace(const vec3& startVec, const vec3& endVec)
@@ -491,28 +633,8 @@ LevelTraceHit CPURaytracer::Trace(const vec3& startVec, const vec3& endVec)
 	TraceHit hit = TriangleMeshShape::find_first_hit(CollisionMesh.get(), startVec, endVec);
 
 	LevelTraceHit trace;
-	trace.start = startVec;
-	trace.end = endVec;
 	trace.fraction = hit.fraction;
-	if (trace.fraction < 1.0f)
-	{
-		int elementIdx = hit.triangle * 3;
-		trace.hitSurface = mesh->surfaces[mesh->MeshSurfaces[hit.triangle]].get();
-		trace.indices[0] = mesh->MeshUVIndex[mesh->MeshElements[elementIdx]];
-		trace.indices[1] = mesh->MeshUVIndex[mesh->MeshElements[elementIdx + 1]];
-		trace.indices[2] = mesh->MeshUVIndex[mesh->MeshElements[elementIdx + 2]];
-		trace.b = hit.b;
-		trace.c = hit.c;
-	}
-	else
-	{
-		trace.hitSurface = nullptr;
-		trace.indices[0] = 0;
-		trace.indices[1] = 0;
-		trace.indices[2] = 0;
-		trace.b = 0.0f;
-		trace.c = 0.0f;
-	}
+	trace.hitSurface = trace.fraction < 1.0f ? &SurfaceInfos[mesh->MeshSurfaces[hit.triangle]] : nullptr;
 	return trace;
 }
 
@@ -521,7 +643,7 @@ bool CPURaytracer::TraceAnyHit(const vec3& startVec, const vec3& endVec)
 	return TriangleMeshShape::find_any_hit(CollisionMesh.get(), startVec, endVec);
 }
 
-void CPURaytracer::RunJob(int count, std::function<void(int)> callback)
+void CPURaytracer::RunJob(int first, int count, int total, std::function<void(int)> callback)
 {
 	int numThreads = NumThreads;
 	if (numThreads <= 0)
@@ -545,24 +667,23 @@ void CPURaytracer::RunJob(int count, std::function<void(int)> callback)
 	{
 		threads.push_back(std::thread([&, threadIndex]() {
 
-			if (threadIndex == 0)
-			{
-				for (int i = 0; i < count; i += numThreads)
-				{
-					if((i / numThreads) % 8192 == 0)
-						printf("\r%.1f%%\t%d/%d", double(i) / double(count) * 100, i, count);
-					callback(i);
-				}
-			}
-			else
+			// Each thread takes every numThreads'th index. The timeline gets
+			// one event for every chunkSize of them.
+			const int chunkSize = 4096;
+			for (int i = threadIndex; i < count;)
 			{
-				for (int i = threadIndex; i < count; i += numThreads)
+				TIMELINE_SCOPE_ARG("Trace chunk", "first", first + i);
+				for (int n = 0; n < chunkSize && i < count; n++, i += numThreads)
 				{
-					callback(i);
+					if (threadIndex == 0 && (i / numThreads) % 8192 == 0)
+						printf("\r%.1f%%\t%d/%d", double(first + i) / double(total) * 100, first + i, total);
+					callback(first + i);
 				}
 			}
 
 			std::unique_lock<std::mutex> lock(m);
+			Stats.Counters.Add(ThreadCounters);
+			ThreadCounters = CPUTraceCounters();
 			threadsleft--;
 			lock.unlock();
 			condvar.notify_all();
@@ -576,9 +697,28 @@ void CPURaytracer::RunJob(int count, std::function<void(int)> callback)
 		{
 			condvar.wait_for(lock, std::chrono::milliseconds(500), [&]() { return threadsleft == 0; });
 		}
-		printf("\r%.1f%%\t%d/%d\n", 100.0, count, count);
+		int finished = first + count;
+		if (finished == total)
+			printf("\r%.1f%%\t%d/%d\n", 100.0, total, total);
+		else
+			printf("\r%.1f%%\t%d/%d", double(finished) / double(total) * 100, finished, total);
 	}
 
 	for (int i = 0; i < numThreads; i++)
 		threads[i].join();
 }
+
+void CPUTraceCounters::Add(const CPUTraceCounters& other)
+{
+	SunRays += other.SunRays;
+	LightRays += other.LightRays;
+	BounceRays += other.BounceRays;
+	BounceMisses += other.BounceMisses;
+	ProbeRays += other.ProbeRays;
+	Rays += other.Rays;
+	BVHNodes += other.BVHNodes;
+	Triangles += other.Triangles;
+	Texels += other.Texels;
+	Probes += other.Probes;
+	LightsInRange += other.LightsInRange;
+}
@@ -2,9 +2,11 @@
 #pragma once
 
 #include <functional>
+#include <vector>
 #include "collision.h"
 
 class LevelMesh;
+class BakeCheckpoint;
 
 struct CPUTraceTask
 {
@@ -22,6 +24,54 @@ struct CPULightInfo
 	vec3 Color;
 };
 
+struct CPUEmissiveSurface
+{
+	float Distance;
+	float Intensity;
+	vec3 Color;
+};
+
+// The lighting of a level as the CPU ray tracer sees it. Nothing in it points
+// back into the level, so it can be saved with the mesh (see bakescene.h).
+struct CPUSceneLighting
+{
+	std::vector<CPULightInfo> Lights;
+	std::vector<CPUEmissiveSurface> Emissives;	// Entry 0 is for everything that does not glow
+	std::vector<int> SurfaceEmissives;			// Index into Emissives for each surface of the mesh
+	vec3 SunDir;
+	vec3 SunColor;
+	int LightBounce;
+
+	// Gathers the lighting from the level the mesh was built from
+	void Gather(LevelMesh* mesh);
+};
+
+// What the passes need to know about a surface, gathered once before tracing
+// so a hit does not have to go back to the level.
+struct CPUSurfaceInfo
+{
+	vec3 Normal;
+	float SamplingDistance;
+	int Emissive;	// Index into CPURaytracer::Emissives, 0 if it does not glow
+	bool Sky;
+};
+
+// Directions along a surface, used to spread the coverage samples
+struct CPUTangentFrame
+{
+	vec3 E0;
+	vec3 E1;
+
+	static CPUTangentFrame FromNormal(const vec3& normal)
+	{
+		CPUTangentFrame frame;
+		frame.E0 = normalize(cross(normal, std::abs(normal.x) < std::abs(normal.y) ? vec3(1.0f, 0.0f, 0.0f) : vec3(0.0f, 1.0f, 0.0f)));
+		frame.E1 = cross(normal, frame.E0);
+		frame.E0 = cross(normal, frame.E1);
+		return frame;
+	}
+};
+
 struct CPUTraceState
 {
 	uint32_t SampleIndex;
@@ -34,10 +84,10 @@ struct CPUTraceState
 	vec3 HemisphereVec;
 
 	vec3 StartPosition;
-	Surface* StartSurface;
+	const CPUSurfaceInfo* StartSurface;
 
 	vec3 Position;
-	Surface* Surf;
+	const CPUSurfaceInfo* Surf;
 
 	vec3 Output;
 	float OutputAttenuation;
@@ -45,22 +95,71 @@ struct CPUTraceState
 	bool EndTrace;
 };
 
-struct CPUEmissiveSurface
+// Counts gathered while tracing, summed over all threads. They stay zero in
+// a build with NO_TRACE_COUNTERS (see collision.h).
+struct CPUTraceCounters
 {
-	float Distance;
-	float Intensity;
-	vec3 Color;
+	int64_t SunRays = 0;		// Shadow rays towards the sun
+	int64_t LightRays = 0;		// Shadow rays towards point and spot lights
+	int64_t BounceRays = 0;		// Rays gathering bounced light
+	int64_t BounceMisses = 0;	// Bounce rays that hit nothing within 32768 units
+	int64_t ProbeRays = 0;		// Rays of all kinds traced for light probes
+	int64_t Rays = 0;
+	int64_t BVHNodes = 0;		// Bounding boxes tested against rays
+	int64_t Triangles = 0;		// Triangles tested against rays
+	int64_t Texels = 0;
+	int64_t Probes = 0;
+	int64_t LightsInRange = 0;	// Lights reaching each texel in its direct light pass, summed
+
+	void Add(const CPUTraceCounters& other);
+};
+
+struct CPUTraceStats
+{
+	CPUTraceCounters Counters;
+	int BVHMinDepth = 0;
+	int BVHMaxDepth = 0;
+	std::vector<int> BVHDepthHistogram;	// Leaves at each depth, see TriangleMeshShape::get_depth_histogram
+};
+
+// The texels and light probes a Raytrace call traces. The lightmap of each
+// surface is divided into tiles of TileSize x TileSize texels, row by row,
+// and a texel is traced when its tile is selected. The samples of everything
+// else are left as they are.
+struct CPUTraceSelection
+{
+	enum { TileSize = 8 };
+
+	std::vector<int> FirstTile;	// Index into Tiles of the first tile of each surface
+	std::vector<bool> Tiles;
+	std::vector<bool> Probes;
+
+	// Sets up the tiles of every surface of the mesh, all selected or none
+	void Init(const LevelMesh* mesh, bool selected);
+
+	// Tiles along a lightmap side of this many texels
+	static int TileCount(int texels) { return (texels + TileSize - 1) / TileSize; }
+
+	bool IsSelected(int surface, int tilesX, int x, int y) const
+	{
+		return Tiles[FirstTile[surface] + (y / TileSize) * tilesX + x / TileSize];
+	}
+
+	bool IsAnySelected(int surface, int numTiles) const
+	{
+		for (int i = 0; i < numTiles; i++)
+		{
+			if (Tiles[FirstTile[surface] + i])
+				return true;
+		}
+		return false;
+	}
 };
 
 struct LevelTraceHit
 {
-	vec3 start;
-	vec3 end;
 	float fraction;
-
-	Surface* hitSurface;
-	int indices[3];
-	float b, c;
+	const CPUSurfaceInfo* hitSurface;
 };
 
 class CPURaytracer
@@ -71,16 +170,31 @@ public:
 
 	void Raytrace(LevelMesh* level);
 
+	// Tracing the same mesh again reuses its BVH, so the collision mesh must
+	// not change between calls. Only the lighting and the samples may.
+	void Raytrace(LevelMesh* level, const CPUSceneLighting& lighting, const CPUTraceSelection* selection = nullptr);
+
+	// Save the progress of every Raytrace call, and resume from it. Null
+	// turns checkpoints off.
+	void SetCheckpoint(BakeCheckpoint* checkpoint) { Checkpoint = checkpoint; }
+
+	// Statistics of the last Raytrace call
+	const CPUTraceStats& GetStats() const { return Stats; }
+
+	static vec2 Hammersley(uint32_t i, uint32_t N);
+
 private:
 	void RaytraceTask(const CPUTraceTask& task);
 	void RunBounceTrace(CPUTraceState& state);
 	void RunLightTrace(CPUTraceState& state);
 
-	CPUEmissiveSurface GetEmissive(Surface* surface);
+	const CPUEmissiveSurface& GetEmissive(const CPUSurfaceInfo* surface) const { return Emissives[surface->Emissive]; }
+	const CPUTangentFrame& GetTangentFrame(const CPUSurfaceInfo* surface) const { return TangentFrames[surface - SurfaceInfos.data()]; }
 
-	void CreateTasks(std::vector<CPUTraceTask>& tasks);
+	void CreateTasks(std::vector<CPUTraceTask>& tasks, const CPUTraceSelection* selection);
 	void CreateHemisphereVectors();
-	void CreateLights();
+	void CreateSampleOffsets();
+	void CreateSurfaceInfo(const CPUSceneLighting& lighting);
 
 	LevelTraceHit Trace(const vec3& startVec, const vec3& endVec);
 	bool TraceAnyHit(const vec3& startVec, const vec3& endVec);
@@ -88,13 +202,24 @@ private:
 	static vec3 ImportanceSample(const vec3& HemisphereVec, vec3 N);
 
 	static float RadicalInverse_VdC(uint32_t bits);
-	static vec2 Hammersley(uint32_t i, uint32_t N);
 
-	static void RunJob(int count, std::function<void(int i)> callback);
+	// Calls back for indices first to first + count - 1 of a job of total
+	void RunJob(int first, int count, int total, std::function<void(int i)> callback);
 
 	LevelMesh* mesh = nullptr;
 	std::vector<vec3> HemisphereVectors;
+	std::vector<vec2> SampleOffsets;	// Hammersley points for coverageSampleCount samples, centered on 0
 	std::vector<CPULightInfo> Lights;
+	vec3 SunDir;
+	vec3 SunColor;
+	int LightBounce = 0;
+	std::vector<CPUSurfaceInfo> SurfaceInfos;
+	std::vector<CPUTangentFrame> TangentFrames;	// One for each entry in SurfaceInfos
+	std::vector<CPUEmissiveSurface> Emissives;
 
 	std::unique_ptr<TriangleMeshShape> CollisionMesh;
+
+	BakeCheckpoint* Checkpoint = nullptr;
+
+	CPUTraceStats Stats;
 };
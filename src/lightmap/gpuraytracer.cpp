@@ -6,6 +6,7 @@
 #include "framework/binfile.h"
 #include "framework/templates.h"
 #include "framework/halffloat.h"
+#include "framework/timeline.h"
 #include "vulkanbuilders.h"
 #include "surfaceclip.h"
 #include <map>
@@ -45,6 +46,8 @@ GPURaytracer::~GPURaytracer()
 
 void GPURaytracer::Raytrace(LevelMesh* level)
 {
+	TIMELINE_SCOPE("Ray trace");
+
 	mesh = level;
 
 	printf("Building Vulkan acceleration structures\n");
@@ -152,7 +155,7 @@ void GPURaytracer::CreateTasks(std::vector<TraceTask>& tasks)
 		if (i % 4096 == 0)
 			printf("\rGathering surface trace tasks: %llu / %llu", i, mesh->surfaces.size());
 
-		Surface* surface = mesh->surfaces[i].get();
+		Surface* surface = &mesh->surfaces[i];
 
 		if (!surface->bSky)
 		{
@@ -161,7 +164,7 @@ void GPURaytracer::CreateTasks(std::vector<TraceTask>& tasks)
 
 			fullTaskCount += size_t(sampleHeight) * size_t(sampleWidth);
 
-			SurfaceClip surfaceClip(surface);
+			SurfaceClip surfaceClip(mesh, surface);
 
 			for (int y = 0; y < sampleHeight; y++)
 			{
@@ -222,7 +225,7 @@ void GPURaytracer::UploadTasks(const TraceTask* tasks, size_t size)
 
 		if (task.id >= 0)
 		{
-			Surface* surface = mesh->surfaces[task.id].get();
+			Surface* surface = &mesh->surfaces[task.id];
 			vec3 pos = surface->lightmapOrigin + surface->lightmapSteps[0] * (task.x + 0.5f) + surface->lightmapSteps[1] * (task.y + 0.5f);
 			startPositions[i] = vec4(pos, (float)task.id);
 		}
@@ -372,9 +375,9 @@ void GPURaytracer::DownloadTasks(const TraceTask* tasks, size_t size)
 		const TraceTask& task = tasks[i];
 		if (task.id >= 0)
 		{
-			Surface* surface = mesh->surfaces[task.id].get();
+			Surface* surface = &mesh->surfaces[task.id];
 			size_t sampleWidth = surface->lightmapDims[0];
-			surface->samples[task.x + task.y * sampleWidth] = vec3(output[i].x, output[i].y, output[i].z);
+			mesh->GetSamples(surface)[task.x + task.y * sampleWidth] = vec3(output[i].x, output[i].y, output[i].z);
 		}
 		else
 		{
@@ -389,29 +392,29 @@ void GPURaytracer::CreateVertexAndIndexBuffers()
 {
 	std::vector<SurfaceInfo> surfaces;
 	surfaces.reserve(mesh->surfaces.size());
-	for (const auto& surface : mesh->surfaces)
+	for (const Surface& surface : mesh->surfaces)
 	{
 		SurfaceLightDef* def = nullptr;
-		if (surface->type >= ST_MIDDLESIDE && surface->type <= ST_LOWERSIDE)
+		if (surface.type >= ST_MIDDLESIDE && surface.type <= ST_LOWERSIDE)
 		{
-			int lightdefidx = mesh->map->Sides[surface->typeIndex].lightdef;
+			int lightdefidx = mesh->map->Sides[surface.typeIndex].lightdef;
 			if (lightdefidx != -1)
 			{
 				def = &mesh->map->SurfaceLights[lightdefidx];
 			}
 		}
-		else if (surface->type == ST_FLOOR || surface->type == ST_CEILING)
+		else if (surface.type == ST_FLOOR || surface.type == ST_CEILING)
 		{
-			MapSubsectorEx* sub = &mesh->map->GLSubsectors[surface->typeIndex];
+			MapSubsectorEx* sub = &mesh->map->GLSubsectors[surface.typeIndex];
 			IntSector* sector = mesh->map->GetSectorFromSubSector(sub);
 
-			if (sector && surface->numVerts > 0)
+			if (sector && surface.numVerts > 0)
 			{
-				if (sector->floorlightdef != -1 && surface->type == ST_FLOOR)
+				if (sector->floorlightdef != -1 && surface.type == ST_FLOOR)
 				{
 					def = &mesh->map->SurfaceLights[sector->floorlightdef];
 				}
-				else if (sector->ceilinglightdef != -1 && surface->type == ST_CEILING)
+				else if (sector->ceilinglightdef != -1 && surface.type == ST_CEILING)
 				{
 					def = &mesh->map->SurfaceLights[sector->ceilinglightdef];
 				}
@@ -419,8 +422,8 @@ void GPURaytracer::CreateVertexAndIndexBuffers()
 		}
 
 		SurfaceInfo info;
-		info.Sky = surface->bSky ? 1.0f : 0.0f;
-		info.Normal = surface->plane.Normal();
+		info.Sky = surface.bSky ? 1.0f : 0.0f;
+		info.Normal = surface.plane.Normal();
 		if (def)
 		{
 			info.EmissiveDistance = def->distance + def->distance;
@@ -434,7 +437,7 @@ void GPURaytracer::CreateVertexAndIndexBuffers()
 			info.EmissiveColor = vec3(0.0f, 0.0f, 0.0f);
 		}
 
-		info.SamplingDistance = float(surface->sampleDimension);
+		info.SamplingDistance = float(surface.sampleDimension);
 		surfaces.push_back(info);
 	}
 
@@ -62,7 +62,7 @@ void GPURaytracer2::Raytrace(LevelMesh* level)
 
 	for (size_t i = 0; i < mesh->surfaces.size(); i++)
 	{
-		Surface* surface = mesh->surfaces[i].get();
+		Surface* surface = &mesh->surfaces[i];
 		int sampleWidth = surface->lightmapDims[0];
 		int sampleHeight = surface->lightmapDims[1];
 		surfaceImages.push_back(CreateImage(sampleWidth, sampleHeight));
@@ -70,7 +70,7 @@ void GPURaytracer2::Raytrace(LevelMesh* level)
 
 	for (size_t i = 0; i < mesh->surfaces.size(); i++)
 	{
-		Surface* surface = mesh->surfaces[i].get();
+		Surface* surface = &mesh->surfaces[i];
 		int sampleWidth = surface->lightmapDims[0];
 		int sampleHeight = surface->lightmapDims[1];
 		LightmapImage& img = surfaceImages[i];
@@ -107,7 +107,7 @@ void GPURaytracer2::Raytrace(LevelMesh* level)
 
 	for (size_t i = 0; i < mesh->surfaces.size(); i++)
 	{
-		Surface* surface = mesh->surfaces[i].get();
+		Surface* surface = &mesh->surfaces[i];
 		int sampleWidth = surface->lightmapDims[0];
 		int sampleHeight = surface->lightmapDims[1];
 		LightmapImage& img = surfaceImages[i];
@@ -129,14 +129,15 @@ void GPURaytracer2::Raytrace(LevelMesh* level)
 
 	for (size_t i = 0; i < mesh->surfaces.size(); i++)
 	{
-		Surface* surface = mesh->surfaces[i].get();
+		Surface* surface = &mesh->surfaces[i];
 		int sampleWidth = surface->lightmapDims[0];
 		int sampleHeight = surface->lightmapDims[1];
 
 		vec4* pixels = (vec4*)surfaceImages[i].Transfer->Map(0, sampleWidth * sampleHeight * sizeof(vec4));
+		vec3* samples = mesh->GetSamples(surface);
 		for (int i = 0; i < sampleWidth * sampleHeight; i++)
 		{
-			surface->samples[i] = pixels[i].xyz();
+			samples[i] = pixels[i].xyz();
 		}
 		surfaceImages[i].Transfer->Unmap();
 	}
@@ -547,29 +548,29 @@ std::vector<SurfaceInfo2> GPURaytracer2::CreateSurfaceInfo()
 {
 	std::vector<SurfaceInfo2> surfaces;
 	surfaces.reserve(mesh->surfaces.size());
-	for (const auto& surface : mesh->surfaces)
+	for (const Surface& surface : mesh->surfaces)
 	{
 		SurfaceLightDef* def = nullptr;
-		if (surface->type >= ST_MIDDLESIDE && surface->type <= ST_LOWERSIDE)
+		if (surface.type >= ST_MIDDLESIDE && surface.type <= ST_LOWERSIDE)
 		{
-			int lightdefidx = mesh->map->Sides[surface->typeIndex].lightdef;
+			int lightdefidx = mesh->map->Sides[surface.typeIndex].lightdef;
 			if (lightdefidx != -1)
 			{
 				def = &mesh->map->SurfaceLights[lightdefidx];
 			}
 		}
-		else if (surface->type == ST_FLOOR || surface->type == ST_CEILING)
+		else if (surface.type == ST_FLOOR || surface.type == ST_CEILING)
 		{
-			MapSubsectorEx* sub = &mesh->map->GLSubsectors[surface->typeIndex];
+			MapSubsectorEx* sub = &mesh->map->GLSubsectors[surface.typeIndex];
 			IntSector* sector = mesh->map->GetSectorFromSubSector(sub);
 
-			if (sector && surface->numVerts > 0)
+			if (sector && surface.numVerts > 0)
 			{
-				if (sector->floorlightdef != -1 && surface->type == ST_FLOOR)
+				if (sector->floorlightdef != -1 && surface.type == ST_FLOOR)
 				{
 					def = &mesh->map->SurfaceLights[sector->floorlightdef];
 				}
-				else if (sector->ceilinglightdef != -1 && surface->type == ST_CEILING)
+				else if (sector->ceilinglightdef != -1 && surface.type == ST_CEILING)
 				{
 					def = &mesh->map->SurfaceLights[sector->ceilinglightdef];
 				}
@@ -577,8 +578,8 @@ std::vector<SurfaceInfo2> GPURaytracer2::CreateSurfaceInfo()
 		}
 
 		SurfaceInfo2 info;
-		info.Sky = surface->bSky ? 1.0f : 0.0f;
-		info.Normal = surface->plane.Normal();
+		info.Sky = surface.bSky ? 1.0f : 0.0f;
+		info.Normal = surface.plane.Normal();
 		if (def)
 		{
 			info.EmissiveDistance = def->distance + def->distance;
@@ -592,7 +593,7 @@ std::vector<SurfaceInfo2> GPURaytracer2::CreateSurfaceInfo()
 			info.EmissiveColor = vec3(0.0f, 0.0f, 0.0f);
 		}
 
-		info.SamplingDistance = float(surface->sampleDimension);
+		info.SamplingDistance = float(surface.sampleDimension);
 		surfaces.push_back(info);
 	}
 	return surfaces;
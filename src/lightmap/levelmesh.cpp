@@ -32,29 +32,121 @@
 #include "level/level.h"
 #include "levelmesh.h"
 #include "pngwriter.h"
+#include "framework/parallel.h"
+#include "framework/timeline.h"
 #include <map>
+#include <unordered_map>
+#include <chrono>
+#include <functional>
+#include <algorithm>
 
 #ifdef _MSC_VER
 #pragma warning(disable: 4267) // warning C4267: 'argument': conversion from 'size_t' to 'int', possible loss of data
 #pragma warning(disable: 4244) // warning C4244: '=': conversion from '__int64' to 'int', possible loss of data
 #endif
 
+// Surfaces, sides and subsectors are handed to the threads in runs of this
+// many.
+static const int MESH_CHUNK = 256;
+
+// Adds a surface with room for numVerts vertices to the list.
+Surface &LevelMesh::SurfaceList::Add(int numVerts, const char *name)
+{
+	auto it = materialIndex.find(name);
+	if (it == materialIndex.end())
+	{
+		it = materialIndex.insert(std::make_pair(std::string(name), (int)materials.size())).first;
+		materials.push_back(name);
+	}
+
+	surfaces.push_back(Surface());
+	Surface &surface = surfaces.back();
+	surface.numVerts = numVerts;
+	surface.firstVert = (int)verts.size();
+	surface.material = it->second;
+
+	verts.resize(verts.size() + numVerts);
+	uvs.resize(uvs.size() + numVerts);
+	return surface;
+}
+
+// Calls create(i, list) for every i in [0, count) on all threads and appends
+// the surfaces they create to the mesh in the order of i.
+void LevelMesh::CreateSurfacesParallel(int count, const std::function<void(int, SurfaceList &)> &create)
+{
+	std::vector<SurfaceList> lists(ChunkCount(count, MESH_CHUNK));
+
+	ParallelForChunks(count, MESH_CHUNK, [&](int chunk, int start, int end)
+	{
+		for (int i = start; i < end; i++)
+		{
+			create(i, lists[chunk]);
+		}
+	});
+
+	size_t numSurfaces = surfaces.size(), numVerts = surfaceVerts.size();
+	for (const SurfaceList &list : lists)
+	{
+		numSurfaces += list.surfaces.size();
+		numVerts += list.verts.size();
+	}
+	surfaces.reserve(numSurfaces);
+	surfaceVerts.reserve(numVerts);
+	surfaceUVs.reserve(numVerts);
+
+	std::map<std::string, int> materialIndex;
+	for (int i = 0; i < (int)materials.size(); i++)
+	{
+		materialIndex[materials[i]] = i;
+	}
+
+	for (SurfaceList &list : lists)
+	{
+		std::vector<int> remap(list.materials.size());
+		for (size_t i = 0; i < list.materials.size(); i++)
+		{
+			auto it = materialIndex.find(list.materials[i]);
+			if (it == materialIndex.end())
+			{
+				it = materialIndex.insert(std::make_pair(list.materials[i], (int)materials.size())).first;
+				materials.push_back(list.materials[i]);
+			}
+			remap[i] = it->second;
+		}
+
+		int firstVert = (int)surfaceVerts.size();
+		for (Surface &surface : list.surfaces)
+		{
+			surface.firstVert += firstVert;
+			surface.material = remap[surface.material];
+			surfaces.push_back(surface);
+		}
+		surfaceVerts.insert(surfaceVerts.end(), list.verts.begin(), list.verts.end());
+		surfaceUVs.insert(surfaceUVs.end(), list.uvs.begin(), list.uvs.end());
+	}
+}
+
 LevelMesh::LevelMesh(FLevel &doomMap, int sampleDistance, int textureSize)
 {
 	map = &doomMap;
+	numGLSubsectors = doomMap.NumGLSubsectors;
 	defaultSamples = sampleDistance;
 	textureWidth = textureSize;
 	textureHeight = textureSize;
 
+	auto starttime = std::chrono::steady_clock::now();
+
 	printf("\n------------- Building side surfaces -------------\n");
 
-	for (unsigned int i = 0; i < doomMap.Sides.Size(); i++)
 	{
-		CreateSideSurfaces(doomMap, &doomMap.Sides[i]);
-		printf("Sides: %i / %i\r", i + 1, doomMap.Sides.Size());
+		TIMELINE_SCOPE("Side surfaces");
+		CreateSurfacesParallel(doomMap.Sides.Size(), [&](int i, SurfaceList &list)
+		{
+			CreateSideSurfaces(doomMap, &doomMap.Sides[i], list);
+		});
 	}
 
-	printf("\nSide surfaces: %i\n", (int)surfaces.size());
+	printf("Side surfaces: %i\n", (int)surfaces.size());
 
 	CreateSubsectorSurfaces(doomMap);
 
@@ -62,55 +154,224 @@ LevelMesh::LevelMesh(FLevel &doomMap, int sampleDistance, int textureSize)
 
 	printf("Building level mesh...\n\n");
 
-	for (size_t i = 0; i < surfaces.size(); i++)
+	// Count the triangles of every surface, so that each one can be written
+	// straight into its place.
+	int numSurfaces = (int)surfaces.size();
+	std::vector<unsigned int> firstTriangle(numSurfaces + 1);
+
+	ParallelForChunks(numSurfaces, MESH_CHUNK, [&](int, int start, int end)
 	{
-		const auto &s = surfaces[i];
-		int numVerts = s->numVerts;
-		unsigned int pos = MeshVertices.Size();
+		for (int i = start; i < end; i++)
+		{
+			int numTriangles = 0;
+			ForEachTriangle(&surfaces[i], [&](int, int, int) { numTriangles++; });
+			firstTriangle[i + 1] = numTriangles;
+		}
+	});
 
-		for (int j = 0; j < numVerts; j++)
+	firstTriangle[0] = 0;
+	for (int i = 0; i < numSurfaces; i++)
+	{
+		firstTriangle[i + 1] += firstTriangle[i];
+	}
+
+	std::vector<unsigned int> meshVertex;
+	WeldVertices(meshVertex);
+
+	MeshElements.Resize(firstTriangle[numSurfaces] * 3);
+	MeshSurfaces.Resize(firstTriangle[numSurfaces]);
+
+	ParallelForChunks(numSurfaces, MESH_CHUNK, [&](int, int start, int end)
+	{
+		for (int i = start; i < end; i++)
+		{
+			const Surface *s = &surfaces[i];
+			const unsigned int *vertex = meshVertex.data() + s->firstVert;
+			unsigned int tri = firstTriangle[i];
+
+			ForEachTriangle(s, [&](int a, int b, int c)
+			{
+				MeshElements[tri * 3] = vertex[a];
+				MeshElements[tri * 3 + 1] = vertex[b];
+				MeshElements[tri * 3 + 2] = vertex[c];
+				MeshSurfaces[tri] = i;
+				tri++;
+			});
+		}
+	});
+
+	printf("Mesh vertices: %d of %d after welding\n", MeshVertices.Size(), (int)surfaceVerts.size());
+
+	CreateLightProbes(doomMap);
+
+	lightmapCoords.resize(surfaceVerts.size());
+
+	ParallelForChunks(numSurfaces, MESH_CHUNK, [&](int, int start, int end)
+	{
+		for (int i = start; i < end; i++)
 		{
-			MeshVertices.Push(s->verts[j]);
-			MeshUVIndex.Push(j);
+			BuildSurfaceParams(&surfaces[i]);
 		}
+	});
+
+	size_t numSamples = 0;
+	for (Surface &surface : surfaces)
+	{
+		surface.firstSample = (int)numSamples;
+		numSamples += (size_t)surface.lightmapDims[0] * surface.lightmapDims[1];
+	}
+	samples.resize(numSamples);
+
+	size_t materialSize = 0;
+	for (const std::string &material : materials)
+	{
+		materialSize += sizeof(std::string) + material.capacity();
+	}
+	size_t surfaceSize = surfaces.capacity() * sizeof(Surface) +
+		(surfaceVerts.capacity() + samples.capacity()) * sizeof(vec3) +
+		(surfaceUVs.capacity() + lightmapCoords.capacity()) * sizeof(vec2) + materialSize;
+
+	printf("Surface data: %d KB, %d vertices, %d samples, %d materials", int(surfaceSize / 1024), (int)surfaceVerts.size(), (int)samples.size(), (int)materials.size());
+	if (!NoTiming)
+	{
+		printf(" (%.3f seconds)", std::chrono::duration<double>(std::chrono::steady_clock::now() - starttime).count());
+	}
+	printf("\n\n");
+}
+
+namespace
+{
+	struct WeldCell
+	{
+		int32_t x, y, z;
+
+		bool operator==(const WeldCell &other) const { return x == other.x && y == other.y && z == other.z; }
+	};
 
-		if (s->type == ST_FLOOR || s->type == ST_CEILING)
+	struct WeldCellHash
+	{
+		size_t operator()(const WeldCell &cell) const
 		{
-			for (int j = 2; j < numVerts; j++)
+			return (uint32_t)cell.x * 73856093u ^ (uint32_t)cell.y * 19349663u ^ (uint32_t)cell.z * 83492791u;
+		}
+	};
+}
+
+// Fills MeshVertices with the surface vertices, merging those that are no
+// more than WeldDistance apart on every axis into the first of them. With a
+// distance of 0 only identical positions are merged, which leaves every
+// triangle exactly as it was. meshVertex receives the index in MeshVertices
+// for each entry of surfaceVerts.
+void LevelMesh::WeldVertices(std::vector<unsigned int> &meshVertex)
+{
+	TIMELINE_SCOPE("Weld vertices");
+
+	int count = (int)surfaceVerts.size();
+	meshVertex.resize(count);
+
+	if (WeldDistance < 0.0f)
+	{
+		MeshVertices.Resize(count);
+		for (int i = 0; i < count; i++)
+		{
+			MeshVertices[i] = surfaceVerts[i];
+			meshVertex[i] = i;
+		}
+		return;
+	}
+
+	// The vertices are hashed by grid cell, or by their exact bits when there
+	// is no distance. Each cell has a list of the mesh vertices in it.
+	std::unordered_map<WeldCell, int, WeldCellHash> cells;
+	std::vector<int> next;
+	cells.reserve(count);
+	next.reserve(count);
+	MeshVertices.Clear();
+	MeshVertices.Grow(count);
+
+	const float distance = WeldDistance;
+	int range = distance > 0.0f ? 1 : 0;
+
+	for (int i = 0; i < count; i++)
+	{
+		const vec3 &v = surfaceVerts[i];
+
+		WeldCell cell;
+		if (distance > 0.0f)
+		{
+			cell.x = (int32_t)std::floor(v.x / distance);
+			cell.y = (int32_t)std::floor(v.y / distance);
+			cell.z = (int32_t)std::floor(v.z / distance);
+		}
+		else
+		{
+			memcpy(&cell.x, &v.x, sizeof(float));
+			memcpy(&cell.y, &v.y, sizeof(float));
+			memcpy(&cell.z, &v.z, sizeof(float));
+		}
+
+		int found = -1;
+		for (int dz = -range; dz <= range; dz++)
+		{
+			for (int dy = -range; dy <= range; dy++)
 			{
-				if (!IsDegenerate(s->verts[0], s->verts[j - 1], s->verts[j]))
+				for (int dx = -range; dx <= range; dx++)
 				{
-					MeshElements.Push(pos);
-					MeshElements.Push(pos + j - 1);
-					MeshElements.Push(pos + j);
-					MeshSurfaces.Push(i);
+					auto it = cells.find({ cell.x + dx, cell.y + dy, cell.z + dz });
+					if (it == cells.end())
+						continue;
+
+					for (int j = it->second; j != -1; j = next[j])
+					{
+						const vec3 &w = MeshVertices[j];
+						if ((found == -1 || j < found) &&
+							std::abs(w.x - v.x) <= distance && std::abs(w.y - v.y) <= distance && std::abs(w.z - v.z) <= distance)
+						{
+							found = j;
+						}
+					}
 				}
 			}
 		}
-		else if (s->type == ST_MIDDLESIDE || s->type == ST_UPPERSIDE || s->type == ST_LOWERSIDE)
+
+		if (found == -1)
 		{
-			if (!IsDegenerate(s->verts[0], s->verts[1], s->verts[2]))
-			{
-				MeshElements.Push(pos + 0);
-				MeshElements.Push(pos + 1);
-				MeshElements.Push(pos + 2);
-				MeshSurfaces.Push(i);
-			}
-			if (!IsDegenerate(s->verts[1], s->verts[2], s->verts[3]))
-			{
-				MeshElements.Push(pos + 3);
-				MeshElements.Push(pos + 2);
-				MeshElements.Push(pos + 1);
-				MeshSurfaces.Push(i);
-			}
+			found = MeshVertices.Push(v);
+			auto it = cells.insert(std::make_pair(cell, -1)).first;
+			next.push_back(it->second);
+			it->second = found;
 		}
+		meshVertex[i] = found;
 	}
+}
 
-	CreateLightProbes(doomMap);
+// Calls callback(a, b, c) with the vertex numbers of every triangle of the
+// surface that is not degenerate.
+template<typename Callback>
+void LevelMesh::ForEachTriangle(const Surface *s, Callback callback)
+{
+	const vec3 *verts = GetVerts(s);
 
-	for (size_t i = 0; i < surfaces.size(); i++)
+	if (s->type == ST_FLOOR || s->type == ST_CEILING)
+	{
+		for (int j = 2; j < s->numVerts; j++)
+		{
+			if (!IsDegenerate(verts[0], verts[j - 1], verts[j]))
+			{
+				callback(0, j - 1, j);
+			}
+		}
+	}
+	else if (s->type == ST_MIDDLESIDE || s->type == ST_UPPERSIDE || s->type == ST_LOWERSIDE)
 	{
-		BuildSurfaceParams(surfaces[i].get());
+		if (!IsDegenerate(verts[0], verts[1], verts[2]))
+		{
+			callback(0, 1, 2);
+		}
+		if (!IsDegenerate(verts[1], verts[2], verts[3]))
+		{
+			callback(3, 2, 1);
+		}
 	}
 }
 
@@ -187,12 +448,13 @@ void LevelMesh::BuildSurfaceParams(Surface* surface)
 		height = (textureHeight - 2);
 	}
 
-	surface->lightmapCoords.resize(surface->numVerts);
+	const vec3 *verts = GetVerts(surface);
+	vec2 *coords = GetLightmapCoords(surface);
 	for (i = 0; i < surface->numVerts; i++)
 	{
-		vec3 tDelta = surface->verts[i] - bounds.min;
-		surface->lightmapCoords[i].x = dot(tDelta, tCoords[0]);
-		surface->lightmapCoords[i].y = dot(tDelta, tCoords[1]);
+		vec3 tDelta = verts[i] - bounds.min;
+		coords[i].x = dot(tDelta, tCoords[0]);
+		coords[i].y = dot(tDelta, tCoords[1]);
 	}
 
 	/*
@@ -236,8 +498,6 @@ void LevelMesh::BuildSurfaceParams(Surface* surface)
 	surface->lightmapOrigin = tOrigin;
 	surface->lightmapSteps[0] = tCoords[0] * (float)surface->sampleDimension;
 	surface->lightmapSteps[1] = tCoords[1] * (float)surface->sampleDimension;
-
-	surface->samples.resize(width * height);
 }
 
 BBox LevelMesh::GetBoundsFromSurface(const Surface* surface)
@@ -248,17 +508,19 @@ BBox LevelMesh::GetBoundsFromSurface(const Surface* surface)
 	BBox bounds;
 	bounds.Clear();
 
+	const vec3 *verts = GetVerts(surface);
+
 	for (int i = 0; i < surface->numVerts; i++)
 	{
 		for (int j = 0; j < 3; j++)
 		{
-			if (surface->verts[i][j] < low[j])
+			if (verts[i][j] < low[j])
 			{
-				low[j] = surface->verts[i][j];
+				low[j] = verts[i][j];
 			}
-			if (surface->verts[i][j] > hi[j])
+			if (verts[i][j] > hi[j])
 			{
-				hi[j] = surface->verts[i][j];
+				hi[j] = verts[i][j];
 			}
 		}
 	}
@@ -271,14 +533,26 @@ BBox LevelMesh::GetBoundsFromSurface(const Surface* surface)
 
 void LevelMesh::CreateTextures()
 {
+	// The coordinates are moved into the texture pages below. When the
+	// samples are traced again, the pages are packed again from the start.
+	if (unpackedLightmapCoords.empty())
+	{
+		unpackedLightmapCoords = lightmapCoords;
+	}
+	else
+	{
+		lightmapCoords = unpackedLightmapCoords;
+		textures.clear();
+	}
+
 	std::vector<Surface*> sortedSurfaces;
 	sortedSurfaces.reserve(surfaces.size());
 
-	for (auto& surface : surfaces)
+	for (Surface& surface : surfaces)
 	{
-		int sampleWidth = surface->lightmapDims[0];
-		int sampleHeight = surface->lightmapDims[1];
-		vec3* colorSamples = surface->samples.data();
+		int sampleWidth = surface.lightmapDims[0];
+		int sampleHeight = surface.lightmapDims[1];
+		vec3* colorSamples = GetSamples(&surface);
 
 		// SVE redraws the scene for lightmaps, so for optimizations,
 		// tell the engine to ignore this surface if completely black
@@ -298,11 +572,11 @@ void LevelMesh::CreateTextures()
 
 		if (bShouldLookupTexture)
 		{
-			sortedSurfaces.push_back(surface.get());
+			sortedSurfaces.push_back(&surface);
 		}
 		else
 		{
-			surface->lightmapNum = -1;
+			surface.lightmapNum = -1;
 		}
 	}
 
@@ -320,7 +594,7 @@ void LevelMesh::FinishSurface(RectPacker& packer, Surface* surface)
 {
 	int sampleWidth = surface->lightmapDims[0];
 	int sampleHeight = surface->lightmapDims[1];
-	vec3* colorSamples = surface->samples.data();
+	vec3* colorSamples = GetSamples(surface);
 
 	auto result = packer.insert(sampleWidth, sampleHeight);
 	int x = result.pos.x, y = result.pos.y;
@@ -334,10 +608,11 @@ void LevelMesh::FinishSurface(RectPacker& packer, Surface* surface)
 	uint16_t* currentTexture = textures[surface->lightmapNum]->Pixels();
 
 	// calculate final texture coordinates
+	vec2* coords = GetLightmapCoords(surface);
 	for (int i = 0; i < surface->numVerts; i++)
 	{
-		auto& u = surface->lightmapCoords[i].x;
-		auto& v = surface->lightmapCoords[i].y;
+		auto& u = coords[i].x;
+		auto& v = coords[i].y;
 		u = (u + x) / (float)textureWidth;
 		v = (v + y) / (float)textureHeight;
 	}
@@ -395,6 +670,8 @@ void LevelMesh::FinishSurface(RectPacker& packer, Surface* surface)
 
 void LevelMesh::CreateLightProbes(FLevel& map)
 {
+	TIMELINE_SCOPE("Light probes");
+
 	float minX = std::floor(map.MinX / 65536.0f);
 	float minY = std::floor(map.MinY / 65536.0f);
 	float maxX = std::floor(map.MaxX / 65536.0f) + 1.0f;
@@ -403,8 +680,21 @@ void LevelMesh::CreateLightProbes(FLevel& map)
 	float halfGridSize = map.GridSize * 0.5f;
 	float doubleGridSize = map.GridSize * 2.0f;
 
+	// The rows are worked on in parallel, but y has to take the same values
+	// as when it is stepped through them one after another.
+	std::vector<float> rows;
 	for (float y = minY; y < maxY; y += map.GridSize)
 	{
+		rows.push_back(y);
+	}
+
+	std::vector<std::vector<LightProbeSample>> rowProbes(rows.size());
+
+	ParallelFor((int)rows.size(), [&](int row)
+	{
+		float y = rows[row];
+		std::vector<LightProbeSample> &probes = rowProbes[row];
+
 		for (float x = minX; x < maxX; x += map.GridSize)
 		{
 			MapSubsectorEx* ssec = map.PointInSubSector((int)x, (int)y);
@@ -423,7 +713,7 @@ void LevelMesh::CreateLightProbes(FLevel& map)
 
 					for (int i = 0; i < 3; i++)
 					{
-						lightProbes.push_back(p[i]);
+						probes.push_back(p[i]);
 					}
 				}
 				else if (delta > 0.0f)
@@ -432,10 +722,15 @@ void LevelMesh::CreateLightProbes(FLevel& map)
 					probe.Position.x = x;
 					probe.Position.y = y;
 					probe.Position.z = z0 + (z1 - z0) * 0.5f;
-					lightProbes.push_back(probe);
+					probes.push_back(probe);
 				}
 			}
 		}
+	});
+
+	for (const auto &probes : rowProbes)
+	{
+		lightProbes.insert(lightProbes.end(), probes.begin(), probes.end());
 	}
 
 	for (unsigned int i = 0; i < map.ThingLightProbes.Size(); i++)
@@ -446,7 +741,7 @@ void LevelMesh::CreateLightProbes(FLevel& map)
 	}
 }
 
-void LevelMesh::CreateSideSurfaces(FLevel &doomMap, IntSideDef *side)
+void LevelMesh::CreateSideSurfaces(FLevel &doomMap, IntSideDef *side, SurfaceList &list)
 {
 	IntSector *front;
 	IntSector *back;
@@ -481,41 +776,37 @@ void LevelMesh::CreateSideSurfaces(FLevel &doomMap, IntSideDef *side)
 		float texWidth = 128.0f;
 		float texHeight = 128.0f;
 
-		auto surf = std::make_unique<Surface>();
-		surf->material = side->midtexture;
-		surf->numVerts = 4;
-		surf->verts.resize(4);
-		surf->bSky = front->skyFloor || front->skyCeiling;
-
-		surf->verts[0].x = surf->verts[2].x = v1.x;
-		surf->verts[0].y = surf->verts[2].y = v1.y;
-		surf->verts[1].x = surf->verts[3].x = v2.x;
-		surf->verts[1].y = surf->verts[3].y = v2.y;
-		surf->verts[0].z = v1Bottom;
-		surf->verts[1].z = v2Bottom;
-		surf->verts[2].z = v1Top;
-		surf->verts[3].z = v2Top;
-
-		surf->plane.SetNormal(surf->verts[0], surf->verts[1], surf->verts[2], surf->verts[3]);
-		surf->plane.SetDistance(surf->verts[0]);
-		surf->type = ST_MIDDLESIDE;
-		surf->typeIndex = typeIndex;
-		surf->controlSector = nullptr;
-		surf->sampleDimension = (surf->sampleDimension = side->GetSampleDistanceMiddle()) ? surf->sampleDimension : defaultSamples;
-
-		float texZ = surf->verts[0].z;
-
-		surf->uvs.resize(4);
-		surf->uvs[0].x = 0.0f;
-		surf->uvs[1].x = distance / texWidth;
-		surf->uvs[2].x = 0.0f;
-		surf->uvs[3].x = distance / texWidth;
-		surf->uvs[0].y = (surf->verts[0].z - texZ) / texHeight;
-		surf->uvs[1].y = (surf->verts[1].z - texZ) / texHeight;
-		surf->uvs[2].y = (surf->verts[2].z - texZ) / texHeight;
-		surf->uvs[3].y = (surf->verts[3].z - texZ) / texHeight;
-
-		surfaces.push_back(std::move(surf));
+		Surface &surf = list.Add(4, side->midtexture);
+		vec3 *verts = &list.verts[surf.firstVert];
+		vec2 *uvs = &list.uvs[surf.firstVert];
+		surf.bSky = front->skyFloor || front->skyCeiling;
+
+		verts[0].x = verts[2].x = v1.x;
+		verts[0].y = verts[2].y = v1.y;
+		verts[1].x = verts[3].x = v2.x;
+		verts[1].y = verts[3].y = v2.y;
+		verts[0].z = v1Bottom;
+		verts[1].z = v2Bottom;
+		verts[2].z = v1Top;
+		verts[3].z = v2Top;
+
+		surf.plane.SetNormal(verts[0], verts[1], verts[2], verts[3]);
+		surf.plane.SetDistance(verts[0]);
+		surf.type = ST_MIDDLESIDE;
+		surf.typeIndex = typeIndex;
+		surf.controlSector = -1;
+		surf.sampleDimension = (surf.sampleDimension = side->GetSampleDistanceMiddle()) ? surf.sampleDimension : defaultSamples;
+
+		float texZ = verts[0].z;
+
+		uvs[0].x = 0.0f;
+		uvs[1].x = distance / texWidth;
+		uvs[2].x = 0.0f;
+		uvs[3].x = distance / texWidth;
+		uvs[0].y = (verts[0].z - texZ) / texHeight;
+		uvs[1].y = (verts[1].z - texZ) / texHeight;
+		uvs[2].y = (verts[2].z - texZ) / texHeight;
+		uvs[3].y = (verts[3].z - texZ) / texHeight;
 		return;
 	}
 
@@ -543,38 +834,34 @@ void LevelMesh::CreateSideSurfaces(FLevel &doomMap, IntSideDef *side)
 
 			IntSideDef* otherSide = &doomMap.Sides[side->line->sidenum[0]] == side ? &doomMap.Sides[side->line->sidenum[1]] : &doomMap.Sides[side->line->sidenum[0]];
 
-			auto surf = std::make_unique<Surface>();
-			surf->material = "texture";
-			surf->type = ST_MIDDLESIDE;
-			surf->typeIndex = typeIndex;
-			surf->controlSector = xfloor;
-			surf->sampleDimension = (surf->sampleDimension = otherSide->GetSampleDistanceMiddle()) ? surf->sampleDimension : defaultSamples;
-			surf->numVerts = 4;
-			surf->verts.resize(4);
-			surf->verts[0].x = surf->verts[2].x = v2.x;
-			surf->verts[0].y = surf->verts[2].y = v2.y;
-			surf->verts[1].x = surf->verts[3].x = v1.x;
-			surf->verts[1].y = surf->verts[3].y = v1.y;
-			surf->verts[0].z = xfloor->floorplane.zAt(v2.x, v2.y);
-			surf->verts[1].z = xfloor->floorplane.zAt(v1.x, v1.y);
-			surf->verts[2].z = xfloor->ceilingplane.zAt(v2.x, v2.y);
-			surf->verts[3].z = xfloor->ceilingplane.zAt(v1.x, v1.y);
-			surf->plane.SetNormal(surf->verts[0], surf->verts[1], surf->verts[2], surf->verts[3]);
-			surf->plane.SetDistance(surf->verts[0]);
-
-			float texZ = surf->verts[0].z;
-
-			surf->uvs.resize(4);
-			surf->uvs[0].x = 0.0f;
-			surf->uvs[1].x = distance / texWidth;
-			surf->uvs[2].x = 0.0f;
-			surf->uvs[3].x = distance / texWidth;
-			surf->uvs[0].y = (surf->verts[0].z - texZ) / texHeight;
-			surf->uvs[1].y = (surf->verts[1].z - texZ) / texHeight;
-			surf->uvs[2].y = (surf->verts[2].z - texZ) / texHeight;
-			surf->uvs[3].y = (surf->verts[3].z - texZ) / texHeight;
-
-			surfaces.push_back(std::move(surf));
+			Surface &surf = list.Add(4, "texture");
+			vec3 *verts = &list.verts[surf.firstVert];
+			vec2 *uvs = &list.uvs[surf.firstVert];
+			surf.type = ST_MIDDLESIDE;
+			surf.typeIndex = typeIndex;
+			surf.controlSector = int(xfloor - &doomMap.Sectors[0]);
+			surf.sampleDimension = (surf.sampleDimension = otherSide->GetSampleDistanceMiddle()) ? surf.sampleDimension : defaultSamples;
+			verts[0].x = verts[2].x = v2.x;
+			verts[0].y = verts[2].y = v2.y;
+			verts[1].x = verts[3].x = v1.x;
+			verts[1].y = verts[3].y = v1.y;
+			verts[0].z = xfloor->floorplane.zAt(v2.x, v2.y);
+			verts[1].z = xfloor->floorplane.zAt(v1.x, v1.y);
+			verts[2].z = xfloor->ceilingplane.zAt(v2.x, v2.y);
+			verts[3].z = xfloor->ceilingplane.zAt(v1.x, v1.y);
+			surf.plane.SetNormal(verts[0], verts[1], verts[2], verts[3]);
+			surf.plane.SetDistance(verts[0]);
+
+			float texZ = verts[0].z;
+
+			uvs[0].x = 0.0f;
+			uvs[1].x = distance / texWidth;
+			uvs[2].x = 0.0f;
+			uvs[3].x = distance / texWidth;
+			uvs[0].y = (verts[0].z - texZ) / texHeight;
+			uvs[1].y = (verts[1].z - texZ) / texHeight;
+			uvs[2].y = (verts[2].z - texZ) / texHeight;
+			uvs[3].y = (verts[3].z - texZ) / texHeight;
 		}
 
 		float v1TopBack = back->ceilingplane.zAt(v1.x, v1.y);
@@ -605,41 +892,37 @@ void LevelMesh::CreateSideSurfaces(FLevel &doomMap, IntSideDef *side)
 				float texWidth = 128.0f;
 				float texHeight = 128.0f;
 
-				auto surf = std::make_unique<Surface>();
-				surf->material = side->bottomtexture;
-				surf->numVerts = 4;
-				surf->verts.resize(4);
-
-				surf->verts[0].x = surf->verts[2].x = v1.x;
-				surf->verts[0].y = surf->verts[2].y = v1.y;
-				surf->verts[1].x = surf->verts[3].x = v2.x;
-				surf->verts[1].y = surf->verts[3].y = v2.y;
-				surf->verts[0].z = v1Bottom;
-				surf->verts[1].z = v2Bottom;
-				surf->verts[2].z = v1BottomBack;
-				surf->verts[3].z = v2BottomBack;
-
-				surf->plane.SetNormal(surf->verts[0], surf->verts[1], surf->verts[2], surf->verts[3]);
-				surf->plane.SetDistance(surf->verts[0]);
-				surf->type = ST_LOWERSIDE;
-				surf->typeIndex = typeIndex;
-				surf->bSky = bSky;
-				surf->controlSector = nullptr;
-				surf->sampleDimension = (surf->sampleDimension = side->GetSampleDistanceBottom()) ? surf->sampleDimension : defaultSamples;
-
-				float texZ = surf->verts[0].z;
-
-				surf->uvs.resize(4);
-				surf->uvs[0].x = 0.0f;
-				surf->uvs[1].x = distance / texWidth;
-				surf->uvs[2].x = 0.0f;
-				surf->uvs[3].x = distance / texWidth;
-				surf->uvs[0].y = (surf->verts[0].z - texZ) / texHeight;
-				surf->uvs[1].y = (surf->verts[1].z - texZ) / texHeight;
-				surf->uvs[2].y = (surf->verts[2].z - texZ) / texHeight;
-				surf->uvs[3].y = (surf->verts[3].z - texZ) / texHeight;
-
-				surfaces.push_back(std::move(surf));
+				Surface &surf = list.Add(4, side->bottomtexture);
+				vec3 *verts = &list.verts[surf.firstVert];
+				vec2 *uvs = &list.uvs[surf.firstVert];
+
+				verts[0].x = verts[2].x = v1.x;
+				verts[0].y = verts[2].y = v1.y;
+				verts[1].x = verts[3].x = v2.x;
+				verts[1].y = verts[3].y = v2.y;
+				verts[0].z = v1Bottom;
+				verts[1].z = v2Bottom;
+				verts[2].z = v1BottomBack;
+				verts[3].z = v2BottomBack;
+
+				surf.plane.SetNormal(verts[0], verts[1], verts[2], verts[3]);
+				surf.plane.SetDistance(verts[0]);
+				surf.type = ST_LOWERSIDE;
+				surf.typeIndex = typeIndex;
+				surf.bSky = bSky;
+				surf.controlSector = -1;
+				surf.sampleDimension = (surf.sampleDimension = side->GetSampleDistanceBottom()) ? surf.sampleDimension : defaultSamples;
+
+				float texZ = verts[0].z;
+
+				uvs[0].x = 0.0f;
+				uvs[1].x = distance / texWidth;
+				uvs[2].x = 0.0f;
+				uvs[3].x = distance / texWidth;
+				uvs[0].y = (verts[0].z - texZ) / texHeight;
+				uvs[1].y = (verts[1].z - texZ) / texHeight;
+				uvs[2].y = (verts[2].z - texZ) / texHeight;
+				uvs[3].y = (verts[3].z - texZ) / texHeight;
 			}
 
 			v1Bottom = v1BottomBack;
@@ -664,41 +947,37 @@ void LevelMesh::CreateSideSurfaces(FLevel &doomMap, IntSideDef *side)
 				float texWidth = 128.0f;
 				float texHeight = 128.0f;
 
-				auto surf = std::make_unique<Surface>();
-				surf->material = side->toptexture;
-				surf->numVerts = 4;
-				surf->verts.resize(4);
-
-				surf->verts[0].x = surf->verts[2].x = v1.x;
-				surf->verts[0].y = surf->verts[2].y = v1.y;
-				surf->verts[1].x = surf->verts[3].x = v2.x;
-				surf->verts[1].y = surf->verts[3].y = v2.y;
-				surf->verts[0].z = v1TopBack;
-				surf->verts[1].z = v2TopBack;
-				surf->verts[2].z = v1Top;
-				surf->verts[3].z = v2Top;
-
-				surf->plane.SetNormal(surf->verts[0], surf->verts[1], surf->verts[2], surf->verts[3]);
-				surf->plane.SetDistance(surf->verts[0]);
-				surf->type = ST_UPPERSIDE;
-				surf->typeIndex = typeIndex;
-				surf->bSky = bSky;
-				surf->controlSector = nullptr;
-				surf->sampleDimension = (surf->sampleDimension = side->GetSampleDistanceTop()) ? surf->sampleDimension : defaultSamples;
-
-				float texZ = surf->verts[0].z;
-
-				surf->uvs.resize(4);
-				surf->uvs[0].x = 0.0f;
-				surf->uvs[1].x = distance / texWidth;
-				surf->uvs[2].x = 0.0f;
-				surf->uvs[3].x = distance / texWidth;
-				surf->uvs[0].y = (surf->verts[0].z - texZ) / texHeight;
-				surf->uvs[1].y = (surf->verts[1].z - texZ) / texHeight;
-				surf->uvs[2].y = (surf->verts[2].z - texZ) / texHeight;
-				surf->uvs[3].y = (surf->verts[3].z - texZ) / texHeight;
-
-				surfaces.push_back(std::move(surf));
+				Surface &surf = list.Add(4, side->toptexture);
+				vec3 *verts = &list.verts[surf.firstVert];
+				vec2 *uvs = &list.uvs[surf.firstVert];
+
+				verts[0].x = verts[2].x = v1.x;
+				verts[0].y = verts[2].y = v1.y;
+				verts[1].x = verts[3].x = v2.x;
+				verts[1].y = verts[3].y = v2.y;
+				verts[0].z = v1TopBack;
+				verts[1].z = v2TopBack;
+				verts[2].z = v1Top;
+				verts[3].z = v2Top;
+
+				surf.plane.SetNormal(verts[0], verts[1], verts[2], verts[3]);
+				surf.plane.SetDistance(verts[0]);
+				surf.type = ST_UPPERSIDE;
+				surf.typeIndex = typeIndex;
+				surf.bSky = bSky;
+				surf.controlSector = -1;
+				surf.sampleDimension = (surf.sampleDimension = side->GetSampleDistanceTop()) ? surf.sampleDimension : defaultSamples;
+
+				float texZ = verts[0].z;
+
+				uvs[0].x = 0.0f;
+				uvs[1].x = distance / texWidth;
+				uvs[2].x = 0.0f;
+				uvs[3].x = distance / texWidth;
+				uvs[0].y = (verts[0].z - texZ) / texHeight;
+				uvs[1].y = (verts[1].z - texZ) / texHeight;
+				uvs[2].y = (verts[2].z - texZ) / texHeight;
+				uvs[3].y = (verts[3].z - texZ) / texHeight;
 			}
 
 			v1Top = v1TopBack;
@@ -712,151 +991,139 @@ void LevelMesh::CreateSideSurfaces(FLevel &doomMap, IntSideDef *side)
 		float texWidth = 128.0f;
 		float texHeight = 128.0f;
 
-		auto surf = std::make_unique<Surface>();
-		surf->material = side->midtexture;
-		surf->numVerts = 4;
-		surf->verts.resize(4);
-
-		surf->verts[0].x = surf->verts[2].x = v1.x;
-		surf->verts[0].y = surf->verts[2].y = v1.y;
-		surf->verts[1].x = surf->verts[3].x = v2.x;
-		surf->verts[1].y = surf->verts[3].y = v2.y;
-		surf->verts[0].z = v1Bottom;
-		surf->verts[1].z = v2Bottom;
-		surf->verts[2].z = v1Top;
-		surf->verts[3].z = v2Top;
-
-		surf->plane.SetNormal(surf->verts[0], surf->verts[1], surf->verts[2], surf->verts[3]);
-		surf->plane.SetDistance(surf->verts[0]);
-		surf->type = ST_MIDDLESIDE;
-		surf->typeIndex = typeIndex;
-		surf->controlSector = nullptr;
-		surf->sampleDimension = (surf->sampleDimension = side->GetSampleDistanceMiddle()) ? surf->sampleDimension : defaultSamples;
-
-		float texZ = surf->verts[0].z;
-
-		surf->uvs.resize(4);
-		surf->uvs[0].x = 0.0f;
-		surf->uvs[1].x = distance / texWidth;
-		surf->uvs[2].x = 0.0f;
-		surf->uvs[3].x = distance / texWidth;
-		surf->uvs[0].y = (surf->verts[0].z - texZ) / texHeight;
-		surf->uvs[1].y = (surf->verts[1].z - texZ) / texHeight;
-		surf->uvs[2].y = (surf->verts[2].z - texZ) / texHeight;
-		surf->uvs[3].y = (surf->verts[3].z - texZ) / texHeight;
-
-		surfaces.push_back(std::move(surf));
+		Surface &surf = list.Add(4, side->midtexture);
+		vec3 *verts = &list.verts[surf.firstVert];
+		vec2 *uvs = &list.uvs[surf.firstVert];
+
+		verts[0].x = verts[2].x = v1.x;
+		verts[0].y = verts[2].y = v1.y;
+		verts[1].x = verts[3].x = v2.x;
+		verts[1].y = verts[3].y = v2.y;
+		verts[0].z = v1Bottom;
+		verts[1].z = v2Bottom;
+		verts[2].z = v1Top;
+		verts[3].z = v2Top;
+
+		surf.plane.SetNormal(verts[0], verts[1], verts[2], verts[3]);
+		surf.plane.SetDistance(verts[0]);
+		surf.type = ST_MIDDLESIDE;
+		surf.typeIndex = typeIndex;
+		surf.controlSector = -1;
+		surf.sampleDimension = (surf.sampleDimension = side->GetSampleDistanceMiddle()) ? surf.sampleDimension : defaultSamples;
+
+		float texZ = verts[0].z;
+
+		uvs[0].x = 0.0f;
+		uvs[1].x = distance / texWidth;
+		uvs[2].x = 0.0f;
+		uvs[3].x = distance / texWidth;
+		uvs[0].y = (verts[0].z - texZ) / texHeight;
+		uvs[1].y = (verts[1].z - texZ) / texHeight;
+		uvs[2].y = (verts[2].z - texZ) / texHeight;
+		uvs[3].y = (verts[3].z - texZ) / texHeight;
 	}
 }
 
-void LevelMesh::CreateFloorSurface(FLevel &doomMap, MapSubsectorEx *sub, IntSector *sector, int typeIndex, bool is3DFloor)
+void LevelMesh::CreateFloorSurface(FLevel &doomMap, MapSubsectorEx *sub, IntSector *sector, int typeIndex, bool is3DFloor, SurfaceList &list)
 {
-	auto surf = std::make_unique<Surface>();
-	surf->sampleDimension = sector->sampleDistanceFloor ? sector->sampleDistanceFloor : defaultSamples;
-	surf->material = sector->data.floorpic;
-	surf->numVerts = sub->numlines;
-	surf->verts.resize(surf->numVerts);
-	surf->uvs.resize(surf->numVerts);
-	surf->bSky = sector->skyFloor;
+	Surface &surf = list.Add(sub->numlines, sector->data.floorpic);
+	vec3 *verts = &list.verts[surf.firstVert];
+	vec2 *uvs = &list.uvs[surf.firstVert];
+	surf.sampleDimension = sector->sampleDistanceFloor ? sector->sampleDistanceFloor : defaultSamples;
+	surf.bSky = sector->skyFloor;
 
 	if (!is3DFloor)
 	{
-		surf->plane = sector->floorplane;
+		surf.plane = sector->floorplane;
 	}
 	else
 	{
-		surf->plane = Plane::Inverse(sector->ceilingplane);
+		surf.plane = Plane::Inverse(sector->ceilingplane);
 	}
 
-	for (int j = 0; j < surf->numVerts; j++)
+	for (int j = 0; j < surf.numVerts; j++)
 	{
-		MapSegGLEx *seg = &doomMap.GLSegs[sub->firstline + (surf->numVerts - 1) - j];
+		MapSegGLEx *seg = &doomMap.GLSegs[sub->firstline + (surf.numVerts - 1) - j];
 		FloatVertex v1 = doomMap.GetSegVertex(seg->v1);
 
-		surf->verts[j].x = v1.x;
-		surf->verts[j].y = v1.y;
-		surf->verts[j].z = surf->plane.zAt(surf->verts[j].x, surf->verts[j].y);
+		verts[j].x = v1.x;
+		verts[j].y = v1.y;
+		verts[j].z = surf.plane.zAt(verts[j].x, verts[j].y);
 
-		surf->uvs[j].x = v1.x / 64.0f;
-		surf->uvs[j].y = v1.y / 64.0f;
+		uvs[j].x = v1.x / 64.0f;
+		uvs[j].y = v1.y / 64.0f;
 	}
 
-	surf->type = ST_FLOOR;
-	surf->typeIndex = typeIndex;
-	surf->controlSector = is3DFloor ? sector : nullptr;
-
-	surfaces.push_back(std::move(surf));
+	surf.type = ST_FLOOR;
+	surf.typeIndex = typeIndex;
+	surf.controlSector = is3DFloor ? int(sector - &doomMap.Sectors[0]) : -1;
 }
 
-void LevelMesh::CreateCeilingSurface(FLevel &doomMap, MapSubsectorEx *sub, IntSector *sector, int typeIndex, bool is3DFloor)
+void LevelMesh::CreateCeilingSurface(FLevel &doomMap, MapSubsectorEx *sub, IntSector *sector, int typeIndex, bool is3DFloor, SurfaceList &list)
 {
-	auto surf = std::make_unique<Surface>();
-	surf->material = sector->data.ceilingpic;
-	surf->sampleDimension = sector->sampleDistanceCeiling ? sector->sampleDistanceCeiling : defaultSamples;
-	surf->numVerts = sub->numlines;
-	surf->verts.resize(surf->numVerts);
-	surf->uvs.resize(surf->numVerts);
-	surf->bSky = sector->skyCeiling;
+	Surface &surf = list.Add(sub->numlines, sector->data.ceilingpic);
+	vec3 *verts = &list.verts[surf.firstVert];
+	vec2 *uvs = &list.uvs[surf.firstVert];
+	surf.sampleDimension = sector->sampleDistanceCeiling ? sector->sampleDistanceCeiling : defaultSamples;
+	surf.bSky = sector->skyCeiling;
 
 	if (!is3DFloor)
 	{
-		surf->plane = sector->ceilingplane;
+		surf.plane = sector->ceilingplane;
 	}
 	else
 	{
-		surf->plane = Plane::Inverse(sector->floorplane);
+		surf.plane = Plane::Inverse(sector->floorplane);
 	}
 
-	for (int j = 0; j < surf->numVerts; j++)
+	for (int j = 0; j < surf.numVerts; j++)
 	{
 		MapSegGLEx *seg = &doomMap.GLSegs[sub->firstline + j];
 		FloatVertex v1 = doomMap.GetSegVertex(seg->v1);
 
-		surf->verts[j].x = v1.x;
-		surf->verts[j].y = v1.y;
-		surf->verts[j].z = surf->plane.zAt(surf->verts[j].x, surf->verts[j].y);
+		verts[j].x = v1.x;
+		verts[j].y = v1.y;
+		verts[j].z = surf.plane.zAt(verts[j].x, verts[j].y);
 
-		surf->uvs[j].x = v1.x / 64.0f;
-		surf->uvs[j].y = v1.y / 64.0f;
+		uvs[j].x = v1.x / 64.0f;
+		uvs[j].y = v1.y / 64.0f;
 	}
 
-	surf->type = ST_CEILING;
-	surf->typeIndex = typeIndex;
-	surf->controlSector = is3DFloor ? sector : nullptr;
-
-	surfaces.push_back(std::move(surf));
+	surf.type = ST_CEILING;
+	surf.typeIndex = typeIndex;
+	surf.controlSector = is3DFloor ? int(sector - &doomMap.Sectors[0]) : -1;
 }
 
 void LevelMesh::CreateSubsectorSurfaces(FLevel &doomMap)
 {
+	TIMELINE_SCOPE("Subsector surfaces");
+
 	printf("\n------------- Building subsector surfaces -------------\n");
 
-	for (int i = 0; i < doomMap.NumGLSubsectors; i++)
+	CreateSurfacesParallel(doomMap.NumGLSubsectors, [&](int i, SurfaceList &list)
 	{
-		printf("Subsectors: %i / %i\r", i + 1, doomMap.NumGLSubsectors);
-
 		MapSubsectorEx *sub = &doomMap.GLSubsectors[i];
 
 		if (sub->numlines < 3)
 		{
-			continue;
+			return;
 		}
 
 		IntSector *sector = doomMap.GetSectorFromSubSector(sub);
 		if (!sector || sector->controlsector)
-			continue;
+			return;
 
-		CreateFloorSurface(doomMap, sub, sector, i, false);
-		CreateCeilingSurface(doomMap, sub, sector, i, false);
+		CreateFloorSurface(doomMap, sub, sector, i, false, list);
+		CreateCeilingSurface(doomMap, sub, sector, i, false, list);
 
 		for (unsigned int j = 0; j < sector->x3dfloors.Size(); j++)
 		{
-			CreateFloorSurface(doomMap, sub, sector->x3dfloors[j], i, true);
-			CreateCeilingSurface(doomMap, sub, sector->x3dfloors[j], i, true);
+			CreateFloorSurface(doomMap, sub, sector->x3dfloors[j], i, true, list);
+			CreateCeilingSurface(doomMap, sub, sector->x3dfloors[j], i, true, list);
 		}
-	}
+	});
 
-	printf("\nLeaf surfaces: %i\n", (int)surfaces.size() - doomMap.NumGLSubsectors);
+	printf("Leaf surfaces: %i\n", (int)surfaces.size() - doomMap.NumGLSubsectors);
 }
 
 bool LevelMesh::IsDegenerate(const vec3 &v0, const vec3 &v1, const vec3 &v2)
@@ -877,14 +1144,16 @@ bool LevelMesh::IsDegenerate(const vec3 &v0, const vec3 &v1, const vec3 &v2)
 
 void LevelMesh::AddLightmapLump(FWadWriter& wadFile)
 {
+	TIMELINE_SCOPE("Lightmap lump");
+
 	// Calculate size of lump
 	int numTexCoords = 0;
 	int numSurfaces = 0;
 	for (size_t i = 0; i < surfaces.size(); i++)
 	{
-		if (surfaces[i]->lightmapNum != -1)
+		if (surfaces[i].lightmapNum != -1)
 		{
-			numTexCoords += surfaces[i]->numVerts;
+			numTexCoords += surfaces[i].numVerts;
 			numSurfaces++;
 		}
 	}
@@ -909,7 +1178,7 @@ void LevelMesh::AddLightmapLump(FWadWriter& wadFile)
 	lumpFile.Write32(numSurfaces);
 	lumpFile.Write32(numTexCoords);
 	lumpFile.Write32(lightProbes.size());
-	lumpFile.Write32(map->NumGLSubsectors);
+	lumpFile.Write32(numGLSubsectors);
 
 	// Write light probes
 	for (const LightProbeSample& probe : lightProbes)
@@ -926,55 +1195,56 @@ void LevelMesh::AddLightmapLump(FWadWriter& wadFile)
 	int coordOffsets = 0;
 	for (size_t i = 0; i < surfaces.size(); i++)
 	{
-		if (surfaces[i]->lightmapNum == -1)
+		if (surfaces[i].lightmapNum == -1)
 			continue;
 
-		lumpFile.Write32(surfaces[i]->type);
-		lumpFile.Write32(surfaces[i]->typeIndex);
-		lumpFile.Write32(surfaces[i]->controlSector ? (uint32_t)(surfaces[i]->controlSector - &map->Sectors[0]) : 0xffffffff);
-		lumpFile.Write32(surfaces[i]->lightmapNum);
+		lumpFile.Write32(surfaces[i].type);
+		lumpFile.Write32(surfaces[i].typeIndex);
+		lumpFile.Write32((uint32_t)surfaces[i].controlSector);
+		lumpFile.Write32(surfaces[i].lightmapNum);
 		lumpFile.Write32(coordOffsets);
-		coordOffsets += surfaces[i]->numVerts;
+		coordOffsets += surfaces[i].numVerts;
 	}
 
 	// Write texture coordinates
 	for (size_t i = 0; i < surfaces.size(); i++)
 	{
-		if (surfaces[i]->lightmapNum == -1)
+		if (surfaces[i].lightmapNum == -1)
 			continue;
 
-		int count = surfaces[i]->numVerts;
-		if (surfaces[i]->type == ST_FLOOR)
+		const vec2 *coords = GetLightmapCoords(&surfaces[i]);
+		int count = surfaces[i].numVerts;
+		if (surfaces[i].type == ST_FLOOR)
 		{
 			for (int j = count - 1; j >= 0; j--)
 			{
-				lumpFile.WriteFloat(surfaces[i]->lightmapCoords[j].x);
-				lumpFile.WriteFloat(surfaces[i]->lightmapCoords[j].y);
+				lumpFile.WriteFloat(coords[j].x);
+				lumpFile.WriteFloat(coords[j].y);
 			}
 		}
-		else if (surfaces[i]->type == ST_CEILING)
+		else if (surfaces[i].type == ST_CEILING)
 		{
 			for (int j = 0; j < count; j++)
 			{
-				lumpFile.WriteFloat(surfaces[i]->lightmapCoords[j].x);
-				lumpFile.WriteFloat(surfaces[i]->lightmapCoords[j].y);
+				lumpFile.WriteFloat(coords[j].x);
+				lumpFile.WriteFloat(coords[j].y);
 			}
 		}
 		else
 		{
 			// zdray uses triangle strip internally, lump/gzd uses triangle fan
 
-			lumpFile.WriteFloat(surfaces[i]->lightmapCoords[0].x);
-			lumpFile.WriteFloat(surfaces[i]->lightmapCoords[0].y);
+			lumpFile.WriteFloat(coords[0].x);
+			lumpFile.WriteFloat(coords[0].y);
 
-			lumpFile.WriteFloat(surfaces[i]->lightmapCoords[2].x);
-			lumpFile.WriteFloat(surfaces[i]->lightmapCoords[2].y);
+			lumpFile.WriteFloat(coords[2].x);
+			lumpFile.WriteFloat(coords[2].y);
 
-			lumpFile.WriteFloat(surfaces[i]->lightmapCoords[3].x);
-			lumpFile.WriteFloat(surfaces[i]->lightmapCoords[3].y);
+			lumpFile.WriteFloat(coords[3].x);
+			lumpFile.WriteFloat(coords[3].y);
 
-			lumpFile.WriteFloat(surfaces[i]->lightmapCoords[1].x);
-			lumpFile.WriteFloat(surfaces[i]->lightmapCoords[1].y);
+			lumpFile.WriteFloat(coords[1].x);
+			lumpFile.WriteFloat(coords[1].y);
 		}
 	}
 
@@ -1004,34 +1274,28 @@ void LevelMesh::Export(std::string filename)
 	for (int i = 0; i < 3; i++) mtlfilename.pop_back();
 	mtlfilename += "mtl";
 
-	TArray<vec3> outvertices;
-	TArray<vec2> outuv;
-	TArray<vec3> outnormal;
+	// The surface vertices are written instead of the welded mesh vertices,
+	// because each surface has its own lightmap coordinates for them.
+	const std::vector<vec3> &outvertices = surfaceVerts;
+	const std::vector<vec2> &outuv = lightmapCoords;
+	std::vector<vec3> outnormal(surfaceVerts.size());
 	TArray<int> outface;
 	TArray<int> outLightmapId;
 
-	outvertices.Resize(MeshVertices.Size());
-	outuv.Resize(MeshVertices.Size());
-	outnormal.Resize(MeshVertices.Size());
-	outLightmapId.Resize(MeshElements.Size() / 3);
-
-	for (unsigned int surfidx = 0; surfidx < MeshElements.Size() / 3; surfidx++)
+	for (Surface &surface : surfaces)
 	{
-		Surface* surface = surfaces[MeshSurfaces[surfidx]].get();
-
-		outLightmapId[surfidx] = surface->lightmapNum;
-
-		for (int i = 0; i < 3; i++)
+		for (int i = 0; i < surface.numVerts; i++)
 		{
-			int elementidx = surfidx * 3 + i;
-			int vertexidx = MeshElements[elementidx];
-			int uvindex = MeshUVIndex[vertexidx];
-
-			outvertices[vertexidx] = MeshVertices[vertexidx];
-			outuv[vertexidx] = surface->lightmapCoords[uvindex];
-			outnormal[vertexidx] = surface->plane.Normal();
-			outface.Push(vertexidx);
+			outnormal[surface.firstVert + i] = surface.plane.Normal();
 		}
+
+		ForEachTriangle(&surface, [&](int a, int b, int c)
+		{
+			outLightmapId.Push(surface.lightmapNum);
+			outface.Push(surface.firstVert + a);
+			outface.Push(surface.firstVert + b);
+			outface.Push(surface.firstVert + c);
+		});
 	}
 
 	std::string buffer;
@@ -1045,7 +1309,7 @@ void LevelMesh::Export(std::string filename)
 
 	float scale = 0.01f;
 
-	for (unsigned int i = 0; i < outvertices.Size(); i++)
+	for (size_t i = 0; i < outvertices.size(); i++)
 	{
 		buffer += "v ";
 		buffer += std::to_string(-outvertices[i].x * scale);
@@ -1056,7 +1320,7 @@ void LevelMesh::Export(std::string filename)
 		buffer += "\r\n";
 	}
 
-	for (unsigned int i = 0; i < outnormal.Size(); i++)
+	for (size_t i = 0; i < outnormal.size(); i++)
 	{
 		buffer += "vn ";
 		buffer += std::to_string(-outnormal[i].x);
@@ -1067,7 +1331,7 @@ void LevelMesh::Export(std::string filename)
 		buffer += "\r\n";
 	}
 
-	for (unsigned int i = 0; i < outuv.Size(); i++)
+	for (size_t i = 0; i < outuv.size(); i++)
 	{
 		buffer += "vt ";
 		buffer += std::to_string(outuv[i].x);
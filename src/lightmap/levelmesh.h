@@ -30,6 +30,8 @@
 #include <vector>
 #include <memory>
 #include <string>
+#include <map>
+#include <functional>
 #include <cstring>
 
 #include "framework/tarray.h"
@@ -57,6 +59,10 @@ enum SurfaceType
 	ST_FLOOR
 };
 
+// Vertex data and lightmap samples of all surfaces are kept in shared pools
+// in LevelMesh. A surface's numVerts vertices start at firstVert in
+// surfaceVerts, surfaceUVs and lightmapCoords, and its lightmapDims[0] *
+// lightmapDims[1] samples start at firstSample in samples.
 struct Surface
 {
 	Plane plane;
@@ -68,16 +74,13 @@ struct Surface
 	vec3 textureCoords[2];
 	BBox bounds;
 	int numVerts;
-	std::vector<vec3> verts;
-	std::vector<vec2> lightmapCoords;
-	//std::vector<bool> coveragemask;
-	std::vector<vec3> samples;
+	int firstVert;
+	int firstSample;
 	SurfaceType type;
 	int typeIndex;
-	IntSector *controlSector;
+	int controlSector;	// Index into FLevel::Sectors of the 3D floor's control sector, or -1
 	bool bSky;
-	std::vector<vec2> uvs;
-	std::string material;
+	int material;	// Index into LevelMesh::materials
 	int sampleDimension;
 };
 
@@ -92,37 +95,71 @@ class LevelMesh
 {
 public:
 	LevelMesh(FLevel &doomMap, int sampleDistance, int textureSize);
+	LevelMesh() { }	// Empty mesh for LoadBakeScene to fill
 
+	// Packs the lightmaps of the surfaces with light into texture pages. It
+	// can be called again after the samples change.
 	void CreateTextures();
 	void AddLightmapLump(FWadWriter& wadFile);
 	void Export(std::string filename);
 
 	FLevel* map = nullptr;
 
-	std::vector<std::unique_ptr<Surface>> surfaces;
+	std::vector<Surface> surfaces;
+	std::vector<vec3> surfaceVerts;
+	std::vector<vec2> surfaceUVs;
+	std::vector<vec2> lightmapCoords;
+	std::vector<vec3> samples;
+	std::vector<std::string> materials;
+
 	std::vector<LightProbeSample> lightProbes;
 
 	std::vector<std::unique_ptr<LightmapTexture>> textures;
 
 	int defaultSamples = 16;
+	int numGLSubsectors = 0;
 	int textureWidth = 128;
 	int textureHeight = 128;
 
+	// The collision mesh. Corners that surfaces share are a single vertex.
 	TArray<vec3> MeshVertices;
-	TArray<int> MeshUVIndex;
 	TArray<unsigned int> MeshElements;
 	TArray<int> MeshSurfaces;
 
+	vec3 *GetVerts(const Surface *surface) { return surfaceVerts.data() + surface->firstVert; }
+	vec2 *GetUVs(const Surface *surface) { return surfaceUVs.data() + surface->firstVert; }
+	vec2 *GetLightmapCoords(const Surface *surface) { return lightmapCoords.data() + surface->firstVert; }
+	vec3 *GetSamples(const Surface *surface) { return samples.data() + surface->firstSample; }
+	const std::string &GetMaterial(const Surface *surface) const { return materials[surface->material]; }
+
 private:
+	// Surfaces created by a single thread. Their vertices and materials
+	// index into the pools here until they are appended to the mesh.
+	struct SurfaceList
+	{
+		std::vector<Surface> surfaces;
+		std::vector<vec3> verts;
+		std::vector<vec2> uvs;
+		std::vector<std::string> materials;
+		std::map<std::string, int> materialIndex;
+
+		Surface &Add(int numVerts, const char *material);
+	};
+
+	void CreateSurfacesParallel(int count, const std::function<void(int, SurfaceList &)> &create);
 	void CreateSubsectorSurfaces(FLevel &doomMap);
-	void CreateCeilingSurface(FLevel &doomMap, MapSubsectorEx *sub, IntSector *sector, int typeIndex, bool is3DFloor);
-	void CreateFloorSurface(FLevel &doomMap, MapSubsectorEx *sub, IntSector *sector, int typeIndex, bool is3DFloor);
-	void CreateSideSurfaces(FLevel &doomMap, IntSideDef *side);
+	void CreateCeilingSurface(FLevel &doomMap, MapSubsectorEx *sub, IntSector *sector, int typeIndex, bool is3DFloor, SurfaceList &list);
+	void CreateFloorSurface(FLevel &doomMap, MapSubsectorEx *sub, IntSector *sector, int typeIndex, bool is3DFloor, SurfaceList &list);
+	void CreateSideSurfaces(FLevel &doomMap, IntSideDef *side, SurfaceList &list);
 	void CreateLightProbes(FLevel& doomMap);
+	void WeldVertices(std::vector<unsigned int> &meshVertex);
 
 	void BuildSurfaceParams(Surface* surface);
 	BBox GetBoundsFromSurface(const Surface* surface);
 	void FinishSurface(RectPacker& packer, Surface* surface);
 
 	static bool IsDegenerate(const vec3 &v0, const vec3 &v1, const vec3 &v2);
+	template<typename Callback> void ForEachTriangle(const Surface *surface, Callback callback);
+
+	std::vector<vec2> unpackedLightmapCoords;	// lightmapCoords before CreateTextures moved them into the pages
 };
@@ -0,0 +1,448 @@
+
+#include "math/mathlib.h"
+#include "levelmesh.h"
+#include "cpuraytracer.h"
+#include "lightmapcache.h"
+#include "framework/bakecache.h"
+#include "framework/parallel.h"
+#include "framework/zdray.h"
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <stdexcept>
+
+// A pack is this header, the NumLights lights of the bake, NumEntries
+// entries sorted by key and then the samples the entries point at, three
+// floats each. The lights and the entries start on 16 byte boundaries.
+struct LightmapPackHeader
+{
+	char Magic[4];	// "ZBLP"
+	uint32_t Version;
+	FHash128 SceneKey;
+	uint64_t NumLights;
+	uint64_t NumEntries;
+};
+
+struct LightmapPackEntry
+{
+	FHash128 Key;
+	uint64_t FirstSample;
+	uint64_t NumSamples;
+};
+
+namespace
+{
+	const uint32_t LightmapCacheVersion = 2;
+	const size_t PackAlignment = 16;
+
+	// Packs searched for each key. The newest is usually the last bake of the
+	// same map; older ones help when switching between versions of a map.
+	const int MaxPacks = 8;
+
+	// Surfaces whose keys are made by one worker at a time
+	const int KeyChunkSize = 256;
+
+	static_assert(sizeof(vec3) == 3 * sizeof(float), "samples are stored as three floats");
+
+	size_t AlignPack(size_t offset)
+	{
+		return (offset + PackAlignment - 1) & ~(PackAlignment - 1);
+	}
+
+	// Whether the light can reach a point in the box. The tracer lights points
+	// closer than the radius; the extra unit keeps rounding from leaving out a
+	// light that only just reaches.
+	bool LightReaches(const CPULightInfo &light, const vec3 &mins, const vec3 &maxs)
+	{
+		vec3 closest(
+			std::min(std::max(light.Origin.x, mins.x), maxs.x),
+			std::min(std::max(light.Origin.y, mins.y), maxs.y),
+			std::min(std::max(light.Origin.z, mins.z), maxs.z));
+		vec3 delta = light.Origin - closest;
+		float radius = light.Radius + 1.0f;
+		return dot(delta, delta) < radius * radius;
+	}
+
+	bool LightLess(const CPULightInfo &a, const CPULightInfo &b)
+	{
+		return memcmp(&a, &b, sizeof(CPULightInfo)) < 0;
+	}
+}
+
+LightmapCache::LightmapCache(FBakeCache *cache, LevelMesh *mesh, const CPUSceneLighting &lighting, bool gpu) : Cache(cache), Mesh(mesh), Lights(lighting.Lights)
+{
+	Layout.Init(mesh, false);
+	CreateKeys(lighting, gpu);
+}
+
+LightmapCache::~LightmapCache()
+{
+}
+
+LightmapCache::Tile LightmapCache::GetTile(int surface, int tile) const
+{
+	const Surface *s = &Mesh->surfaces[surface];
+	int tilesX = CPUTraceSelection::TileCount(s->lightmapDims[0]);
+	int index = tile - Layout.FirstTile[surface];
+
+	Tile t;
+	t.Surface = surface;
+	t.X = (index % tilesX) * CPUTraceSelection::TileSize;
+	t.Y = (index / tilesX) * CPUTraceSelection::TileSize;
+	t.Width = std::min((int)CPUTraceSelection::TileSize, s->lightmapDims[0] - t.X);
+	t.Height = std::min((int)CPUTraceSelection::TileSize, s->lightmapDims[1] - t.Y);
+	return t;
+}
+
+void LightmapCache::CreateKeys(const CPUSceneLighting &lighting, bool gpu)
+{
+	FHasher sceneHasher;
+	sceneHasher.AddValue(LightmapCacheVersion);
+	sceneHasher.AddValue(gpu);
+	sceneHasher.AddValue(coverageSampleCount);
+	sceneHasher.AddValue(bounceSampleCount);
+	sceneHasher.AddValue(ambientSampleCount);
+	sceneHasher.AddValue(WatertightTrace);
+	sceneHasher.AddArray(Mesh->MeshVertices.Data(), Mesh->MeshVertices.Size());
+	sceneHasher.AddArray(Mesh->MeshElements.Data(), Mesh->MeshElements.Size());
+	sceneHasher.AddArray(Mesh->MeshSurfaces.Data(), Mesh->MeshSurfaces.Size());
+	sceneHasher.AddValue((uint64_t)Mesh->surfaces.size());
+	for (const Surface &surface : Mesh->surfaces)
+	{
+		// What a ray learns about the surface it hits
+		sceneHasher.AddValue(surface.plane.Normal());
+		sceneHasher.AddValue(surface.bSky);
+	}
+	sceneHasher.AddArray(lighting.SurfaceEmissives.data(), lighting.SurfaceEmissives.size());
+	sceneHasher.AddArray(lighting.Emissives.data(), lighting.Emissives.size());
+	sceneHasher.AddValue(lighting.SunDir);
+	sceneHasher.AddValue(lighting.SunColor);
+	sceneHasher.AddValue(lighting.LightBounce);
+	if (lighting.LightBounce > 0)
+	{
+		sceneHasher.AddArray(Lights.data(), Lights.size());
+	}
+	SceneKey = sceneHasher.Finish();
+
+	TileKeys.resize(Layout.Tiles.size());
+	ParallelForChunks((int)Mesh->surfaces.size(), KeyChunkSize, [&](int, int start, int end)
+	{
+		for (int i = start; i < end; i++)
+		{
+			Surface *surface = &Mesh->surfaces[i];
+
+			FHasher surfaceHasher;
+			surfaceHasher.Add(SceneKey);
+			surfaceHasher.AddValue(surface->plane.a);
+			surfaceHasher.AddValue(surface->plane.b);
+			surfaceHasher.AddValue(surface->plane.c);
+			surfaceHasher.AddValue(surface->plane.d);
+			surfaceHasher.AddValue(surface->lightmapDims);
+			surfaceHasher.AddValue(surface->lightmapOrigin);
+			surfaceHasher.AddValue(surface->lightmapSteps);
+			surfaceHasher.AddValue(surface->sampleDimension);
+			surfaceHasher.AddValue(surface->type);
+			surfaceHasher.AddValue(surface->bSky);
+			surfaceHasher.AddValue(lighting.SurfaceEmissives[i]);
+			surfaceHasher.AddArray(Mesh->GetVerts(surface), surface->numVerts);
+			FHash128 surfaceKey = surfaceHasher.Finish();
+
+			int numTiles = CPUTraceSelection::TileCount(surface->lightmapDims[0]) * CPUTraceSelection::TileCount(surface->lightmapDims[1]);
+			for (int j = 0; j < numTiles; j++)
+			{
+				Tile tile = GetTile(i, Layout.FirstTile[i] + j);
+
+				FHasher hasher;
+				hasher.Add(surfaceKey);
+				hasher.AddValue(tile.X);
+				hasher.AddValue(tile.Y);
+
+				// Texels are traced from their centers, 0.1 units off the surface
+				vec3 mins(1e30f), maxs(-1e30f);
+				for (float y : { tile.Y + 0.5f, tile.Y + tile.Height - 0.5f })
+				{
+					for (float x : { tile.X + 0.5f, tile.X + tile.Width - 0.5f })
+					{
+						vec3 pos = surface->lightmapOrigin + surface->lightmapSteps[0] * x + surface->lightmapSteps[1] * y;
+						mins = vec3(std::min(mins.x, pos.x), std::min(mins.y, pos.y), std::min(mins.z, pos.z));
+						maxs = vec3(std::max(maxs.x, pos.x), std::max(maxs.y, pos.y), std::max(maxs.z, pos.z));
+					}
+				}
+				mins = mins - 0.1f;
+				maxs = maxs + 0.1f;
+
+				// The order matters too, since it is the order the light is added up in
+				for (const CPULightInfo &light : Lights)
+				{
+					if (LightReaches(light, mins, maxs))
+						hasher.AddValue(light);
+				}
+
+				TileKeys[Layout.FirstTile[i] + j] = hasher.Finish();
+			}
+		}
+	});
+
+	ProbeKeys.resize(Mesh->lightProbes.size());
+	for (size_t i = 0; i < Mesh->lightProbes.size(); i++)
+	{
+		const vec3 &pos = Mesh->lightProbes[i].Position;
+
+		FHasher hasher;
+		hasher.Add(SceneKey);
+		hasher.AddValue(pos);
+		for (const CPULightInfo &light : Lights)
+		{
+			if (LightReaches(light, pos, pos))
+				hasher.AddValue(light);
+		}
+		ProbeKeys[i] = hasher.Finish();
+	}
+}
+
+int LightmapCache::Load(CPUTraceSelection &selection)
+{
+	for (auto &file : Cache->FindRecent("lightmap", MaxPacks))
+	{
+		LightmapPackHeader header;
+		if (file->Size() < sizeof(LightmapPackHeader))
+			continue;
+		memcpy(&header, file->Data(), sizeof(LightmapPackHeader));
+		if (memcmp(header.Magic, "ZBLP", 4) != 0 || header.Version != LightmapCacheVersion)
+			continue;
+
+		size_t lightsStart = AlignPack(sizeof(LightmapPackHeader));
+		if (file->Size() < lightsStart || header.NumLights > (file->Size() - lightsStart) / sizeof(CPULightInfo))
+			continue;
+		size_t entriesStart = AlignPack(lightsStart + size_t(header.NumLights) * sizeof(CPULightInfo));
+		if (entriesStart > file->Size() || header.NumEntries > (file->Size() - entriesStart) / sizeof(LightmapPackEntry))
+			continue;
+		size_t samplesStart = entriesStart + size_t(header.NumEntries) * sizeof(LightmapPackEntry);
+
+		Pack pack;
+		pack.SceneKey = header.SceneKey;
+		pack.Lights = reinterpret_cast<const CPULightInfo *>(file->Data() + lightsStart);
+		pack.NumLights = size_t(header.NumLights);
+		pack.Entries = reinterpret_cast<const LightmapPackEntry *>(file->Data() + entriesStart);
+		pack.NumEntries = size_t(header.NumEntries);
+		pack.Samples = reinterpret_cast<const float *>(file->Data() + samplesStart);
+		pack.NumSamples = (file->Size() - samplesStart) / sizeof(vec3);
+		pack.File = std::move(file);
+		Packs.push_back(std::move(pack));
+	}
+
+	PrintLightChanges();
+
+	selection.Init(Mesh, true);
+
+	int cachedTiles = 0;
+	for (size_t i = 0; i < Mesh->surfaces.size(); i++)
+	{
+		Surface *surface = &Mesh->surfaces[i];
+		int numTiles = CPUTraceSelection::TileCount(surface->lightmapDims[0]) * CPUTraceSelection::TileCount(surface->lightmapDims[1]);
+		for (int j = Layout.FirstTile[i]; j < Layout.FirstTile[i] + numTiles; j++)
+		{
+			Tile tile = GetTile((int)i, j);
+			const float *samples = Find(TileKeys[j], size_t(tile.Width) * tile.Height);
+			if (samples)
+			{
+				vec3 *dest = Mesh->GetSamples(surface) + tile.X + tile.Y * surface->lightmapDims[0];
+				for (int y = 0; y < tile.Height; y++)
+				{
+					memcpy(dest + y * surface->lightmapDims[0], samples + y * tile.Width * 3, tile.Width * sizeof(vec3));
+				}
+				selection.Tiles[j] = false;
+				cachedTiles++;
+			}
+		}
+	}
+
+	int cachedProbes = 0;
+	for (size_t i = 0; i < Mesh->lightProbes.size(); i++)
+	{
+		const float *samples = Find(ProbeKeys[i], 1);
+		if (samples)
+		{
+			memcpy(&Mesh->lightProbes[i].Color, samples, sizeof(vec3));
+			selection.Probes[i] = false;
+			cachedProbes++;
+		}
+	}
+
+	printf("   %d of %d lightmap tiles and %d of %d light probes taken from the cache\n",
+		cachedTiles, (int)TileKeys.size(), cachedProbes, (int)ProbeKeys.size());
+
+	return int(TileKeys.size() - cachedTiles + ProbeKeys.size() - cachedProbes);
+}
+
+int LightmapCache::SelectChanged(const LightmapCache &previous, CPUTraceSelection &selection) const
+{
+	if (previous.Mesh != Mesh)
+		throw std::runtime_error("Lightmap keys of different meshes cannot be compared");
+
+	selection.Init(Mesh, false);
+
+	int changed = 0;
+	for (size_t i = 0; i < TileKeys.size(); i++)
+	{
+		if (TileKeys[i] != previous.TileKeys[i])
+		{
+			selection.Tiles[i] = true;
+			changed++;
+		}
+	}
+	for (size_t i = 0; i < ProbeKeys.size(); i++)
+	{
+		if (ProbeKeys[i] != previous.ProbeKeys[i])
+		{
+			selection.Probes[i] = true;
+			changed++;
+		}
+	}
+	return changed;
+}
+
+// Compares the lights with the ones of the last bake of the same scene. This
+// only informs the user, since the keys already tell which tiles changed.
+void LightmapCache::PrintLightChanges() const
+{
+	for (const Pack &pack : Packs)
+	{
+		if (pack.SceneKey != SceneKey)
+			continue;
+
+		std::vector<CPULightInfo> before(pack.Lights, pack.Lights + pack.NumLights);
+		std::vector<CPULightInfo> after = Lights;
+		std::sort(before.begin(), before.end(), LightLess);
+		std::sort(after.begin(), after.end(), LightLess);
+
+		// A light that was moved or changed counts as removed and added
+		size_t unchanged = 0;
+		auto b = before.begin();
+		auto a = after.begin();
+		while (b != before.end() && a != after.end())
+		{
+			if (LightLess(*b, *a))
+			{
+				++b;
+			}
+			else if (LightLess(*a, *b))
+			{
+				++a;
+			}
+			else
+			{
+				unchanged++;
+				++a;
+				++b;
+			}
+		}
+
+		if (unchanged != before.size() || unchanged != after.size())
+		{
+			printf("   Lights since the last bake: %d removed, %d added\n", int(before.size() - unchanged), int(after.size() - unchanged));
+		}
+		return;
+	}
+}
+
+const float *LightmapCache::Find(const FHash128 &key, size_t numSamples) const
+{
+	for (const Pack &pack : Packs)
+	{
+		const LightmapPackEntry *end = pack.Entries + pack.NumEntries;
+		const LightmapPackEntry *entry = std::lower_bound(pack.Entries, end, key, [](const LightmapPackEntry &e, const FHash128 &k) { return e.Key < k; });
+		if (entry == end || entry->Key != key)
+			continue;
+
+		if (entry->NumSamples != numSamples || entry->FirstSample > pack.NumSamples || numSamples > pack.NumSamples - entry->FirstSample)
+			continue;
+
+		return pack.Samples + entry->FirstSample * 3;
+	}
+	return nullptr;
+}
+
+void LightmapCache::Store()
+{
+	struct Item
+	{
+		FHash128 Key;
+		Tile Texels;	// Surface is -1 for a light probe, with the probe index in X
+	};
+
+	std::vector<Item> items;
+	items.reserve(TileKeys.size() + ProbeKeys.size());
+	for (size_t i = 0; i < Mesh->surfaces.size(); i++)
+	{
+		const Surface *surface = &Mesh->surfaces[i];
+		int numTiles = CPUTraceSelection::TileCount(surface->lightmapDims[0]) * CPUTraceSelection::TileCount(surface->lightmapDims[1]);
+		for (int j = Layout.FirstTile[i]; j < Layout.FirstTile[i] + numTiles; j++)
+		{
+			items.push_back({ TileKeys[j], GetTile((int)i, j) });
+		}
+	}
+	for (size_t i = 0; i < ProbeKeys.size(); i++)
+	{
+		items.push_back({ ProbeKeys[i], { -1, (int)i, 0, 1, 1 } });
+	}
+
+	// Equal keys were traced from the same input, so one copy is enough
+	std::sort(items.begin(), items.end(), [](const Item &a, const Item &b) { return a.Key < b.Key; });
+	items.erase(std::unique(items.begin(), items.end(), [](const Item &a, const Item &b) { return a.Key == b.Key; }), items.end());
+
+	size_t numSamples = 0;
+	for (const Item &item : items)
+		numSamples += size_t(item.Texels.Width) * item.Texels.Height;
+
+	size_t lightsStart = AlignPack(sizeof(LightmapPackHeader));
+	size_t entriesStart = AlignPack(lightsStart + Lights.size() * sizeof(CPULightInfo));
+	size_t samplesStart = entriesStart + items.size() * sizeof(LightmapPackEntry);
+	std::vector<uint8_t> data(samplesStart + numSamples * sizeof(vec3));
+
+	LightmapPackHeader header = {};
+	memcpy(header.Magic, "ZBLP", 4);
+	header.Version = LightmapCacheVersion;
+	header.SceneKey = SceneKey;
+	header.NumLights = Lights.size();
+	header.NumEntries = items.size();
+	memcpy(data.data(), &header, sizeof(LightmapPackHeader));
+	if (!Lights.empty())
+		memcpy(data.data() + lightsStart, Lights.data(), Lights.size() * sizeof(CPULightInfo));
+
+	// The pack is named after the keys in it, so baking the same thing again
+	// does not add another copy.
+	FHasher packHasher;
+	packHasher.AddValue(LightmapCacheVersion);
+
+	LightmapPackEntry *entries = reinterpret_cast<LightmapPackEntry *>(data.data() + entriesStart);
+	vec3 *samples = reinterpret_cast<vec3 *>(data.data() + samplesStart);
+	size_t firstSample = 0;
+	for (size_t i = 0; i < items.size(); i++)
+	{
+		const Tile &tile = items[i].Texels;
+		entries[i].Key = items[i].Key;
+		entries[i].FirstSample = firstSample;
+		entries[i].NumSamples = size_t(tile.Width) * tile.Height;
+
+		if (tile.Surface >= 0)
+		{
+			Surface *surface = &Mesh->surfaces[tile.Surface];
+			const vec3 *src = Mesh->GetSamples(surface) + tile.X + tile.Y * surface->lightmapDims[0];
+			for (int y = 0; y < tile.Height; y++)
+			{
+				memcpy(samples + firstSample + y * tile.Width, src + y * surface->lightmapDims[0], tile.Width * sizeof(vec3));
+			}
+		}
+		else
+		{
+			samples[firstSample] = Mesh->lightProbes[tile.X].Color;
+		}
+		firstSample += entries[i].NumSamples;
+
+		packHasher.Add(items[i].Key);
+	}
+	packHasher.AddArray(Lights.data(), Lights.size());
+
+	Cache->Store(packHasher.Finish(), "lightmap", data.data(), data.size());
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "math/mathlib.h"
+#include "framework/hash.h"
+#include "cpuraytracer.h"
+#include <memory>
+#include <vector>
+
+class LevelMesh;
+class FBakeCache;
+class FMappedFile;
+struct LightmapPackEntry;
+
+// Lightmap samples kept in the bake cache (see framework/bakecache.h), so
+// that texels nothing has changed for are not traced again. Samples are kept
+// per tile of CPUTraceSelection::TileSize x TileSize texels and per light
+// probe.
+//
+// Sun and bounce rays can cross the whole map, so samples are only reused
+// when the collision mesh, the sun, the glowing surfaces and the trace
+// settings are all unchanged. These make up the scene key. Point and spot
+// lights stop at their radius: the key of a tile holds the lights that reach
+// its texels and no others, so when a light is moved, added or removed only
+// the tiles inside its old and new radius are traced again. With light
+// bounces, any light can reach any texel, and every light goes into the
+// scene key instead.
+//
+// The samples of a bake are stored as one pack: the scene key and lights it
+// was made with, a table of keys sorted for a binary search, and the samples.
+// Keys are looked up in the packs that were used most recently, so a map that
+// is baked over and over finds its previous bake first.
+class LightmapCache
+{
+public:
+	// The cache may be null if the keys are only compared with SelectChanged
+	LightmapCache(FBakeCache *cache, LevelMesh *mesh, const CPUSceneLighting &lighting, bool gpu);
+	~LightmapCache();
+
+	// Copies the samples found in the cache into the mesh. Returns the number
+	// of tiles and probes that were not found, which are the ones the
+	// selection is set for.
+	int Load(CPUTraceSelection &selection);
+
+	// Adds the samples of every tile and probe to the cache
+	void Store();
+
+	// Selects the tiles and probes whose keys differ from the ones made for
+	// the same mesh with other lighting, which is what has to be traced again
+	// when the lights change. Returns the number selected.
+	int SelectChanged(const LightmapCache &previous, CPUTraceSelection &selection) const;
+
+private:
+	struct Pack
+	{
+		std::unique_ptr<FMappedFile> File;
+		FHash128 SceneKey;
+		const CPULightInfo *Lights;
+		size_t NumLights;
+		const LightmapPackEntry *Entries;
+		size_t NumEntries;
+		const float *Samples;
+		size_t NumSamples;
+	};
+
+	struct Tile
+	{
+		int Surface;
+		int X, Y;	// First texel
+		int Width, Height;
+	};
+
+	void CreateKeys(const CPUSceneLighting &lighting, bool gpu);
+	const float *Find(const FHash128 &key, size_t numSamples) const;
+	void PrintLightChanges() const;
+
+	Tile GetTile(int surface, int tile) const;
+
+	FBakeCache *Cache;
+	LevelMesh *Mesh;
+	FHash128 SceneKey;
+	std::vector<CPULightInfo> Lights;
+	CPUTraceSelection Layout;	// Where the tiles of each surface start
+	std::vector<FHash128> TileKeys;
+	std::vector<FHash128> ProbeKeys;
+	std::vector<Pack> Packs;
+};
@@ -58,6 +58,13 @@
 #include "framework/zdray.h"
 #include "wad/wad.h"
 #include "level/level.h"
+#include "lightmap/levelmesh.h"
+#include "lightmap/cpuraytracer.h"
+#include "lightmap/bakescene.h"
+#include "lightmap/bakecheckpoint.h"
+#include "framework/timeline.h"
+#include "library/libzdray.h"
+#include "server/server.h"
 #include "commandline/getopt.h"
 
 // MACROS ------------------------------------------------------------------
@@ -78,6 +85,7 @@ static void ParseArgs(int argc, char **argv);
 static void ShowUsage();
 static void ShowVersion();
 static bool CheckInOutNames();
+static void ReplayBakeScene();
 
 #ifndef DISABLE_SSE
 static void CheckSSE();
@@ -88,43 +96,10 @@ static void CheckSSE();
 extern "C" int optind;
 extern "C" char *optarg;
 
-// PUBLIC DATA DEFINITIONS -------------------------------------------------
-
-const char		*Map = nullptr;
-const char		*InName;
-const char		*OutName = "tmp.wad";
-bool			 BuildNodes = true;
-bool			 BuildGLNodes = true;// false;
-bool			 ConformNodes = false;
-bool			 NoPrune = false;
-EBlockmapMode	 BlockmapMode = EBM_Rebuild;
-ERejectMode		 RejectMode = ERM_DontTouch;
-bool			 WriteComments = false;
-int				 MaxSegs = 64;
-int				 SplitCost = 8;
-int				 AAPreference = 16;
-bool			 CheckPolyobjs = true;
-bool			 ShowWarnings = false;
-bool			 NoTiming = false;
-bool			 CompressNodes = true;// false;
-bool			 CompressGLNodes = true;// false;
-bool			 ForceCompression = true;// false;
-bool			 GLOnly = true;// false;
-bool			 V5GLNodes = false;
-bool			 HaveSSE1, HaveSSE2;
-int				 SSELevel;
-int				 NumThreads = 0;
-int				 LMDims = 1024;
-bool			 CPURaytrace = false;
-bool			 VKDebug = false;
-bool			 DumpMesh = false;
-
-int coverageSampleCount = 256;
-int bounceSampleCount = 2048;
-int ambientSampleCount = 2048;
-
 // PRIVATE DATA DEFINITIONS ------------------------------------------------
 
+static ZDRayOptions Options;
+
 static option long_opts[] =
 {
 	{"help",			no_argument,		0,	1000},
@@ -162,6 +137,22 @@ static option long_opts[] =
 	{"vkdebug",			no_argument,		0,	'D'},
 	{"dump-mesh",		no_argument,		0,	1004},
 	{"preview",			no_argument,		0,	1005},
+	{"fast-nodes",		no_argument,		0,	1006},
+	{"reject-time",		required_argument,	0,	1007},
+	{"weld",			required_argument,	0,	1008},
+	{"watertight",		no_argument,		0,	1009},
+	{"dump-bake-scene",	required_argument,	0,	1010},
+	{"replay-bake-scene",	required_argument,	0,	1011},
+	{"trace-timeline",	required_argument,	0,	1012},
+	{"cache",			required_argument,	0,	1013},
+	{"cache-size",		required_argument,	0,	1014},
+	{"serve",			no_argument,		0,	1015},
+	{"checkpoint",		required_argument,	0,	1016},
+	{"checkpoint-interval",	required_argument,	0,	1017},
+	{"resume",			no_argument,		0,	1018},
+	{"time-budget",		required_argument,	0,	1019},
+	{"shard",			required_argument,	0,	1020},
+	{"merge-shards",	required_argument,	0,	1021},
 	{0,0,0,0}
 };
 
@@ -173,15 +164,13 @@ int main(int argc, char **argv)
 {
 	bool fixSame = false;
 
-#ifdef DISABLE_SSE
-	HaveSSE1 = HaveSSE2 = false;
-#else
-	HaveSSE1 = HaveSSE2 = true;
-#endif
-
 	ParseArgs(argc, argv);
+#ifndef DISABLE_SSE
+	CheckSSE();
+#endif
+	Options.Apply();
 
-	if (InName == nullptr)
+	if (InName == nullptr && ReplaySceneName == nullptr && !ServeMode)
 	{
 		if (optind >= argc || optind < argc - 1)
 		{ // Source file is unspecified or followed by junk
@@ -192,14 +181,36 @@ int main(int argc, char **argv)
 		InName = argv[optind];
 	}
 
-#ifndef DISABLE_SSE
-	CheckSSE();
-#endif
-
 	try
 	{
 		START_COUNTER(t1a, t1b, t1c)
 
+		if (TimelineName)
+		{
+			TimelineStart();
+		}
+
+		if (ReplaySceneName)
+		{
+			ReplayBakeScene();
+			END_COUNTER(t1a, t1b, t1c, "\nTotal time: %.3f seconds.\n")
+			if (TimelineName)
+			{
+				TimelineWrite(TimelineName);
+			}
+			return 0;
+		}
+
+		if (ServeMode)
+		{
+			ServeRequests(Options);
+			if (TimelineName)
+			{
+				TimelineWrite(TimelineName);
+			}
+			return 0;
+		}
+
 		if (CheckInOutNames())
 		{
 			// When the input and output files are the same, output will go to
@@ -233,56 +244,8 @@ int main(int argc, char **argv)
 			fixSame = true;
 		}
 
-		{
-			FWadReader inwad(InName);
-			FWadWriter outwad(OutName, inwad.IsIWAD());
-
-			int lump = 0;
-			int max = inwad.NumLumps();
-
-			while (lump < max)
-			{
-				if (inwad.IsMap(lump) && (!Map || stricmp(inwad.LumpName(lump), Map) == 0))
-				{
-					START_COUNTER(t2a, t2b, t2c)
-					FProcessor builder(inwad, lump);
-					builder.BuildNodes();
-					builder.BuildLightmaps();
-					builder.Write(outwad);
-
-					END_COUNTER(t2a, t2b, t2c, "   %.3f seconds.\n")
-
-					if(DumpMesh)
-					{
-						printf("\n");
-						builder.DumpMesh();
-					}
-
-					lump = inwad.LumpAfterMap(lump);
-				}
-				else if (inwad.IsGLNodes(lump))
-				{
-					// Ignore GL nodes from the input for any maps we process.
-					if (BuildNodes && (Map == nullptr || stricmp(inwad.LumpName(lump) + 3, Map) == 0))
-					{
-						lump = inwad.SkipGLNodes(lump);
-					}
-					else
-					{
-						outwad.CopyLump(inwad, lump);
-						++lump;
-					}
-				}
-				else
-				{
-					//printf ("copy %s\n", inwad.LumpName (lump));
-					outwad.CopyLump(inwad, lump);
-					++lump;
-				}
-			}
-
-			outwad.Close();
-		}
+		ZDRayContext context(Options);
+		context.ProcessWad(InName, OutName, Map);
 
 		if (fixSame)
 		{
@@ -295,6 +258,18 @@ int main(int argc, char **argv)
 		}
 
 		END_COUNTER(t1a, t1b, t1c, "\nTotal time: %.3f seconds.\n")
+
+		if (TimelineName)
+		{
+			TimelineWrite(TimelineName);
+		}
+	}
+	catch (BakeTimeBudgetExceeded msg)
+	{
+		// The output would be missing lightmaps, so there is none
+		printf("\n%s\n", msg.what());
+		remove(OutName);
+		return 3;
 	}
 	catch (std::runtime_error msg)
 	{
@@ -340,7 +315,7 @@ static void ParseArgs(int argc, char **argv)
 			break;
 
 		case 'w':
-			ShowWarnings = true;
+			Options.ShowWarnings = true;
 			break;
 		case 'm':
 			Map = optarg;
@@ -352,120 +327,183 @@ static void ParseArgs(int argc, char **argv)
 			InName = optarg;
 			break;
 		case 'N':
-			BuildNodes = false;
+			Options.BuildNodes = false;
 			break;
 		case 'b':
-			BlockmapMode = EBM_Create0;
+			Options.BlockmapMode = EBM_Create0;
 			break;
 		case 'r':
-			RejectMode = ERM_Create0;
+			Options.RejectMode = ERM_Create0;
 			break;
 		case 'R':
-			RejectMode = ERM_CreateZeroes;
+			Options.RejectMode = ERM_CreateZeroes;
 			break;
 		case 'e':
-			RejectMode = ERM_Rebuild;
+			Options.RejectMode = ERM_Rebuild;
 			break;
 		case 'E':
-			RejectMode = ERM_DontTouch;
+			Options.RejectMode = ERM_DontTouch;
 			break;
 		case 'p':
-			MaxSegs = atoi(optarg);
-			if (MaxSegs < 3)
+			Options.MaxSegs = atoi(optarg);
+			if (Options.MaxSegs < 3)
 			{ // Don't be too unreasonable
-				MaxSegs = 3;
+				Options.MaxSegs = 3;
 			}
 			break;
 		case 's':
-			SplitCost = atoi(optarg);
-			if (SplitCost < 1)
+			Options.SplitCost = atoi(optarg);
+			if (Options.SplitCost < 1)
 			{ // 1 means to add no extra weight at all
-				SplitCost = 1;
+				Options.SplitCost = 1;
 			}
 			break;
 		case 'd':
-			AAPreference = atoi(optarg);
-			if (AAPreference < 1)
+			Options.AAPreference = atoi(optarg);
+			if (Options.AAPreference < 1)
 			{
-				AAPreference = 1;
+				Options.AAPreference = 1;
 			}
 			break;
 		case 'P':
-			CheckPolyobjs = false;
+			Options.CheckPolyobjs = false;
 			break;
 		case 'g':
-			BuildGLNodes = true;
-			ConformNodes = false;
+			Options.BuildGLNodes = true;
+			Options.ConformNodes = false;
 			break;
 		case 'G':
-			BuildGLNodes = true;
-			ConformNodes = true;
+			Options.BuildGLNodes = true;
+			Options.ConformNodes = true;
 			break;
 		case 'X':
-			CompressNodes = true;
-			CompressGLNodes = true;
-			ForceCompression = false;
+			Options.CompressNodes = true;
+			Options.CompressGLNodes = true;
+			Options.ForceCompression = false;
 			break;
 		case 'z':
-			CompressNodes = true;
-			CompressGLNodes = true;
-			ForceCompression = true;
+			Options.CompressNodes = true;
+			Options.CompressGLNodes = true;
+			Options.ForceCompression = true;
 			break;
 		case 'Z':
-			CompressNodes = true;
-			CompressGLNodes = false;
-			ForceCompression = true;
+			Options.CompressNodes = true;
+			Options.CompressGLNodes = false;
+			Options.ForceCompression = true;
 			break;
 		case 'x':
-			GLOnly = true;
-			BuildGLNodes = true;
-			ConformNodes = false;
+			Options.GLOnly = true;
+			Options.BuildGLNodes = true;
+			Options.ConformNodes = false;
 			break;
 		case '5':
-			V5GLNodes = true;
+			Options.V5GLNodes = true;
 			break;
 		case 'q':
-			NoPrune = true;
+			Options.NoPrune = true;
 			break;
 		case 't':
-			NoTiming = true;
+			Options.NoTiming = true;
 			break;
 		case 'c':
-			WriteComments = true;
+			Options.WriteComments = true;
 			break;
 		case 'V':
 			ShowVersion();
 			exit(0);
 			break;
 		case 1002:		// Disable SSE/SSE2 ClassifyLine routine
-			HaveSSE1 = false;
-			HaveSSE2 = false;
+			Options.SSE1 = false;
+			Options.SSE2 = false;
 			break;
 		case 1003:		// Disable only SSE2 ClassifyLine routine
-			HaveSSE2 = false;
+			Options.SSE2 = false;
 			break;
 		case 'j':
-			NumThreads = atoi(optarg);
+			Options.Threads = atoi(optarg);
 			break;
 		case 'S':
-			LMDims = atoi(optarg);
-			if (LMDims <= 0) LMDims = 1;
-			if (LMDims > 1024) LMDims = 1024;
-			LMDims = Math::RoundPowerOfTwo(LMDims);
+			Options.LightmapSize = atoi(optarg);
+			if (Options.LightmapSize <= 0) Options.LightmapSize = 1;
+			if (Options.LightmapSize > 1024) Options.LightmapSize = 1024;
+			Options.LightmapSize = Math::RoundPowerOfTwo(Options.LightmapSize);
 			break;
 		case 'C':
-			CPURaytrace = true;
+			Options.CPURaytrace = true;
 			break;
 		case 'D':
-			VKDebug = true;
+			Options.VKDebug = true;
 			break;
 		case 1004:
 			DumpMesh = true;
 			break;
 		case 1005:
-			coverageSampleCount = 4;
-			bounceSampleCount = 16;
-			ambientSampleCount = 16;
+			Options.CoverageSamples = 4;
+			Options.BounceSamples = 16;
+			Options.AmbientSamples = 16;
+			break;
+		case 1006:
+			Options.FastNodes = true;
+			break;
+		case 1007:
+			Options.RejectTimeLimit = atoi(optarg);
+			break;
+		case 1008:
+			Options.WeldDistance = (float)atof(optarg);
+			break;
+		case 1009:
+			Options.WatertightTrace = true;
+			break;
+		case 1010:
+			DumpSceneName = optarg;
+			break;
+		case 1011:
+			ReplaySceneName = optarg;
+			break;
+		case 1012:
+			TimelineName = optarg;
+			break;
+		case 1013:
+			Options.CacheDir = optarg;
+			break;
+		case 1014:
+			Options.CacheSize = atoi(optarg);
+			if (Options.CacheSize < 1) Options.CacheSize = 1;
+			break;
+		case 1015:
+			ServeMode = true;
+			break;
+		case 1016:
+			Options.CheckpointFile = optarg;
+			break;
+		case 1017:
+			Options.CheckpointInterval = atoi(optarg);
+			if (Options.CheckpointInterval < 1) Options.CheckpointInterval = 1;
+			break;
+		case 1018:
+			Options.Resume = true;
+			break;
+		case 1019:
+			Options.TimeBudget = atof(optarg);
+			break;
+		case 1020:
+			if (sscanf(optarg, "%d/%d", &Options.Shard, &Options.ShardCount) != 2 ||
+				Options.ShardCount < 1 || Options.Shard < 1 || Options.Shard > Options.ShardCount)
+			{
+				printf("--shard must be K/N with K from 1 to N, such as --shard=2/4.\n");
+				exit(0);
+			}
+			break;
+		case 1021:
+			Options.MergeShards.clear();
+			for (const char *name = optarg; *name != 0;)
+			{
+				const char *comma = strchr(name, ',');
+				size_t length = comma ? size_t(comma - name) : strlen(name);
+				if (length > 0)
+					Options.MergeShards.push_back(std::string(name, length));
+				name += comma ? length + 1 : length;
+			}
 			break;
 		case 1000:
 			ShowUsage();
@@ -475,6 +513,18 @@ static void ParseArgs(int argc, char **argv)
 			exit(0);
 		}
 	}
+
+	if ((Options.Resume || Options.TimeBudget > 0.0) && Options.CheckpointFile.empty())
+	{
+		printf("--resume and --time-budget need a --checkpoint file.\n");
+		exit(0);
+	}
+
+	if (Options.ShardCount > 0 && !Options.MergeShards.empty())
+	{
+		printf("--shard and --merge-shards cannot be used together.\n");
+		exit(0);
+	}
 }
 
 //==========================================================================
@@ -502,9 +552,11 @@ static void ShowUsage()
 		"  -b, --empty-blockmap     Create an empty blockmap\n"
 		"  -r, --empty-reject       Create an empty reject table\n"
 		"  -R, --zero-reject        Create a reject table of all zeroes\n"
-		//"  -e, --full-reject        Rebuild reject table (unsupported)\n"
+		"  -e, --full-reject        Rebuild reject table\n"
+		"      --reject-time=NNN    Stop rebuilding the reject after NNN seconds (default %d, 0 = never)\n"
 		"  -E, --no-reject          Leave reject table untouched\n"
 		"  -p, --partition=NNN      Maximum segs to consider at each node (default %d)\n"
+		"      --fast-nodes         Pick splitters from a sample of the segs (faster, worse trees)\n"
 		"  -s, --split-cost=NNN     Cost for splitting segs (default %d)\n"
 		"  -d, --diagonal-cost=NNN  Cost for avoiding diagonal splitters (default %d)\n"
 		"  -P, --no-polyobjs        Do not check for polyobject subsector splits\n"
@@ -512,7 +564,23 @@ static void ShowUsage()
 		"  -S, --size=NNN           lightmap texture dimensions for width and height must be in powers of two (1, 2, 4, 8, 16, etc)\n"
 		"  -C, --cpu-raytrace       Use the CPU for ray tracing\n"
 		"  -D, --vkdebug            Print messages from the Vulkan validation layer\n"
+		"      --weld=DIST          Merge collision mesh vertices up to DIST apart (default 0 = identical only, -1 = off)\n"
+		"      --watertight         Use a watertight ray/triangle test in the CPU ray tracer\n"
 		"      --dump-mesh          Export level mesh and lightmaps for debugging\n"
+		"      --dump-bake-scene=FILE    Save the level mesh and lighting to FILE before ray tracing\n"
+		"      --replay-bake-scene=FILE  Ray trace a scene saved with --dump-bake-scene and write\n"
+		"                           only its LIGHTMAP lump to the output file\n"
+		"      --trace-timeline=FILE     Write a Chrome trace-event timeline of the run to FILE\n"
+		"      --cache=DIR          Reuse nodes, blockmaps and lightmaps of earlier runs kept in DIR\n"
+		"      --cache-size=NNN     Megabytes the cache may use before old entries are removed (default %d)\n"
+		"      --serve              Keep a map loaded and answer bake and relight requests on stdin\n"
+		"      --checkpoint=FILE    Save the progress of the ray tracing to FILE (traces on the CPU)\n"
+		"      --checkpoint-interval=NNN  Seconds between checkpoints (default %d)\n"
+		"      --resume             Continue the ray tracing saved in the checkpoint file\n"
+		"      --time-budget=NNN    Write the checkpoint and stop after NNN seconds (exit code 3)\n"
+		"      --shard=K/N          Trace only part K of N of the lightmaps and write its samples\n"
+		"                           to the output file instead of a wad\n"
+		"      --merge-shards=FILE,FILE,...  Build the wad with the samples of every shard\n"
 		"  -w, --warn               Show warning messages\n"
 #if HAVE_TIMING
 		"  -t, --no-timing          Suppress timing information\n"
@@ -522,10 +590,13 @@ static void ShowUsage()
 #ifndef _WIN32
 		"\n"
 #endif
-		, MaxSegs /* Partition size */
-		, SplitCost
-		, AAPreference
+		, Options.RejectTimeLimit
+		, Options.MaxSegs /* Partition size */
+		, Options.SplitCost
+		, Options.AAPreference
 		, (int)std::thread::hardware_concurrency()
+		, Options.CacheSize
+		, Options.CheckpointInterval
 	);
 }
 
@@ -566,6 +637,31 @@ static void ShowVersion()
 		" : " __DATE__ ")\n");
 }
 
+//==========================================================================
+//
+// ReplayBakeScene
+//
+// Ray traces a scene written by --dump-bake-scene and writes a wad that
+// holds nothing but the resulting LIGHTMAP lump.
+//
+//==========================================================================
+
+static void ReplayBakeScene()
+{
+	CPUSceneLighting lighting;
+	std::unique_ptr<LevelMesh> mesh = LoadBakeScene(ReplaySceneName, lighting);
+	printf("Loaded bake scene %s: %d surfaces, %d triangles, %d lights\n", ReplaySceneName,
+		(int)mesh->surfaces.size(), (int)mesh->MeshSurfaces.Size(), (int)lighting.Lights.size());
+
+	CPURaytracer raytracer;
+	raytracer.Raytrace(mesh.get(), lighting);
+	mesh->CreateTextures();
+
+	FWadWriter outwad(OutName, false);
+	mesh->AddLightmapLump(outwad);
+	outwad.Close();
+}
+
 //==========================================================================
 //
 // CheckInOutNames
@@ -634,7 +730,7 @@ static bool CheckInOutNames()
 //
 // CheckSSE
 //
-// Checks if the processor supports SSE or SSE2.
+// Turns off the SSE options the processor does not support.
 //
 //==========================================================================
 
@@ -647,16 +743,16 @@ static void CheckSSE()
 	return;
 #endif
 
-	if (!HaveSSE2 && !HaveSSE1)
+	if (!Options.SSE2 && !Options.SSE1)
 	{
 		return;
 	}
 
-	bool forcenosse1 = !HaveSSE1;
-	bool forcenosse2 = !HaveSSE2;
+	bool forcenosse1 = !Options.SSE1;
+	bool forcenosse2 = !Options.SSE2;
 
-	HaveSSE1 = false;
-	HaveSSE2 = false;
+	bool haveSSE1 = false;
+	bool haveSSE2 = false;
 #if defined(_MSC_VER) && !defined(__clang__)
 
 #ifdef _M_X64
@@ -680,9 +776,9 @@ static void CheckSSE()
 		mov eax, 1
 		cpuid
 		test edx, (1 << 25)	// Check for SSE
-		setnz HaveSSE1
+		setnz haveSSE1
 		test edx, (1 << 26)	// Check for SSE2
-		setnz HaveSSE2
+		setnz haveSSE2
 		noid :
 	}
 #endif
@@ -708,33 +804,11 @@ static void CheckSSE()
 			"test $(1<<26),%%edx\n\t"
 			"setneb %1\n"
 			"noid:"
-			:"=m" (HaveSSE1), "=m" (HaveSSE2)::"eax", "ebx", "ecx", "edx");
+			:"=m" (haveSSE1), "=m" (haveSSE2)::"eax", "ebx", "ecx", "edx");
 
 #endif
 
-	if (forcenosse1)
-	{
-		HaveSSE1 = false;
-	}
-	if (forcenosse2)
-	{
-		HaveSSE2 = false;
-	}
+	Options.SSE1 = haveSSE1 && !forcenosse1;
+	Options.SSE2 = haveSSE2 && !forcenosse2;
 }
 #endif
-
-//==========================================================================
-
-void Warn(const char *format, ...)
-{
-	va_list marker;
-
-	if (!ShowWarnings)
-	{
-		return;
-	}
-
-	va_start(marker, format);
-	vprintf(format, marker);
-	va_end(marker);
-}
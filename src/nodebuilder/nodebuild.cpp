@@ -22,6 +22,7 @@
 #include <assert.h>
 #include <string.h>
 #include <stdio.h>
+#include <time.h>
 #ifndef _WIN32
 #include <unistd.h>
 #endif
@@ -29,6 +30,7 @@
 #include "framework/zdray.h"
 #include "nodebuilder/nodebuild.h"
 #include "framework/templates.h"
+#include "framework/timeline.h"
 
 #define Printf printf
 #define STACK_ARGS
@@ -42,9 +44,9 @@
 FNodeBuilder::FNodeBuilder (FLevel &level,
 							TArray<FPolyStart> &polyspots, TArray<FPolyStart> &anchors,
 							const char *name, bool makeGLnodes)
-	: Level(level), SegsStuffed(0), MapName(name)
+	: FastSeed(0x9E3779B9), Level(level), SegsStuffed(0), NumSplits(0), MapName(name)
 {
-	VertexMap = new FVertexMap (*this, Level.MinX, Level.MinY, Level.MaxX, Level.MaxY);
+	VertexMap = new FVertexMap (*this, Level.NumVertices);
 	GLNodes = makeGLnodes;
 	FindUsedVertices (Level.Vertices, Level.NumVertices);
 	MakeSegsFromSides ();
@@ -64,17 +66,30 @@ FNodeBuilder::~FNodeBuilder()
 void FNodeBuilder::BuildTree ()
 {
 	fixed_t bbox[4];
+	clock_t start = clock();
 
 	fprintf (stderr, "   BSP:   0.0%%\r");
 	HackSeg = DWORD_MAX;
 	HackMate = DWORD_MAX;
-	CreateNode (0, Segs.Size(), bbox);
+	CreateNode (0, Segs.Size(), bbox, 0);
 	CreateSubsectorsForReal ();
 	fprintf (stderr, "   BSP: 100.0%%\n");
+
+	printf ("   %s nodes: %u, subsectors: %u, segs: %u, splits: %d",
+		GLNodes ? "GL" : "Normal", Nodes.Size(), Subsectors.Size(), Segs.Size(), NumSplits);
+	if (!NoTiming)
+	{
+		printf (" (%.3f seconds%s)", double(clock() - start) / CLOCKS_PER_SEC, FastNodes ? ", fast" : "");
+	}
+	printf ("\n");
 }
 
-uint32_t FNodeBuilder::CreateNode (uint32_t set, unsigned int count, fixed_t bbox[4])
+uint32_t FNodeBuilder::CreateNode (uint32_t set, unsigned int count, fixed_t bbox[4], int depth)
 {
+	// Only the top levels of the tree go on the timeline. Below them there
+	// are too many nodes, each too small to see.
+	TIMELINE_SCOPE_IF (depth < 8, "Create node", "depth", depth);
+
 	node_t node;
 	int skip, selstat;
 	uint32_t splitseg;
@@ -83,8 +98,11 @@ uint32_t FNodeBuilder::CreateNode (uint32_t set, unsigned int count, fixed_t bbo
 	// in this set. That's okay, because we just use it to get a skip count, so an
 	// estimate is fine.
 	skip = int(count / MaxSegs);
+	selstat = 0;
 
-	if ((selstat = SelectSplitter (set, node, splitseg, skip, true)) > 0 ||
+	// In fast mode only small sets get the full treatment.
+	if ((FastNodes && count > FAST_NODES_CUTOFF && SelectSplitterFast (set, node, splitseg) > 0) ||
+		(selstat = SelectSplitter (set, node, splitseg, skip, true)) > 0 ||
 		(skip > 0 && (selstat = SelectSplitter (set, node, splitseg, 1, true)) > 0) ||
 		(selstat < 0 && (SelectSplitter (set, node, splitseg, skip, false) > 0 ||
 						(skip > 0 && SelectSplitter (set, node, splitseg, 1, false)))) ||
@@ -98,8 +116,8 @@ uint32_t FNodeBuilder::CreateNode (uint32_t set, unsigned int count, fixed_t bbo
 		D(PrintSet (1, set1));
 		D(Printf ("(%d,%d) delta (%d,%d) from seg %d\n", node.x>>16, node.y>>16, node.dx>>16, node.dy>>16, splitseg));
 		D(PrintSet (2, set2));
-		node.intchildren[0] = CreateNode (set1, count1, node.bbox[0]);
-		node.intchildren[1] = CreateNode (set2, count2, node.bbox[1]);
+		node.intchildren[0] = CreateNode (set1, count1, node.bbox[0], depth + 1);
+		node.intchildren[1] = CreateNode (set2, count2, node.bbox[1], depth + 1);
 		bbox[BOXTOP] = MAX (node.bbox[0][BOXTOP], node.bbox[1][BOXTOP]);
 		bbox[BOXBOTTOM] = MIN (node.bbox[0][BOXBOTTOM], node.bbox[1][BOXBOTTOM]);
 		bbox[BOXLEFT] = MIN (node.bbox[0][BOXLEFT], node.bbox[1][BOXLEFT]);
@@ -889,6 +907,7 @@ void FNodeBuilder::SplitSegs (uint32_t set, node_t &node, uint32_t splitseg, uin
 		}
 		set = next;
 	}
+	Events.Sort ();
 	FixSplitSharers ();
 	if (GLNodes)
 	{
@@ -923,6 +942,7 @@ uint32_t FNodeBuilder::SplitSeg (uint32_t segnum, int splitvert, int v1InFront)
 	FPrivSeg newseg;
 	int newnum = (int)Segs.Size();
 
+	NumSplits++;
 	newseg = Segs[segnum];
 	dx = double(Vertices[splitvert].x - Vertices[newseg.v1].x);
 	dy = double(Vertices[splitvert].y - Vertices[newseg.v1].y);
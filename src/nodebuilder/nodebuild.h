@@ -14,38 +14,30 @@ struct FEventInfo
 
 struct FEvent
 {
-	FEvent *Parent, *Left, *Right;
 	double Distance;
 	FEventInfo Info;
 };
 
-class FEventTree
+// Vertices intersected by a splitter. Events are only ever added while the
+// segs are being split and only ever walked afterwards, so they are appended
+// to a flat array that is sorted once instead of being kept in a tree. The
+// array keeps its storage between splits.
+class FEventList
 {
 public:
-	FEventTree ();
-	~FEventTree ();
+	FEvent *GetMinimum () { return Events.Size() > 0 ? &Events[0] : nullptr; }
+	FEvent *GetSuccessor (FEvent *event) const { return event + 1 < Events.end() ? event + 1 : nullptr; }
+	FEvent *GetPredecessor (FEvent *event) const { return event > Events.begin() ? event - 1 : nullptr; }
 
-	FEvent *GetMinimum ();
-	FEvent *GetSuccessor (FEvent *event) const { FEvent *node = Successor(event); return node == &Nil ? nullptr : node; }
-	FEvent *GetPredecessor (FEvent *event) const { FEvent *node = Predecessor(event); return node == &Nil ? nullptr : node; }
-
-	FEvent *GetNewNode ();
-	void Insert (FEvent *event);
+	void Insert (double distance, int vertex);
+	void Sort ();
 	FEvent *FindEvent (double distance) const;
-	void DeleteAll ();
+	void DeleteAll () { Events.Clear(); }
 
-	void PrintTree () const { PrintTree (Root); }
+	void PrintList () const;
 
 private:
-	FEvent Nil;
-	FEvent *Root;
-	FEvent *Spare;
-
-	void DeletionTraverser (FEvent *event);
-	FEvent *Successor (FEvent *event) const;
-	FEvent *Predecessor (FEvent *event) const;
-
-	void PrintTree (const FEvent *event) const;
+	TArray<FEvent> Events;
 };
 
 struct FSimpleVert
@@ -118,35 +110,46 @@ class FNodeBuilder
 		uint32_t Seg;
 		bool Forward;
 	};
+	struct FFastCandidate
+	{
+		uint32_t Seg;
+		int Estimate;
+	};
 
-	// Like a blockmap, but for vertices instead of lines
+	// Like a blockmap, but for vertices instead of lines. Vertices are kept in a
+	// flat open-addressing hash keyed on their snapped cell coordinates.
 	class FVertexMap
 	{
 	public:
-		FVertexMap (FNodeBuilder &builder, fixed_t minx, fixed_t miny, fixed_t maxx, fixed_t maxy);
+		FVertexMap (FNodeBuilder &builder, int sizehint);
 		~FVertexMap ();
 
 		int SelectVertexExact (FPrivVert &vert);
 		int SelectVertexClose (FPrivVert &vert);
 
 	private:
-		FNodeBuilder &MyBuilder;
-		TArray<int> *VertexGrid;
+		struct FSlot
+		{
+			fixed_t x, y;
+			int vertnum;		// -1 if the slot is empty
+		};
 
-		fixed_t MinX, MinY, MaxX, MaxY;
-		int BlocksWide, BlocksTall;
+		FNodeBuilder &MyBuilder;
+		FSlot *Slots;
+		unsigned int Mask;
+		unsigned int Used;
 
-		enum { BLOCK_SHIFT = 8 + FRACBITS };
-		enum { BLOCK_SIZE = 1 << BLOCK_SHIFT };
+		// Cells must be larger than twice VERTEX_EPSILON so that a close match
+		// is always in the vertex's own cell or one of its neighbours.
+		enum { CELL_SHIFT = 4 };
 
 		int InsertVertex (FPrivVert &vert);
-		inline int GetBlock (fixed_t x, fixed_t y)
+		void Grow ();
+		int FindInCell (int cx, int cy, fixed_t x, fixed_t y, bool exact) const;
+		inline unsigned int HashCell (int cx, int cy) const
 		{
-			assert (x >= MinX);
-			assert (y >= MinY);
-			assert (x <= MaxX);
-			assert (y <= MaxY);
-			return (unsigned(x - MinX) >> BLOCK_SHIFT) + (unsigned(y - MinY) >> BLOCK_SHIFT) * BlocksWide;
+			uint64_t key = (uint64_t(uint32_t(cx)) << 32) | uint32_t(cy);
+			return unsigned((key * 0x9E3779B97F4A7C15ull) >> 32) & Mask;
 		}
 	};
 
@@ -195,9 +198,17 @@ private:
 
 	TArray<int> Touched;	// Loops a splitter touches on a vertex
 	TArray<int> Colinear;	// Loops with edges colinear to a splitter
-	FEventTree Events;		// Vertices intersected by the current splitter
+	FEventList Events;		// Vertices intersected by the current splitter
 	TArray<FSplitSharer> SplitSharers;	// Segs collinear with the current splitter
 
+	// Scratch space for SelectSplitterFast
+	TArray<uint32_t> FastSet;
+	TArray<uint32_t> FastAxial;
+	TArray<uint32_t> FastDiagonal;
+	TArray<fixed_t> FastMinX, FastMaxX, FastMinY, FastMaxY;
+	TArray<FFastCandidate> FastCandidates;
+	unsigned int FastSeed;
+
 	uint32_t HackSeg;			// Seg to force to back of splitter
 	uint32_t HackMate;			// Seg to use in front of hack seg
 	FLevel &Level;
@@ -205,6 +216,7 @@ private:
 
 	// Progress meter stuff
 	int SegsStuffed;
+	int NumSplits;
 	const char *MapName;
 
 	void FindUsedVertices (WideVertex *vertices, int max);
@@ -216,13 +228,15 @@ private:
 	bool GetPolyExtents (int polynum, fixed_t bbox[4]);
 	int MarkLoop (uint32_t firstseg, int loopnum);
 	void AddSegToBBox (fixed_t bbox[4], const FPrivSeg *seg);
-	uint32_t CreateNode (uint32_t set, unsigned int count, fixed_t bbox[4]);
+	uint32_t CreateNode (uint32_t set, unsigned int count, fixed_t bbox[4], int depth);
 	uint32_t CreateSubsector (uint32_t set, fixed_t bbox[4]);
 	void CreateSubsectorsForReal ();
 	bool CheckSubsector (uint32_t set, node_t &node, uint32_t &splitseg);
 	bool CheckSubsectorOverlappingSegs (uint32_t set, node_t &node, uint32_t &splitseg);
 	bool ShoveSegBehind (uint32_t set, node_t &node, uint32_t seg, uint32_t mate);
 	int SelectSplitter (uint32_t set, node_t &node, uint32_t &splitseg, int step, bool nosplit);
+	int SelectSplitterFast (uint32_t set, node_t &node, uint32_t &splitseg);
+	unsigned int FastRandom ();
 	void SplitSegs (uint32_t set, node_t &node, uint32_t splitseg, uint32_t &outset0, uint32_t &outset1, unsigned int &count0, unsigned int &count1);
 	uint32_t SplitSeg (uint32_t segnum, int splitvert, int v1InFront);
 	int Heuristic (node_t &node, uint32_t set, bool honorNoSplit);
@@ -267,6 +281,10 @@ const double SIDE_EPSILON = 6.5536;
 // Vertices within this distance of each other will be considered as the same vertex.
 #define VERTEX_EPSILON	6		// This is a fixed_t value
 
+// With --fast-nodes, sets with no more segs than this still get the
+// exhaustive splitter selection.
+const unsigned int FAST_NODES_CUTOFF = 96;
+
 inline int FNodeBuilder::PointOnSide (int x, int y, int x1, int y1, int dx, int dy)
 {
 	// For most cases, a simple dot product is enough.
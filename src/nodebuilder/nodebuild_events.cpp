@@ -1,5 +1,5 @@
 /*
-    A red-black tree implementation for building minisegs.
+    A sorted list of splitter intersections for building minisegs.
     Copyright (C) 2002-2006 Randy Heit
 
     This program is free software; you can redistribute it and/or modify
@@ -19,189 +19,50 @@
 */
 #include <string.h>
 #include <stdio.h>
+#include <algorithm>
 #include "framework/zdray.h"
 #include "nodebuilder/nodebuild.h"
 
-FEventTree::FEventTree ()
-: Root (&Nil), Spare (nullptr)
+void FEventList::Insert (double distance, int vertex)
 {
-	memset (&Nil, 0, sizeof(Nil));
-}
-
-FEventTree::~FEventTree ()
-{
-	FEvent *probe;
-
-	DeleteAll ();
-	probe = Spare;
-	while (probe != nullptr)
-	{
-		FEvent *next = probe->Left;
-		delete probe;
-		probe = next;
-	}
-}
-
-void FEventTree::DeleteAll ()
-{
-	DeletionTraverser (Root);
-	Root = &Nil;
-}
-
-void FEventTree::DeletionTraverser (FEvent *node)
-{
-	if (node != &Nil && node != nullptr)
-	{
-		DeletionTraverser (node->Left);
-		DeletionTraverser (node->Right);
-		node->Left = Spare;
-		Spare = node;
-	}
-}
-
-FEvent *FEventTree::GetNewNode ()
-{
-	FEvent *node;
+	FEvent event;
 
-	if (Spare != nullptr)
-	{
-		node = Spare;
-		Spare = node->Left;
-	}
-	else
-	{
-		node = new FEvent;
-	}
-	return node;
+	event.Distance = distance;
+	event.Info.Vertex = vertex;
+	event.Info.FrontSeg = DWORD_MAX;
+	Events.Push (event);
 }
 
-void FEventTree::Insert (FEvent *z)
-{
-	FEvent *y = &Nil;
-	FEvent *x = Root;
-
-	while (x != &Nil)
-	{
-		y = x;
-		if (z->Distance < x->Distance)
-		{
-			x = x->Left;
-		}
-		else
-		{
-			x = x->Right;
-		}
-	}
-	z->Parent = y;
-	if (y == &Nil)
-	{
-		Root = z;
-	}
-	else if (z->Distance < y->Distance)
-	{
-		y->Left = z;
-	}
-	else
-	{
-		y->Right = z;
-	}
-	z->Left = &Nil;
-	z->Right = &Nil;
-}
+// Orders the events by distance. When several vertices were added at the
+// same distance, only the first one added is kept.
 
-FEvent *FEventTree::Successor (FEvent *event) const
+void FEventList::Sort ()
 {
-	if (event->Right != &Nil)
-	{
-		event = event->Right;
-		while (event->Left != &Nil)
-		{
-			event = event->Left;
-		}
-		return event;
-	}
-	else
-	{
-		FEvent *y = event->Parent;
-		while (y != &Nil && event == y->Right)
-		{
-			event = y;
-			y = y->Parent;
-		}
-		return y;
-	}
-}
+	std::stable_sort (Events.begin(), Events.end(),
+		[](const FEvent &a, const FEvent &b) { return a.Distance < b.Distance; });
 
-FEvent *FEventTree::Predecessor (FEvent *event) const
-{
-	if (event->Left != &Nil)
-	{
-		event = event->Left;
-		while (event->Right != &Nil)
-		{
-			event = event->Right;
-		}
-		return event;
-	}
-	else
-	{
-		FEvent *y = event->Parent;
-		while (y != &Nil && event == y->Left)
-		{
-			event = y;
-			y = y->Parent;
-		}
-		return y;
-	}
+	FEvent *last = std::unique (Events.begin(), Events.end(),
+		[](const FEvent &a, const FEvent &b) { return a.Distance == b.Distance; });
+	Events.Resize ((unsigned int)(last - Events.begin()));
 }
 
-FEvent *FEventTree::FindEvent (double key) const
+FEvent *FEventList::FindEvent (double key) const
 {
-	FEvent *node = Root;
+	const FEvent *event = std::lower_bound (Events.begin(), Events.end(), key,
+		[](const FEvent &a, double key) { return a.Distance < key; });
 
-	while (node != &Nil)
+	if (event != Events.end() && event->Distance == key)
 	{
-		if (node->Distance == key)
-		{
-			return node;
-		}
-		else if (node->Distance > key)
-		{
-			node = node->Left;
-		}
-		else
-		{
-			node = node->Right;
-		}
+		return const_cast<FEvent *>(event);
 	}
 	return nullptr;
 }
 
-FEvent *FEventTree::GetMinimum ()
+void FEventList::PrintList () const
 {
-	FEvent *node = Root;
-
-	if (node == &Nil)
-	{
-		return nullptr;
-	}
-	while (node->Left != &Nil)
-	{
-		node = node->Left;
-	}
-	return node;
-}
-
-void FEventTree::PrintTree (const FEvent *event) const
-{
-	if (event->Left != &Nil)
-	{
-		PrintTree (event->Left);
-	}
-	printf (" Distance %g, vertex %d, seg %u\n",
-		sqrt(event->Distance/4294967296.0), event->Info.Vertex, (unsigned)event->Info.FrontSeg);
-	if (event->Right != &Nil)
+	for (const FEvent &event : Events)
 	{
-		PrintTree (event->Right);
+		printf (" Distance %g, vertex %d, seg %u\n",
+			sqrt(event.Distance/4294967296.0), event.Info.Vertex, (unsigned)event.Info.FrontSeg);
 	}
 }
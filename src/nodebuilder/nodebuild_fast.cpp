@@ -0,0 +1,267 @@
+/*
+    Approximate splitter selection for very large maps.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <algorithm>
+
+#include "framework/zdray.h"
+#include "nodebuilder/nodebuild.h"
+#include "framework/templates.h"
+
+#if 0
+#define D(x) x
+#define Printf printf
+#else
+#define D(x) do{}while(0)
+#endif
+
+// Number of segs in a set that are used to estimate how well a splitter
+// balances it.
+static const unsigned int FAST_SAMPLE_SIZE = 512;
+
+// Diagonal candidates have to classify every sampled seg, so they only
+// look at the start of the sample.
+static const unsigned int FAST_DIAGONAL_SAMPLE_SIZE = 64;
+
+// Number of the best estimated splitters that are checked with the full
+// Heuristic() before one is picked.
+static const int FAST_VALIDATE = 4;
+static const int FAST_VALIDATE_MAX = 16;
+
+// Returns a deterministic pseudo-random number, so that fast builds of the
+// same map always produce the same tree.
+
+unsigned int FNodeBuilder::FastRandom ()
+{
+	FastSeed ^= FastSeed << 13;
+	FastSeed ^= FastSeed >> 17;
+	FastSeed ^= FastSeed << 5;
+	return FastSeed;
+}
+
+// Counts how many values in the sorted array are <= key (or < key if
+// inclusive is false).
+
+static int CountBelow (const TArray<fixed_t> &sorted, fixed_t key, bool inclusive)
+{
+	const fixed_t *p = inclusive ?
+		std::upper_bound (sorted.begin(), sorted.end(), key) :
+		std::lower_bound (sorted.begin(), sorted.end(), key);
+	return int(p - sorted.begin());
+}
+
+// Used in place of SelectSplitter() when FastNodes is set and the set is
+// large. Instead of running the full Heuristic() over every step-th plane,
+// candidate planes are scored against a small random sample of the set,
+// with axis-aligned planes considered first. Axis-aligned candidates are
+// scored from the sample's sorted extents, so they cost a binary search
+// each. Only the best few estimates are checked with the real Heuristic().
+//
+// Returns 1 if a splitter was found. Otherwise returns 0, and the caller
+// should fall back to the exhaustive selection.
+
+int FNodeBuilder::SelectSplitterFast (uint32_t set, node_t &node, uint32_t &splitseg)
+{
+	uint32_t seg;
+	unsigned int i, count, samplecount;
+
+	FastSet.Clear ();
+	for (seg = set; seg != DWORD_MAX; seg = Segs[seg].next)
+	{
+		FastSet.Push (seg);
+	}
+	count = FastSet.Size ();
+
+	// Pick a random subset of the set with a partial Fisher-Yates shuffle.
+	samplecount = MIN (count, FAST_SAMPLE_SIZE);
+	for (i = 0; i < samplecount; ++i)
+	{
+		unsigned int j = i + FastRandom() % (count - i);
+		std::swap (FastSet[i], FastSet[j]);
+	}
+
+	FastMinX.Clear (); FastMaxX.Clear ();
+	FastMinY.Clear (); FastMaxY.Clear ();
+	for (i = 0; i < samplecount; ++i)
+	{
+		const FPrivSeg *s = &Segs[FastSet[i]];
+		const FPrivVert *v1 = &Vertices[s->v1];
+		const FPrivVert *v2 = &Vertices[s->v2];
+		FastMinX.Push (MIN (v1->x, v2->x));
+		FastMaxX.Push (MAX (v1->x, v2->x));
+		FastMinY.Push (MIN (v1->y, v2->y));
+		FastMaxY.Push (MAX (v1->y, v2->y));
+	}
+	std::sort (FastMinX.begin(), FastMinX.end());
+	std::sort (FastMaxX.begin(), FastMaxX.end());
+	std::sort (FastMinY.begin(), FastMinY.end());
+	std::sort (FastMaxY.begin(), FastMaxY.end());
+
+	// Gather one seg for every plane in the set, split by orientation.
+	TArray<uint32_t> &axial = FastAxial;
+	TArray<uint32_t> &diagonal = FastDiagonal;
+
+	axial.Clear ();
+	diagonal.Clear ();
+	memset (&PlaneChecked[0], 0, PlaneChecked.Size());
+	for (i = 0; i < count; ++i)
+	{
+		const FPrivSeg *s = &Segs[FastSet[i]];
+		if (s->linedef == -1 || s->planenum < 0)
+		{ // Minisegs lie on planes that were already used as splitters.
+			continue;
+		}
+		int l = s->planenum >> 3;
+		int r = 1 << (s->planenum & 7);
+		if ((PlaneChecked[l] & r) == 0)
+		{
+			PlaneChecked[l] |= r;
+			const FSimpleLine *pline = &Planes[s->planenum];
+			if (pline->dx == 0 || pline->dy == 0)
+			{
+				axial.Push (FastSet[i]);
+			}
+			else
+			{
+				diagonal.Push (FastSet[i]);
+			}
+		}
+	}
+
+	// Take up to MaxSegs candidates, evenly spread over the axis-aligned
+	// planes first and the diagonal ones after that.
+	FastCandidates.Clear ();
+	unsigned int want = MIN ((unsigned int)MaxSegs, axial.Size());
+	for (i = 0; i < want; ++i)
+	{
+		FFastCandidate cand = { axial[(unsigned int)((uint64_t)i * axial.Size() / want)], 0 };
+		FastCandidates.Push (cand);
+	}
+	want = MIN ((unsigned int)MaxSegs - want, diagonal.Size());
+	for (i = 0; i < want; ++i)
+	{
+		FFastCandidate cand = { diagonal[(unsigned int)((uint64_t)i * diagonal.Size() / want)], 0 };
+		FastCandidates.Push (cand);
+	}
+
+	if (FastCandidates.Size() == 0)
+	{
+		return 0;
+	}
+
+	// Estimate each candidate against the sample.
+	for (i = 0; i < FastCandidates.Size(); ++i)
+	{
+		int front, back, split;
+		bool axis;
+
+		SetNodeFromSeg (node, &Segs[FastCandidates[i].Seg]);
+
+		if (node.dx == 0 || node.dy == 0)
+		{
+			const TArray<fixed_t> &mins = node.dx == 0 ? FastMinX : FastMinY;
+			const TArray<fixed_t> &maxs = node.dx == 0 ? FastMaxX : FastMaxY;
+			fixed_t c = node.dx == 0 ? node.x : node.y;
+
+			// Segs ending at or before the plane are on one side, segs starting at
+			// or after it are on the other. Segs on the plane count for both.
+			front = CountBelow (maxs, c, true);
+			back = (int)samplecount - CountBelow (mins, c, false);
+			split = MAX ((int)samplecount - front - back, 0);
+			axis = true;
+		}
+		else
+		{
+			int sidev[2];
+			unsigned int diagcount = MIN (samplecount, FAST_DIAGONAL_SAMPLE_SIZE);
+			front = back = split = 0;
+			for (unsigned int j = 0; j < diagcount; ++j)
+			{
+				const FPrivSeg *s = &Segs[FastSet[j]];
+				switch (ClassifyLine (node, &Vertices[s->v1], &Vertices[s->v2], sidev))
+				{
+				case 0:		front++; break;
+				case 1:		back++; break;
+				default:	split++; break;
+				}
+			}
+			// Scale up to the size of the whole sample.
+			front = front * (int)samplecount / (int)diagcount;
+			back = back * (int)samplecount / (int)diagcount;
+			split = split * (int)samplecount / (int)diagcount;
+			axis = false;
+		}
+
+		if (front + split == 0 || back + split == 0)
+		{ // Does not divide the sample.
+			FastCandidates[i].Estimate = INT_MIN;
+			continue;
+		}
+
+		// Same weighting as Heuristic(), but on the sample.
+		int estimate = ((int)samplecount - split) * SplitCost;
+		estimate += 2 * MIN (front + split, back + split);
+		if (axis)
+		{
+			estimate += (int)samplecount / AAPreference;
+		}
+		FastCandidates[i].Estimate = estimate;
+	}
+
+	std::stable_sort (FastCandidates.begin(), FastCandidates.end(),
+		[](const FFastCandidate &a, const FFastCandidate &b) { return a.Estimate > b.Estimate; });
+
+	// Check the most promising candidates with the real heuristic, since it
+	// also knows about polyobject loops and splits too close to vertices.
+	int bestvalue = 0, found = 0;
+	uint32_t bestseg = DWORD_MAX;
+
+	for (i = 0; i < FastCandidates.Size() && i < (unsigned int)FAST_VALIDATE_MAX && found < FAST_VALIDATE; ++i)
+	{
+		if (FastCandidates[i].Estimate == INT_MIN)
+		{
+			break;
+		}
+		SetNodeFromSeg (node, &Segs[FastCandidates[i].Seg]);
+		int value = Heuristic (node, set, true);
+
+		D(Printf ("Fast candidate seg %u estimated %d scores %d\n", FastCandidates[i].Seg, FastCandidates[i].Estimate, value));
+
+		if (value > 0)
+		{
+			found++;
+			if (value > bestvalue)
+			{
+				bestvalue = value;
+				bestseg = FastCandidates[i].Seg;
+			}
+		}
+	}
+
+	if (bestseg == DWORD_MAX)
+	{
+		return 0;
+	}
+
+	splitseg = bestseg;
+	SetNodeFromSeg (node, &Segs[bestseg]);
+	return 1;
+}
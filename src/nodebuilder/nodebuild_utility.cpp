@@ -455,37 +455,71 @@ void FNodeBuilder::AddSegToBBox (fixed_t bbox[4], const FPrivSeg *seg)
 	if (v2->y > bbox[BOXTOP])		bbox[BOXTOP] = v2->y;
 }
 
-FNodeBuilder::FVertexMap::FVertexMap (FNodeBuilder &builder,
-	fixed_t minx, fixed_t miny, fixed_t maxx, fixed_t maxy)
+FNodeBuilder::FVertexMap::FVertexMap (FNodeBuilder &builder, int sizehint)
 	: MyBuilder(builder)
 {
-	MinX = minx;
-	MinY = miny;
-	BlocksWide = int(((double(maxx) - minx + 1) + (BLOCK_SIZE - 1)) / BLOCK_SIZE);
-	BlocksTall = int(((double(maxy) - miny + 1) + (BLOCK_SIZE - 1)) / BLOCK_SIZE);
-	MaxX = MinX + BlocksWide * BLOCK_SIZE - 1;
-	MaxY = MinY + BlocksTall * BLOCK_SIZE - 1;
-	VertexGrid = new TArray<int>[BlocksWide * BlocksTall];
+	// Splits add vertices as the tree is built, so leave some headroom
+	// beyond the map's own vertex count.
+	unsigned int size = 1024;
+	while (size < unsigned(sizehint) * 4)
+	{
+		size <<= 1;
+	}
+	Mask = size - 1;
+	Used = 0;
+	Slots = new FSlot[size];
+	for (unsigned int i = 0; i < size; ++i)
+	{
+		Slots[i].vertnum = -1;
+	}
 }
 
 FNodeBuilder::FVertexMap::~FVertexMap ()
 {
-	delete[] VertexGrid;
+	delete[] Slots;
 }
 
-int FNodeBuilder::FVertexMap::SelectVertexExact (FNodeBuilder::FPrivVert &vert)
+// Returns the lowest numbered vertex stored for cell (cx,cy) that matches
+// (x,y), either exactly or within VERTEX_EPSILON, or -1 if there is none.
+
+int FNodeBuilder::FVertexMap::FindInCell (int cx, int cy, fixed_t x, fixed_t y, bool exact) const
 {
-	TArray<int> &block = VertexGrid[GetBlock (vert.x, vert.y)];
-	FPrivVert *vertices = &MyBuilder.Vertices[0];
-	unsigned int i;
+	int best = -1;
 
-	for (i = 0; i < block.Size(); ++i)
+	for (unsigned int i = HashCell (cx, cy); Slots[i].vertnum >= 0; i = (i + 1) & Mask)
 	{
-		if (vertices[block[i]].x == vert.x && vertices[block[i]].y == vert.y)
+		const FSlot &slot = Slots[i];
+		if (best >= 0 && slot.vertnum > best)
+		{
+			continue;
+		}
+		if (exact)
+		{
+			if (slot.x == x && slot.y == y)
+			{
+				best = slot.vertnum;
+			}
+		}
+#if VERTEX_EPSILON <= 1
+		else if (slot.x == x && slot.y == y)
+#else
+		else if (abs(slot.x - x) < VERTEX_EPSILON && abs(slot.y - y) < VERTEX_EPSILON)
+#endif
 		{
-			return block[i];
+			best = slot.vertnum;
 		}
 	}
+	return best;
+}
+
+int FNodeBuilder::FVertexMap::SelectVertexExact (FNodeBuilder::FPrivVert &vert)
+{
+	int vertnum = FindInCell (vert.x >> CELL_SHIFT, vert.y >> CELL_SHIFT, vert.x, vert.y, true);
+
+	if (vertnum >= 0)
+	{
+		return vertnum;
+	}
 
 	// Not present: add it!
 	return InsertVertex (vert);
@@ -493,23 +527,30 @@ int FNodeBuilder::FVertexMap::SelectVertexExact (FNodeBuilder::FPrivVert &vert)
 
 int FNodeBuilder::FVertexMap::SelectVertexClose (FNodeBuilder::FPrivVert &vert)
 {
-	TArray<int> &block = VertexGrid[GetBlock (vert.x, vert.y)];
-	FPrivVert *vertices = &MyBuilder.Vertices[0];
-	unsigned int i;
-
-	for (i = 0; i < block.Size(); ++i)
+	// Only probe the neighbouring cells the epsilon box actually reaches into.
+	int cx0 = (vert.x - (VERTEX_EPSILON - 1)) >> CELL_SHIFT;
+	int cx1 = (vert.x + (VERTEX_EPSILON - 1)) >> CELL_SHIFT;
+	int cy0 = (vert.y - (VERTEX_EPSILON - 1)) >> CELL_SHIFT;
+	int cy1 = (vert.y + (VERTEX_EPSILON - 1)) >> CELL_SHIFT;
+	int best = -1;
+
+	for (int cy = cy0; cy <= cy1; ++cy)
 	{
-#if VERTEX_EPSILON <= 1
-		if (vertices[block[i]].x == vert.x && vertices[block[i]].y == vert.y)
-#else
-		if (abs(vertices[block[i]].x - vert.x) < VERTEX_EPSILON &&
-			abs(vertices[block[i]].y - vert.y) < VERTEX_EPSILON)
-#endif
+		for (int cx = cx0; cx <= cx1; ++cx)
 		{
-			return block[i];
+			int vertnum = FindInCell (cx, cy, vert.x, vert.y, false);
+			if (vertnum >= 0 && (best < 0 || vertnum < best))
+			{
+				best = vertnum;
+			}
 		}
 	}
 
+	if (best >= 0)
+	{
+		return best;
+	}
+
 	// Not present: add it!
 	return InsertVertex (vert);
 }
@@ -522,35 +563,48 @@ int FNodeBuilder::FVertexMap::InsertVertex (FNodeBuilder::FPrivVert &vert)
 	vert.segs2 = DWORD_MAX;
 	vertnum = (int)MyBuilder.Vertices.Push (vert);
 
-	// If a vertex is near a block boundary, then it will be inserted on
-	// both sides of the boundary so that SelectVertexClose can find
-	// it by checking in only one block.
-	fixed_t minx = MAX (MinX, vert.x - VERTEX_EPSILON);
-	fixed_t maxx = MIN (MaxX, vert.x + VERTEX_EPSILON);
-	fixed_t miny = MAX (MinY, vert.y - VERTEX_EPSILON);
-	fixed_t maxy = MIN (MaxY, vert.y + VERTEX_EPSILON);
+	// Keep the load factor at or below one half so probe sequences stay short.
+	if ((Used + 1) * 2 > Mask + 1)
+	{
+		Grow ();
+	}
 
-	int blk[4] =
+	unsigned int i = HashCell (vert.x >> CELL_SHIFT, vert.y >> CELL_SHIFT);
+	while (Slots[i].vertnum >= 0)
 	{
-		GetBlock (minx, miny),
-		GetBlock (maxx, miny),
-		GetBlock (minx, maxy),
-		GetBlock (maxx, maxy)
-	};
-	unsigned int blkcount[4] =
+		i = (i + 1) & Mask;
+	}
+	Slots[i].x = vert.x;
+	Slots[i].y = vert.y;
+	Slots[i].vertnum = vertnum;
+	Used++;
+
+	return vertnum;
+}
+
+void FNodeBuilder::FVertexMap::Grow ()
+{
+	FSlot *oldslots = Slots;
+	unsigned int oldsize = Mask + 1;
+
+	Mask = oldsize * 2 - 1;
+	Slots = new FSlot[oldsize * 2];
+	for (unsigned int i = 0; i <= Mask; ++i)
 	{
-		VertexGrid[blk[0]].Size(),
-		VertexGrid[blk[1]].Size(),
-		VertexGrid[blk[2]].Size(),
-		VertexGrid[blk[3]].Size()
-	};
-	for (int i = 0; i < 4; ++i)
+		Slots[i].vertnum = -1;
+	}
+
+	for (unsigned int i = 0; i < oldsize; ++i)
 	{
-		if (VertexGrid[blk[i]].Size() == blkcount[i])
+		if (oldslots[i].vertnum >= 0)
 		{
-			VertexGrid[blk[i]].Push (vertnum);
+			unsigned int j = HashCell (oldslots[i].x >> CELL_SHIFT, oldslots[i].y >> CELL_SHIFT);
+			while (Slots[j].vertnum >= 0)
+			{
+				j = (j + 1) & Mask;
+			}
+			Slots[j] = oldslots[i];
 		}
 	}
-
-	return vertnum;
+	delete[] oldslots;
 }
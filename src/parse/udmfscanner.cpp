@@ -0,0 +1,502 @@
+/*
+    Tokenizer for UDMF text maps.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdexcept>
+#include <string>
+#include "parse/udmfscanner.h"
+
+#ifdef _MSC_VER
+#pragma warning(disable:4996)
+#endif
+
+// Characters that are always a token of their own, same as SC_GetString in
+// C mode.
+static const char StopChars[] = "`~!@#$%^&*(){}[]/=?+|;:<>,";
+
+static struct FStopCharTable
+{
+	bool IsStop[256];
+
+	FStopCharTable()
+	{
+		memset(IsStop, 0, sizeof(IsStop));
+		for (const char *p = StopChars; *p; p++)
+		{
+			IsStop[(uint8_t)*p] = true;
+		}
+	}
+} StopCharTable;
+
+static inline bool IsStopChar(char c)
+{
+	return StopCharTable.IsStop[(uint8_t)c];
+}
+
+static inline char ToLower(char c)
+{
+	return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+bool FUDMFToken::Is(const char *name) const
+{
+	for (int i = 0; i < Len; i++)
+	{
+		if (name[i] == 0 || ToLower(Str[i]) != ToLower(name[i]))
+		{
+			return false;
+		}
+	}
+	return name[Len] == 0;
+}
+
+uint32_t UDMFKeyHash(const char *str, int len)
+{
+	uint32_t hash = 2166136261u;
+	for (int i = 0; i < len; i++)
+	{
+		hash = (hash ^ uint8_t(ToLower(str[i]))) * 16777619u;
+	}
+	return hash;
+}
+
+//==========================================================================
+//
+// UDMFStrToD
+//
+// Plain decimal numbers with up to 15 digits are exact as a double, and so
+// is a power of ten up to 1e22. The quotient of the two is then correctly
+// rounded, which is what strtod() returns too. Anything else goes through
+// strtod() on a terminated copy.
+//
+//==========================================================================
+
+bool UDMFStrToD(const char *str, int len, double &value)
+{
+	static const double pow10[] =
+	{
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+
+	const char *p = str, *end = str + len;
+	bool negative = false;
+
+	if (p < end && (*p == '-' || *p == '+'))
+	{
+		negative = *p++ == '-';
+	}
+	else if (p < end && !(*p >= '0' && *p <= '9') && *p != '.' &&
+		ToLower(*p) != 'i' && ToLower(*p) != 'n')
+	{ // Not a number at all (e.g. a quoted string or true)
+		value = 0;
+		return false;
+	}
+
+	int64_t mantissa = 0;
+	int digits = 0, fraction = 0;
+	bool dot = false;
+
+	for (; p < end; p++)
+	{
+		if (*p >= '0' && *p <= '9')
+		{
+			if (++digits > 15)
+			{
+				goto slow;
+			}
+			mantissa = mantissa * 10 + (*p - '0');
+			fraction += dot;
+		}
+		else if (*p == '.' && !dot)
+		{
+			dot = true;
+		}
+		else
+		{
+			goto slow;
+		}
+	}
+	if (digits > 0)
+	{
+		value = double(mantissa) / pow10[fraction];
+		if (negative)
+		{
+			value = -value;
+		}
+		return true;
+	}
+
+slow:
+	char buffer[64];
+	std::string copy;
+	const char *start = buffer;
+	char *stopper;
+	if (len < (int)sizeof(buffer))
+	{
+		memcpy(buffer, str, len);
+		buffer[len] = 0;
+	}
+	else
+	{
+		copy.assign(str, len);
+		start = copy.c_str();
+	}
+	value = strtod(start, &stopper);
+	return len > 0 && *stopper == 0;
+}
+
+//==========================================================================
+//
+// FUDMFScanner
+//
+//==========================================================================
+
+FUDMFScanner::FUDMFScanner(char *buffer, int size)
+{
+	Ptr = buffer;
+	End = buffer + size;
+	Line = 1;
+	AlreadyGot = false;
+	Last.Str = buffer;
+	Last.Len = 0;
+	Last.Quoted = false;
+}
+
+FUDMFScanner::FUDMFScanner(const FPos &start, char *end)
+{
+	Ptr = start.Ptr;
+	End = end;
+	Line = start.Line;
+	AlreadyGot = false;
+	Last.Str = Ptr;
+	Last.Len = 0;
+	Last.Quoted = false;
+}
+
+//==========================================================================
+//
+// FUDMFScanner :: SkipComment
+//
+// Skips the comment Ptr points at. Returns false if it runs to the end.
+//
+//==========================================================================
+
+bool FUDMFScanner::SkipComment()
+{
+	if (Ptr[1] == '*')
+	{ // C comment
+		while (Ptr[0] != '*' || Ptr[1] != '/')
+		{
+			if (Ptr[0] == '\n')
+			{
+				Line++;
+			}
+			Ptr++;
+			if (Ptr >= End - 1)
+			{
+				Ptr = End;
+				return false;
+			}
+		}
+		Ptr += 2;
+	}
+	else
+	{ // C++ comment
+		while (*Ptr++ != '\n')
+		{
+			if (Ptr >= End)
+			{
+				return false;
+			}
+		}
+		Line++;
+	}
+	return true;
+}
+
+//==========================================================================
+//
+// FUDMFScanner :: GetToken
+//
+//==========================================================================
+
+bool FUDMFScanner::GetToken(FUDMFToken &token)
+{
+	if (AlreadyGot)
+	{
+		AlreadyGot = false;
+		token = Last;
+		return true;
+	}
+
+	for (;;)
+	{
+		while (Ptr < End && *Ptr <= ' ')
+		{
+			if (*Ptr++ == '\n')
+			{
+				Line++;
+			}
+		}
+		if (Ptr >= End)
+		{
+			return false;
+		}
+		if (!(Ptr[0] == '/' && Ptr < End - 1 && (Ptr[1] == '/' || Ptr[1] == '*')))
+		{ // Found a token
+			break;
+		}
+
+		if (!SkipComment())
+		{
+			return false;
+		}
+	}
+
+	token.Str = Ptr;
+	token.Quoted = false;
+
+	if (*Ptr == '"')
+	{ // Quoted string - return string including the quotes
+		char *text = ++Ptr;
+		token.Quoted = true;
+		while (Ptr < End && *Ptr != '"')
+		{
+			if (*Ptr >= 0 && *Ptr < ' ')
+			{
+				if (*Ptr == '\n')
+				{
+					Line++;
+				}
+				Ptr++;
+			}
+			else if (*Ptr == '\\' && Ptr < End - 1)
+			{
+				// Keep escape sequences as they are. They only need to be
+				// recognized so that \" does not end the string.
+				*text++ = *Ptr++;
+				*text++ = *Ptr++;
+			}
+			else
+			{
+				*text++ = *Ptr++;
+			}
+		}
+		if (Ptr < End)
+		{
+			*text++ = '"';
+			Ptr++;
+		}
+		token.Len = int(text - token.Str);
+	}
+	else if (IsStopChar(*Ptr))
+	{
+		Ptr++;
+		token.Len = 1;
+	}
+	else
+	{
+		while (Ptr < End && *Ptr > ' ' && !IsStopChar(*Ptr))
+		{
+			Ptr++;
+		}
+		token.Len = int(Ptr - token.Str);
+	}
+
+	Last = token;
+	return true;
+}
+
+//==========================================================================
+//
+// FUDMFScanner :: MustGetToken
+//
+//==========================================================================
+
+void FUDMFScanner::MustGetToken(FUDMFToken &token)
+{
+	if (!GetToken(token))
+	{
+		ScriptError("Missing string (unexpected end of file).");
+	}
+}
+
+//==========================================================================
+//
+// FUDMFScanner :: MustGetTokenName
+//
+//==========================================================================
+
+void FUDMFScanner::MustGetTokenName(const char *name)
+{
+	FUDMFToken token;
+	MustGetToken(token);
+	if (!token.Is(name))
+	{
+		ScriptError("Expected '%s', got '%.*s'.", name, token.Len, token.Str);
+	}
+}
+
+//==========================================================================
+//
+// FUDMFScanner :: CheckTokenName
+//
+// Checks if the next token matches the specified string. Returns true if
+// it does. If it doesn't, it ungets it and returns false.
+//
+//==========================================================================
+
+bool FUDMFScanner::CheckTokenName(const char *name)
+{
+	FUDMFToken token;
+	if (GetToken(token))
+	{
+		if (token.Is(name))
+		{
+			return true;
+		}
+		UnGet();
+	}
+	return false;
+}
+
+//==========================================================================
+//
+// FUDMFScanner :: UnGet
+//
+//==========================================================================
+
+void FUDMFScanner::UnGet()
+{
+	AlreadyGot = true;
+}
+
+//==========================================================================
+//
+// FUDMFScanner :: SkipBlock
+//
+// This has to agree with GetToken about where strings and comments are:
+// a quote only starts a string at the beginning of a token, while a
+// comment can start after any token, because '/' is a stop character.
+//
+//==========================================================================
+
+bool FUDMFScanner::SkipBlock()
+{
+	bool intoken = false;
+
+	while (Ptr < End)
+	{
+		char c = *Ptr;
+
+		if (c <= ' ')
+		{
+			if (c == '\n')
+			{
+				Line++;
+			}
+			Ptr++;
+			intoken = false;
+		}
+		else if (c == '"' && !intoken)
+		{
+			for (Ptr++; Ptr < End && *Ptr != '"'; Ptr++)
+			{
+				if (*Ptr == '\n')
+				{
+					Line++;
+				}
+				else if (*Ptr == '\\' && Ptr < End - 1)
+				{ // The escaped character is copied as is, even a newline.
+					Ptr++;
+				}
+			}
+			if (Ptr < End)
+			{
+				Ptr++;
+			}
+		}
+		else if (c == '/' && Ptr < End - 1 && (Ptr[1] == '/' || Ptr[1] == '*'))
+		{
+			if (!SkipComment())
+			{
+				return false;
+			}
+			intoken = false;
+		}
+		else if (IsStopChar(c))
+		{
+			Ptr++;
+			intoken = false;
+			if (c == '}')
+			{
+				return true;
+			}
+		}
+		else
+		{
+			Ptr++;
+			intoken = true;
+		}
+	}
+	return false;
+}
+
+//==========================================================================
+//
+// FUDMFScanner :: SavePos / RestorePos
+//
+//==========================================================================
+
+FUDMFScanner::FPos FUDMFScanner::SavePos() const
+{
+	FPos pos = { AlreadyGot ? Last.Str : Ptr, Line };
+	return pos;
+}
+
+void FUDMFScanner::RestorePos(const FPos &pos)
+{
+	Ptr = pos.Ptr;
+	Line = pos.Line;
+	AlreadyGot = false;
+}
+
+//==========================================================================
+//
+// FUDMFScanner :: ScriptError
+//
+//==========================================================================
+
+void FUDMFScanner::ScriptError(const char *message, ...) const
+{
+	char composed[2048];
+	char error[2100];
+
+	va_list arglist;
+	va_start(arglist, message);
+	vsnprintf(composed, sizeof(composed), message, arglist);
+	va_end(arglist);
+
+	snprintf(error, sizeof(error), "Script error, line %d:\n%s", Line, composed);
+	throw std::runtime_error(error);
+}
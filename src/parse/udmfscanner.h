@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdint.h>
+
+// A token from FUDMFScanner. Str points into the scanned buffer and is not
+// null-terminated.
+struct FUDMFToken
+{
+	char *Str;
+	int Len;
+	bool Quoted;
+
+	bool Is(const char *name) const;
+};
+
+// Case-insensitive FNV-1a. It can be evaluated at compile time, so a switch
+// over the hashes of a list of names fails to compile if two of them collide.
+constexpr uint32_t UDMFKeyHash(const char *str, uint32_t hash = 2166136261u)
+{
+	return *str == 0 ? hash :
+		UDMFKeyHash(str + 1, (hash ^ uint8_t(*str >= 'A' && *str <= 'Z' ? *str + ('a' - 'A') : *str)) * 16777619u);
+}
+
+uint32_t UDMFKeyHash(const char *str, int len);
+
+// Parses the number at the start of str like strtod() would, but without
+// calling it for plain decimal numbers. Returns false if there is anything
+// else in str.
+bool UDMFStrToD(const char *str, int len, double &value);
+
+// Tokenizer for UDMF text maps. It splits the text the same way as SC_GetString
+// in C mode, but tokens point into the buffer instead of being copied, and
+// all state is kept in the object, so several maps can be scanned at once.
+// Quoted strings keep their quotes. Control characters inside them are
+// dropped by moving the rest of the string down in the buffer.
+class FUDMFScanner
+{
+public:
+	struct FPos
+	{
+		char *Ptr;
+		int Line;
+	};
+
+	FUDMFScanner(char *buffer, int size);
+	FUDMFScanner(const FPos &start, char *end);
+
+	bool GetToken(FUDMFToken &token);
+	void MustGetToken(FUDMFToken &token);
+	void MustGetTokenName(const char *name);
+	bool CheckTokenName(const char *name);
+	void UnGet();
+
+	// Moves past the next '}' that is not inside a string or a comment
+	// without tokenizing anything. Returns false if the end was reached
+	// first. There must be no token pending from UnGet().
+	bool SkipBlock();
+
+	FPos SavePos() const;
+	void RestorePos(const FPos &pos);
+
+	int GetLine() const { return Line; }
+
+	[[noreturn]] void ScriptError(const char *message, ...) const;
+
+private:
+	bool SkipComment();
+
+	char *Ptr;
+	char *End;
+	int Line;
+
+	FUDMFToken Last;
+	bool AlreadyGot;
+};
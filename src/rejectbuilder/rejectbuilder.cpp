@@ -0,0 +1,457 @@
+/*
+    Routines for building a Doom map's REJECT lump.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+#include <stdio.h>
+#include <string.h>
+
+#include "framework/zdray.h"
+#include "framework/templates.h"
+#include "framework/parallel.h"
+#include "rejectbuilder/rejectbuilder.h"
+
+// The reject only has to be right about pairs that can never see each other,
+// so everything here errs on the side of keeping sight lines: points within
+// this distance (in map units) of a clipping line are kept.
+static const double REJECT_EPSILON = 1.0 / 64;
+
+// How many sectors are entered between checks of the clock.
+static const int REJECT_CLOCK_STEPS = 1024;
+
+// A sector can see another if some straight line starts in the one and ends
+// in the other while only crossing two-sided lines. Each such line passes a
+// chain of portals, entering a new sector with each of them, and it can cross
+// each linedef at most once. Starting at every sector, FlowFromSector()
+// follows every chain and keeps, like Quake's vis, two windows: the part of
+// the first portal (the source) and the part of the last portal crossed (the
+// pass) through which a single line can still pass the whole chain. A
+// portal out of the current sector is clipped to the lines that separate the
+// source from the pass, and the chain stops when nothing of it is left.
+//
+// Sectors are worked on in groups of eight, so every group owns a whole
+// number of bytes in the reject and the rows can be written in place from
+// any thread.
+
+FRejectBuilder::FRejectBuilder (FLevel &level)
+	: Level (level), TimedOut (false), SectorsSkipped (0)
+{
+	auto starttime = std::chrono::steady_clock::now ();
+
+	NumSectors = Level.NumSectors ();
+	Reject = new uint8_t[Level.RejectSize];
+	memset (Reject, 0, Level.RejectSize);
+
+	HasDeadline = RejectTimeLimit > 0;
+	Deadline = starttime + std::chrono::seconds (RejectTimeLimit);
+
+	BuildPortals ();
+	BuildReject ();
+	MakeSymmetric ();
+
+	if (SectorsSkipped > 0)
+	{
+		printf ("   REJECT time limit of %d seconds reached; %d sectors can see everything.\n",
+			RejectTimeLimit, (int)SectorsSkipped);
+	}
+
+	int hidden = 0;
+	for (int i = 0; i < NumSectors * NumSectors; ++i)
+	{
+		if (Reject[i >> 3] & (1 << (i & 7)))
+		{
+			hidden++;
+		}
+	}
+	printf ("   REJECT: %d portals, %d of %d sector pairs hidden", Portals.Size(), hidden, NumSectors * NumSectors);
+	if (!NoTiming)
+	{
+		printf (" (%.3f seconds)", std::chrono::duration<double> (std::chrono::steady_clock::now () - starttime).count ());
+	}
+	printf ("\n");
+}
+
+FRejectBuilder::~FRejectBuilder ()
+{
+	delete[] Reject;
+}
+
+uint8_t *FRejectBuilder::GetReject ()
+{
+	uint8_t *reject = Reject;
+	Reject = nullptr;
+	return reject;
+}
+
+void FRejectBuilder::BuildPortals ()
+{
+	TArray<int> counts;
+	unsigned int i;
+
+	counts.Resize (NumSectors);
+	for (int j = 0; j < NumSectors; ++j)
+	{
+		counts[j] = 0;
+	}
+
+	for (i = 0; i < Level.Lines.Size(); ++i)
+	{
+		const IntLineDef &line = Level.Lines[i];
+
+		if (line.sidenum[0] == NO_INDEX || line.sidenum[1] == NO_INDEX)
+		{
+			continue;
+		}
+
+		int front = Level.Sides[line.sidenum[0]].sector;
+		int back = Level.Sides[line.sidenum[1]].sector;
+
+		if (front == back || front < 0 || back < 0 || front >= NumSectors || back >= NumSectors)
+		{ // Lines inside a single sector never block sight and need no portal.
+			continue;
+		}
+
+		dvec2 v1 (Level.Vertices[line.v1].x / 65536.0, Level.Vertices[line.v1].y / 65536.0);
+		dvec2 v2 (Level.Vertices[line.v2].x / 65536.0, Level.Vertices[line.v2].y / 65536.0);
+		dvec2 delta = v2 - v1;
+		double len = length (delta);
+
+		if (len == 0)
+		{
+			continue;
+		}
+
+		// The front side is on the right, so the back sector is to the left.
+		dvec2 left (-delta.y / len, delta.x / len);
+
+		FPortal portal;
+		portal.Winding.p1 = v1;
+		portal.Winding.p2 = v2;
+		portal.Line = i;
+
+		portal.Winding.Normal = left;
+		portal.ToSector = back;
+		Portals.Push (portal);
+		counts[front]++;
+
+		portal.Winding.Normal = -left;
+		portal.ToSector = front;
+		Portals.Push (portal);
+		counts[back]++;
+	}
+
+	// Sort the portals by the sector they leave.
+	SectorPortals.Resize (NumSectors + 1);
+	SectorPortals[0] = 0;
+	for (int j = 0; j < NumSectors; ++j)
+	{
+		SectorPortals[j + 1] = SectorPortals[j] + counts[j];
+		counts[j] = SectorPortals[j];
+	}
+
+	TArray<FPortal> sorted;
+	sorted.Resize (Portals.Size());
+	for (i = 0; i < Portals.Size(); i += 2)
+	{
+		// Each pair is the front-to-back portal followed by the back-to-front one.
+		int back = Portals[i].ToSector;
+		int front = Portals[i + 1].ToSector;
+		sorted[counts[front]++] = Portals[i];
+		sorted[counts[back]++] = Portals[i + 1];
+	}
+	Portals = sorted;
+}
+
+void FRejectBuilder::BuildReject ()
+{
+	ParallelForChunks (NumSectors, 8, [this](int, int firstsector, int lastsector)
+	{
+		FFlowState state;
+		state.Visible.Resize (NumSectors);
+		state.LineUsed.Resize (Level.Lines.Size());
+		if (Level.Lines.Size() > 0)
+		{
+			memset (&state.LineUsed[0], 0, Level.Lines.Size());
+		}
+		BuildRows (firstsector, lastsector, state);
+	});
+}
+
+void FRejectBuilder::BuildRows (int firstsector, int lastsector, FFlowState &state)
+{
+	for (int y = firstsector; y < lastsector; ++y)
+	{
+		if (TimedOut)
+		{ // Leave the row clear, so this sector can see everything.
+			SectorsSkipped++;
+			continue;
+		}
+
+		memset (&state.Visible[0], 0, NumSectors);
+		state.Visible[y] = 1;
+		state.Steps = 0;
+		state.Aborted = false;
+
+		FlowFromSector (state, y);
+
+		if (state.Aborted)
+		{
+			SectorsSkipped++;
+			continue;
+		}
+
+		int pnum = y * NumSectors;
+		for (int x = 0; x < NumSectors; ++x, ++pnum)
+		{
+			if (!state.Visible[x])
+			{
+				Reject[pnum >> 3] |= 1 << (pnum & 7);
+			}
+		}
+	}
+}
+
+// Follows every chain of portals out of sector, depth first. The chains can
+// be as long as the number of two-sided lines, so they are kept in
+// state.Chain instead of on the stack of the worker thread.
+
+void FRejectBuilder::FlowFromSector (FFlowState &state, int sector)
+{
+	state.Chain.Clear ();
+	EnterSector (state, sector, -1, nullptr, nullptr);
+
+	while (state.Chain.Size () > 0 && !state.Aborted)
+	{
+		FFlowStep &step = state.Chain[state.Chain.Size () - 1];
+
+		if (step.NextPortal == SectorPortals[step.Sector + 1])
+		{ // Every portal out of here has been followed.
+			if (step.Line >= 0)
+			{
+				state.LineUsed[step.Line] = 0;
+			}
+			state.Chain.Delete (state.Chain.Size () - 1);
+			continue;
+		}
+
+		const FPortal &portal = Portals[step.NextPortal++];
+
+		if (state.LineUsed[portal.Line])
+		{ // A straight line can only cross it once.
+			continue;
+		}
+
+		FWinding target = portal.Winding;
+		FWinding newsource;
+
+		if (!step.HasSource)
+		{ // Every part of the neighbours is visible.
+			newsource = target;
+		}
+		else
+		{
+			const FWinding &source = step.Source;
+			const FWinding *pass = step.HasPass ? &step.Pass : nullptr;
+
+			// Only the part beyond the source and the pass can be reached...
+			if (!ClipWinding (target, source.p1, source.Normal))
+			{
+				continue;
+			}
+			if (pass != nullptr)
+			{
+				if (!ClipWinding (target, pass->p1, pass->Normal) ||
+					!ClipToSeparators (source, *pass, target))
+				{
+					continue;
+				}
+			}
+
+			// ...and only the part of the source that can see what is left of
+			// the target matters past it.
+			newsource = source;
+			if (!ClipWinding (newsource, target.p1, -target.Normal))
+			{
+				continue;
+			}
+			if (pass != nullptr && !ClipToSeparators (target, *pass, newsource))
+			{
+				continue;
+			}
+		}
+
+		state.Visible[portal.ToSector] = 1;
+
+		// This can move the chain, so step is not used past here.
+		EnterSector (state, portal.ToSector, portal.Line, &newsource, step.HasSource ? &target : nullptr);
+	}
+
+	// Leave the lines clear for the next row after a timeout.
+	for (unsigned int i = 0; i < state.Chain.Size (); ++i)
+	{
+		if (state.Chain[i].Line >= 0)
+		{
+			state.LineUsed[state.Chain[i].Line] = 0;
+		}
+	}
+	state.Chain.Clear ();
+}
+
+// Adds sector to the end of the chain. source and pass are the windows left
+// of the first and the last portal crossed, or nullptr when none have been.
+
+void FRejectBuilder::EnterSector (FFlowState &state, int sector, int line, const FWinding *source, const FWinding *pass)
+{
+	if (CheckDeadline (state))
+	{
+		return;
+	}
+
+	FFlowStep step;
+	step.Sector = sector;
+	step.NextPortal = SectorPortals[sector];
+	step.Line = line;
+	step.HasSource = source != nullptr;
+	step.HasPass = pass != nullptr;
+	if (source != nullptr)
+	{
+		step.Source = *source;
+	}
+	if (pass != nullptr)
+	{
+		step.Pass = *pass;
+	}
+	state.Chain.Push (step);
+
+	if (line >= 0)
+	{
+		state.LineUsed[line] = 1;
+	}
+}
+
+bool FRejectBuilder::CheckDeadline (FFlowState &state)
+{
+	if (state.Aborted)
+	{
+		return true;
+	}
+	if (++state.Steps % REJECT_CLOCK_STEPS != 0)
+	{
+		return false;
+	}
+	if (TimedOut || (HasDeadline && std::chrono::steady_clock::now () > Deadline))
+	{
+		TimedOut = true;
+		state.Aborted = true;
+	}
+	return state.Aborted;
+}
+
+// Sight works both ways, so a pair is only hidden if neither sector found the
+// other. This also covers up small differences from rounding.
+
+void FRejectBuilder::MakeSymmetric ()
+{
+	for (int y = 0; y < NumSectors; ++y)
+	{
+		for (int x = y + 1; x < NumSectors; ++x)
+		{
+			int a = y * NumSectors + x;
+			int b = x * NumSectors + y;
+			bool hidden = (Reject[a >> 3] & (1 << (a & 7))) && (Reject[b >> 3] & (1 << (b & 7)));
+
+			if (!hidden)
+			{
+				Reject[a >> 3] &= ~(1 << (a & 7));
+				Reject[b >> 3] &= ~(1 << (b & 7));
+			}
+		}
+	}
+}
+
+// Clips w to the side of the line through org that normal points to. Returns
+// false if nothing is left.
+
+bool FRejectBuilder::ClipWinding (FWinding &w, const dvec2 &org, const dvec2 &normal)
+{
+	double d1 = dot (normal, w.p1 - org);
+	double d2 = dot (normal, w.p2 - org);
+
+	if (d1 < -REJECT_EPSILON && d2 < -REJECT_EPSILON)
+	{
+		return false;
+	}
+	if (d1 >= -REJECT_EPSILON && d2 >= -REJECT_EPSILON)
+	{
+		return true;
+	}
+
+	dvec2 mid = w.p1 + (w.p2 - w.p1) * (d1 / (d1 - d2));
+	if (d1 < -REJECT_EPSILON)
+	{
+		w.p1 = mid;
+	}
+	else
+	{
+		w.p2 = mid;
+	}
+	return true;
+}
+
+// Clips target to the part that lines from source through pass can reach.
+// Those lines are bounded by the lines through an end of the source and an
+// end of the pass that have the rest of the source on one side and the rest
+// of the pass on the other. Returns false if nothing is left.
+
+bool FRejectBuilder::ClipToSeparators (const FWinding &source, const FWinding &pass, FWinding &target)
+{
+	const dvec2 *s[2] = { &source.p1, &source.p2 };
+	const dvec2 *p[2] = { &pass.p1, &pass.p2 };
+
+	for (int i = 0; i < 2; ++i)
+	{
+		for (int j = 0; j < 2; ++j)
+		{
+			dvec2 org = *s[i];
+			dvec2 delta = *p[j] - org;
+			double len = length (delta);
+
+			if (len < REJECT_EPSILON)
+			{
+				continue;
+			}
+
+			dvec2 normal (-delta.y / len, delta.x / len);
+			double sd = dot (normal, *s[i^1] - org);
+			double pd = dot (normal, *p[j^1] - org);
+
+			if (pd < -REJECT_EPSILON && sd >= -REJECT_EPSILON)
+			{
+				normal = -normal;
+			}
+			else if (pd <= REJECT_EPSILON || sd > REJECT_EPSILON)
+			{ // Not a separator
+				continue;
+			}
+
+			if (!ClipWinding (target, org, normal))
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
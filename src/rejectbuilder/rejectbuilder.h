@@ -0,0 +1,80 @@
+#pragma once
+
+#include "level/doomdata.h"
+#include "level/workdata.h"
+#include "framework/tarray.h"
+#include "math/vec.h"
+#include <atomic>
+#include <chrono>
+
+class FRejectBuilder
+{
+public:
+	FRejectBuilder (FLevel &level);
+	~FRejectBuilder ();
+
+	// Returns the new REJECT, which is Level.RejectSize bytes long. The
+	// caller takes ownership of it.
+	uint8_t *GetReject ();
+
+private:
+	// A piece of a portal's line. Normal points into the sector the portal
+	// leads to.
+	struct FWinding
+	{
+		dvec2 p1, p2;
+		dvec2 Normal;
+	};
+
+	// One direction of a two-sided line between two different sectors.
+	struct FPortal
+	{
+		FWinding Winding;
+		int Line;
+		int ToSector;
+	};
+
+	// A sector on the current chain of portals. Source and Pass are only
+	// valid once the chain has crossed one and two portals.
+	struct FFlowStep
+	{
+		int Sector;
+		int NextPortal;			// Index into Portals of the next one to follow
+		int Line;				// The line crossed to get here, or -1
+		FWinding Source, Pass;
+		bool HasSource, HasPass;
+	};
+
+	// Per-thread state for walking out from a single source sector.
+	struct FFlowState
+	{
+		TArray<uint8_t> Visible;
+		TArray<uint8_t> LineUsed;
+		TArray<FFlowStep> Chain;
+		int Steps;
+		bool Aborted;
+	};
+
+	FLevel &Level;
+	int NumSectors;
+	uint8_t *Reject;
+
+	TArray<FPortal> Portals;
+	TArray<int> SectorPortals;		// CSR index into Portals: SectorPortals[s] .. SectorPortals[s+1]
+
+	std::chrono::steady_clock::time_point Deadline;
+	bool HasDeadline;
+	std::atomic<bool> TimedOut;
+	std::atomic<int> SectorsSkipped;
+
+	void BuildPortals ();
+	void BuildReject ();
+	void BuildRows (int firstsector, int lastsector, FFlowState &state);
+	void FlowFromSector (FFlowState &state, int sector);
+	void EnterSector (FFlowState &state, int sector, int line, const FWinding *source, const FWinding *pass);
+	void MakeSymmetric ();
+	bool CheckDeadline (FFlowState &state);
+
+	static bool ClipWinding (FWinding &w, const dvec2 &org, const dvec2 &normal);
+	static bool ClipToSeparators (const FWinding &source, const FWinding &pass, FWinding &target);
+};
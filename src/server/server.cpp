@@ -0,0 +1,445 @@
+#include "math/mathlib.h"
+#include "server/server.h"
+#include "framework/json.h"
+#include "framework/zdray.h"
+#include "framework/bakecache.h"
+#include "library/libzdray.h"
+#include "level/level.h"
+#include "lightmap/levelmesh.h"
+#include "lightmap/cpuraytracer.h"
+#include "lightmap/lightmapcache.h"
+#include "wad/wad.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#define dup _dup
+#define dup2 _dup2
+#define fdopen _fdopen
+#define fileno _fileno
+#else
+#include <unistd.h>
+#endif
+
+namespace
+{
+	// Error codes defined by JSON-RPC 2.0, and one for requests that failed
+	enum
+	{
+		RPC_ParseError = -32700,
+		RPC_InvalidRequest = -32600,
+		RPC_MethodNotFound = -32601,
+		RPC_InvalidParams = -32602,
+		RPC_Failed = -32000
+	};
+
+	class RpcError : public std::runtime_error
+	{
+	public:
+		RpcError(int code, const std::string &message) : std::runtime_error(message), Code(code) { }
+
+		int Code;
+	};
+
+	std::string GetString(const FJsonValue &params, const char *name)
+	{
+		const FJsonValue *value = params.Find(name);
+		if (!value || value->GetType() != FJsonValue::String)
+			throw RpcError(RPC_InvalidParams, std::string(name) + " must be a string");
+		return value->GetString();
+	}
+
+	float GetFloat(const FJsonValue &value, const char *name)
+	{
+		if (value.GetType() != FJsonValue::Number)
+			throw RpcError(RPC_InvalidParams, std::string(name) + " must be a number");
+		return (float)value.GetNumber();
+	}
+
+	vec3 GetVec3(const FJsonValue &value, const char *name)
+	{
+		if (value.GetType() != FJsonValue::Array || value.GetArray().size() != 3)
+			throw RpcError(RPC_InvalidParams, std::string(name) + " must be an array of three numbers");
+		const std::vector<FJsonValue> &v = value.GetArray();
+		return vec3(GetFloat(v[0], name), GetFloat(v[1], name), GetFloat(v[2], name));
+	}
+
+	FJsonValue MakeVec3(const vec3 &v)
+	{
+		FJsonValue array = FJsonValue::MakeArray();
+		array.Add((double)v.x).Add((double)v.y).Add((double)v.z);
+		return array;
+	}
+
+	FJsonValue MakeLight(const CPULightInfo &light)
+	{
+		FJsonValue object = FJsonValue::MakeObject();
+		object.Set("origin", MakeVec3(light.Origin));
+		object.Set("radius", (double)light.Radius);
+		object.Set("intensity", (double)light.Intensity);
+		object.Set("color", MakeVec3(light.Color));
+		object.Set("innerAngleCos", (double)light.InnerAngleCos);
+		object.Set("outerAngleCos", (double)light.OuterAngleCos);
+		object.Set("spotDir", MakeVec3(light.SpotDir));
+		return object;
+	}
+
+	// Sets the fields the edit has and leaves the others alone
+	void EditLight(CPULightInfo &light, const FJsonValue &edit)
+	{
+		if (const FJsonValue *value = edit.Find("origin")) light.Origin = GetVec3(*value, "origin");
+		if (const FJsonValue *value = edit.Find("radius")) light.Radius = GetFloat(*value, "radius");
+		if (const FJsonValue *value = edit.Find("intensity")) light.Intensity = GetFloat(*value, "intensity");
+		if (const FJsonValue *value = edit.Find("color")) light.Color = GetVec3(*value, "color");
+		if (const FJsonValue *value = edit.Find("innerAngleCos")) light.InnerAngleCos = GetFloat(*value, "innerAngleCos");
+		if (const FJsonValue *value = edit.Find("outerAngleCos")) light.OuterAngleCos = GetFloat(*value, "outerAngleCos");
+		if (const FJsonValue *value = edit.Find("spotDir")) light.SpotDir = GetVec3(*value, "spotDir");
+	}
+
+	std::vector<CPULightInfo> EditLights(const std::vector<CPULightInfo> &lights, const FJsonValue &edits)
+	{
+		if (edits.GetType() != FJsonValue::Array)
+			throw RpcError(RPC_InvalidParams, "lights must be an array");
+
+		std::vector<CPULightInfo> changed = lights;
+		std::vector<bool> removed(lights.size(), false);
+		std::vector<CPULightInfo> added;
+		for (const FJsonValue &edit : edits.GetArray())
+		{
+			if (edit.GetType() != FJsonValue::Object)
+				throw RpcError(RPC_InvalidParams, "Each entry of lights must be an object");
+
+			if (const FJsonValue *indexValue = edit.Find("index"))
+			{
+				double index = GetFloat(*indexValue, "index");
+				if (index < 0.0 || index >= (double)lights.size() || index != std::floor(index))
+					throw RpcError(RPC_InvalidParams, "There is no light " + indexValue->ToString());
+
+				const FJsonValue *remove = edit.Find("remove");
+				if (remove && remove->GetType() == FJsonValue::Bool && remove->GetBool())
+					removed[(size_t)index] = true;
+				else
+					EditLight(changed[(size_t)index], edit);
+			}
+			else
+			{
+				if (!edit.Find("origin") || !edit.Find("radius"))
+					throw RpcError(RPC_InvalidParams, "A new light needs an origin and a radius");
+
+				// A white point light unless the edit says otherwise
+				CPULightInfo light;
+				light.Intensity = 1.0f;
+				light.InnerAngleCos = -1.0f;
+				light.OuterAngleCos = -1.0f;
+				light.SpotDir = vec3(0.0f, 0.0f, 0.0f);
+				light.Color = vec3(1.0f, 1.0f, 1.0f);
+				EditLight(light, edit);
+				added.push_back(light);
+			}
+		}
+
+		std::vector<CPULightInfo> result;
+		for (size_t i = 0; i < changed.size(); i++)
+		{
+			if (!removed[i])
+				result.push_back(changed[i]);
+		}
+		result.insert(result.end(), added.begin(), added.end());
+		return result;
+	}
+
+	double SecondsSince(std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// The map of the last bake, with everything needed to relight it
+	class ServeSession
+	{
+	public:
+		ServeSession(const ZDRayOptions &options)
+		{
+			if (!options.CacheDir.empty())
+				Cache = std::make_unique<FBakeCache>(options.CacheDir.c_str(), uint64_t(options.CacheSize) << 20);
+		}
+
+		FJsonValue Bake(const FJsonValue &params);
+		FJsonValue Relight(const FJsonValue &params);
+
+	private:
+		void Clear();
+
+		std::unique_ptr<FBakeCache> Cache;
+
+		// The processor refers to the wad and the ray tracer, and the keys to
+		// the mesh of the processor, so they go in this order
+		std::unique_ptr<FWadReader> Wad;
+		std::unique_ptr<CPURaytracer> Raytracer;
+		std::unique_ptr<FProcessor> Processor;
+		CPUSceneLighting Lighting;
+		std::unique_ptr<LightmapCache> Keys;	// Of the samples in the mesh, made by the first relight
+		bool SamplesStale = false;	// A relight failed partway, so the samples match no lighting
+	};
+
+	void ServeSession::Clear()
+	{
+		Keys.reset();
+		SamplesStale = false;
+		Processor.reset();
+		Raytracer.reset();
+		Wad.reset();
+		Lighting = CPUSceneLighting();
+	}
+
+	FJsonValue ServeSession::Bake(const FJsonValue &params)
+	{
+		std::string wadName = GetString(params, "wad");
+		std::string output = GetString(params, "output");
+		std::string map = params.Find("map") ? GetString(params, "map") : std::string();
+		if (output == wadName)
+			throw RpcError(RPC_InvalidParams, "The output cannot be the input wad");
+
+		auto start = std::chrono::steady_clock::now();
+
+		// The old map goes first, so that two are never in memory at once
+		Clear();
+
+		Wad = std::make_unique<FWadReader>(wadName.c_str());
+		int lump = 0;
+		while (lump < Wad->NumLumps() && !(Wad->IsMap(lump) && (map.empty() || stricmp(Wad->LumpName(lump), map.c_str()) == 0)))
+			lump++;
+		if (lump == Wad->NumLumps())
+		{
+			Clear();
+			throw RpcError(RPC_InvalidParams, map.empty() ? "The wad has no maps" : "The wad has no map " + map);
+		}
+		std::string mapName = Wad->LumpName(lump);
+
+		try
+		{
+			Raytracer = std::make_unique<CPURaytracer>();
+			Processor = std::make_unique<FProcessor>(*Wad, lump);
+			Processor->SetCache(Cache.get());
+			Processor->SetRaytracer(Raytracer.get());
+			Processor->BuildNodes();
+			Processor->BuildLightmaps();
+
+			FWadWriter outwad(output.c_str(), false);
+			Processor->Write(outwad);
+			outwad.Close();
+		}
+		catch (...)
+		{
+			Clear();
+			throw;
+		}
+
+		if (Cache)
+			Cache->Trim();
+
+		FJsonValue result = FJsonValue::MakeObject();
+		result.Set("map", mapName);
+
+		FJsonValue lights = FJsonValue::MakeArray();
+		if (LevelMesh *mesh = Processor->GetLightmapMesh())
+		{
+			Lighting.Gather(mesh);
+			for (const CPULightInfo &light : Lighting.Lights)
+				lights.Add(MakeLight(light));
+			result.Set("surfaces", (int)mesh->surfaces.size());
+		}
+		result.Set("lights", lights);
+		result.Set("seconds", SecondsSince(start));
+		return result;
+	}
+
+	FJsonValue ServeSession::Relight(const FJsonValue &params)
+	{
+		LevelMesh *mesh = Processor ? Processor->GetLightmapMesh() : nullptr;
+		if (!mesh)
+			throw RpcError(RPC_Failed, "There is no baked map to relight");
+
+		const FJsonValue *edits = params.Find("lights");
+		if (!edits)
+			throw RpcError(RPC_InvalidParams, "lights is missing");
+		std::string output = GetString(params, "output");
+
+		auto start = std::chrono::steady_clock::now();
+
+		CPUSceneLighting lighting = Lighting;
+		lighting.Lights = EditLights(Lighting.Lights, *edits);
+
+		// The keys say which tiles a light reaches, so the tiles whose keys
+		// changed are the ones to trace again. Only the CPU ray tracer was
+		// used, so the keys are made as for a CPU bake.
+		// The tiles are traced in place. If that fails partway, the samples
+		// match neither the old nor the new lights, and the next relight
+		// traces everything.
+		if (!Keys && !SamplesStale)
+			Keys = std::make_unique<LightmapCache>(nullptr, mesh, Lighting, false);
+		auto keys = std::make_unique<LightmapCache>(nullptr, mesh, lighting, false);
+
+		CPUTraceSelection selection;
+		try
+		{
+			int selected;
+			if (SamplesStale)
+			{
+				selection.Init(mesh, true);
+				selected = (int)(selection.Tiles.size() + selection.Probes.size());
+			}
+			else
+			{
+				selected = keys->SelectChanged(*Keys, selection);
+			}
+
+			if (selected > 0)
+			{
+				Raytracer->Raytrace(mesh, lighting, &selection);
+			}
+			else
+			{
+				printf("Nothing to ray trace\n");
+			}
+		}
+		catch (...)
+		{
+			Keys.reset();
+			SamplesStale = true;
+			throw;
+		}
+		Keys = std::move(keys);
+		Lighting = lighting;
+		SamplesStale = false;
+
+		mesh->CreateTextures();
+
+		FWadWriter outwad(output.c_str(), false);
+		mesh->AddLightmapLump(outwad);
+		outwad.Close();
+
+		FJsonValue result = FJsonValue::MakeObject();
+		result.Set("lights", (int)Lighting.Lights.size());
+		result.Set("tiles", (int)std::count(selection.Tiles.begin(), selection.Tiles.end(), true));
+		result.Set("probes", (int)std::count(selection.Probes.begin(), selection.Probes.end(), true));
+		result.Set("seconds", SecondsSince(start));
+		return result;
+	}
+
+	// Returns the reply, or a null value if the request was a notification
+	FJsonValue HandleRequest(ServeSession &session, const std::string &line, bool &exitRequested)
+	{
+		FJsonValue id;
+		bool notification = false;
+		FJsonValue reply = FJsonValue::MakeObject();
+		reply.Set("jsonrpc", "2.0");
+		try
+		{
+			FJsonValue request;
+			try
+			{
+				request = FJsonValue::Parse(line);
+			}
+			catch (const std::runtime_error &e)
+			{
+				throw RpcError(RPC_ParseError, e.what());
+			}
+
+			const FJsonValue *idValue = request.Find("id");
+			if (idValue)
+				id = *idValue;
+			else
+				notification = true;
+
+			const FJsonValue *method = request.Find("method");
+			if (!method || method->GetType() != FJsonValue::String)
+				throw RpcError(RPC_InvalidRequest, "The request has no method");
+
+			FJsonValue noParams = FJsonValue::MakeObject();
+			const FJsonValue *params = request.Find("params");
+			if (!params)
+				params = &noParams;
+			else if (params->GetType() != FJsonValue::Object)
+				throw RpcError(RPC_InvalidParams, "params must be an object");
+
+			FJsonValue result;
+			const std::string &name = method->GetString();
+			if (name == "bake")
+			{
+				result = session.Bake(*params);
+			}
+			else if (name == "relight")
+			{
+				result = session.Relight(*params);
+			}
+			else if (name == "exit")
+			{
+				exitRequested = true;
+			}
+			else
+			{
+				throw RpcError(RPC_MethodNotFound, "There is no method " + name);
+			}
+
+			if (notification)
+				return FJsonValue();
+			reply.Set("id", id);
+			reply.Set("result", result);
+			return reply;
+		}
+		catch (const RpcError &e)
+		{
+			reply.Set("id", id);
+			reply.Set("error", FJsonValue::MakeObject().Set("code", e.Code).Set("message", e.what()));
+		}
+		catch (const std::bad_alloc &)
+		{
+			reply.Set("id", id);
+			reply.Set("error", FJsonValue::MakeObject().Set("code", (int)RPC_Failed).Set("message", "Out of memory"));
+		}
+		catch (const std::exception &e)
+		{
+			reply.Set("id", id);
+			reply.Set("error", FJsonValue::MakeObject().Set("code", (int)RPC_Failed).Set("message", e.what()));
+		}
+		return reply;
+	}
+}
+
+void ServeRequests(const ZDRayOptions &options)
+{
+	// Only the replies go to stdout. Whatever else is printed goes to stderr.
+	fflush(stdout);
+	FILE *replies = fdopen(dup(fileno(stdout)), "w");
+	if (!replies)
+		throw std::runtime_error("Could not open stdout for the replies");
+	dup2(fileno(stderr), fileno(stdout));
+
+	// Partial traces are only possible on the CPU
+	CPURaytrace = true;
+
+	ServeSession session(options);
+	bool exitRequested = false;
+	std::string line;
+	while (!exitRequested && std::getline(std::cin, line))
+	{
+		if (line.find_first_not_of(" \t\r") == std::string::npos)
+			continue;
+
+		FJsonValue reply = HandleRequest(session, line, exitRequested);
+		fflush(stdout);
+		if (!reply.IsNull())
+		{
+			fprintf(replies, "%s\n", reply.ToString().c_str());
+			fflush(replies);
+		}
+	}
+	fclose(replies);
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+// zdray --serve keeps a baked map in memory for a level editor. Requests come
+// in on stdin and replies go out on stdout, one JSON-RPC 2.0 message per
+// line. Everything zdray normally prints goes to stderr instead.
+//
+//   {"jsonrpc":"2.0","id":1,"method":"bake","params":{"wad":"in.wad","map":"MAP01","output":"map01.wad"}}
+//
+// Loads the map (the first one if "map" is left out), builds its nodes and
+// lightmaps and writes a wad holding just that map. The reply lists the
+// lights of the map in the order "relight" numbers them.
+//
+//   {"jsonrpc":"2.0","id":2,"method":"relight","params":{"lights":[...],"output":"lightmap.wad"}}
+//
+// Changes the lights of the baked map and writes a wad holding only the new
+// LIGHTMAP lump. Each entry of "lights" is one of:
+//
+//   {"index":3,"origin":[x,y,z]}   changes the fields given of light 3
+//   {"index":3,"remove":true}      removes light 3
+//   {"origin":[x,y,z],"radius":r}  adds a light
+//
+// A light has the fields origin, radius, intensity, color, innerAngleCos,
+// outerAngleCos and spotDir, as in CPULightInfo. Indices refer to the lights
+// before the request, and added lights go at the end. Only the lightmap tiles
+// and probes within reach of a changed light are traced again, with the BVH
+// of the bake.
+//
+//   {"jsonrpc":"2.0","id":3,"method":"exit"}
+//
+// Ray tracing is always done on the CPU, since only the CPU ray tracer can
+// trace part of a lightmap.
+
+struct ZDRayOptions;
+
+// Returns when stdin ends or an "exit" request is answered
+void ServeRequests(const ZDRayOptions &options);
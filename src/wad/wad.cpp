@@ -18,6 +18,7 @@
 
 */
 #include "wad.h"
+#include "framework/timeline.h"
 
 static const char MapLumpNames[12][9] =
 {
@@ -68,14 +69,24 @@ FWadReader::FWadReader (const char *filename)
 	{
 		throw std::runtime_error("Could not open input file");
 	}
+	ReadDirectory ();
+}
+
+FWadReader::FWadReader (std::vector<uint8_t> image)
+	: Lumps (nullptr), File (nullptr), Image (std::move(image))
+{
+	ReadDirectory ();
+}
 
+void FWadReader::ReadDirectory ()
+{
 	SafeRead (&Header, sizeof(Header));
 	if (Header.Magic[0] != 'P' && Header.Magic[0] != 'I' &&
 		Header.Magic[1] != 'W' &&
 		Header.Magic[2] != 'A' &&
 		Header.Magic[3] != 'D')
 	{
-		fclose (File);
+		if (File) fclose (File);
 		File = nullptr;
 		throw std::runtime_error("Input file is not a wad");
 	}
@@ -83,10 +94,7 @@ FWadReader::FWadReader (const char *filename)
 	Header.NumLumps = LittleLong(Header.NumLumps);
 	Header.Directory = LittleLong(Header.Directory);
 
-	if (fseek (File, Header.Directory, SEEK_SET))
-	{
-		throw std::runtime_error("Could not read wad directory");
-	}
+	Seek (Header.Directory);
 
 	Lumps = new WadLump[Header.NumLumps];
 	SafeRead (Lumps, Header.NumLumps * sizeof(*Lumps));
@@ -326,9 +334,43 @@ int FWadReader::LumpAfterMap (int i) const
 
 void FWadReader::SafeRead (void *buffer, size_t size)
 {
-	if (fread (buffer, 1, size, File) != size)
+	if (File)
+	{
+		if (fread (buffer, 1, size, File) != size)
+		{
+			throw std::runtime_error("Failed to read");
+		}
+	}
+	else
+	{
+		if (ImagePos > Image.size() || size > Image.size() - ImagePos)
+		{
+			throw std::runtime_error("Failed to read");
+		}
+		if (size > 0)
+		{
+			memcpy (buffer, Image.data() + ImagePos, size);
+		}
+		ImagePos += size;
+	}
+}
+
+void FWadReader::Seek (int32_t pos)
+{
+	if (File)
+	{
+		if (fseek (File, pos, SEEK_SET))
+		{
+			throw std::runtime_error("Failed to seek");
+		}
+	}
+	else
 	{
-		throw std::runtime_error("Failed to read");
+		if (pos < 0 || (size_t)pos > Image.size())
+		{
+			throw std::runtime_error("Failed to seek");
+		}
+		ImagePos = (size_t)pos;
 	}
 }
 
@@ -341,14 +383,24 @@ const char *FWadReader::LumpName (int lump)
 }
 
 FWadWriter::FWadWriter (const char *filename, bool iwad)
-	: File (nullptr)
+	: File (nullptr), InMemory (false)
 {
 	File = fopen (filename, "wb");
 	if (File == nullptr)
 	{
 		throw std::runtime_error("Could not open output file");
 	}
+	WriteHeader (iwad);
+}
 
+FWadWriter::FWadWriter (bool iwad)
+	: File (nullptr), InMemory (true)
+{
+	WriteHeader (iwad);
+}
+
+void FWadWriter::WriteHeader (bool iwad)
+{
 	WadHeader head;
 
 	if (iwad)
@@ -368,7 +420,7 @@ FWadWriter::FWadWriter (const char *filename, bool iwad)
 
 FWadWriter::~FWadWriter ()
 {
-	if (File)
+	if (File || InMemory)
 	{
 		Close ();
 	}
@@ -376,37 +428,52 @@ FWadWriter::~FWadWriter ()
 
 void FWadWriter::Close ()
 {
-	if (File)
+	if (File || InMemory)
 	{
+		TIMELINE_SCOPE("Write wad directory");
 		int32_t head[2];
 
 		head[0] = LittleLong(Lumps.Size());
-		head[1] = LittleLong(ftell (File));
+		head[1] = LittleLong(Tell ());
 
 		SafeWrite (&Lumps[0], sizeof(WadLump)*Lumps.Size());
-		fseek (File, 4, SEEK_SET);
-		SafeWrite (head, 8);
-		fclose (File);
-		File = nullptr;
+		if (InMemory)
+		{
+			memcpy (Image.data() + 4, head, 8);
+			InMemory = false;
+		}
+		else
+		{
+			fseek (File, 4, SEEK_SET);
+			SafeWrite (head, 8);
+			fclose (File);
+			File = nullptr;
+		}
 	}
 }
 
+int32_t FWadWriter::Tell ()
+{
+	return InMemory ? (int32_t)Image.size() : (int32_t)ftell (File);
+}
+
 void FWadWriter::CreateLabel (const char *name)
 {
 	WadLump lump;
 
 	strncpy (lump.Name, name, 8);
-	lump.FilePos = LittleLong(ftell (File));
+	lump.FilePos = LittleLong(Tell ());
 	lump.Size = 0;
 	Lumps.Push (lump);
 }
 
 void FWadWriter::WriteLump (const char *name, const void *data, int len)
 {
+	TIMELINE_SCOPE_ARG("Write lump", "bytes", len);
 	WadLump lump;
 
 	strncpy (lump.Name, name, 8);
-	lump.FilePos = LittleLong(ftell (File));
+	lump.FilePos = LittleLong(Tell ());
 	lump.Size = LittleLong(len);
 	Lumps.Push (lump);
 
@@ -415,6 +482,7 @@ void FWadWriter::WriteLump (const char *name, const void *data, int len)
 
 void FWadWriter::CopyLump (FWadReader &wad, int lump)
 {
+	TIMELINE_SCOPE("Copy lump");
 	uint8_t *data;
 	int size;
 
@@ -439,6 +507,16 @@ void FWadWriter::AddToLump (const void *data, int len)
 
 void FWadWriter::SafeWrite (const void *buffer, size_t size)
 {
+	if (InMemory)
+	{
+		size_t pos = Image.size();
+		Image.resize (pos + size);
+		if (size > 0)
+		{
+			memcpy (Image.data() + pos, buffer, size);
+		}
+		return;
+	}
 	if (fwrite (buffer, 1, size, File) != size)
 	{
 		fclose (File);
@@ -3,6 +3,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <vector>
 
 #include "framework/zdray.h"
 #include "framework/tarray.h"
@@ -25,6 +26,7 @@ class FWadReader
 {
 public:
 	FWadReader (const char *filename);
+	FWadReader (std::vector<uint8_t> image);	// A whole wad in memory
 	~FWadReader ();
 
 	bool IsIWAD () const;
@@ -48,9 +50,14 @@ public:
 	friend void ReadLump (FWadReader &wad, int index, T *&data, int &size);
 
 private:
+	void ReadDirectory ();
+	void Seek (int32_t pos);
+
 	WadHeader Header;
 	WadLump *Lumps;
 	FILE *File;
+	std::vector<uint8_t> Image;	// Instead of File
+	size_t ImagePos = 0;
 };
 
 
@@ -63,10 +70,7 @@ void ReadLump (FWadReader &wad, int index, T *&data, int &size)
 		size = 0;
 		return;
 	}
-	if (fseek (wad.File, wad.Lumps[index].FilePos, SEEK_SET))
-	{
-		throw std::runtime_error("Failed to seek");
-	}
+	wad.Seek (wad.Lumps[index].FilePos);
 	size = wad.Lumps[index].Size / sizeof(T);
 	data = new T[size];
 	wad.SafeRead (data, size*sizeof(T));
@@ -83,6 +87,7 @@ class FWadWriter
 {
 public:
 	FWadWriter (const char *filename, bool iwad);
+	explicit FWadWriter (bool iwad);	// Writes the wad to memory, see GetImage()
 	~FWadWriter ();
 
 	void CreateLabel (const char *name);
@@ -94,6 +99,9 @@ public:
 	void StartWritingLump (const char *name);
 	void AddToLump (const void *data, int len);
 
+	// The wad written to memory. It is complete once Close() was called.
+	const std::vector<uint8_t> &GetImage () const { return Image; }
+
 	FWadWriter &operator << (uint8_t);
 	FWadWriter &operator << (uint16_t);
 	FWadWriter &operator << (int16_t);
@@ -103,6 +111,10 @@ public:
 private:
 	TArray<WadLump> Lumps;
 	FILE *File;
+	bool InMemory;
+	std::vector<uint8_t> Image;	// Instead of File
 
+	void WriteHeader (bool iwad);
+	int32_t Tell ();
 	void SafeWrite (const void *buffer, size_t size);
 };